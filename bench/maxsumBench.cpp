@@ -0,0 +1,409 @@
+/**
+ * @file maxsumBench.cpp
+ * Performance benchmarks for the maxsum library, built on Google Benchmark.
+ * Micro benchmarks cover the core DiscreteFunction, DomainIterator and
+ * PostOffice operations, while macro benchmarks time
+ * MaxSumController::optimise on generated graph colouring problems.
+ *
+ * All problems are generated from fixed seeds, so that results are
+ * repeatable between runs. To record results for regression tracking, run:
+ *
+ *    maxsumBench --benchmark_out=results.json --benchmark_out_format=json
+ */
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <random>
+#include <set>
+#include <utility>
+#include <vector>
+#include "maxsum/common.h"
+#include "maxsum/DiscreteFunction.h"
+#include "maxsum/DomainIterator.h"
+#include "maxsum/MaxSumController.h"
+#include "maxsum/PostOffice.h"
+
+using namespace maxsum;
+
+namespace
+{
+   /**
+    * Seed used to generate all random values and graphs.
+    */
+   const unsigned SEED_M = 20130101;
+
+   /**
+    * Number of colours used by the graph colouring benchmarks.
+    */
+   const ValIndex NO_COLOURS_M = 3;
+
+   /**
+    * Returns the identifier of the k-th variable with the specified domain
+    * size, registering it if necessary. Variables with different domain
+    * sizes are given disjoint identifiers.
+    */
+   VarID benchVar_m(int k, ValIndex size)
+   {
+      VarID var = static_cast<VarID>(size)*1000 + k;
+      registerVariable(var,size);
+      return var;
+   }
+
+   /**
+    * Creates a function depending on the variables with indices in
+    * [first,first+arity), each with the specified domain size, and fills
+    * it with random values.
+    */
+   DiscreteFunction randomFunction_m
+   (
+    int first,
+    int arity,
+    ValIndex size,
+    std::mt19937& rng
+   )
+   {
+      std::vector<VarID> vars;
+      for(int k=first; k<first+arity; ++k)
+      {
+         vars.push_back(benchVar_m(k,size));
+      }
+      DiscreteFunction result(vars.begin(),vars.end());
+      std::uniform_real_distribution<ValType> dist(-1,1);
+      for(ValIndex k=0; k<result.domainSize(); ++k)
+      {
+         result(k) = dist(rng);
+      }
+      return result;
+   }
+
+   /**
+    * List of undirected edges between variables, identified by index.
+    */
+   typedef std::vector<std::pair<int,int> > EdgeList_m;
+
+   /**
+    * Generates a square grid graph with the specified side length.
+    */
+   EdgeList_m gridGraph_m(int side)
+   {
+      EdgeList_m edges;
+      for(int row=0; row<side; ++row)
+      {
+         for(int col=0; col<side; ++col)
+         {
+            const int k = row*side + col;
+            if(col+1<side)
+            {
+               edges.push_back(std::make_pair(k,k+1));
+            }
+            if(row+1<side)
+            {
+               edges.push_back(std::make_pair(k,k+side));
+            }
+         }
+      }
+      return edges;
+   }
+
+   /**
+    * Generates an approximately regular random graph, using the
+    * configuration model. Self loops and duplicate edges are discarded,
+    * so a few nodes may have fewer than <code>degree</code> neighbours.
+    */
+   EdgeList_m randomRegularGraph_m(int noNodes, int degree)
+   {
+      std::mt19937 rng(SEED_M);
+      std::vector<int> stubs;
+      for(int k=0; k<noNodes; ++k)
+      {
+         stubs.insert(stubs.end(),degree,k);
+      }
+      std::shuffle(stubs.begin(),stubs.end(),rng);
+
+      std::set<std::pair<int,int> > unique;
+      for(std::size_t k=0; k+1<stubs.size(); k+=2)
+      {
+         int a = std::min(stubs[k],stubs[k+1]);
+         int b = std::max(stubs[k],stubs[k+1]);
+         if(a!=b)
+         {
+            unique.insert(std::make_pair(a,b));
+         }
+      }
+      return EdgeList_m(unique.begin(),unique.end());
+   }
+
+   /**
+    * Generates a scale-free graph using preferential attachment
+    * (the Barabasi-Albert model), in which each new node is connected to
+    * <code>m</code> existing nodes chosen with probability proportional
+    * to their degree.
+    */
+   EdgeList_m scaleFreeGraph_m(int noNodes, int m)
+   {
+      std::mt19937 rng(SEED_M);
+      EdgeList_m edges;
+      std::vector<int> targets; // each node appears once per edge
+      for(int k=0; k<=m; ++k)
+      {
+         for(int j=0; j<k; ++j)
+         {
+            edges.push_back(std::make_pair(j,k));
+            targets.push_back(j);
+            targets.push_back(k);
+         }
+      }
+
+      for(int k=m+1; k<noNodes; ++k)
+      {
+         std::set<int> chosen;
+         while(static_cast<int>(chosen.size())<m)
+         {
+            std::uniform_int_distribution<std::size_t>
+               pick(0,targets.size()-1);
+            chosen.insert(targets[pick(rng)]);
+         }
+         for(std::set<int>::const_iterator it=chosen.begin();
+               it!=chosen.end(); ++it)
+         {
+            edges.push_back(std::make_pair(*it,k));
+            targets.push_back(*it);
+            targets.push_back(k);
+         }
+      }
+      return edges;
+   }
+
+   /**
+    * Sets up a graph colouring problem with one factor per edge. Each
+    * factor's utility is -1 if both variables have the same colour, plus
+    * a small random bias to break ties.
+    */
+   void colourGraph_m
+   (
+    const EdgeList_m& edges,
+    int graphType,
+    MaxSumController& controller
+   )
+   {
+      std::mt19937 rng(SEED_M);
+      std::uniform_real_distribution<ValType> bias(0,0.001);
+      const VarID base = 1000000 + 100000*graphType;
+      FactorID id = 0;
+      for(EdgeList_m::const_iterator it=edges.begin(); it!=edges.end(); ++it)
+      {
+         VarID vars[] = {base+it->first, base+it->second};
+         registerVariable(vars[0],NO_COLOURS_M);
+         registerVariable(vars[1],NO_COLOURS_M);
+         DiscreteFunction factor(vars,vars+2);
+         for(ValIndex a=0; a<NO_COLOURS_M; ++a)
+         {
+            for(ValIndex b=0; b<NO_COLOURS_M; ++b)
+            {
+               factor(a,b) = bias(rng) - (a==b ? 1 : 0);
+            }
+         }
+         controller.setFactor(id++,std::move(factor));
+      }
+   }
+
+   /**
+    * Times MaxSumController::optimise from a cold start on the specified
+    * graph. Each repetition starts from a fresh copy of the controller, so
+    * that every run does the same work.
+    */
+   void runOptimise_m
+   (
+    benchmark::State& state,
+    const EdgeList_m& edges,
+    int graphType
+   )
+   {
+      MaxSumController prototype;
+      colourGraph_m(edges,graphType,prototype);
+      prototype.setSchedule(
+            static_cast<MaxSumController::Schedule>(state.range(1)));
+
+      int iterations = 0;
+      long updates = 0;
+      for(auto _ : state)
+      {
+         state.PauseTiming();
+         MaxSumController controller(prototype);
+         controller.compile();
+         state.ResumeTiming();
+
+         iterations = controller.optimise();
+         updates = controller.noUpdates();
+      }
+      state.counters["factors"] = edges.size();
+      state.counters["iterations"] = iterations;
+      state.counters["updates"] = updates;
+   }
+
+} // module namespace
+
+//******************************************************************************
+// Micro benchmarks
+//******************************************************************************
+
+/**
+ * Adds two functions with the same domain, with arguments
+ * (arity, domain size per variable).
+ */
+static void BM_AddSameDomain(benchmark::State& state)
+{
+   std::mt19937 rng(SEED_M);
+   const int arity = state.range(0);
+   const ValIndex size = state.range(1);
+   DiscreteFunction f = randomFunction_m(0,arity,size,rng);
+   DiscreteFunction g = randomFunction_m(0,arity,size,rng);
+   for(auto _ : state)
+   {
+      f += g;
+      benchmark::DoNotOptimize(&f(0));
+   }
+   state.SetItemsProcessed(state.iterations()*f.domainSize());
+}
+BENCHMARK(BM_AddSameDomain)
+   ->ArgsProduct({{1,2,3,4},{2,8,16}})->ArgNames({"arity","size"});
+
+/**
+ * Adds a function of one variable to a copy of a function that does not
+ * depend on it, so that the result's domain must be expanded. Arguments
+ * are (arity of the result, domain size per variable).
+ */
+static void BM_AddExpanding(benchmark::State& state)
+{
+   std::mt19937 rng(SEED_M);
+   const int arity = state.range(0);
+   const ValIndex size = state.range(1);
+   DiscreteFunction f = randomFunction_m(0,arity-1,size,rng);
+   DiscreteFunction g = randomFunction_m(arity-1,1,size,rng);
+   ValIndex resultSize = 0;
+   for(auto _ : state)
+   {
+      DiscreteFunction result(f);
+      result += g;
+      resultSize = result.domainSize();
+      benchmark::DoNotOptimize(&result(0));
+   }
+   state.SetItemsProcessed(state.iterations()*resultSize);
+}
+BENCHMARK(BM_AddExpanding)
+   ->ArgsProduct({{2,3,4},{2,8,16}})->ArgNames({"arity","size"});
+
+/**
+ * Max marginalises a function onto its middle variable, with arguments
+ * (arity, domain size per variable).
+ */
+static void BM_MaxMarginal(benchmark::State& state)
+{
+   std::mt19937 rng(SEED_M);
+   const int arity = state.range(0);
+   const ValIndex size = state.range(1);
+   DiscreteFunction in = randomFunction_m(0,arity,size,rng);
+   DiscreteFunction out(benchVar_m(arity/2,size),0);
+   for(auto _ : state)
+   {
+      maxMarginal(in,out);
+      benchmark::DoNotOptimize(&out(0));
+   }
+   state.SetItemsProcessed(state.iterations()*in.domainSize());
+}
+BENCHMARK(BM_MaxMarginal)
+   ->ArgsProduct({{1,2,3,4},{2,8,16}})->ArgNames({"arity","size"});
+
+/**
+ * Iterates over the entire domain of a function, with arguments
+ * (arity, domain size per variable).
+ */
+static void BM_DomainIterator(benchmark::State& state)
+{
+   std::mt19937 rng(SEED_M);
+   const int arity = state.range(0);
+   const ValIndex size = state.range(1);
+   DiscreteFunction fun = randomFunction_m(0,arity,size,rng);
+   for(auto _ : state)
+   {
+      ValIndex count = 0;
+      for(DomainIterator it(fun); it.hasNext(); ++it)
+      {
+         count += it.getInd();
+      }
+      benchmark::DoNotOptimize(count);
+   }
+   state.SetItemsProcessed(state.iterations()*fun.domainSize());
+}
+BENCHMARK(BM_DomainIterator)
+   ->ArgsProduct({{1,2,3,4},{2,8,16}})->ArgNames({"arity","size"});
+
+/**
+ * Swaps the current and previous outboxes of every sender in a
+ * PostOffice, with arguments (number of senders, receivers per sender).
+ */
+static void BM_SwapOutBoxes(benchmark::State& state)
+{
+   const int noSenders = state.range(0);
+   const int degree = state.range(1);
+   util::PostOffice<int,int> office;
+   for(int s=0; s<noSenders; ++s)
+   {
+      for(int k=0; k<degree; ++k)
+      {
+         office.addEdge(s,(s+k)%noSenders);
+      }
+   }
+   for(auto _ : state)
+   {
+      for(int s=0; s<noSenders; ++s)
+      {
+         office.swapOutBoxes(s);
+      }
+   }
+   state.SetItemsProcessed(state.iterations()*noSenders*degree);
+}
+BENCHMARK(BM_SwapOutBoxes)
+   ->ArgsProduct({{100,1000},{2,8}})->ArgNames({"senders","degree"});
+
+//******************************************************************************
+// Macro benchmarks. The second argument of each benchmark selects the
+// MaxSumController::Schedule (0=flooding, 1=residual, 2=round robin).
+//******************************************************************************
+
+/**
+ * Optimises a colouring problem on a square grid with the specified
+ * side length.
+ */
+static void BM_OptimiseGrid(benchmark::State& state)
+{
+   runOptimise_m(state,gridGraph_m(state.range(0)),0);
+}
+BENCHMARK(BM_OptimiseGrid)
+   ->ArgsProduct({{16,32},{0,1,2}})->ArgNames({"side","schedule"})
+   ->Unit(benchmark::kMillisecond)->UseRealTime();
+
+/**
+ * Optimises a colouring problem on a random 3-regular graph with the
+ * specified number of nodes.
+ */
+static void BM_OptimiseRandomRegular(benchmark::State& state)
+{
+   runOptimise_m(state,randomRegularGraph_m(state.range(0),3),1);
+}
+BENCHMARK(BM_OptimiseRandomRegular)
+   ->ArgsProduct({{256,1024},{0,1,2}})->ArgNames({"nodes","schedule"})
+   ->Unit(benchmark::kMillisecond)->UseRealTime();
+
+/**
+ * Optimises a colouring problem on a scale-free graph with the specified
+ * number of nodes, each attached to two earlier nodes.
+ */
+static void BM_OptimiseScaleFree(benchmark::State& state)
+{
+   runOptimise_m(state,scaleFreeGraph_m(state.range(0),2),2);
+}
+BENCHMARK(BM_OptimiseScaleFree)
+   ->ArgsProduct({{256,1024},{0,1,2}})->ArgNames({"nodes","schedule"})
+   ->Unit(benchmark::kMillisecond)->UseRealTime();
+
+BENCHMARK_MAIN();
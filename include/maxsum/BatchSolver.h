@@ -0,0 +1,366 @@
+/**
+ * @file BatchSolver.h
+ * Defines the maxsum::BatchSolver class, which runs max-sum on many small,
+ * independent problems with the same structure at once.
+ */
+#ifndef MAXSUM_BATCH_SOLVER_H
+#define MAXSUM_BATCH_SOLVER_H
+
+#include <vector>
+#include "common.h"
+#include "MaxSumController.h"
+#include "ThreadPool.h"
+
+namespace maxsum
+{
+   /**
+    * Runs max-sum on a batch of independent problems, which all have the
+    * same factor graph structure, but different factor values. This avoids
+    * the per-problem cost of a maxsum::MaxSumController, which must build
+    * its own maps and compiled graph, and look up every variable in the
+    * global variable register.
+    * <p>
+    * Variables and factors are identified by contiguous indices, assigned
+    * in the order in which they are added, and the domain size of each
+    * variable is stored by this solver, so no variables need to be
+    * registered. The value tables of every problem, and all of their
+    * messages, are stored in shared contiguous arrays, in which the
+    * problem index varies fastest. The same element of every problem is
+    * therefore adjacent in memory, so each step of the algorithm is a loop
+    * over problems that the compiler can vectorise.
+    * </p>
+    * <p>
+    * Problems are divided into blocks of BatchSolver::BLOCK_SIZE, which
+    * are solved independently, in parallel if more than one thread is
+    * used. The problems in each block are updated together, using the
+    * MaxSumController::FLOODING schedule, until all of them converge or
+    * the maximum number of iterations is reached.
+    * </p>
+    */
+   class BatchSolver
+   {
+   public:
+
+      /**
+       * The number of problems that are updated together, and solved by
+       * the same thread.
+       */
+      static const int BLOCK_SIZE = 64;
+
+   private:
+
+      /**
+       * Scratch space used by one thread to update a block of problems.
+       */
+      struct Workspace
+      {
+         /**
+          * The total value of a factor for each problem in a block.
+          */
+         std::vector<ValType> total;
+
+         /**
+          * Max marginal of a factor's total value onto one variable, or the
+          * sum of a variable's input messages, for each problem in a block.
+          */
+         std::vector<ValType> marginal;
+
+         /**
+          * The mean of a variable's output message for each problem.
+          */
+         std::vector<ValType> mean;
+      };
+
+      /**
+       * Task used to solve blocks of problems in parallel.
+       */
+      class SolveTask;
+
+      /**
+       * The maximum number of iterations performed by BatchSolver::solve.
+       */
+      int maxIterations_i;
+
+      /**
+       * Messages whose maxnorm change is no larger than this are considered
+       * to have converged.
+       */
+      ValType maxNormThreshold_i;
+
+      /**
+       * Domain size of each variable.
+       */
+      std::vector<ValIndex> varSizes_i;
+
+      /**
+       * Edges of factor <code>f</code> are [factorEdges_i[f],
+       * factorEdges_i[f+1]), in the order of the factor's dimensions.
+       */
+      std::vector<int> factorEdges_i;
+
+      /**
+       * The variable at the end of each edge.
+       */
+      std::vector<int> edgeVar_i;
+
+      /**
+       * Linear index increment in its factor's table for each edge.
+       */
+      std::vector<ValIndex> edgeStride_i;
+
+      /**
+       * Position of the first element of each factor's table, followed by
+       * the total size of all tables.
+       */
+      std::vector<int> tableOffset_i;
+
+      /**
+       * Position of the first element of each edge's messages, followed by
+       * the total size of all messages.
+       */
+      std::vector<int> msgOffset_i;
+
+      /**
+       * Edges of variable <code>v</code> are varEdges_i[k] for k in
+       * [varEdgeStart_i[v], varEdgeStart_i[v+1]).
+       */
+      std::vector<int> varEdgeStart_i;
+
+      /**
+       * Edge indices grouped by variable.
+       */
+      std::vector<int> varEdges_i;
+
+      /**
+       * The number of problems in this batch.
+       */
+      int noProblems_i;
+
+      /**
+       * Factor values of every problem. Element <code>k</code> of factor
+       * <code>f</code> for problem <code>p</code> is at position
+       * (tableOffset_i[f]+k)*noProblems_i+p.
+       */
+      std::vector<ValType> tables_i;
+
+      /**
+       * Factor to variable messages of every problem, laid out by edge in
+       * the same way as tables_i.
+       */
+      std::vector<ValType> fac2var_i;
+
+      /**
+       * Variable to factor messages of every problem.
+       */
+      std::vector<ValType> var2fac_i;
+
+      /**
+       * Value of variable <code>v</code> for problem <code>p</code> at
+       * position v*noProblems_i+p.
+       */
+      std::vector<ValIndex> values_i;
+
+      /**
+       * The number of iterations performed for each block by the last call
+       * to BatchSolver::solve.
+       */
+      std::vector<int> blockIterations_i;
+
+      /**
+       * The number of threads used by BatchSolver::solve.
+       */
+      int numThreads_i;
+
+      /**
+       * Pool of worker threads, or NULL if problems are solved serially.
+       */
+      util::ThreadPool* pPool_i;
+
+      /**
+       * Scratch space for each thread.
+       */
+      std::vector<Workspace> workspaces_i;
+
+      // Worker threads are not shared, so solvers are not copied.
+      BatchSolver(const BatchSolver&);
+      BatchSolver& operator=(const BatchSolver&);
+
+      /**
+       * Discards all problems, so that the structure can be changed.
+       */
+      void discardProblems();
+
+      /**
+       * Reserves enough space in each workspace to update any node.
+       */
+      void reserveWorkspaces();
+
+      /**
+       * Updates the messages sent by a factor for a block of problems.
+       * @param[in] f the index of the factor.
+       * @param[in] begin the first problem in the block.
+       * @param[in] end one past the last problem in the block.
+       * @param[in,out] ws scratch space for the calling thread.
+       * @returns the largest maxnorm change in any message sent.
+       */
+      ValType updateFactor(int f, int begin, int end, Workspace& ws);
+
+      /**
+       * Updates the messages sent by a variable for a block of problems,
+       * and sets its value to maximise the sum of its inputs.
+       * @param[in] v the index of the variable.
+       * @param[in] begin the first problem in the block.
+       * @param[in] end one past the last problem in the block.
+       * @param[in,out] ws scratch space for the calling thread.
+       * @param[in,out] changed set to true if any value changes.
+       * @returns the largest maxnorm change in any message sent.
+       */
+      ValType updateVariable(int v, int begin, int end, Workspace& ws,
+            bool& changed);
+
+      /**
+       * Runs max-sum on one block of problems until they all converge, or
+       * the maximum number of iterations is reached.
+       * @param[in] block the index of the block.
+       * @param[in,out] ws scratch space for the calling thread.
+       */
+      void solveBlock(int block, Workspace& ws);
+
+   public:
+
+      /**
+       * Constructs an empty batch.
+       * @param[in] maxIterations the maximum number of iterations
+       * performed by BatchSolver::solve.
+       * @param[in] maxnorm the maxnorm threshold used to decide when
+       * messages have converged.
+       */
+      BatchSolver
+      (
+       int maxIterations=MaxSumController::DEFAULT_MAX_ITERATIONS,
+       ValType maxnorm=MaxSumController::DEFAULT_MAXNORM_THRESHOLD
+      )
+      : maxIterations_i(maxIterations), maxNormThreshold_i(maxnorm),
+        factorEdges_i(1,0), tableOffset_i(1,0), msgOffset_i(1,0),
+        varEdgeStart_i(1,0), noProblems_i(0), numThreads_i(1), pPool_i(0),
+        workspaces_i(1) {}
+
+      /**
+       * Destructor stops any worker threads.
+       */
+      ~BatchSolver()
+      {
+         delete pPool_i;
+      }
+
+      /**
+       * Adds a variable to the structure shared by every problem.
+       * @param[in] size the domain size of the variable.
+       * @returns the index of the new variable.
+       * @post any existing problems are discarded.
+       * @throws maxsum::BadDomainException if <code>size</code> is less
+       * than 1.
+       */
+      int addVariable(ValIndex size);
+
+      /**
+       * Adds a factor to the structure shared by every problem.
+       * @param[in] vars the index of each variable that the factor depends
+       * on, from the least significant dimension of its table to the
+       * most significant. Each variable may only be listed once.
+       * @returns the index of the new factor.
+       * @post any existing problems are discarded.
+       * @throws maxsum::OutOfRangeException if any variable does not exist.
+       * @throws maxsum::BadDomainException if a variable is repeated, or
+       * the factor depends on too many variables.
+       */
+      int addFactor(const std::vector<int>& vars);
+
+      /**
+       * Sets the number of problems in this batch. Every factor value,
+       * message and variable value is reset to zero.
+       */
+      void setNoProblems(int n);
+
+      /**
+       * Sets the number of threads used by BatchSolver::solve.
+       * @param[in] n the number of threads to use, including the calling
+       * thread. If <code>n</code> is 0, one thread is used for each
+       * hardware thread.
+       */
+      void setNumThreads(int n);
+
+      /**
+       * Sets the values of one factor for one problem.
+       * @param[in] problem the index of the problem.
+       * @param[in] f the index of the factor.
+       * @param[in] values BatchSolver::tableSize values, in increasing
+       * order of linear index.
+       * @throws maxsum::OutOfRangeException if the problem or factor does
+       * not exist.
+       */
+      void setFactor(int problem, int f, const ValType* values);
+
+      /**
+       * Resets every message to zero, so that the next call to
+       * BatchSolver::solve starts from scratch. Otherwise, it continues
+       * from the messages left by the previous call.
+       */
+      void clearMessages();
+
+      /**
+       * Runs max-sum on every problem in this batch.
+       * @returns the largest number of iterations performed for any block
+       * of problems.
+       */
+      int solve();
+
+      /**
+       * Returns the value assigned to a variable in one problem by the last
+       * call to BatchSolver::solve.
+       * @throws maxsum::OutOfRangeException if the problem or variable
+       * does not exist.
+       */
+      ValIndex getValue(int problem, int var) const;
+
+      /**
+       * Copies the values assigned to every variable in one problem.
+       * @param[in] problem the index of the problem.
+       * @param[out] values the value of each variable, in order of index.
+       * @throws maxsum::OutOfRangeException if the problem does not exist.
+       */
+      void getValues(int problem, std::vector<ValIndex>& values) const;
+
+      /**
+       * Returns the number of variables in each problem.
+       */
+      int noVars() const { return varSizes_i.size(); }
+
+      /**
+       * Returns the number of factors in each problem.
+       */
+      int noFactors() const { return factorEdges_i.size()-1; }
+
+      /**
+       * Returns the number of problems in this batch.
+       */
+      int noProblems() const { return noProblems_i; }
+
+      /**
+       * Returns the number of values in the table of the specified factor.
+       */
+      ValIndex tableSize(int f) const
+      {
+         return tableOffset_i[f+1] - tableOffset_i[f];
+      }
+
+      /**
+       * Returns the number of threads used by BatchSolver::solve.
+       */
+      int getNumThreads() const { return numThreads_i; }
+
+   }; // class BatchSolver
+
+} // namespace maxsum
+
+#endif // MAXSUM_BATCH_SOLVER_H
@@ -0,0 +1,248 @@
+/**
+ * @file BroadcastPlan.h
+ * Defines the maxsum::util::BroadcastPlan class, which is used to implement
+ * element-wise operations between maxsum::DiscreteFunction objects with
+ * different domains.
+ * @attention The types defined in this header are not intended to form part
+ * of the public interface to the maxsum library.
+ */
+#ifndef MAXSUM_UTIL_BROADCAST_PLAN_H
+#define MAXSUM_UTIL_BROADCAST_PLAN_H
+
+#include <cassert>
+#include "common.h"
+#include "Domain.h"
+#include "MarginalPlan.h"
+
+namespace maxsum
+{
+namespace util
+{
+   /**
+    * Precomputed strategy for combining every value of one function with
+    * the corresponding value of another function, whose domain is a subset
+    * of the first. This is the inverse of maxsum::util::MarginalPlan: the
+    * values of the smaller function are broadcast across the dimensions of
+    * the larger function that it does not depend on.
+    * <p>
+    * The values of the larger function are visited in increasing order of
+    * linear index, so the result is exactly the same as iterating over its
+    * domain with a maxsum::DomainIterator, but no sub-indices are looked up
+    * and no memory is allocated. Since maxsum::util::Domain already caches
+    * each variable's stride, constructing a plan only requires one pass
+    * over the variables in the larger domain.
+    * </p>
+    */
+   class BroadcastPlan
+   {
+   private:
+
+      /**
+       * Dimensions of the larger function, with the stride of each in the
+       * value array of the smaller function. The stride is zero for
+       * dimensions that the smaller function does not depend on.
+       * Dimensions that are contiguous in both functions are merged.
+       */
+      StrideList dims_i;
+
+      /**
+       * Functor used to copy each value of the smaller function.
+       */
+      struct Assign_m
+      {
+         void operator()(ValType& out, const ValType in) const { out = in; }
+      };
+
+   public:
+
+      /**
+       * Constructs a plan for broadcasting a function with domain
+       * <code>sub</code> over the domain <code>full</code>.
+       * @pre the variables of <code>sub</code> are a subset of those of
+       * <code>full</code>.
+       */
+      BroadcastPlan(const Domain& full, const Domain& sub) : dims_i()
+      {
+         int s=0;
+         for(int k=0; k<full.noVars(); ++k)
+         {
+            if( (s<sub.noVars()) && (sub.vars()[s]==full.vars()[k]) )
+            {
+               dims_i.push(sub.strides()[s],full.sizes()[k]);
+               ++s;
+            }
+            else
+            {
+               dims_i.push(0,full.sizes()[k]);
+            }
+         }
+         assert(sub.noVars()==s);
+
+      } // constructor
+
+      /**
+       * Applies <code>op(pFull[k],pSub[j])</code> for every linear index
+       * <code>k</code> into the larger function, in increasing order, where
+       * <code>j</code> is the linear index of the corresponding value in
+       * the smaller function.
+       * @param[in,out] pFull pointer to the first value of the larger
+       * function.
+       * @param[in] pSub pointer to the first value of the smaller function.
+       * @param[in] op functor with signature void op(ValType&, ValType).
+       */
+      template<typename Op> void apply
+      (
+       ValType* pFull,
+       const ValType* pSub,
+       Op op
+      ) const
+      {
+         if(0==dims_i.noDims)
+         {
+            op(*pFull,*pSub);
+            return;
+         }
+
+         //*********************************************************************
+         // The innermost dimension is processed in a tight loop, while the
+         // outer dimensions are visited using an odometer over their
+         // subindices.
+         //*********************************************************************
+         const ValIndex innerStride = dims_i.stride[0];
+         const ValIndex innerSize = dims_i.size[0];
+         ValIndex sub[MAX_DOMAIN_DIMS] = {0};
+         ValIndex offset = 0;
+         ValType* const pEnd = pFull + dims_i.total;
+         while(true)
+         {
+            const ValType* pCur = pSub + offset;
+            for(ValIndex k=0; k<innerSize; ++k)
+            {
+               op(*pFull,*pCur);
+               ++pFull;
+               pCur += innerStride;
+            }
+
+            if(pEnd==pFull)
+            {
+               return;
+            }
+
+            for(int d=1; d<dims_i.noDims; ++d)
+            {
+               offset += dims_i.stride[d];
+               if(++sub[d] < dims_i.size[d])
+               {
+                  break;
+               }
+               offset -= dims_i.stride[d]*dims_i.size[d];
+               sub[d] = 0;
+            }
+
+         } // while loop
+
+      } // apply
+
+      /**
+       * Sets every value of the larger function to the corresponding value
+       * of the smaller function.
+       * @param[out] pFull pointer to the first value of the larger function.
+       * @param[in] pSub pointer to the first value of the smaller function.
+       */
+      void assign(ValType* pFull, const ValType* pSub) const
+      {
+         apply(pFull,pSub,Assign_m());
+      }
+
+   }; // class BroadcastPlan
+
+   /**
+    * Sums a factor with all of its input messages in a single pass.
+    * Each message depends on exactly one of the factor's variables, and
+    * the messages are specified in the same order as the factor's domain.
+    * For every linear index <code>k</code>, this computes
+    * <code>pOut[k] = ((pFactor[k] + m0) + m1) + ...</code>
+    * where <code>mi</code> is the value of message <code>i</code> for the
+    * corresponding variable's subindex. The additions are performed in
+    * the same order as adding each message to a copy of the factor in turn,
+    * so the result is identical, but the value array is only traversed once.
+    * @param[in] pFactor the factor's value array.
+    * @param[in] noMsgs the number of variables in the factor's domain.
+    * @param[in] pSizes the domain size of each of the factor's variables.
+    * @param[in] ppMsgs the values of the message for each variable.
+    * @param[out] pOut array of the same length as <code>pFactor</code>,
+    * which may be the same array.
+    */
+   inline void addMessages
+   (
+    const ValType* pFactor,
+    const int noMsgs,
+    const ValIndex* pSizes,
+    const ValType* const* ppMsgs,
+    ValType* pOut
+   )
+   {
+      if(0==noMsgs)
+      {
+         *pOut = *pFactor;
+         return;
+      }
+
+      //************************************************************************
+      // The first variable always has unit stride, so its message is added
+      // in the inner loop. For the remaining variables, we keep track of
+      // their current subindices and message values, which only change
+      // between runs of the inner loop.
+      //************************************************************************
+      assert(MAX_DOMAIN_DIMS>=noMsgs);
+      ValIndex sub[MAX_DOMAIN_DIMS] = {0};
+      ValType cur[MAX_DOMAIN_DIMS];
+      for(int m=1; m<noMsgs; ++m)
+      {
+         cur[m] = ppMsgs[m][0];
+      }
+
+      const ValType* const pInner = ppMsgs[0];
+      const ValIndex innerSize = pSizes[0];
+      while(true)
+      {
+         for(ValIndex j=0; j<innerSize; ++j)
+         {
+            ValType val = pFactor[j] + pInner[j];
+            for(int m=1; m<noMsgs; ++m)
+            {
+               val += cur[m];
+            }
+            pOut[j] = val;
+         }
+         pFactor += innerSize;
+         pOut += innerSize;
+
+         //*********************************************************************
+         // Increment the odometer for the outer variables, and stop once
+         // every one has wrapped around.
+         //*********************************************************************
+         int m=1;
+         for(; m<noMsgs; ++m)
+         {
+            if(++sub[m] < pSizes[m])
+            {
+               cur[m] = ppMsgs[m][sub[m]];
+               break;
+            }
+            sub[m] = 0;
+            cur[m] = ppMsgs[m][0];
+         }
+         if(noMsgs==m)
+         {
+            return;
+         }
+
+      } // while loop
+
+   } // function addMessages
+
+} // namespace util
+} // namespace maxsum
+
+#endif // MAXSUM_UTIL_BROADCAST_PLAN_H
@@ -0,0 +1,126 @@
+/**
+ * @file CardinalityFactor.h
+ * Defines the maxsum::CardinalityFactor class, a factor that only depends
+ * on how many of its variables are active.
+ */
+#ifndef MAXSUM_CARDINALITY_FACTOR_H
+#define MAXSUM_CARDINALITY_FACTOR_H
+
+#include <vector>
+#include "common.h"
+#include "ImplicitFactor.h"
+
+namespace maxsum
+{
+   /**
+    * Factor whose value depends only on the number of its variables that
+    * are <em>active</em>, meaning that they take any value other than 0.
+    * This can represent constraints such as "at most k of these variables
+    * may be active", or costs that grow with the number of active
+    * variables, over any number of variables.
+    * <p>
+    * Max marginals are computed without enumerating joint assignments, by
+    * sorting the variables by how much their input messages gain from being
+    * active. The best assignment with exactly c active variables then
+    * activates the first c variables in this order, so every max marginal
+    * is found in O(n log n) time for n variables, rather than time
+    * exponential in n.
+    * </p>
+    * <p>
+    * Hard constraints should be represented by a large finite penalty
+    * rather than by infinity, so that message normalisation remains
+    * well defined.
+    * </p>
+    */
+   class CardinalityFactor : public ImplicitFactor
+   {
+   private:
+
+      /**
+       * Value of this factor for each number of active variables, from 0
+       * up to and including the number of variables.
+       */
+      std::vector<ValType> counts_i;
+
+   public:
+
+      /**
+       * Constructs a cardinality factor.
+       * @param[in] begin iterator to the start of the variable list.
+       * @param[in] end iterator to the end of the variable list.
+       * @param[in] counts the value of this factor when exactly
+       * <code>c</code> variables are active, for <code>c</code> from 0 up to
+       * and including the number of distinct variables.
+       * @throws UnknownVariableException if any variable is not registered.
+       * @throws BadDomainException if <code>counts</code> has the wrong
+       * length.
+       */
+      template<class VarIt> CardinalityFactor
+      (
+       VarIt begin,
+       VarIt end,
+       const std::vector<ValType>& counts
+      )
+      : ImplicitFactor(begin,end), counts_i(counts)
+      {
+         checkCounts();
+      }
+
+      /**
+       * Constructs a factor that is 0 if at most <code>k</code> of its
+       * variables are active, and <code>penalty</code> otherwise.
+       * @param[in] begin iterator to the start of the variable list.
+       * @param[in] end iterator to the end of the variable list.
+       * @param[in] k the maximum number of active variables allowed.
+       * @param[in] penalty the value of this factor when more than
+       * <code>k</code> variables are active, which should be negative.
+       * @throws UnknownVariableException if any variable is not registered.
+       */
+      template<class VarIt> CardinalityFactor
+      (
+       VarIt begin,
+       VarIt end,
+       int k,
+       ValType penalty
+      )
+      : ImplicitFactor(begin,end), counts_i()
+      {
+         for(int c=0; c<=noVars(); ++c)
+         {
+            counts_i.push_back(c<=k ? 0 : penalty);
+         }
+      }
+
+      /**
+       * Returns the value of this factor for each number of active
+       * variables.
+       */
+      const std::vector<ValType>& counts() const { return counts_i; }
+
+      /**
+       * Returns the value of this factor for a joint assignment.
+       */
+      ValType value(const ValIndex* pSubs) const;
+
+      /**
+       * Max marginalises the sum of this factor and its input messages
+       * onto every variable.
+       * @see ImplicitFactor::maxMarginals
+       */
+      void maxMarginals(const ValType* const* ppMsgs,
+            ValType* const* ppOut) const;
+
+   private:
+
+      /**
+       * Checks that there is one value for each possible number of active
+       * variables.
+       * @throws BadDomainException if not.
+       */
+      void checkCounts() const;
+
+   }; // class CardinalityFactor
+
+} // namespace maxsum
+
+#endif // MAXSUM_CARDINALITY_FACTOR_H
@@ -10,9 +10,13 @@
 #include <iostream>
 #include <cassert>
 #include <algorithm>
+#include <utility>
 #include "common.h"
 #include "register.h"
+#include "Domain.h"
 #include "DomainIterator.h"
+#include "MarginalPlan.h"
+#include "BroadcastPlan.h"
 
 namespace maxsum
 {
@@ -52,15 +56,10 @@ namespace maxsum
       typedef Eigen::Array<ValType, Eigen::Dynamic, 1> ValVec;
 
       /**
-       * Set of variables on which this function depends.
+       * Shared description of the set of variables on which this function
+       * depends, and their domain sizes.
        */
-      VarVec vars_i;
-
-      /**
-       * Cache specifying the domain size for each variable on which this
-       * function depends.
-       */
-      SizeVec size_i;
+      const util::Domain* pDomain_i;
 
       /**
        * Array containing the values for this function.
@@ -79,7 +78,7 @@ namespace maxsum
        * @param[in] val the constant scalar value of this function.
        */
       DiscreteFunction(ValType val=0)
-         : vars_i(0), size_i(0), values_i()
+         : pDomain_i(util::Domain::empty()), values_i()
       {
          values_i.resize(1);
          values_i(0) = val;
@@ -102,28 +101,13 @@ namespace maxsum
        VarIt end,
        ValType val=0
       )
-      : vars_i(begin,end), size_i(end-begin), values_i()
+      : pDomain_i(util::Domain::intern(begin,end)), values_i()
       {
          //*********************************************************************
-         // Ensure that the variable ids are sorted.
-         //*********************************************************************
-         std::sort(vars_i.begin(),vars_i.end());
-
-         //*********************************************************************
-         // Cache the size of each variable, and from this, calculate
-         // the total capacity required for the data array.
-         //*********************************************************************
-         ValIndex totalSize = 1;
-         for(int k=0; k<vars_i.size(); k++)
-         {
-            size_i[k] = getDomainSize(vars_i[k]);
-            totalSize *= size_i[k];
-         }
-
-         //*********************************************************************
-         // Initialise the data array
+         // The shared domain sorts the variable ids, and caches the total
+         // capacity required for the data array.
          //*********************************************************************
-         values_i.resize(totalSize);
+         values_i.resize(pDomain_i->totalSize());
          Eigen::Matrix<ValType,1,1> valWrapper;
          valWrapper(0) = val;
          values_i.matrix().rowwise() = valWrapper;
@@ -138,9 +122,9 @@ namespace maxsum
        * @throws UnknownVariableException if \c var is not registered.
        */
       DiscreteFunction(VarID var, ValType val)
-         : vars_i(1,var), size_i(1,getDomainSize(var)), values_i()
+         : pDomain_i(util::Domain::intern(var)), values_i()
       {
-         values_i.resize(getDomainSize(var));
+         values_i.resize(pDomain_i->totalSize());
          Eigen::Matrix<ValType,1,1> valWrapper;
          valWrapper(0) = val;
          values_i.matrix().rowwise() = valWrapper;
@@ -151,7 +135,29 @@ namespace maxsum
        * @param[in] val the object to copy.
        */
       DiscreteFunction(const DiscreteFunction& val)
-         : vars_i(val.vars_i), size_i(val.size_i), values_i(val.values_i) {}
+         : pDomain_i(util::Domain::addRef(val.pDomain_i)),
+           values_i(val.values_i) {}
+
+      /**
+       * Move Constructor takes ownership of another function's domain and
+       * values, without copying or allocating memory.
+       * @param[in,out] val the object to move.
+       * @post <code>val</code> is left in a valid but unspecified state,
+       * in which it may only be assigned to or destroyed.
+       */
+      DiscreteFunction(DiscreteFunction&& val) noexcept
+         : pDomain_i(util::Domain::empty()), values_i()
+      {
+         swap(val);
+      }
+
+      /**
+       * Destructor releases this function's reference to its domain.
+       */
+      ~DiscreteFunction()
+      {
+         util::Domain::release(pDomain_i);
+      }
 
       /**
        * Accessor method for the total size this function's domain.
@@ -160,6 +166,16 @@ namespace maxsum
       {
          return values_i.size();
       }
+
+      /**
+       * Returns the number of bytes of heap storage used for the values of
+       * this function. Domains are shared by every function that depends on
+       * the same variables, so are not included.
+       */
+      std::size_t bytesUsed() const
+      {
+         return values_i.size()*sizeof(ValType);
+      }
       
       /**
        * Returns true if this function depends on the specified variable.
@@ -181,7 +197,7 @@ namespace maxsum
        */
       VarIterator varBegin() const
       {
-         return vars_i.begin();
+         return pDomain_i->vars().begin();
       }
 
       /**
@@ -190,7 +206,7 @@ namespace maxsum
        */
       VarIterator varEnd() const
       {
-         return vars_i.end();
+         return pDomain_i->vars().end();
       }
 
       /**
@@ -211,7 +227,7 @@ namespace maxsum
        */
       SizeIterator sizeBegin() const
       {
-         return size_i.begin();
+         return pDomain_i->sizes().begin();
       }
 
       /**
@@ -226,7 +242,7 @@ namespace maxsum
        */
       SizeIterator sizeEnd() const
       {
-         return size_i.end();
+         return pDomain_i->sizes().end();
       }
 
 
@@ -235,7 +251,18 @@ namespace maxsum
        */
       int noVars() const
       {
-         return vars_i.size();
+         return pDomain_i->noVars();
+      }
+
+      /**
+       * Returns the shared description of this function's domain.
+       * Since domains are interned, two functions have the same domain if
+       * and only if this method returns the same object for both.
+       * @see maxsum::sameDomain
+       */
+      const util::Domain& domain() const
+      {
+         return *pDomain_i;
       }
 
       /**
@@ -265,6 +292,19 @@ namespace maxsum
        */
       DiscreteFunction& operator=(const DiscreteFunction& val);
 
+      /**
+       * Move assignment takes ownership of another function's domain and
+       * values, without copying or allocating memory.
+       * @param[in,out] val the value to assign to this function.
+       * @post <code>val</code> is left in a valid but unspecified state,
+       * in which it may only be assigned to or destroyed.
+       */
+      DiscreteFunction& operator=(DiscreteFunction&& val) noexcept
+      {
+         swap(val);
+         return *this;
+      }
+
       /**
        * Adds a scalar value to this function.
        */
@@ -304,9 +344,20 @@ namespace maxsum
       /**
        * Multiply function by -1
        */
-      DiscreteFunction operator-() const
+      DiscreteFunction operator-() const &
       {
-         return DiscreteFunction(*this) *= -1;
+         DiscreteFunction result(*this);
+         result *= -1;
+         return result;
+      }
+
+      /**
+       * Multiply temporary function by -1, reusing its storage.
+       */
+      DiscreteFunction operator-() &&
+      {
+         *this *= -1;
+         return std::move(*this);
       }
 
       /**
@@ -350,33 +401,85 @@ namespace maxsum
       /**
        * Subtract function or scalar.
        */
-      template<class T> DiscreteFunction operator-(T rhs) const
+      template<class T> DiscreteFunction operator-(const T& rhs) const &
+      {
+         DiscreteFunction result(*this);
+         result -= rhs;
+         return result;
+      }
+
+      /**
+       * Subtract function or scalar.
+       * The result is computed in place, reusing the storage of this
+       * temporary function.
+       */
+      template<class T> DiscreteFunction operator-(const T& rhs) &&
+      {
+         *this -= rhs;
+         return std::move(*this);
+      }
+
+      /**
+       * Add function or scalar.
+       */
+      template<class T> DiscreteFunction operator+(const T& rhs) const &
       {
-         return DiscreteFunction(*this) -= rhs;
+         DiscreteFunction result(*this);
+         result += rhs;
+         return result;
       }
 
       /**
        * Add function or scalar.
+       * The result is computed in place, reusing the storage of this
+       * temporary function.
        */
-      template<class T> DiscreteFunction operator+(T rhs) const
+      template<class T> DiscreteFunction operator+(const T& rhs) &&
       {
-         return DiscreteFunction(*this) += rhs;
+         *this += rhs;
+         return std::move(*this);
       }
 
       /**
        * Multiply function or scalar.
        */
-      template<class T> DiscreteFunction operator*(T rhs) const
+      template<class T> DiscreteFunction operator*(const T& rhs) const &
       {
-         return DiscreteFunction(*this) *= rhs;
+         DiscreteFunction result(*this);
+         result *= rhs;
+         return result;
+      }
+
+      /**
+       * Multiply function or scalar.
+       * The result is computed in place, reusing the storage of this
+       * temporary function.
+       */
+      template<class T> DiscreteFunction operator*(const T& rhs) &&
+      {
+         *this *= rhs;
+         return std::move(*this);
+      }
+
+      /**
+       * Divide function by function or scalar.
+       */
+      template<class T> DiscreteFunction operator/(const T& rhs) const &
+      {
+         DiscreteFunction result(*this);
+         result /= rhs;
+         return result;
       }
 
       /**
        * Divide function by function or scalar.
+       * The result is computed in place, reusing the storage of this
+       * temporary function.
        */
-      template<class T> DiscreteFunction operator/(T rhs) const
+      template<class T> DiscreteFunction operator/(const T& rhs) &&
       {
-         return DiscreteFunction(*this) /= rhs;
+         *this /= rhs;
+         return std::move(*this);
       }
 
       /**
@@ -482,7 +585,7 @@ namespace maxsum
        */
       template<class IndIt> ValType& operator()(IndIt begin, IndIt end)
       {
-         ValIndex ind = sub2ind(size_i.begin(),size_i.end(),begin,end);
+         ValIndex ind = sub2ind(sizeBegin(),sizeEnd(),begin,end);
          return values_i[ind];
       }
 
@@ -525,8 +628,7 @@ namespace maxsum
          // Validate list sizes as far as possible
          //*********************************************************************
          assert( (varEnd-varBegin) == (subEnd-subBegin) );
-         assert( vars_i.size() == size_i.size() );
-         assert( (varEnd-varBegin) >= vars_i.size() );
+         assert( (varEnd-varBegin) >= noVars() );
          
          //*********************************************************************
          // Now we need iterators for the input variables and indices,
@@ -534,8 +636,9 @@ namespace maxsum
          //*********************************************************************
          VarIt inV = varBegin;
          IndIt sub = subBegin;
-         VarVec::const_iterator myV = vars_i.begin();
-         SizeVec::const_iterator siz = size_i.begin();
+         const VarVec& myVars = pDomain_i->vars();
+         VarVec::const_iterator myV = myVars.begin();
+         SizeVec::const_iterator siz = pDomain_i->sizes().begin();
          
          //*********************************************************************
          // Now we iterate through the input variables and indices and perform
@@ -547,7 +650,7 @@ namespace maxsum
          // to check for variable equality by iterating through each list in
          // strict order
          //*********************************************************************         
-         while( (myV!=vars_i.end()) && (inV!=varEnd) )
+         while( (myV!=myVars.end()) && (inV!=varEnd) )
          {
             //******************************************************************
             // Skip indices for variables that are not in the domain of this
@@ -586,8 +689,8 @@ namespace maxsum
          // Sanity check that we found all the variables in this functions
          // domain, and return the resulting linear index.
          //*********************************************************************
-         assert(myV==vars_i.end());
-         assert(siz==size_i.end());
+         assert(myV==myVars.end());
+         assert(siz==sizeEnd());
          assert(index<values_i.size());
          return values_i[index];
          
@@ -667,16 +770,16 @@ namespace maxsum
          //*********************************************************************
          // Validate list sizes as far as possible
          //*********************************************************************
-         assert( vars_i.size() == size_i.size() );
-         assert( vals.size() >= vars_i.size() );
+         assert( vals.size() >= static_cast<std::size_t>(noVars()) );
          
          //*********************************************************************
          // Now we need iterators for the input variables and indices,
          // and this variables own variables and their domain sizes.
          //*********************************************************************
          typename VarMap::const_iterator inV = vals.begin();
-         VarVec::const_iterator myV = vars_i.begin();
-         SizeVec::const_iterator siz = size_i.begin();
+         const VarVec& myVars = pDomain_i->vars();
+         VarVec::const_iterator myV = myVars.begin();
+         SizeVec::const_iterator siz = pDomain_i->sizes().begin();
          
          //*********************************************************************
          // Now we iterate through the input variables and indices and perform
@@ -688,7 +791,7 @@ namespace maxsum
          // to check for variable equality by iterating through each list in
          // strict order
          //*********************************************************************
-         while( (myV!=vars_i.end()) && (inV!=vals.end()) )
+         while( (myV!=myVars.end()) && (inV!=vals.end()) )
          {
             //******************************************************************
             // Skip indices for variables that are not in the domain of this
@@ -725,8 +828,8 @@ namespace maxsum
          // Sanity check that we found all the variables in this functions
          // domain, and return the resulting linear index.
          //*********************************************************************
-         assert(myV==vars_i.end());
-         assert(siz==size_i.end());
+         assert(myV==myVars.end());
+         assert(siz==sizeEnd());
          assert(index<values_i.size());
          return index;
 
@@ -804,7 +907,7 @@ namespace maxsum
        * @param fun Another DiscreteFunction whose value and domain is swapped
        * with that of this one.
        */
-      void swap(DiscreteFunction& fun);
+      void swap(DiscreteFunction& fun) noexcept;
 
       /**
        * Make this function depend on additional variables.
@@ -819,8 +922,8 @@ namespace maxsum
          // Construct the union of the specified variables with this
          // functions current domain
          //*********************************************************************
-         std::vector<VarID> newVar = vars_i;
-         int maxSize = (end - begin) + vars_i.size();
+         std::vector<VarID> newVar(varBegin(),varEnd());
+         int maxSize = (end - begin) + noVars();
          newVar.reserve(maxSize);
          newVar.insert(newVar.end(),begin,end);
          std::sort(newVar.begin(),newVar.end());
@@ -834,7 +937,7 @@ namespace maxsum
          // If the specified list is a subset of the current domain, then
          // we're done.
          //*********************************************************************
-         if(newVar.size() <= vars_i.size())
+         if(newVar.size() <= static_cast<std::size_t>(noVars()))
          {
             return;
          }
@@ -848,10 +951,8 @@ namespace maxsum
          //*********************************************************************
          // Copy old values to new values across the expanded domain
          //*********************************************************************
-         for(DomainIterator k(result); k.hasNext(); ++k)
-         { 
-            result(k.getInd()) = (*this)(newVar,k.getSubInd());
-         }
+         util::BroadcastPlan(result.domain(),domain())
+            .assign(result.values_i.data(),values_i.data());
 
          //*********************************************************************
          // Assign the new values to this one.
@@ -873,7 +974,6 @@ namespace maxsum
        * If necessary, the domain of this function is expanded to include the
        * domain of the parameter fun.
        * @param[in] fun function whose domain we want to expand to.
-       * @todo Make this more efficient by using fun.size_i cache.
        * @post domain of this is union of its previous domain, with that of fun.
        */
       void expand(const DiscreteFunction& fun);
@@ -921,7 +1021,7 @@ namespace maxsum
          // Otherwise construct the reduced domain of free variables.
          //*********************************************************************
          std::vector<VarID> freeVars;
-         freeVars.reserve(vars_i.size());
+         freeVars.reserve(noVars());
          for(VarIterator varIt=varBegin(); varIt != varEnd(); ++varIt)
          {
             if(!it.isFixed(*varIt))
@@ -932,13 +1032,13 @@ namespace maxsum
 
          //*********************************************************************
          // Create a temporary function to hold the result, and copy in the
-         // conditioned values.
+         // conditioned values. The free variables are visited in the same
+         // order as the result's linear index.
          //*********************************************************************
          DiscreteFunction result(freeVars.begin(),freeVars.end());
-         while(it.hasNext())
+         for(ValIndex k=0; it.hasNext(); ++k, ++it)
          {
-            result(it.getVars(),it.getSubInd()) = this->at(it.getInd());
-            ++it;
+            result(k) = this->at(it.getInd());
          }
 
          //*********************************************************************
@@ -1296,13 +1396,13 @@ namespace maxsum
 
       //*********************************************************************
       // Create a temporary function to hold the result, and copy in the
-      // conditioned values.
+      // conditioned values. The free variables are visited in the same
+      // order as the result's linear index.
       //*********************************************************************
       DiscreteFunction result(freeVars.begin(),freeVars.end());
-      while(it.hasNext())
+      for(ValIndex k=0; it.hasNext(); ++k, ++it)
       {
-         result(it.getVars(),it.getSubInd()) = inFun(it.getInd());
-         ++it;
+         result(k) = inFun(it.getInd());
       }
 
       //*********************************************************************
@@ -1364,13 +1464,13 @@ namespace maxsum
 
       //*********************************************************************
       // Create a temporary function to hold the result, and copy in the
-      // conditioned values.
+      // conditioned values. The free variables are visited in the same
+      // order as the result's linear index.
       //*********************************************************************
       DiscreteFunction result(freeVars.begin(),freeVars.end());
-      while(it.hasNext())
+      for(ValIndex k=0; it.hasNext(); ++k, ++it)
       {
-         result(it.getVars(),it.getSubInd()) = inFun(it.getInd());
-         ++it;
+         result(k) = inFun(it.getInd());
       }
 
       //*********************************************************************
@@ -1441,41 +1541,18 @@ namespace maxsum
       }
 
       //************************************************************************
-      // Calculate and store the result for each value in the output function.
-      // Notice, we need to get the first element outside the loop, so that we
-      // have at least two values with which to call the aggregate function.
-      // If there is only one value, then that becomes its own aggregate.
+      // Precompute the strides of the kept and eliminated variables, and
+      // use them to reduce the input values without any further lookups.
+      // Each output value is initialised to its first corresponding input
+      // value, so that things like max and min work properly as aggregate
+      // functions, and the remaining values are aggregated in increasing
+      // order of linear index.
       //************************************************************************
-      for(DomainIterator outIt(outFun); outIt.hasNext(); ++outIt)
-      {
-         //*********************************************************************
-         // Initialise the result to the first corresponding value in the input
-         // function. This ensures that things like max and min will work
-         // properly as aggregate functions, because they already have
-         // something to work with.
-         //*********************************************************************
-         DomainIterator inIt(inFun);
-         inIt.condition(outIt);
-         ValType result = inFun(inIt.getInd());
-         ++inIt;
-
-         //*********************************************************************
-         // Update the result by aggregating with any remaining values in the
-         // free part of the input function domain.
-         //*********************************************************************
-         while(inIt.hasNext())
-         {
-            result = aggregate(result,inFun(inIt.getInd()));
-            ++inIt;
-         }
-
-         //*********************************************************************
-         // Store the current aggregate value in the current position of the
-         // output function.
-         //*********************************************************************
-         outFun(outIt.getInd()) = result;
+      util::MarginalPlan plan(inFun.varBegin(),inFun.varEnd(),
+            inFun.sizeBegin(),outFun.varBegin(),outFun.varEnd());
 
-      } // for loop
+      assert(plan.outputSize()==outFun.domainSize());
+      plan.reduce(&inFun(0),aggregate,&outFun(0));
 
    } // function marginal
 
@@ -1484,6 +1561,8 @@ namespace maxsum
     * This function reduces the domain of inFun to that of outFun by
     * maximisation, and stores the result in outFun. This behaviour is
     * equivalent to maxsum::marginal(inFun,std::max<ValType>,outFun).
+    * If the kept (or eliminated) variables are contiguous in memory,
+    * the reduction is performed by Eigen's vectorised kernels instead.
     * @pre variables in domain of outFun are a subset of variables in inFun.
     * @post previous content of outFun is overwritten.
     * @post The domains of outFun and inFun remain unchanged.
@@ -1502,6 +1581,8 @@ namespace maxsum
     * This function reduces the domain of inFun to that of outFun by
     * minimisation, and stores the result in outFun. This behaviour is
     * equivalent to maxsum::marginal(inFun,std::min<ValType>,outFun).
+    * If the kept (or eliminated) variables are contiguous in memory,
+    * the reduction is performed by Eigen's vectorised kernels instead.
     * @pre variables in domain of outFun are a subset of variables in inFun.
     * @post previous content of outFun is overwritten.
     * @post The domains of outFun and inFun remain unchanged.
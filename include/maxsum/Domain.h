@@ -0,0 +1,417 @@
+/**
+ * @file Domain.h
+ * Defines the maxsum::util::Domain class, which is used to share domain
+ * information between maxsum::DiscreteFunction objects.
+ * @attention The types defined in this header are not intended to form part
+ * of the public interface to the maxsum library.
+ */
+#ifndef MAXSUM_UTIL_DOMAIN_H
+#define MAXSUM_UTIL_DOMAIN_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#include "common.h"
+
+namespace maxsum
+{
+namespace util
+{
+   /**
+    * Immutable description of the domain of a maxsum::DiscreteFunction.
+    * Domains are interned: for any sorted set of variables, there is exactly
+    * one maxsum::util::Domain object, which is shared by every function that
+    * depends on those variables. Two functions therefore have the same
+    * domain if and only if they point to the same maxsum::util::Domain,
+    * and each function need only store a single pointer to describe its
+    * domain.
+    * <p>
+    * Each domain counts the functions that refer to it, and is reclaimed
+    * once the last of them is destroyed or assigned a different domain, so
+    * the table only holds domains that are still in use. The empty domain
+    * is never counted or reclaimed.
+    * </p>
+    * <p>
+    * It is safe to intern and release domains from multiple threads
+    * concurrently. Finding a domain that is already interned never takes
+    * a lock: the table is split into shards, each searched without locking,
+    * and a lock on one shard is only taken to insert a new domain or remove
+    * an unused one. Removed domains are freed once no thread can still be
+    * searching them.
+    * </p>
+    * @see maxsum::sameDomain
+    */
+   class Domain
+   {
+   public:
+
+      /**
+       * Type of list used to store variable ids.
+       */
+      typedef std::vector<VarID> VarVec;
+
+      /**
+       * Type of list used to store variable sizes and strides.
+       */
+      typedef std::vector<ValIndex> SizeVec;
+
+   private:
+
+      /**
+       * Sorted list of the variables in this domain.
+       */
+      VarVec vars_i;
+
+      /**
+       * Registered domain size of each variable in this domain.
+       */
+      SizeVec size_i;
+
+      /**
+       * Linear index increment for each variable in this domain, in the
+       * column-major value array of a function with this domain.
+       */
+      SizeVec stride_i;
+
+      /**
+       * Product of the domain sizes of all variables in this domain.
+       */
+      ValIndex totalSize_i;
+
+      /**
+       * Hash of the variables in this domain.
+       */
+      std::size_t hash_i;
+
+      /**
+       * Number of functions that refer to this domain.
+       */
+      mutable std::atomic<long> refs_i;
+
+      /**
+       * View of a sorted list of unique variables, which lets the intern
+       * table search for a list given by any iterator type without first
+       * copying it.
+       */
+      class SortedVars
+      {
+      public:
+
+         /**
+          * Number of variables in the list.
+          */
+         std::size_t size;
+
+         /**
+          * Hash of the list, as returned by Domain::hash.
+          */
+         std::size_t hash;
+
+         /**
+          * Returns true if the list is equal to <code>vars</code>.
+          */
+         virtual bool equals(const VarVec& vars) const = 0;
+
+         /**
+          * Copies the list into <code>vars</code>.
+          */
+         virtual void copyTo(VarVec& vars) const = 0;
+
+      protected:
+
+         /**
+          * Protected destructor, since views are never owned by pointer.
+          */
+         ~SortedVars() {}
+
+      }; // class SortedVars
+
+      /**
+       * View of a sorted list of unique variables given by forward
+       * iterators.
+       */
+      template<class VarIt> class SortedRange : public SortedVars
+      {
+      public:
+
+         /**
+          * Constructs a view of a list, which must outlive it.
+          */
+         SortedRange(VarIt begin, VarIt end, std::size_t siz,
+               std::size_t key) : begin_i(begin), end_i(end)
+         {
+            size = siz;
+            hash = key;
+         }
+
+         bool equals(const VarVec& vars) const
+         {
+            return (vars.size()==size) &&
+               std::equal(vars.begin(),vars.end(),begin_i);
+         }
+
+         void copyTo(VarVec& vars) const
+         {
+            vars.assign(begin_i,end_i);
+         }
+
+      private:
+
+         VarIt begin_i;
+         VarIt end_i;
+
+      }; // class SortedRange
+
+      /**
+       * Number of variables that Domain::intern can sort without allocating
+       * memory, if they are not already sorted.
+       */
+      static const std::size_t MAX_STACK_VARS = 16;
+
+      /**
+       * Constructs the empty domain, which depends on no variables.
+       */
+      Domain() : vars_i(), size_i(), stride_i(), totalSize_i(1), hash_i(0),
+         refs_i(1) {}
+
+      /**
+       * Constructs a domain over a sorted list of unique variables, with a
+       * single reference.
+       * @throws UnknownVariableException if any variable is not registered.
+       */
+      explicit Domain(const SortedVars& vars);
+
+      /**
+       * Returns the shared domain for a sorted list of unique variables,
+       * with a new reference held by the caller.
+       * @throws UnknownVariableException if any variable is not registered.
+       */
+      static const Domain* internSorted(const SortedVars& vars);
+
+      /**
+       * Returns the shared domain for a sorted list of unique variables,
+       * with a new reference held by the caller.
+       * @throws UnknownVariableException if any variable is not registered.
+       */
+      template<class VarIt>
+         static const Domain* internSorted(VarIt begin, VarIt end)
+      {
+         std::size_t siz = 0;
+         std::size_t key = 0;
+         for(VarIt it=begin; it!=end; ++it, ++siz)
+         {
+            key = hashStep(key,*it);
+         }
+         return internSorted(SortedRange<VarIt>(begin,end,siz,
+                  hashFinish(key,siz)));
+      }
+
+      /**
+       * Adds one variable to a partially computed hash.
+       */
+      static std::size_t hashStep(std::size_t key, VarID var)
+      {
+         return key ^ (static_cast<std::size_t>(var) + 0x9e3779b9 +
+               (key << 6) + (key >> 2));
+      }
+
+      /**
+       * Completes a hash of the specified number of variables.
+       */
+      static std::size_t hashFinish(std::size_t key, std::size_t siz)
+      {
+         return hashStep(key,static_cast<VarID>(siz));
+      }
+
+      /**
+       * Removes an unreferenced domain from the intern table, and frees it
+       * once no thread can still be searching it.
+       */
+      static void reclaim(const Domain* pDomain);
+
+      // Domains are immutable and shared, so are never copied.
+      Domain(const Domain&);
+      Domain& operator=(const Domain&);
+
+   public:
+
+      /**
+       * Increments the reference count, unless it has already fallen to
+       * zero, in which case this domain is about to be reclaimed.
+       * @returns true if the reference was added.
+       */
+      bool tryAddRef() const
+      {
+         long refs = refs_i.load(std::memory_order_relaxed);
+         while(0<refs)
+         {
+            if(refs_i.compare_exchange_weak(refs,refs+1,
+                     std::memory_order_acquire,std::memory_order_relaxed))
+            {
+               return true;
+            }
+         }
+         return false;
+      }
+
+      /**
+       * Returns the hash value used to intern a sorted list of variables.
+       */
+      static std::size_t hash(const VarID* begin, const VarID* end)
+      {
+         std::size_t key = 0;
+         for(const VarID* pVar=begin; pVar!=end; ++pVar)
+         {
+            key = hashStep(key,*pVar);
+         }
+         return hashFinish(key,end-begin);
+      }
+
+      /**
+       * Returns the number of domains currently interned, not counting the
+       * empty domain.
+       */
+      static std::size_t noInterned();
+
+      /**
+       * Returns the shared empty domain, which depends on no variables.
+       */
+      static const Domain* empty()
+      {
+         static const Domain emptyDomain;
+         return &emptyDomain;
+      }
+
+      /**
+       * Returns the shared domain for a list of variables, with a new
+       * reference that the caller must eventually pass to Domain::release.
+       * The list need not be sorted, and any duplicates are ignored. If it
+       * is already sorted and unique, as is usual, then the domain is found
+       * directly from the iterators. Otherwise, the list is first sorted in
+       * a copy, which is only allocated on the heap if it has more than
+       * MAX_STACK_VARS variables.
+       * @param[in] begin forward iterator to the start of the variable list.
+       * @param[in] end forward iterator to the end of the variable list.
+       * @throws UnknownVariableException if any variable in the list is not
+       * registered.
+       */
+      template<class VarIt> static const Domain* intern(VarIt begin, VarIt end)
+      {
+         if(begin==end)
+         {
+            return empty();
+         }
+
+         //*********************************************************************
+         // Check whether the list is already sorted and unique.
+         //*********************************************************************
+         std::size_t siz = 1;
+         VarIt prev = begin;
+         VarIt it = begin;
+         for(++it; it!=end; ++it, ++prev, ++siz)
+         {
+            if(!(*prev < *it))
+            {
+               break;
+            }
+         }
+         if(it==end)
+         {
+            return internSorted(begin,end);
+         }
+
+         //*********************************************************************
+         // Otherwise, sort and remove duplicates from a copy.
+         //*********************************************************************
+         for(; it!=end; ++it)
+         {
+            ++siz;
+         }
+         VarID stackVars[MAX_STACK_VARS];
+         VarVec heapVars;
+         VarID* pVars = stackVars;
+         if(MAX_STACK_VARS < siz)
+         {
+            heapVars.resize(siz);
+            pVars = heapVars.data();
+         }
+         std::copy(begin,end,pVars);
+         std::sort(pVars,pVars+siz);
+         VarID* pEnd = std::unique(pVars,pVars+siz);
+         return internSorted(static_cast<const VarID*>(pVars),
+               static_cast<const VarID*>(pEnd));
+      }
+
+      /**
+       * Returns the shared domain for a single variable, with a new
+       * reference that the caller must eventually pass to Domain::release.
+       * @throws UnknownVariableException if the variable is not registered.
+       */
+      static const Domain* intern(VarID var)
+      {
+         return internSorted(&var,&var+1);
+      }
+
+      /**
+       * Adds a reference to a domain that is already referenced by the
+       * caller, for example when copying a function.
+       */
+      static const Domain* addRef(const Domain* pDomain)
+      {
+         if(0!=pDomain->noVars())
+         {
+            pDomain->refs_i.fetch_add(1,std::memory_order_relaxed);
+         }
+         return pDomain;
+      }
+
+      /**
+       * Removes a reference to a domain, reclaiming it if no other
+       * references remain.
+       */
+      static void release(const Domain* pDomain)
+      {
+         if( (0!=pDomain->noVars()) &&
+             (1==pDomain->refs_i.fetch_sub(1,std::memory_order_acq_rel)) )
+         {
+            reclaim(pDomain);
+         }
+      }
+
+      /**
+       * Returns the sorted list of variables in this domain.
+       */
+      const VarVec& vars() const { return vars_i; }
+
+      /**
+       * Returns the registered size of each variable in this domain.
+       */
+      const SizeVec& sizes() const { return size_i; }
+
+      /**
+       * Returns the column-major stride of each variable in this domain.
+       */
+      const SizeVec& strides() const { return stride_i; }
+
+      /**
+       * Returns the number of variables in this domain.
+       */
+      int noVars() const { return vars_i.size(); }
+
+      /**
+       * Returns the number of values in a function with this domain.
+       */
+      ValIndex totalSize() const { return totalSize_i; }
+
+      /**
+       * Returns the hash of the variables in this domain.
+       */
+      std::size_t hash() const { return hash_i; }
+
+   }; // class Domain
+
+} // namespace util
+} // namespace maxsum
+
+#endif // MAXSUM_UTIL_DOMAIN_H
@@ -10,6 +10,7 @@
 #include <algorithm>
 #include <vector>
 #include "common.h"
+#include "MarginalPlan.h"
 #include "register.h"
 
 namespace maxsum
@@ -21,6 +22,14 @@ namespace maxsum
    /**
     * This class provides methods for iterating over the Cartesian product for
     * a set of variable domains.
+    * <p>
+    * The stride of each variable in the linear index is computed once, when
+    * the domain is set, and the positions of the free (unconditioned)
+    * variables are kept in a fixed size array, so each increment only
+    * visits the free variables that actually change, and updates the linear
+    * index by their strides. Once constructed, an iterator never allocates
+    * memory, except when variables are added to its domain.
+    * </p>
     */
    class DomainIterator
    {
@@ -69,16 +78,32 @@ namespace maxsum
       ValIndex ind_i;
 
       /**
-       * Set of flags indicating which variables to iterate.
-       * If fixed_i[k] is true, then DomainIterator::operator++ will not change
-       * the value of subInd_i[k]
+       * Cache of domain sizes for each variable.
        */
-      std::vector<bool> fixed_i;
+      IndList sizes_i;
 
       /**
-       * Cache of domain sizes for each variable.
+       * Linear index increment for each variable in vars_i.
        */
-      IndList sizes_i;
+      ValIndex strides_i[util::MAX_DOMAIN_DIMS];
+
+      /**
+       * Positions in vars_i of the free variables, in increasing order.
+       * DomainIterator::operator++ only changes the sub indices of these
+       * variables.
+       */
+      int free_i[util::MAX_DOMAIN_DIMS];
+
+      /**
+       * Positions in vars_i of the conditioned variables, in increasing
+       * order.
+       */
+      int fixed_i[util::MAX_DOMAIN_DIMS];
+
+      /**
+       * The number of free variables.
+       */
+      int noFree_i;
 
       /**
        * This flag is set to finished when we have iterated over the last
@@ -95,8 +120,8 @@ namespace maxsum
        * DomainIterator::getSubInd() will return empty lists, and
        * DomainIterator::operator++() will throw an exception.
        */
-      DomainIterator() : vars_i(), subInd_i(), ind_i(0), fixed_i(),
-                         sizes_i(), finished_i(false) {}
+      DomainIterator() : vars_i(), subInd_i(), ind_i(0), sizes_i(),
+                         noFree_i(0), finished_i(false) {}
 
       /**
        * Construct Domain iterator with initial list of variables.
@@ -108,8 +133,8 @@ namespace maxsum
          : vars_i(begin,end),        // copy variables
            subInd_i(end-begin,0),    // set all subindices to zero
            ind_i(0),                 // set linear index to zero
-           fixed_i(end-begin,false), // all variables are initially free
            sizes_i(end-begin,0),     // allocate space for variable sizes
+           noFree_i(0),              // set by initStrides
            finished_i(false)         // iterator is not done yet
       {
          //*********************************************************************
@@ -119,12 +144,14 @@ namespace maxsum
 
          //*********************************************************************
          // Most of the work here is done by the initialiser list.
-         // All we have to do now is populate the size array.
+         // All we have to do now is populate the size array, and the
+         // strides of each variable, which are all initially free.
          //*********************************************************************
          for(int k=0; k<vars_i.size(); ++k)
          {
             sizes_i[k] = getDomainSize(vars_i[k]);
          }
+         initStrides();
 
       } // constructor
 
@@ -145,6 +172,44 @@ namespace maxsum
        */
       DomainIterator& operator=(const DomainIterator& it);
 
+   private:
+
+      /**
+       * Computes the stride of each variable from sizes_i, and marks every
+       * variable as free.
+       */
+      void initStrides();
+
+      /**
+       * Marks the variable at the specified position in vars_i as
+       * conditioned, if it is not already.
+       */
+      void fix(int position);
+
+      /**
+       * Sets every free sub index back to zero, and recomputes the linear
+       * index from the conditioned sub indices.
+       * @post DomainIterator::hasNext() returns true.
+       */
+      void restart();
+
+      /**
+       * Returns the position of the specified variable in vars_i, or -1 if
+       * it is not in this iterator's domain.
+       */
+      int position(VarID var) const
+      {
+         VarList::const_iterator pos =
+            std::lower_bound(vars_i.begin(),vars_i.end(),var);
+         if( (vars_i.end()==pos) || (var!=*pos) )
+         {
+            return -1;
+         }
+         return pos - vars_i.begin();
+      }
+
+   public:
+
       /**
        * Returns true if next call to DomainIterator::operator++() will not
        * throw an exception.
@@ -189,7 +254,7 @@ namespace maxsum
       /**
        * Returns the number of conditioned variables for this function.
        */
-      int fixedCount() const;
+      int fixedCount() const { return vars_i.size() - noFree_i; }
 
       /**
        * Add the specified variables to the domain of this iterator.
@@ -220,13 +285,16 @@ namespace maxsum
          newVars.resize(newEnd-newVars.begin());
 
          //*********************************************************************
-         // Expand the indice, fixed and size arrays with initial values for
-         // all new variables.
+         // Expand the indice and size arrays with initial values for all new
+         // variables, keeping the values of conditioned variables.
          //*********************************************************************
          int pos = 0; // position in old variable list
+         int noFixed = fixedCount();
+         int fixedPos = 0; // position in old conditioned variable list
          std::vector<ValIndex> newSizes(newVars.size());
          std::vector<ValIndex> newSubInd(newVars.size());
-         std::vector<bool> newFixed(newVars.size());
+         std::vector<int> newFixed;
+         newFixed.reserve(noFixed);
 
          for(int k=0; k<newVars.size(); k++)
          {
@@ -237,8 +305,13 @@ namespace maxsum
             if( (pos<vars_i.size()) && (vars_i[pos] == newVars[k]) )
             {
                newSizes[k] = sizes_i[pos];
-               newSubInd[k] = subInd_i[pos];
-               newFixed[k] = fixed_i[pos];
+               newSubInd[k] = 0;
+               if( (fixedPos<noFixed) && (fixed_i[fixedPos]==pos) )
+               {
+                  newSubInd[k] = subInd_i[pos];
+                  newFixed.push_back(k);
+                  ++fixedPos;
+               }
                ++pos;
             }
             //******************************************************************
@@ -248,31 +321,29 @@ namespace maxsum
             {
                newSizes[k] = getDomainSize(newVars[k]);
                newSubInd[k] = 0;
-               newFixed[k] = false;
             }
 
          } // for loop
 
          //*********************************************************************
-         // Set the linear index to its appropriate value based on the
-         // updated subindices and sizes.
+         // Swap in the new variable list, and recompute the strides.
          //*********************************************************************
-         ind_i = sub2ind( sizes_i.begin(),  sizes_i.end(),
-                         subInd_i.begin(), subInd_i.end() );
+         vars_i.swap(newVars);
+         sizes_i.swap(newSizes);
+         subInd_i.swap(newSubInd);
+         initStrides();
+         for(std::vector<int>::const_iterator it=newFixed.begin();
+               it!=newFixed.end(); ++it)
+         {
+            fix(*it);
+         }
 
          //*********************************************************************
          // Since we've returned to the first element in the free part of the
-         // domain, DomainIterator::hasNext() should return true.
+         // domain, DomainIterator::hasNext() should return true, and the
+         // linear index is set from the conditioned variables.
          //*********************************************************************
-         finished_i = false;
-
-         //*********************************************************************
-         // Finally, we swap in the new variable list.
-         //*********************************************************************
-         vars_i.swap(newVars);
-         sizes_i.swap(newSizes);
-         subInd_i.swap(newSubInd);
-         fixed_i.swap(newFixed);
+         restart();
 
       } // function addVars
 
@@ -338,14 +409,11 @@ namespace maxsum
             // If the current variable is in our domain, condition its value
             // as specified.
             //******************************************************************
-            std::vector<VarID>::const_iterator pMyVar =
-               find(vars_i.begin(),vars_i.end(),*pInVar);
-
-            if(vars_i.end() != pMyVar)
+            const int pos = position(*pInVar);
+            if(0<=pos)
             {
-               int position = pMyVar - vars_i.begin();
-                fixed_i[position] = true;
-               subInd_i[position] = *pInd;
+               fix(pos);
+               subInd_i[pos] = *pInd;
             }
 
             //******************************************************************
@@ -357,31 +425,12 @@ namespace maxsum
          } // loop
 
          //*********************************************************************
-         // Set free indices back to zero. (This is a much easier policy to 
-         // implement that trying to pick up were we left off.)
-         //*********************************************************************
-         for(int k=0; k<subInd_i.size(); ++k)
-         {
-            if(!fixed_i[k])
-            {
-               subInd_i[k]=0;
-            }
-         }
-
-         //*********************************************************************
-         // Since the free variables have been reset, the iterator is not
-         // finished. Notice, even if there are now free variables, we
-         // still intend to return the conditioned values at least once before
-         // finishing.
-         //*********************************************************************
-         finished_i = false;
-
-         //*********************************************************************
-         // Set the linear index to its apropriate value, based on the
-         // conditioned variables.
+         // Set free indices back to zero. (This is a much easier policy to
+         // implement that trying to pick up were we left off.) Notice, even
+         // if there are now no free variables, we still intend to return the
+         // conditioned values at least once before finishing.
          //*********************************************************************
-         ind_i = sub2ind( sizes_i.begin(),  sizes_i.end(),
-                         subInd_i.begin(), subInd_i.end() );
+         restart();
 
       } // function condition
 
@@ -407,7 +456,6 @@ namespace maxsum
          // Set the specified conditions for any variables that are in
          // this domain.
          //*********************************************************************
-         std::vector<VarID>::const_iterator pMyVar = vars_i.begin();
          for(typename VarMap::const_iterator it=vars.begin();
                it!=vars.end(); ++it)
          {
@@ -415,43 +463,19 @@ namespace maxsum
             // If the current variable is in our domain, condition its value
             // as specified.
             //******************************************************************
-            pMyVar = find(vars_i.begin(),vars_i.end(),it->first);
-
-            if(vars_i.end() != pMyVar)
-            {
-               int position = pMyVar - vars_i.begin();
-                fixed_i[position] = true;
-               subInd_i[position] = it->second;
-            }
-            
-         } // loop
-
-         //*********************************************************************
-         // Set free indices back to zero. (This is a much easier policy to 
-         // implement that trying to pick up were we left off.)
-         //*********************************************************************
-         for(int k=0; k<subInd_i.size(); ++k)
-         {
-            if(!fixed_i[k])
+            const int pos = position(it->first);
+            if(0<=pos)
             {
-               subInd_i[k]=0;
+               fix(pos);
+               subInd_i[pos] = it->second;
             }
-         }
 
-         //*********************************************************************
-         // Since the free variables have been reset, the iterator is not
-         // finished. Notice, even if there are now free variables, we
-         // still intend to return the conditioned values at least once before
-         // finishing.
-         //*********************************************************************
-         finished_i = false;
+         } // loop
 
          //*********************************************************************
-         // Set the linear index to its apropriate value, based on the
-         // conditioned variables.
+         // Set free indices back to zero, and start iterating again.
          //*********************************************************************
-         ind_i = sub2ind( sizes_i.begin(),  sizes_i.end(),
-                         subInd_i.begin(), subInd_i.end() );
+         restart();
 
       } // function condition
 
@@ -468,6 +492,36 @@ namespace maxsum
        */
       void condition(const DomainIterator& it);
 
+      /**
+       * Moves this iterator to a different set of values for its
+       * conditioned variables, without searching for them again. This is
+       * useful for loops such as marginalisation, in which the same
+       * variables are conditioned on each value of an output function.
+       * <pre>
+       * DomainIterator in(inFun);
+       * for(DomainIterator out(outFun); out.hasNext(); ++out)
+       * {
+       *    in.rebind(out.getSubInd().begin(),out.getSubInd().end());
+       *    ...
+       * }
+       * </pre>
+       * @pre indBegin and indEnd specify one value for each conditioned
+       * variable, in increasing order of variable id.
+       * @post All free indices are set back to 0, and
+       * DomainIterator::hasNext() returns true.
+       * @param[in] indBegin iterator to start of value list.
+       * @param[in] indEnd iterator to end of value list.
+       */
+      template<class IndIt> void rebind(IndIt indBegin, IndIt indEnd)
+      {
+         const int noFixed = fixedCount();
+         for(int k=0; (k<noFixed) && (indEnd!=indBegin); ++k, ++indBegin)
+         {
+            subInd_i[fixed_i[k]] = *indBegin;
+         }
+         restart();
+      }
+
    }; // class DomainIterator
 
 } // namespace maxsum
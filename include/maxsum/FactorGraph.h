@@ -0,0 +1,643 @@
+/**
+ * @file FactorGraph.h
+ * Defines the maxsum::util::FactorGraph class, which is the compiled form of
+ * the factor graph used by maxsum::MaxSumController to pass messages.
+ * @attention The types defined in this header are not intended to form part
+ * of the public interface to the maxsum library.
+ */
+#ifndef MAXSUM_UTIL_FACTOR_GRAPH_H
+#define MAXSUM_UTIL_FACTOR_GRAPH_H
+
+#include <map>
+#include <memory>
+#include <vector>
+#include "common.h"
+#include "DiscreteFunction.h"
+#include "ImplicitFactor.h"
+
+namespace maxsum
+{
+namespace util
+{
+   /**
+    * Set of nodes that need to recheck their mail, identified by their
+    * position in a maxsum::util::FactorGraph. Unlike the std::queue used by
+    * maxsum::util::PostOffice, each node appears at most once, no matter how
+    * many times it is notified.
+    */
+   class NoticeList
+   {
+   private:
+
+      /**
+       * Nonzero for each node that is currently in the pending list.
+       */
+      std::vector<char> flags_i;
+
+      /**
+       * Nodes that currently have new mail, in order of notification.
+       */
+      std::vector<int> pending_i;
+
+   public:
+
+      /**
+       * Removes all notices, and sets the number of nodes to <code>n</code>.
+       * Enough storage is reserved to notify every node, so that
+       * NoticeList::notify and NoticeList::notifyAll never allocate memory.
+       */
+      void reset(int n)
+      {
+         flags_i.assign(n,0);
+         pending_i.clear();
+         pending_i.reserve(n);
+      }
+
+      /**
+       * Returns the number of nodes covered by this list.
+       */
+      int size() const { return flags_i.size(); }
+
+      /**
+       * Returns the number of nodes that currently have new mail.
+       */
+      int count() const { return pending_i.size(); }
+
+      /**
+       * Returns true if the specified node currently has new mail.
+       */
+      bool isPending(int k) const { return 0!=flags_i[k]; }
+
+      /**
+       * Tells the specified node that it has new mail.
+       */
+      void notify(int k)
+      {
+         if(0==flags_i[k])
+         {
+            flags_i[k] = 1;
+            pending_i.push_back(k);
+         }
+      }
+
+      /**
+       * Tells every node that it has new mail.
+       */
+      void notifyAll()
+      {
+         pending_i.resize(flags_i.size());
+         for(int k=0; k<static_cast<int>(flags_i.size()); ++k)
+         {
+            flags_i[k] = 1;
+            pending_i[k] = k;
+         }
+      }
+
+      /**
+       * Moves all pending notices into <code>out</code>, so that this list
+       * is left empty. Any previous contents of <code>out</code> are
+       * destroyed, but its storage is reused where possible.
+       * @pre to avoid allocating memory, <code>out</code> should have
+       * capacity for at least NoticeList::size elements.
+       */
+      void take(std::vector<int>& out)
+      {
+         out.clear();
+         out.reserve(flags_i.size());
+         out.swap(pending_i);
+         for(std::vector<int>::const_iterator it=out.begin();
+               it!=out.end(); ++it)
+         {
+            flags_i[*it] = 0;
+         }
+      }
+
+      /**
+       * Returns the number of bytes of heap storage reserved by this list.
+       */
+      std::size_t bytesUsed() const
+      {
+         return flags_i.capacity()*sizeof(char)
+            + pending_i.capacity()*sizeof(int);
+      }
+
+      /**
+       * Swaps the contents of this list with another.
+       */
+      void swap(NoticeList& rhs) noexcept
+      {
+         flags_i.swap(rhs.flags_i);
+         pending_i.swap(rhs.pending_i);
+      }
+
+   }; // class NoticeList
+
+   /**
+    * Compiled, read-mostly representation of a factor graph and the
+    * messages passed along its edges.
+    *
+    * Factors, variables and edges are each identified by a contiguous
+    * index, assigned in increasing order of maxsum::FactorID and
+    * maxsum::VarID, unless the graph is reordered when compiled (see
+    * FactorGraph::setReordering). Adjacency is stored in compressed sparse
+    * row (CSR) form: the edges of factor <code>f</code> are exactly the edge
+    * indices in [factorEdgeBegin(f),factorEdgeEnd(f)), in the same order as
+    * the factor's domain, while the edges of each variable are listed in
+    * increasing order of factor.
+    *
+    * Every edge carries one factor to variable message, and one variable to
+    * factor message, both of which are identified by the edge index, so
+    * the reverse of any message is found in constant time. The values of
+    * all messages sent in each direction are packed into a single
+    * contiguous array.
+    *
+    * A maxsum::util::FactorGraph refers to, but does not own, the functions
+    * and values stored by the maps from which it is compiled, so it must be
+    * recompiled whenever any element is added to or removed from these maps.
+    */
+   class FactorGraph
+   {
+   public:
+
+      /**
+       * Type of container used to map factors to their defining functions.
+       */
+      typedef std::map<FactorID,DiscreteFunction> FactorMap;
+
+      /**
+       * Type of container used to map factors to their implicit definitions.
+       */
+      typedef std::map<FactorID,std::shared_ptr<const ImplicitFactor> >
+         ImplicitMap;
+
+      /**
+       * Type of container used to map variables to their assigned values.
+       */
+      typedef std::map<VarID,ValIndex> ValueMap;
+
+   private:
+
+      /**
+       * Unique identifier for each factor, in increasing order unless this
+       * graph is reordered.
+       */
+      std::vector<FactorID> factorIds_i;
+
+      /**
+       * The function associated with each factor, or 0 for implicit factors.
+       */
+      std::vector<const DiscreteFunction*> factors_i;
+
+      /**
+       * The definition of each implicit factor, or 0 for factor tables.
+       */
+      std::vector<const ImplicitFactor*> implicit_i;
+
+      /**
+       * The total value of each factor, or 0 for implicit factors.
+       */
+      std::vector<DiscreteFunction*> totals_i;
+
+      /**
+       * Index of the first edge belonging to each factor, followed by the
+       * total number of edges.
+       */
+      std::vector<int> factorEdges_i;
+
+      /**
+       * The shape of each factor. Factor tables have the same shape if and
+       * only if their domains have the same sizes in the same order, so
+       * that they can be updated by the same batched kernel. Implicit
+       * factors have shapes of their own.
+       */
+      std::vector<int> factorShape_i;
+
+      /**
+       * Unique identifier for each variable, in increasing order unless
+       * this graph is reordered.
+       */
+      std::vector<VarID> varIds_i;
+
+      /**
+       * The value currently assigned to each variable.
+       */
+      std::vector<ValIndex*> values_i;
+
+      /**
+       * Domain size for each variable.
+       */
+      std::vector<ValIndex> varSizes_i;
+
+      /**
+       * Position in varEdges_i of the first edge belonging to each variable,
+       * followed by the total number of edges.
+       */
+      std::vector<int> varEdgeStart_i;
+
+      /**
+       * Edge indices grouped by variable.
+       */
+      std::vector<int> varEdges_i;
+
+      /**
+       * The factor at one end of each edge.
+       */
+      std::vector<int> edgeFactor_i;
+
+      /**
+       * The variable at the other end of each edge.
+       */
+      std::vector<int> edgeVar_i;
+
+      /**
+       * Stride of each edge's variable in its factor's value array, or 0
+       * for the edges of implicit factors.
+       */
+      std::vector<ValIndex> edgeStride_i;
+
+      /**
+       * Offset of each edge's messages in the message arrays, followed by
+       * the total length of these arrays.
+       */
+      std::vector<int> msgOffset_i;
+
+      /**
+       * Values of all factor to variable messages.
+       */
+      std::vector<ValType> fac2var_i;
+
+      /**
+       * Values of all variable to factor messages.
+       */
+      std::vector<ValType> var2fac_i;
+
+      /**
+       * Factors that need to update their output messages.
+       */
+      NoticeList factorNotices_i;
+
+      /**
+       * Variables that need to update their output messages.
+       */
+      NoticeList varNotices_i;
+
+      /**
+       * The largest domain size of any variable.
+       */
+      ValIndex maxVarSize_i;
+
+      /**
+       * The number of distinct factor shapes.
+       */
+      int noShapes_i;
+
+      /**
+       * The largest number of variables of any implicit factor.
+       */
+      int maxImplicitArity_i;
+
+      /**
+       * The largest total domain size of the variables of any implicit
+       * factor, which is the space needed for all its output messages.
+       */
+      ValIndex maxImplicitLength_i;
+
+      /**
+       * True if FactorGraph::compile renumbers nodes to follow the
+       * structure of the graph.
+       */
+      bool reorder_i;
+
+      /**
+       * The index of each factor, in increasing order of identifier, or
+       * empty if factors are indexed in that order.
+       */
+      std::vector<int> factorsById_i;
+
+      /**
+       * The index of each variable, in increasing order of identifier, or
+       * empty if variables are indexed in that order.
+       */
+      std::vector<int> varsById_i;
+
+      /**
+       * Renumbers the factors and variables of a graph that is being
+       * compiled, so that nodes which are close together in the graph are
+       * also close together in memory.
+       * @pre the nodes and edges of each factor have been added in
+       * increasing order of identifier, but edges have not yet been grouped
+       * by variable.
+       */
+      void reorder();
+
+   public:
+
+      /**
+       * Constructs an empty factor graph.
+       */
+      FactorGraph()
+         : maxVarSize_i(0), noShapes_i(0), maxImplicitArity_i(0),
+           maxImplicitLength_i(0), reorder_i(false)
+      {
+         factorEdges_i.push_back(0);
+         varEdgeStart_i.push_back(0);
+         msgOffset_i.push_back(0);
+      }
+
+      /**
+       * Rebuilds this graph from the specified factors.
+       * Messages along edges that were already in this graph are preserved,
+       * while new edges start with zero messages. Likewise, any pending
+       * notices are preserved for nodes that remain in the graph. Factors
+       * that were not previously in this graph are notified, so that they
+       * send their initial messages.
+       * @param[in] factors the function for each factor stored as a table.
+       * @param[in] implicit each implicit factor, none of which has the
+       * same identifier as a factor in <code>factors</code>.
+       * @param[in,out] totals an entry is created for each factor table, if one
+       * does not already exist, to store its total value. Any entry whose
+       * domain differs from its factor is reset to the factor's value, so
+       * that totals can later be updated in place without allocating memory.
+       * @param[in,out] values the value of every variable in the domain of at
+       * least one factor.
+       * @pre <code>values</code> contains exactly the variables in the union
+       * of the factors' domains.
+       */
+      void compile(const FactorMap& factors, const ImplicitMap& implicit,
+            FactorMap& totals, ValueMap& values)
+      {
+         FactorGraph spare;
+         compile(factors,implicit,totals,values,spare);
+      }
+
+      /**
+       * Rebuilds this graph from the specified factors, reusing the storage
+       * of another graph, so that recompiling a graph whose size has not
+       * grown does not allocate memory for its arrays or messages.
+       * @param[in,out] spare any graph other than this one, whose contents
+       * are discarded. On return, it holds the storage of the previous
+       * version of this graph, ready to be reused by the next call.
+       * @see FactorGraph::compile(const FactorMap&,const ImplicitMap&,FactorMap&,ValueMap&)
+       */
+      void compile(const FactorMap& factors, const ImplicitMap& implicit,
+            FactorMap& totals, ValueMap& values, FactorGraph& spare);
+
+      /**
+       * Rebuilds this graph from a set of factor tables, with no implicit
+       * factors.
+       * @see FactorGraph::compile(const FactorMap&,const ImplicitMap&,FactorMap&,ValueMap&)
+       */
+      void compile(const FactorMap& factors, FactorMap& totals,
+            ValueMap& values)
+      {
+         compile(factors,ImplicitMap(),totals,values);
+      }
+
+      /**
+       * Removes all nodes, edges, messages and notices from this graph,
+       * and releases its storage.
+       */
+      void clear();
+
+      /**
+       * Removes all nodes, edges, messages and notices from this graph, but
+       * keeps its storage for reuse. The graph is left in the state
+       * expected by FactorGraph::compile for the graph being built, and must
+       * not otherwise be used until it is compiled.
+       */
+      void recycle();
+
+      /**
+       * Returns the number of bytes of heap storage reserved by this graph,
+       * including its messages, but excluding the factors it refers to.
+       */
+      std::size_t bytesUsed() const;
+
+      /**
+       * Swaps the contents of this graph with another.
+       */
+      void swap(FactorGraph& rhs) noexcept;
+
+      /**
+       * Enables or disables reordering. When enabled, each call to
+       * FactorGraph::compile renumbers the nodes of the graph in reverse
+       * Cuthill-McKee order, found by a breadth first search from a node of
+       * least degree in each connected component, which visits neighbours in
+       * increasing order of degree. The edges and messages of neighbouring
+       * nodes are then stored close together, and schedules that update
+       * nodes in order of index visit neighbourhoods in turn. Identifiers
+       * are unchanged, but FactorGraph::findFactor and FactorGraph::findVar
+       * then need one more level of indirection, and compiling allocates
+       * temporary storage.
+       * @param[in] enabled true to reorder nodes from the next compile.
+       */
+      void setReordering(bool enabled) { reorder_i = enabled; }
+
+      /**
+       * Returns true if nodes are reordered when this graph is compiled.
+       */
+      bool isReordering() const { return reorder_i; }
+
+      /**
+       * Returns the index of the factor with the <code>k</code>th smallest
+       * identifier.
+       */
+      int factorById(int k) const
+      {
+         return factorsById_i.empty() ? k : factorsById_i[k];
+      }
+
+      /**
+       * Returns the index of the variable with the <code>k</code>th
+       * smallest identifier.
+       */
+      int varById(int k) const
+      {
+         return varsById_i.empty() ? k : varsById_i[k];
+      }
+
+      /**
+       * Returns the number of factors in this graph.
+       */
+      int noFactors() const { return factorIds_i.size(); }
+
+      /**
+       * Returns the number of variables in this graph.
+       */
+      int noVars() const { return varIds_i.size(); }
+
+      /**
+       * Returns the number of edges in this graph.
+       */
+      int noEdges() const { return edgeVar_i.size(); }
+
+      /**
+       * Returns the total number of values in all factor to variable
+       * messages, which is the same as for variable to factor messages.
+       * Messages are stored contiguously in edge order, starting at
+       * <code>fac2var(0)</code> and <code>var2fac(0)</code> respectively.
+       */
+      int noMsgValues() const { return msgOffset_i.back(); }
+
+      /**
+       * Returns the largest domain size of any variable in this graph.
+       */
+      ValIndex maxVarSize() const { return maxVarSize_i; }
+
+      /**
+       * Returns the largest number of variables of any implicit factor.
+       */
+      int maxImplicitArity() const { return maxImplicitArity_i; }
+
+      /**
+       * Returns the total length of the output messages of the implicit
+       * factor with the most message values.
+       */
+      ValIndex maxImplicitLength() const { return maxImplicitLength_i; }
+
+      /**
+       * Returns the index of the specified factor, or -1 if it is not in
+       * this graph.
+       */
+      int findFactor(FactorID id) const;
+
+      /**
+       * Returns the index of the specified variable, or -1 if it is not in
+       * this graph.
+       */
+      int findVar(VarID id) const;
+
+      /**
+       * Returns the unique identifier of factor <code>f</code>.
+       */
+      FactorID factorId(int f) const { return factorIds_i[f]; }
+
+      /**
+       * Returns the function associated with factor <code>f</code>.
+       * @pre factor <code>f</code> is not implicit.
+       */
+      const DiscreteFunction& factor(int f) const { return *factors_i[f]; }
+
+      /**
+       * Returns the definition of factor <code>f</code> if it is implicit,
+       * or 0 if it is stored as a table.
+       */
+      const ImplicitFactor* implicit(int f) const { return implicit_i[f]; }
+
+      /**
+       * Returns the total value of factor <code>f</code>.
+       * @pre factor <code>f</code> is not implicit.
+       */
+      DiscreteFunction& total(int f) { return *totals_i[f]; }
+
+      /**
+       * Returns the index of the first edge of factor <code>f</code>.
+       */
+      int factorEdgeBegin(int f) const { return factorEdges_i[f]; }
+
+      /**
+       * Returns one past the index of the last edge of factor <code>f</code>.
+       */
+      int factorEdgeEnd(int f) const { return factorEdges_i[f+1]; }
+
+      /**
+       * Returns the shape of factor <code>f</code>, in [0,noShapes()).
+       */
+      int factorShape(int f) const { return factorShape_i[f]; }
+
+      /**
+       * Returns the number of distinct factor shapes.
+       */
+      int noShapes() const { return noShapes_i; }
+
+      /**
+       * Returns the unique identifier of variable <code>v</code>.
+       */
+      VarID varId(int v) const { return varIds_i[v]; }
+
+      /**
+       * Returns the value currently assigned to variable <code>v</code>.
+       */
+      ValIndex& value(int v) { return *values_i[v]; }
+
+      /**
+       * Returns the domain size of variable <code>v</code>.
+       */
+      ValIndex varSize(int v) const { return varSizes_i[v]; }
+
+      /**
+       * Returns the position in the variable edge list of the first edge of
+       * variable <code>v</code>.
+       * @see FactorGraph::varEdge
+       */
+      int varEdgeBegin(int v) const { return varEdgeStart_i[v]; }
+
+      /**
+       * Returns one past the position in the variable edge list of the last
+       * edge of variable <code>v</code>.
+       * @see FactorGraph::varEdge
+       */
+      int varEdgeEnd(int v) const { return varEdgeStart_i[v+1]; }
+
+      /**
+       * Returns the edge at position <code>k</code> in the variable
+       * edge list.
+       */
+      int varEdge(int k) const { return varEdges_i[k]; }
+
+      /**
+       * Returns the factor at one end of edge <code>e</code>.
+       */
+      int edgeFactor(int e) const { return edgeFactor_i[e]; }
+
+      /**
+       * Returns the variable at the other end of edge <code>e</code>.
+       */
+      int edgeVar(int e) const { return edgeVar_i[e]; }
+
+      /**
+       * Returns the stride of edge <code>e</code>'s variable in the value
+       * array of its factor.
+       */
+      ValIndex edgeStride(int e) const { return edgeStride_i[e]; }
+
+      /**
+       * Returns the values of the message sent from factor to variable
+       * along edge <code>e</code>.
+       */
+      ValType* fac2var(int e) { return &fac2var_i[msgOffset_i[e]]; }
+
+      /**
+       * Returns the values of the message sent from factor to variable
+       * along edge <code>e</code>.
+       */
+      const ValType* fac2var(int e) const { return &fac2var_i[msgOffset_i[e]]; }
+
+      /**
+       * Returns the values of the message sent from variable to factor
+       * along edge <code>e</code>.
+       */
+      ValType* var2fac(int e) { return &var2fac_i[msgOffset_i[e]]; }
+
+      /**
+       * Returns the values of the message sent from variable to factor
+       * along edge <code>e</code>.
+       */
+      const ValType* var2fac(int e) const { return &var2fac_i[msgOffset_i[e]]; }
+
+      /**
+       * Returns the set of factors that need to update their messages.
+       */
+      NoticeList& factorNotices() { return factorNotices_i; }
+
+      /**
+       * Returns the set of variables that need to update their messages.
+       */
+      NoticeList& varNotices() { return varNotices_i; }
+
+   }; // class FactorGraph
+
+} // namespace util
+} // namespace maxsum
+
+#endif // MAXSUM_UTIL_FACTOR_GRAPH_H
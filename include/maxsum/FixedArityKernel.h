@@ -0,0 +1,154 @@
+/**
+ * @file FixedArityKernel.h
+ * Defines the maxsum::util::FixedArityKernel class template, which is used
+ * by maxsum::MaxSumController to update factors with few variables.
+ * @attention The types defined in this header are not intended to form part
+ * of the public interface to the maxsum library.
+ */
+#ifndef MAXSUM_UTIL_FIXED_ARITY_KERNEL_H
+#define MAXSUM_UTIL_FIXED_ARITY_KERNEL_H
+
+#include <algorithm>
+#include "common.h"
+
+namespace maxsum
+{
+namespace util
+{
+   /**
+    * Largest number of variables for which a factor is updated using
+    * maxsum::util::FixedArityKernel rather than the generic kernels.
+    */
+   const int MAX_FIXED_ARITY = 3;
+
+   /**
+    * Message update kernel for factors that depend on exactly
+    * <code>Arity</code> variables. Since the number of variables is known
+    * at compile time, all loops over the factor's variables are unrolled,
+    * and the sum of the factor with its input messages is calculated and
+    * max marginalised onto every variable in a single pass.
+    * <p>
+    * The values of the factor are visited in increasing order of linear
+    * index, and each marginal is initialised and aggregated in exactly the
+    * same order as maxsum::maxMarginal, so the results are identical to
+    * those of the generic kernels.
+    * </p>
+    * @tparam Arity the number of variables in the factor's domain.
+    */
+   template<int Arity> class FixedArityKernel
+   {
+   public:
+
+      /**
+       * Calculates the sum of a factor and its input messages, and max
+       * marginalises it onto each variable in the factor's domain.
+       * @param[in] pFactor the factor's value array.
+       * @param[in] pSizes the domain size of each of the factor's variables.
+       * @param[in] ppMsgs the input message for each of the factor's
+       * variables, in the same order as the factor's domain.
+       * @param[out] pTotal the sum of the factor and its input messages.
+       * @param[out] ppOut the max marginal of the sum for each variable.
+       */
+      static void maxMarginals
+      (
+       const ValType* pFactor,
+       const ValIndex* pSizes,
+       const ValType* const* ppMsgs,
+       ValType* pTotal,
+       ValType* const* ppOut
+      )
+      {
+         //*********************************************************************
+         // Initialise each marginal to the first value that contributes to
+         // it, which is where every other variable's subindex is zero.
+         //*********************************************************************
+         ValIndex stride = 1;
+         for(int d=0; d<Arity; ++d)
+         {
+            for(ValIndex j=0; j<pSizes[d]; ++j)
+            {
+               ValType val = pFactor[j*stride];
+               for(int m=0; m<Arity; ++m)
+               {
+                  val += ppMsgs[m][m==d ? j : 0];
+               }
+               ppOut[d][j] = val;
+            }
+            stride *= pSizes[d];
+         }
+
+         //*********************************************************************
+         // Visit every value in linear order. The first variable varies in
+         // the inner loop, while the running maxima for the other variables
+         // only change between runs of the inner loop.
+         //*********************************************************************
+         ValIndex sub[Arity] = {0};
+         ValType cur[Arity];
+         ValType best[Arity];
+         for(int m=1; m<Arity; ++m)
+         {
+            cur[m] = ppMsgs[m][0];
+         }
+
+         const ValType* const pInner = ppMsgs[0];
+         ValType* const pInnerOut = ppOut[0];
+         const ValIndex innerSize = pSizes[0];
+         while(true)
+         {
+            for(int m=1; m<Arity; ++m)
+            {
+               best[m] = ppOut[m][sub[m]];
+            }
+
+            for(ValIndex j=0; j<innerSize; ++j)
+            {
+               ValType val = pFactor[j] + pInner[j];
+               for(int m=1; m<Arity; ++m)
+               {
+                  val += cur[m];
+               }
+               pTotal[j] = val;
+               pInnerOut[j] = std::max(pInnerOut[j],val);
+               for(int m=1; m<Arity; ++m)
+               {
+                  best[m] = std::max(best[m],val);
+               }
+            }
+            pFactor += innerSize;
+            pTotal += innerSize;
+
+            for(int m=1; m<Arity; ++m)
+            {
+               ppOut[m][sub[m]] = best[m];
+            }
+
+            //******************************************************************
+            // Increment the odometer for the outer variables, and stop once
+            // every one has wrapped around.
+            //******************************************************************
+            int m=1;
+            for(; m<Arity; ++m)
+            {
+               if(++sub[m] < pSizes[m])
+               {
+                  cur[m] = ppMsgs[m][sub[m]];
+                  break;
+               }
+               sub[m] = 0;
+               cur[m] = ppMsgs[m][0];
+            }
+            if(Arity==m)
+            {
+               return;
+            }
+
+         } // while loop
+
+      } // maxMarginals
+
+   }; // class FixedArityKernel
+
+} // namespace util
+} // namespace maxsum
+
+#endif // MAXSUM_UTIL_FIXED_ARITY_KERNEL_H
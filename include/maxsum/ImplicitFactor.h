@@ -0,0 +1,154 @@
+/**
+ * @file ImplicitFactor.h
+ * Defines the maxsum::ImplicitFactor class, which is the base class for
+ * factors that are not stored as a full table of values.
+ */
+#ifndef MAXSUM_IMPLICIT_FACTOR_H
+#define MAXSUM_IMPLICIT_FACTOR_H
+
+#include <algorithm>
+#include <vector>
+#include "common.h"
+#include "register.h"
+
+namespace maxsum
+{
+   /**
+    * Base class for factors whose values are defined by a rule, rather
+    * than stored in a table like a maxsum::DiscreteFunction. The number of
+    * values in a maxsum::DiscreteFunction is the product of the domain
+    * sizes of all its variables, which is impractical for factors that
+    * depend on many variables. Many such factors have a simple structure,
+    * however, which lets their max marginals be computed without visiting
+    * every joint assignment.
+    * <p>
+    * Subclasses define the value of the factor for any joint assignment,
+    * and compute the max marginals required by max-sum. An implicit factor
+    * is added to a factor graph using
+    * maxsum::MaxSumController::setImplicitFactor, and is otherwise treated
+    * exactly like any other factor.
+    * </p>
+    * <p>
+    * Implicit factors are immutable once constructed, so they may be
+    * shared between controllers, and used by several threads at once.
+    * </p>
+    * @see maxsum::SparseFactor
+    * @see maxsum::CardinalityFactor
+    * @see maxsum::PottsFactor
+    */
+   class ImplicitFactor
+   {
+   public:
+
+      /**
+       * Type of list used to store variable ids.
+       */
+      typedef std::vector<VarID> VarVec;
+
+      /**
+       * Type of list used to store variable domain sizes.
+       */
+      typedef std::vector<ValIndex> SizeVec;
+
+   private:
+
+      /**
+       * Sorted list of the variables on which this factor depends.
+       */
+      VarVec vars_i;
+
+      /**
+       * Registered domain size of each variable in vars_i.
+       */
+      SizeVec sizes_i;
+
+      // Implicit factors are shared by pointer, so are never copied.
+      ImplicitFactor(const ImplicitFactor&);
+      ImplicitFactor& operator=(const ImplicitFactor&);
+
+   protected:
+
+      /**
+       * Constructs a factor that depends on the specified variables.
+       * The list need not be sorted, and any duplicates are ignored.
+       * @param[in] begin iterator to the start of the variable list.
+       * @param[in] end iterator to the end of the variable list.
+       * @throws UnknownVariableException if any variable in the list is not
+       * registered.
+       */
+      template<class VarIt> ImplicitFactor(VarIt begin, VarIt end)
+         : vars_i(begin,end), sizes_i()
+      {
+         std::sort(vars_i.begin(),vars_i.end());
+         vars_i.erase(std::unique(vars_i.begin(),vars_i.end()),vars_i.end());
+         sizes_i.reserve(vars_i.size());
+         for(VarVec::const_iterator it=vars_i.begin(); it!=vars_i.end(); ++it)
+         {
+            sizes_i.push_back(getDomainSize(*it));
+         }
+      }
+
+      /**
+       * Constructs a factor that depends on the variables in a list.
+       * @param[in] vars the variables, in any order.
+       * @throws UnknownVariableException if any variable in the list is not
+       * registered.
+       */
+      explicit ImplicitFactor(const VarVec& vars)
+         : ImplicitFactor(vars.begin(),vars.end()) {}
+
+   public:
+
+      /**
+       * Virtual destructor for subclasses.
+       */
+      virtual ~ImplicitFactor() {}
+
+      /**
+       * Returns the sorted list of variables on which this factor depends.
+       */
+      const VarVec& vars() const { return vars_i; }
+
+      /**
+       * Returns the domain size of each variable, in the same order as
+       * ImplicitFactor::vars.
+       */
+      const SizeVec& sizes() const { return sizes_i; }
+
+      /**
+       * Returns the number of variables on which this factor depends.
+       */
+      int noVars() const { return vars_i.size(); }
+
+      /**
+       * Returns the value of this factor for a joint assignment.
+       * @param[in] pSubs the value of each variable, in the same order as
+       * ImplicitFactor::vars.
+       */
+      virtual ValType value(const ValIndex* pSubs) const = 0;
+
+      /**
+       * Max marginalises the sum of this factor and one message for each
+       * of its variables onto every variable. For each variable
+       * <code>k</code> and value <code>x</code>, this calculates the
+       * maximum, over all joint assignments in which variable
+       * <code>k</code> takes value <code>x</code>, of the factor's value
+       * plus the value of every variable's message, including that of
+       * variable <code>k</code> itself.
+       * @param[in] ppMsgs the message for each variable, in the same order
+       * as ImplicitFactor::vars.
+       * @param[out] ppOut the max marginal for each variable, in the same
+       * order as ImplicitFactor::vars. Each has the same length as the
+       * variable's domain.
+       */
+      virtual void maxMarginals
+      (
+       const ValType* const* ppMsgs,
+       ValType* const* ppOut
+      ) const = 0;
+
+   }; // class ImplicitFactor
+
+} // namespace maxsum
+
+#endif // MAXSUM_IMPLICIT_FACTOR_H
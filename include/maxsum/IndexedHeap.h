@@ -0,0 +1,216 @@
+/**
+ * @file IndexedHeap.h
+ * Defines the maxsum::util::IndexedHeap class, which is used by
+ * maxsum::MaxSumController to order node updates by priority.
+ * @attention The types defined in this header are not intended to form part
+ * of the public interface to the maxsum library.
+ */
+#ifndef MAXSUM_UTIL_INDEXED_HEAP_H
+#define MAXSUM_UTIL_INDEXED_HEAP_H
+
+#include <cassert>
+#include <vector>
+#include "common.h"
+
+namespace maxsum
+{
+namespace util
+{
+   /**
+    * Binary max-heap of nodes, identified by their index in [0,size()).
+    * Each node appears at most once, and the priority of a node that is
+    * already in the heap can be raised in logarithmic time. Unlike
+    * std::priority_queue, this allows a node to be notified many times
+    * before it is updated, without growing the heap.
+    */
+   class IndexedHeap
+   {
+   private:
+
+      /**
+       * Nodes currently in the heap, in heap order.
+       */
+      std::vector<int> heap_i;
+
+      /**
+       * Position of each node in heap_i, or -1 if it is not in the heap.
+       */
+      std::vector<int> pos_i;
+
+      /**
+       * Current priority of each node in the heap.
+       */
+      std::vector<ValType> priority_i;
+
+      /**
+       * Moves the node at the specified heap position up, until its
+       * parent has at least the same priority.
+       */
+      void siftUp(int i)
+      {
+         const int k = heap_i[i];
+         while(0<i)
+         {
+            const int parent = (i-1)/2;
+            if(!(priority_i[heap_i[parent]] < priority_i[k]))
+            {
+               break;
+            }
+            heap_i[i] = heap_i[parent];
+            pos_i[heap_i[i]] = i;
+            i = parent;
+         }
+         heap_i[i] = k;
+         pos_i[k] = i;
+      }
+
+      /**
+       * Moves the node at the specified heap position down, until neither
+       * of its children has a higher priority.
+       */
+      void siftDown(int i)
+      {
+         const int k = heap_i[i];
+         const int n = heap_i.size();
+         while(true)
+         {
+            int child = 2*i+1;
+            if(child>=n)
+            {
+               break;
+            }
+            if( (child+1<n) &&
+                (priority_i[heap_i[child]] < priority_i[heap_i[child+1]]) )
+            {
+               ++child;
+            }
+            if(!(priority_i[k] < priority_i[heap_i[child]]))
+            {
+               break;
+            }
+            heap_i[i] = heap_i[child];
+            pos_i[heap_i[i]] = i;
+            i = child;
+         }
+         heap_i[i] = k;
+         pos_i[k] = i;
+      }
+
+   public:
+
+      /**
+       * Removes all nodes, and sets the number of nodes to <code>n</code>.
+       * Enough storage is reserved to hold every node, so that no further
+       * memory is allocated until the next call to reset.
+       */
+      void reset(int n)
+      {
+         heap_i.clear();
+         heap_i.reserve(n);
+         pos_i.assign(n,-1);
+         priority_i.assign(n,0);
+      }
+
+      /**
+       * Returns the number of nodes covered by this heap.
+       */
+      int size() const { return pos_i.size(); }
+
+      /**
+       * Returns true if no nodes are currently in the heap.
+       */
+      bool empty() const { return heap_i.empty(); }
+
+      /**
+       * Returns the number of nodes currently in the heap.
+       */
+      int count() const { return heap_i.size(); }
+
+      /**
+       * Returns true if the specified node is currently in the heap.
+       */
+      bool contains(int k) const { return 0<=pos_i[k]; }
+
+      /**
+       * Returns the priority of a node that is currently in the heap.
+       */
+      ValType priority(int k) const
+      {
+         assert(contains(k));
+         return priority_i[k];
+      }
+
+      /**
+       * Returns the node with the highest priority.
+       * @pre the heap is not empty.
+       */
+      int top() const
+      {
+         assert(!empty());
+         return heap_i[0];
+      }
+
+      /**
+       * Inserts a node with the specified priority or, if it is already in
+       * the heap, raises its priority to <code>priority</code> if that is
+       * higher than its current priority.
+       */
+      void raise(int k, ValType priority)
+      {
+         if(!contains(k))
+         {
+            priority_i[k] = priority;
+            heap_i.push_back(k);
+            siftUp(heap_i.size()-1);
+         }
+         else if(priority_i[k] < priority)
+         {
+            priority_i[k] = priority;
+            siftUp(pos_i[k]);
+         }
+      }
+
+      /**
+       * Removes and returns the node with the highest priority.
+       * @pre the heap is not empty.
+       */
+      int pop()
+      {
+         assert(!empty());
+         const int result = heap_i[0];
+         pos_i[result] = -1;
+         const int last = heap_i.back();
+         heap_i.pop_back();
+         if(!heap_i.empty())
+         {
+            heap_i[0] = last;
+            siftDown(0);
+         }
+         return result;
+      }
+
+      /**
+       * Returns the number of bytes of heap storage reserved by this heap.
+       */
+      std::size_t bytesUsed() const
+      {
+         return heap_i.capacity()*sizeof(int) + pos_i.capacity()*sizeof(int)
+            + priority_i.capacity()*sizeof(ValType);
+      }
+
+      /**
+       * Swaps the contents of this heap with another.
+       */
+      void swap(IndexedHeap& rhs) noexcept
+      {
+         heap_i.swap(rhs.heap_i);
+         pos_i.swap(rhs.pos_i);
+         priority_i.swap(rhs.priority_i);
+      }
+
+   }; // class IndexedHeap
+
+} // namespace util
+} // namespace maxsum
+
+#endif // MAXSUM_UTIL_INDEXED_HEAP_H
@@ -0,0 +1,150 @@
+/**
+ * @file LocalTransport.h
+ * Defines the maxsum::LocalTransport class, which connects partitions that
+ * run in different threads of the same process.
+ */
+#ifndef MAXSUM_LOCAL_TRANSPORT_H
+#define MAXSUM_LOCAL_TRANSPORT_H
+
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+#include "PartitionTransport.h"
+
+namespace maxsum
+{
+   /**
+    * Implementation of maxsum::PartitionTransport for partitions that run
+    * in different threads of the same process. All partitions share one
+    * LocalTransport::Hub, and each has its own LocalTransport, which must
+    * only be used by that partition's thread. This is mainly useful for
+    * testing partitioned factor graphs without a cluster, and for using one
+    * controller per core on machines with non-uniform memory access.
+    */
+   class LocalTransport : public PartitionTransport
+   {
+   public:
+
+      /**
+       * State shared by every partition connected to the same
+       * maxsum::LocalTransport network.
+       */
+      class Hub
+      {
+      private:
+
+         friend class LocalTransport;
+
+         /**
+          * Protects every other member.
+          */
+         std::mutex mutex_i;
+
+         /**
+          * Signalled when every partition has reached the barrier.
+          */
+         std::condition_variable ready_i;
+
+         /**
+          * The number of partitions.
+          */
+         const int size_i;
+
+         /**
+          * The number of partitions waiting at the barrier.
+          */
+         int waiting_i;
+
+         /**
+          * Incremented each time every partition reaches the barrier.
+          */
+         long generation_i;
+
+         /**
+          * The batch sent from each partition to each other, indexed by
+          * destination then source.
+          */
+         std::vector<std::vector<const Batch*> > mail_i;
+
+         /**
+          * The vote passed to LocalTransport::allTrue by each partition.
+          */
+         std::vector<char> votes_i;
+
+         /**
+          * Blocks until every partition has called this function.
+          * @param[in] lock a lock on mutex_i.
+          */
+         void barrier(std::unique_lock<std::mutex>& lock);
+
+         // Hubs are shared by reference, so are never copied.
+         Hub(const Hub&);
+         Hub& operator=(const Hub&);
+
+      public:
+
+         /**
+          * Constructs a hub for the specified number of partitions.
+          */
+         explicit Hub(int size)
+            : size_i(size), waiting_i(0), generation_i(0),
+              mail_i(size,std::vector<const Batch*>(size,0)), votes_i(size,0)
+         {}
+
+         /**
+          * Returns the number of partitions.
+          */
+         int size() const { return size_i; }
+
+      }; // class Hub
+
+   private:
+
+      /**
+       * The hub shared by every partition.
+       */
+      Hub& hub_i;
+
+      /**
+       * The number of this partition.
+       */
+      const int rank_i;
+
+   public:
+
+      /**
+       * Connects one partition to a hub.
+       * @param[in] hub the hub shared by every partition.
+       * @param[in] rank the number of this partition, in [0,hub.size()).
+       */
+      LocalTransport(Hub& hub, int rank) : hub_i(hub), rank_i(rank) {}
+
+      /**
+       * Returns the number of this partition.
+       */
+      int rank() const { return rank_i; }
+
+      /**
+       * Returns the total number of partitions.
+       */
+      int noPartitions() const { return hub_i.size(); }
+
+      /**
+       * Sends one batch to every partition, and receives one batch from
+       * every partition.
+       * @see PartitionTransport::exchange
+       */
+      void exchange(const std::vector<Batch>& outgoing,
+            std::vector<Batch>& incoming);
+
+      /**
+       * Returns true if and only if every partition passes true.
+       * @see PartitionTransport::allTrue
+       */
+      bool allTrue(bool value);
+
+   }; // class LocalTransport
+
+} // namespace maxsum
+
+#endif // MAXSUM_LOCAL_TRANSPORT_H
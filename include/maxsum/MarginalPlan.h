@@ -0,0 +1,334 @@
+/**
+ * @file MarginalPlan.h
+ * Defines the maxsum::util::MarginalPlan class, which is used to implement
+ * maxsum::marginal() and its specialisations efficiently.
+ * @attention The types defined in this header are not intended to form part
+ * of the public interface to the maxsum library.
+ */
+#ifndef MAXSUM_UTIL_MARGINAL_PLAN_H
+#define MAXSUM_UTIL_MARGINAL_PLAN_H
+
+#include <cassert>
+#include "common.h"
+
+namespace maxsum
+{
+namespace util
+{
+   /**
+    * Upper bound on the number of variables in the domain of any function.
+    * Every registered variable has a domain size of at least 2, and the
+    * total size of a function's domain must be representable by
+    * maxsum::ValIndex, so no function can depend on more variables than
+    * there are bits in maxsum::ValIndex. This allows stride information to
+    * be stored in fixed size arrays, without any dynamic memory allocation.
+    */
+   const int MAX_DOMAIN_DIMS = 8*sizeof(ValIndex);
+
+   /**
+    * Stores the strides and sizes for a subset of the dimensions of a
+    * function's value array. Adjacent dimensions that are contiguous in
+    * memory are merged into a single dimension, so that the number of
+    * dimensions stored here is often much smaller than the number of
+    * variables in the original domain.
+    */
+   struct StrideList
+   {
+      /**
+       * The number of (merged) dimensions in this list.
+       */
+      int noDims;
+
+      /**
+       * The product of the sizes of all dimensions in this list.
+       */
+      ValIndex total;
+
+      /**
+       * Linear index increment for each dimension.
+       */
+      ValIndex stride[MAX_DOMAIN_DIMS];
+
+      /**
+       * Number of elements in each dimension.
+       */
+      ValIndex size[MAX_DOMAIN_DIMS];
+
+      /**
+       * Constructs an empty list, which spans exactly one element.
+       */
+      StrideList() : noDims(0), total(1) {}
+
+      /**
+       * Appends a dimension to this list, merging it with the last dimension
+       * if the two are contiguous.
+       * @pre dimensions must be appended in order of increasing stride.
+       */
+      void push(ValIndex dimStride, ValIndex dimSize)
+      {
+         total *= dimSize;
+         if( (0<noDims) && (stride[noDims-1]*size[noDims-1]==dimStride) )
+         {
+            size[noDims-1] *= dimSize;
+            return;
+         }
+         assert(MAX_DOMAIN_DIMS>noDims);
+         stride[noDims] = dimStride;
+         size[noDims] = dimSize;
+         ++noDims;
+      }
+
+   }; // struct StrideList
+
+   /**
+    * Precomputed strategy for marginalising one function onto a subset of
+    * its domain. A maxsum::util::MarginalPlan splits the dimensions of an
+    * input function into those that are kept in the output domain, and
+    * those that are eliminated. Marginalisation is then performed by
+    * iterating over the eliminated dimensions in the outer loop, and
+    * the kept dimensions in the inner loop, so that each output value is
+    * aggregated in exactly the same order as increasing linear index in the
+    * input function. No dynamic memory allocation is required.
+    */
+   class MarginalPlan
+   {
+   private:
+
+      /**
+       * Dimensions of the input function that appear in the output domain.
+       * These are stored in the same order as the output function's domain,
+       * so iterating over them visits the output values in linear order.
+       */
+      StrideList kept_i;
+
+      /**
+       * Dimensions of the input function that are aggregated over.
+       */
+      StrideList free_i;
+
+      /**
+       * Applies op(outValue,inValue) for every output value, where
+       * inValue is taken from the input array at the specified offset
+       * into the eliminated dimensions.
+       * @param[in] pIn pointer to first value of input function.
+       * @param[in] op functor with signature void op(ValType&, ValType).
+       * @param[out] pOut pointer to first value of output function.
+       */
+      template<typename Op> void forEachKept
+      (
+       const ValType* pIn,
+       Op& op,
+       ValType* pOut
+      ) const
+      {
+         //*********************************************************************
+         // Deal with the trivial case, where the output is a scalar.
+         //*********************************************************************
+         if(0==kept_i.noDims)
+         {
+            op(*pOut,*pIn);
+            return;
+         }
+
+         //*********************************************************************
+         // Otherwise, the innermost kept dimension is processed in a tight
+         // loop, while the outer kept dimensions are visited using an
+         // odometer over their subindices.
+         //*********************************************************************
+         const ValIndex innerStride = kept_i.stride[0];
+         const ValIndex innerSize = kept_i.size[0];
+         ValIndex sub[MAX_DOMAIN_DIMS] = {0};
+         ValIndex offset = 0;
+         ValType* pOutEnd = pOut + kept_i.total;
+         while(true)
+         {
+            const ValType* pCur = pIn + offset;
+            for(ValIndex k=0; k<innerSize; ++k)
+            {
+               op(*pOut,*pCur);
+               ++pOut;
+               pCur += innerStride;
+            }
+
+            if(pOutEnd==pOut)
+            {
+               return;
+            }
+
+            //******************************************************************
+            // Increment the odometer for the outer kept dimensions.
+            //******************************************************************
+            for(int d=1; d<kept_i.noDims; ++d)
+            {
+               offset += kept_i.stride[d];
+               if(++sub[d] < kept_i.size[d])
+               {
+                  break;
+               }
+               offset -= kept_i.stride[d]*kept_i.size[d];
+               sub[d] = 0;
+            }
+
+         } // while loop
+
+      } // forEachKept
+
+      /**
+       * Functor used to initialise each output value to the first
+       * corresponding input value.
+       */
+      struct Assign_m
+      {
+         void operator()(ValType& out, const ValType in) const { out = in; }
+      };
+
+      /**
+       * Functor used to aggregate each input value into the output value.
+       */
+      template<typename F> struct Aggregate_m
+      {
+         F& aggregate;
+         Aggregate_m(F& f) : aggregate(f) {}
+         void operator()(ValType& out, const ValType in)
+         {
+            out = aggregate(out,in);
+         }
+      };
+
+   public:
+
+      /**
+       * Constructs a plan for marginalising a function with a specified
+       * domain onto a subset of that domain.
+       * @param[in] inVarBegin iterator to first variable in input domain.
+       * @param[in] inVarEnd iterator to end of input domain variable list.
+       * @param[in] inSizeBegin iterator to the domain sizes of the input
+       * variables.
+       * @param[in] outVarBegin iterator to first variable in output domain.
+       * @param[in] outVarEnd iterator to end of output domain variable list.
+       * @pre both variable lists are sorted, and the output variables are
+       * a subset of the input variables.
+       */
+      template<class VarIt, class SizeIt> MarginalPlan
+      (
+       VarIt inVarBegin,
+       VarIt inVarEnd,
+       SizeIt inSizeBegin,
+       VarIt outVarBegin,
+       VarIt outVarEnd
+      )
+      : kept_i(), free_i()
+      {
+         ValIndex stride = 1;
+         VarIt outVar = outVarBegin;
+         SizeIt siz = inSizeBegin;
+         for(VarIt inVar=inVarBegin; inVar!=inVarEnd; ++inVar, ++siz)
+         {
+            if( (outVar!=outVarEnd) && (*outVar==*inVar) )
+            {
+               kept_i.push(stride,*siz);
+               ++outVar;
+            }
+            else
+            {
+               free_i.push(stride,*siz);
+            }
+            stride *= *siz;
+         }
+         assert(outVar==outVarEnd);
+
+      } // constructor
+
+      /**
+       * Returns the number of output values produced by this plan.
+       */
+      ValIndex outputSize() const { return kept_i.total; }
+
+      /**
+       * Returns the number of input values aggregated for each output value.
+       */
+      ValIndex freeSize() const { return free_i.total; }
+
+      /**
+       * Returns true if the kept dimensions are innermost in the input
+       * function's value array. In this case, the input values can be viewed
+       * as a column-major matrix with outputSize() rows and freeSize()
+       * columns, and each output value is a reduction over one row.
+       * This is the case, for example, when marginalising onto the first
+       * variable in the input domain.
+       */
+      bool keptInner() const
+      {
+         return (1>=kept_i.noDims) && (1>=free_i.noDims) &&
+            ( (0==kept_i.noDims) || (1==kept_i.stride[0]) );
+      }
+
+      /**
+       * Returns true if the eliminated dimensions are innermost in the input
+       * function's value array. In this case, the input values can be viewed
+       * as a column-major matrix with freeSize() rows and outputSize()
+       * columns, and each output value is a reduction over one column.
+       * This is the case, for example, when marginalising onto the last
+       * variable in the input domain.
+       */
+      bool freeInner() const
+      {
+         return (1>=kept_i.noDims) && (1>=free_i.noDims) &&
+            ( (0==free_i.noDims) || (1==free_i.stride[0]) );
+      }
+
+      /**
+       * Marginalises an input value array using this plan.
+       * For each output value, the corresponding input values are
+       * aggregated in increasing order of their linear index, with the
+       * first such value used as the initial aggregate.
+       * @param[in] pIn pointer to the first value of the input function.
+       * @param[in] aggregate functor or function pointer with signature
+       * <code>ValType aggregate(ValType prevResult, ValType nextVal)</code>
+       * @param[out] pOut pointer to the first value of the output function.
+       * @see maxsum::marginal()
+       */
+      template<typename F> void reduce
+      (
+       const ValType* pIn,
+       F aggregate,
+       ValType* pOut
+      ) const
+      {
+         //*********************************************************************
+         // The first value in the free domain initialises the result.
+         //*********************************************************************
+         Assign_m assign;
+         forEachKept(pIn,assign,pOut);
+
+         //*********************************************************************
+         // Aggregate the remaining values in the free domain, using an
+         // odometer to keep track of the offset into the eliminated
+         // dimensions.
+         //*********************************************************************
+         Aggregate_m<F> agg(aggregate);
+         ValIndex sub[MAX_DOMAIN_DIMS] = {0};
+         ValIndex offset = 0;
+         for(ValIndex f=1; f<free_i.total; ++f)
+         {
+            for(int d=0; d<free_i.noDims; ++d)
+            {
+               offset += free_i.stride[d];
+               if(++sub[d] < free_i.size[d])
+               {
+                  break;
+               }
+               offset -= free_i.stride[d]*free_i.size[d];
+               sub[d] = 0;
+            }
+            forEachKept(pIn+offset,agg,pOut);
+         }
+
+      } // reduce
+
+   }; // class MarginalPlan
+
+} // namespace util
+} // namespace maxsum
+
+#endif // MAXSUM_UTIL_MARGINAL_PLAN_H
@@ -6,12 +6,21 @@
 #ifndef MAXSUM_MAXSUMCONTROLLER_H
 #define MAXSUM_MAXSUMCONTROLLER_H
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <stack>
+#include <string>
 #include "common.h"
 #include "DiscreteFunction.h"
-#include "PostOffice.h"
+#include "FactorGraph.h"
+#include "FixedArityKernel.h"
+#include "IndexedHeap.h"
+#include "ThreadPool.h"
 
 /**
  * Namespace for all public types and functions defined by the Max-Sum library.
@@ -34,7 +43,286 @@ namespace maxsum
        * Type of container used to map factor's to their defining functions.
        */
       typedef std::map<FactorID,DiscreteFunction> FactorMap;
-      
+
+      /**
+       * Type of container used to map factors to their implicit definitions.
+       */
+      typedef util::FactorGraph::ImplicitMap ImplicitMap;
+
+      /**
+       * Clock used to measure deadlines and iteration times.
+       * @see MaxSumController::optimise(Clock::time_point)
+       */
+      typedef std::chrono::steady_clock Clock;
+
+      /**
+       * Order in which MaxSumController::optimise updates the messages
+       * sent by notified nodes.
+       * @see MaxSumController::setSchedule
+       */
+      enum Schedule
+      {
+         /**
+          * Every notified factor, and then every notified variable, is
+          * updated once per iteration, using the messages computed in the
+          * previous half-iteration. This is the default, and the only
+          * schedule that can use more than one thread.
+          */
+         FLOODING,
+
+         /**
+          * Residual belief propagation: notified nodes are updated one at a
+          * time, in decreasing order of the largest change (maxnorm) in any
+          * of their input messages since they were last updated. Updates are
+          * concentrated where messages are still changing, which usually
+          * needs far fewer updates to converge on loopy graphs. One
+          * iteration is counted for every MaxSumController::noFactors plus
+          * MaxSumController::noVars updates.
+          */
+         RESIDUAL,
+
+         /**
+          * Each iteration sweeps through the notified factors in increasing
+          * order of identifier. After each factor is updated, any variables
+          * whose inputs have changed significantly are updated immediately,
+          * so that factors later in the sweep see their new messages.
+          */
+         ROUND_ROBIN
+      };
+
+      /**
+       * Statistics describing a single iteration of
+       * MaxSumController::optimise, which are reported to the controller's
+       * MaxSumController::IterationObserver, if it has one. For the
+       * MaxSumController::RESIDUAL schedule, an iteration is every
+       * MaxSumController::noFactors plus MaxSumController::noVars updates,
+       * as for the iteration count returned by MaxSumController::optimise.
+       */
+      struct IterationStats
+      {
+         /**
+          * The number of this iteration within the current call to
+          * MaxSumController::optimise, starting from 1.
+          */
+         int iteration;
+
+         /**
+          * The number of factors that updated their output messages.
+          */
+         int noFactorUpdates;
+
+         /**
+          * The number of variables that updated their output messages.
+          */
+         int noVarUpdates;
+
+         /**
+          * The number of factor to variable messages whose maxnorm change
+          * exceeded the controller's threshold.
+          */
+         int noFac2VarChanges;
+
+         /**
+          * The number of variable to factor messages whose maxnorm change
+          * exceeded the controller's threshold.
+          */
+         int noVar2FacChanges;
+
+         /**
+          * The largest maxnorm change in any factor to variable message.
+          */
+         ValType maxFac2VarResidual;
+
+         /**
+          * The sum of the maxnorm changes in every factor to variable message.
+          */
+         ValType totalFac2VarResidual;
+
+         /**
+          * The largest maxnorm change in any variable to factor message.
+          */
+         ValType maxVar2FacResidual;
+
+         /**
+          * The sum of the maxnorm changes in every variable to factor message.
+          */
+         ValType totalVar2FacResidual;
+
+         /**
+          * The number of variables whose assigned value changed.
+          */
+         int noValueChanges;
+
+         /**
+          * Wall clock time in seconds spent updating factor to variable
+          * messages. For schedules that interleave factor and variable
+          * updates, this is the time for the whole iteration.
+          */
+         double fac2varSeconds;
+
+         /**
+          * Wall clock time in seconds spent updating variable to factor
+          * messages. This is zero for schedules that interleave factor and
+          * variable updates.
+          */
+         double var2facSeconds;
+
+         /**
+          * Constructs statistics for an iteration with no updates.
+          */
+         IterationStats() { clear(); }
+
+         /**
+          * Resets all statistics to zero.
+          */
+         void clear()
+         {
+            iteration = noFactorUpdates = noVarUpdates = 0;
+            noFac2VarChanges = noVar2FacChanges = noValueChanges = 0;
+            maxFac2VarResidual = totalFac2VarResidual = 0;
+            maxVar2FacResidual = totalVar2FacResidual = 0;
+            fac2varSeconds = var2facSeconds = 0;
+         }
+
+         /**
+          * Adds the update counts and residuals of another set of statistics
+          * to this one.
+          */
+         void merge(const IterationStats& rhs)
+         {
+            noFactorUpdates += rhs.noFactorUpdates;
+            noVarUpdates += rhs.noVarUpdates;
+            noFac2VarChanges += rhs.noFac2VarChanges;
+            noVar2FacChanges += rhs.noVar2FacChanges;
+            noValueChanges += rhs.noValueChanges;
+            maxFac2VarResidual =
+               std::max(maxFac2VarResidual,rhs.maxFac2VarResidual);
+            totalFac2VarResidual += rhs.totalFac2VarResidual;
+            maxVar2FacResidual =
+               std::max(maxVar2FacResidual,rhs.maxVar2FacResidual);
+            totalVar2FacResidual += rhs.totalVar2FacResidual;
+         }
+      };
+
+      /**
+       * Number of bytes of heap storage used by a controller, as returned
+       * by MaxSumController::memoryUsage. Messages are stored contiguously
+       * in the compiled factor graph, so they are allocated and freed in
+       * bulk whenever the graph is recompiled or cleared.
+       */
+      struct MemoryUsage
+      {
+         /**
+          * Bytes used by the compiled factor graph, including all messages.
+          */
+         std::size_t graphBytes;
+
+         /**
+          * Bytes kept from the previous compiled graph, which are reused
+          * when the graph is next recompiled.
+          */
+         std::size_t spareBytes;
+
+         /**
+          * Bytes used for the values of factor tables.
+          */
+         std::size_t factorBytes;
+
+         /**
+          * Bytes used for the total value of each factor table.
+          */
+         std::size_t totalBytes;
+
+         /**
+          * Bytes used by the per-thread workspaces and schedule state.
+          */
+         std::size_t workspaceBytes;
+
+         /**
+          * Returns the total number of bytes used.
+          */
+         std::size_t total() const
+         {
+            return graphBytes + spareBytes + factorBytes + totalBytes
+               + workspaceBytes;
+         }
+      };
+
+      /**
+       * Immutable copy of the assignment of values to variables, published
+       * by MaxSumController::optimise while snapshots are enabled.
+       * @see MaxSumController::snapshot
+       */
+      struct Snapshot
+      {
+         /**
+          * The iteration of the call to MaxSumController::optimise after
+          * which this snapshot was taken.
+          */
+         int iteration;
+
+         /**
+          * The id of every variable in the factor graph, in increasing order.
+          */
+         std::vector<VarID> vars;
+
+         /**
+          * The value of the corresponding variable in Snapshot::vars.
+          */
+         std::vector<ValIndex> values;
+
+         /**
+          * The total value of each factor table, if requested when
+          * snapshots were enabled, or empty otherwise.
+          */
+         FactorMap totals;
+
+         /**
+          * Returns the value of the specified variable in this snapshot.
+          * @throws maxsum::NoSuchElementException if the variable was not in
+          * the factor graph.
+          */
+         ValIndex getValue(VarID id) const
+         {
+            std::vector<VarID>::const_iterator pos =
+               std::lower_bound(vars.begin(),vars.end(),id);
+            if( (vars.end()==pos) || (id!=*pos) )
+            {
+               throw new NoSuchElementException("Snapshot::getValue()",
+                     "No value for variable in snapshot");
+            }
+            return values[pos-vars.begin()];
+         }
+      };
+
+      /**
+       * Type of pointer to a published snapshot, which remains valid for
+       * as long as any reader holds it.
+       */
+      typedef std::shared_ptr<const Snapshot> SnapshotPtr;
+
+      /**
+       * Interface for objects that monitor the progress of
+       * MaxSumController::optimise.
+       * @see MaxSumController::setObserver
+       */
+      class IterationObserver
+      {
+      public:
+
+         /**
+          * Called at the end of every iteration of
+          * MaxSumController::optimise, on the thread that called it.
+          * @param[in] stats statistics for the iteration just completed.
+          */
+         virtual void iterationDone(const IterationStats& stats) = 0;
+
+         /**
+          * Virtual destructor for subclasses.
+          */
+         virtual ~IterationObserver() {}
+      };
+
    private:
 
       /**
@@ -44,6 +332,12 @@ namespace maxsum
       friend std::ostream& operator<<(std::ostream& out,
             MaxSumController& controller);
 
+      /**
+       * Reads the messages sent to boundary variables, which are not
+       * otherwise visible outside this class.
+       */
+      friend class PartitionedController;
+
       /**
        * Map storing the functions associated with each factor under the
        * control of this object.
@@ -58,6 +352,12 @@ namespace maxsum
        */
       FactorMap factorTotalValue_i;
 
+      /**
+       * Map storing the definition of each implicit factor. No factor id is
+       * in both this map and factors_i.
+       */
+      ImplicitMap implicit_i;
+
       /**
        * Type of container used to map (action) variables to their currently
        * assigned values.
@@ -71,14 +371,34 @@ namespace maxsum
       ValueMap values_i;
 
       /**
-       * PostOffice for factor to variable messages.
+       * Type of container used to count the number of factors connected
+       * to each variable.
        */
-      util::F2VPostOffice fac2varMsgs_i;
+      typedef std::map<VarID,int> DegreeMap;
 
       /**
-       * PostOffice for variable to factor messages.
+       * Map storing the number of factors connected to each variable
+       * in values_i.
        */
-      util::V2FPostOffice var2facMsgs_i;
+      DegreeMap varDegrees_i;
+
+      /**
+       * Compiled factor graph, which stores all messages and notices.
+       */
+      util::FactorGraph graph_i;
+
+      /**
+       * Storage kept from the previous compiled factor graph, which is
+       * reused the next time the graph is compiled.
+       */
+      util::FactorGraph spareGraph_i;
+
+      /**
+       * True if graph_i is consistent with the current set of factors.
+       * Otherwise, graph_i still holds the messages and notices for the
+       * previous factor graph, and is recompiled before it is next used.
+       */
+      bool graphValid_i;
 
       /**
        * The maximum number of max-sum iterations allowed before the
@@ -92,6 +412,474 @@ namespace maxsum
        */
       ValType maxNormThreshold_i;
 
+      /**
+       * The number of threads used to update messages in
+       * MaxSumController::optimise.
+       */
+      int numThreads_i;
+
+      /**
+       * Pool of worker threads used to update messages in parallel, or
+       * NULL if messages are updated serially.
+       */
+      util::ThreadPool* pPool_i;
+
+      /**
+       * True if changes to the factor graph only wake up the affected
+       * nodes, rather than the whole graph.
+       * @see MaxSumController::setIncremental
+       */
+      bool incremental_i;
+
+      /**
+       * True if a change in a variable's value only notifies the factors
+       * connected to it, rather than every factor.
+       * @see MaxSumController::setTargetedNotices
+       */
+      bool targetedNotices_i;
+
+      /**
+       * The schedule used to update messages in MaxSumController::optimise.
+       */
+      Schedule schedule_i;
+
+      /**
+       * True if acyclic components are solved exactly before the selected
+       * schedule is run.
+       * @see MaxSumController::setTreeSolver
+       */
+      bool treeSolver_i;
+
+      /**
+       * True if the compiled graph is renumbered to follow its structure.
+       * @see MaxSumController::setReordering
+       */
+      bool reorderGraph_i;
+
+      /**
+       * False if the compiled graph has changed since its acyclic
+       * components were last found.
+       */
+      bool treesValid_i;
+
+      /**
+       * The nodes of every acyclic component, each in breadth first order
+       * from its root. Nodes are numbered by factor index, followed by
+       * variable index plus the number of factors.
+       */
+      std::vector<int> treeNodes_i;
+
+      /**
+       * The edge between each node in treeNodes_i and its parent, or -1 for
+       * the root.
+       */
+      std::vector<int> treeParents_i;
+
+      /**
+       * Position of each acyclic component's root in treeNodes_i, followed
+       * by the total number of nodes in acyclic components.
+       */
+      std::vector<int> treeStart_i;
+
+      /**
+       * The acyclic component containing each node, or -1 if it is on a
+       * cycle.
+       */
+      std::vector<int> treeComponent_i;
+
+      /**
+       * Number of factor and variable updates performed by the most recent
+       * call to MaxSumController::optimise.
+       */
+      long noUpdates_i;
+
+      /**
+       * Scratch space used by one thread to update messages.
+       */
+      struct Workspace
+      {
+         /**
+          * Graph indices of the receivers of significantly changed
+          * messages, which are notified once all threads are finished.
+          */
+         std::vector<int> notices;
+
+         /**
+          * Maxnorm change in the message sent to the corresponding receiver
+          * in Workspace::notices.
+          */
+         std::vector<ValType> residuals;
+
+         /**
+          * Statistics for the updates performed by this thread in the
+          * current iteration.
+          */
+         IterationStats stats;
+
+         /**
+          * Graph indices of the variables whose values have changed in the
+          * current iteration, each listed once.
+          */
+         std::vector<int> changedVars;
+
+         /**
+          * Nonzero for each variable listed in Workspace::changedVars.
+          */
+         std::vector<char> isChanged;
+
+         /**
+          * Temporary message values, with room for one message to each
+          * variable of a factor updated by util::FixedArityKernel, or of
+          * any implicit factor.
+          */
+         std::vector<ValType> buffer;
+
+         /**
+          * Input messages passed to an implicit factor.
+          */
+         std::vector<const ValType*> inputs;
+
+         /**
+          * Output messages computed by an implicit factor.
+          */
+         std::vector<ValType*> outputs;
+
+         /**
+          * Reserves enough space to update any node in the specified
+          * graph without allocating memory.
+          */
+         void reserve(const util::FactorGraph& graph)
+         {
+            notices.reserve(graph.noEdges());
+            residuals.reserve(graph.noEdges());
+            changedVars.clear();
+            changedVars.reserve(graph.noVars());
+            isChanged.assign(graph.noVars(),0);
+            buffer.resize(std::max(util::MAX_FIXED_ARITY*graph.maxVarSize(),
+                     graph.maxImplicitLength()));
+            inputs.resize(graph.maxImplicitArity());
+            outputs.resize(graph.maxImplicitArity());
+         }
+
+         /**
+          * Returns the number of bytes of heap storage reserved by this
+          * workspace.
+          */
+         std::size_t bytesUsed() const
+         {
+            return notices.capacity()*sizeof(int)
+               + residuals.capacity()*sizeof(ValType)
+               + changedVars.capacity()*sizeof(int)
+               + isChanged.capacity()*sizeof(char)
+               + buffer.capacity()*sizeof(ValType)
+               + inputs.capacity()*sizeof(const ValType*)
+               + outputs.capacity()*sizeof(ValType*);
+         }
+
+         /**
+          * Lists a variable whose value has changed, unless it is already
+          * listed, so that Workspace::changedVars never holds more than one
+          * entry for each variable in the graph.
+          */
+         void changeVar(int v)
+         {
+            if(0==isChanged[v])
+            {
+               isChanged[v] = 1;
+               changedVars.push_back(v);
+            }
+         }
+
+         /**
+          * Clears the list of variables whose values have changed.
+          */
+         void clearChangedVars()
+         {
+            for(std::vector<int>::const_iterator it=changedVars.begin();
+                  it!=changedVars.end(); ++it)
+            {
+               isChanged[*it] = 0;
+            }
+            changedVars.clear();
+         }
+      };
+
+      /**
+       * Object notified after each iteration of optimise, or 0 if none.
+       */
+      IterationObserver* pObserver_i;
+
+      /**
+       * Workspace for each thread.
+       */
+      std::vector<Workspace> workspaces_i;
+
+      /**
+       * The factors or variables currently being updated.
+       */
+      std::vector<int> jobs_i;
+
+      /**
+       * Priority queue of factors, followed by variables, used by the
+       * MaxSumController::RESIDUAL schedule.
+       */
+      util::IndexedHeap heap_i;
+
+      /**
+       * Nonzero for each factor that needs updating in the current
+       * MaxSumController::ROUND_ROBIN sweep.
+       */
+      std::vector<char> sweepFlags_i;
+
+      /**
+       * Variables notified by the factor currently being updated in a
+       * MaxSumController::ROUND_ROBIN sweep.
+       */
+      std::vector<int> sweepVars_i;
+
+      /**
+       * True if a snapshot of the assignment is published after each
+       * iteration.
+       * @see MaxSumController::setSnapshots
+       */
+      bool snapshots_i;
+
+      /**
+       * True if published snapshots include the total value of each factor.
+       */
+      bool snapshotTotals_i;
+
+      /**
+       * The most recently published snapshot, or null if none has been
+       * published. This is only accessed through std::atomic_load and
+       * std::atomic_store, so that it can be read while optimise runs.
+       */
+      SnapshotPtr snapshot_i;
+
+      /**
+       * Set by MaxSumController::cancel to stop the current call to
+       * MaxSumController::optimise.
+       */
+      std::atomic<bool> cancel_i;
+
+      /**
+       * Deadline for the current call to MaxSumController::optimise, or 0
+       * if it has none. While this is set, the utility of the current
+       * assignment and the best assignment seen so far are tracked.
+       */
+      const Clock::time_point* pDeadline_i;
+
+      /**
+       * Value of each factor in graph_i for the current assignment, while
+       * a deadline is set.
+       */
+      std::vector<ValType> factorUtility_i;
+
+      /**
+       * Factors whose values need to be re-evaluated because a variable
+       * in their domain has changed value.
+       */
+      util::NoticeList utilityNotices_i;
+
+      /**
+       * Sum of factorUtility_i.
+       */
+      ValType utility_i;
+
+      /**
+       * The highest utility of any assignment seen so far.
+       */
+      ValType bestUtility_i;
+
+      /**
+       * The value of each variable in graph_i for the assignment with
+       * utility bestUtility_i.
+       */
+      std::vector<ValIndex> bestValues_i;
+
+      /**
+       * Scratch space for the joint assignment of an implicit factor's
+       * variables, used when evaluating its utility.
+       */
+      std::vector<ValIndex> utilitySubs_i;
+
+      /**
+       * Task used to update the messages sent by a set of factors or
+       * variables in parallel.
+       */
+      class UpdateTask;
+
+      /**
+       * Updates the messages sent by a single factor.
+       * @param[in] f the index of the factor in graph_i.
+       * @param[in,out] ws scratch space for the calling thread. The index
+       * of each variable whose message has changed significantly is
+       * appended to its notice list.
+       * @post messages sent by different factors may be updated concurrently,
+       * provided that each thread uses its own workspace.
+       */
+      void updateFactor(int f, Workspace& ws);
+
+      /**
+       * Sets the message sent along an edge from its factor, given the max
+       * marginal of the factor's total value onto the edge's variable.
+       * @param[in] e the index of the edge in graph_i.
+       * @param[in] pMarginal the max marginal, including the variable's
+       * last message to the factor.
+       * @param[in,out] ws scratch space for the calling thread.
+       */
+      void sendFactorMessage(int e, const ValType* pMarginal, Workspace& ws);
+
+      /**
+       * Updates the messages sent by a single variable.
+       * @param[in] v the index of the variable in graph_i.
+       * @param[in,out] ws scratch space for the calling thread. The index
+       * of each factor whose message has changed significantly is
+       * appended to its notice list.
+       * @returns true if the value assigned to this variable has changed.
+       * @post messages sent by different variables may be updated
+       * concurrently, provided that each thread uses its own workspace.
+       */
+      bool updateVariable(int v, Workspace& ws);
+
+      /**
+       * Updates the edges and variables of the factor graph to reflect a
+       * new value for the specified factor, without changing the factor.
+       * @param[in] id the unique identifier of the factor.
+       * @param[in] factor the new value for this factor.
+       * @param[in] notifyAll if false, and this controller is not in
+       * incremental mode, the caller is responsible for telling every
+       * factor to recheck its mail, which allows many factors to be set
+       * with only one call to NoticeList::notifyAll.
+       * @returns a reference to the stored value of this factor, which
+       * should then be set to <code>factor</code>.
+       */
+      DiscreteFunction& updateStructure(FactorID id,
+            const DiscreteFunction& factor, bool notifyAll=true);
+
+      /**
+       * Updates the edges and variables of the factor graph when the
+       * variables of a factor change, and tells the appropriate factors and
+       * variables to recheck their mail.
+       * @param[in] id the unique identifier of the factor.
+       * @param[in] oldVars the sorted list of the factor's old variables.
+       * @param[in] newVars the sorted list of the factor's new variables.
+       * @param[in] changed true if the compiled graph must be rebuilt even
+       * if the factor's variables are the same.
+       * @param[in] notifyAll as for MaxSumController::updateStructure.
+       */
+      void updateEdges(FactorID id, const std::vector<VarID>& oldVars,
+            const std::vector<VarID>& newVars, bool changed, bool notifyAll);
+
+      /**
+       * Reserves enough space in each workspace, and in the schedule state,
+       * to optimise the current compiled graph without allocating memory.
+       */
+      void reserveWorkspaces();
+
+      /**
+       * Finds the acyclic connected components of the compiled factor
+       * graph, and orders the nodes of each by a breadth first search.
+       */
+      void analyseTrees();
+
+      /**
+       * Updates the messages sent by a node of a tree.
+       * @param[in] node the index of a factor, or the number of factors
+       * plus the index of a variable.
+       * @param[in,out] ws scratch space for the calling thread.
+       */
+      void updateTreeNode(int node, Workspace& ws);
+
+      /**
+       * Solves every acyclic component that has pending notices exactly,
+       * using one pass from the leaves to the root and one pass back, and
+       * removes the notices of their nodes.
+       * @returns the number of factor and variable updates performed.
+       */
+      long solveTrees();
+
+      /**
+       * Decodes the values of one tree from its root downwards, so that
+       * they are jointly optimal even when there are ties.
+       * @param[in] begin position of the tree's root in treeNodes_i.
+       * @param[in] end position one past the tree's last node.
+       * @param[in,out] ws workspace to which every variable whose value
+       * changes is appended.
+       */
+      void decodeTree(int begin, int end, Workspace& ws);
+
+      /**
+       * Finishes an iteration. The statistics counted by each workspace
+       * since the last call are combined, reset, and reported to the
+       * observer, if any. If a deadline is set, the utility of the
+       * current assignment is also updated.
+       * @param[in] iteration the number of the iteration just completed.
+       * @param[in] fac2varSeconds time spent updating factors.
+       * @param[in] var2facSeconds time spent updating variables.
+       */
+      void endIteration(int iteration, double fac2varSeconds,
+            double var2facSeconds);
+
+      /**
+       * Re-evaluates every factor that depends on a variable whose value
+       * has changed since the last call, and records the current
+       * assignment if it is the best seen so far.
+       */
+      void trackUtility();
+
+      /**
+       * Returns the value of factor <code>f</code> in graph_i for the current
+       * assignment of values to variables.
+       */
+      ValType evaluateFactor(int f);
+
+      /**
+       * Returns true if the current call to MaxSumController::optimise has
+       * been cancelled, or has a deadline that has passed.
+       */
+      bool pastDeadline() const
+      {
+         return cancel_i.load(std::memory_order_relaxed) ||
+            ( (0!=pDeadline_i) && (Clock::now() >= *pDeadline_i) );
+      }
+
+      /**
+       * Publishes a snapshot of the current assignment, which replaces any
+       * previous snapshot.
+       * @param[in] iteration the number of iterations performed so far by
+       * the current call to MaxSumController::optimise.
+       */
+      void publish(int iteration);
+
+      /**
+       * Runs MaxSumController::optimise for MaxSumController::optimiseAsync,
+       * and then restores the snapshot setting that was in force before
+       * it was called, even if optimise throws an exception.
+       * @param[in] enabled true if snapshots were previously enabled.
+       * @param[in] totals true if snapshots previously included totals.
+       * @param[in] pDeadline the time by which to stop, or NULL for none.
+       * @returns the number of iterations performed.
+       */
+      int optimiseAndRestore(bool enabled, bool totals,
+            const Clock::time_point* pDeadline);
+
+      /**
+       * Notifies each of the specified variables that is currently in
+       * the factor graph.
+       */
+      template<class VarIt> void notifyVars(VarIt begin, VarIt end)
+      {
+         for(VarIt it=begin; it!=end; ++it)
+         {
+            int v = graph_i.findVar(*it);
+            if(0<=v)
+            {
+               graph_i.varNotices().notify(v);
+            }
+         }
+      }
+
       /**
        * Updates factor to variable messages.
        * This function only needs to update messages that have changed
@@ -113,9 +901,22 @@ namespace maxsum
       int updateVar2FacMsgs();
 
       /**
-       * Infer the factor graph from the given factor domains.
+       * Runs max-sum using the MaxSumController::FLOODING schedule.
+       * @returns the number of iterations performed.
        */
-      void inferGraph();
+      int optimiseFlooding();
+
+      /**
+       * Runs max-sum using the MaxSumController::RESIDUAL schedule.
+       * @returns the number of iterations performed.
+       */
+      int optimiseResidual();
+
+      /**
+       * Runs max-sum using the MaxSumController::ROUND_ROBIN schedule.
+       * @returns the number of iterations performed.
+       */
+      int optimiseRoundRobin();
 
    public:
 
@@ -152,34 +953,316 @@ namespace maxsum
        int maxIterations=DEFAULT_MAX_ITERATIONS,
        ValType maxnorm=DEFAULT_MAXNORM_THRESHOLD
       )
-      : maxIterations_i(maxIterations),
-        maxNormThreshold_i(maxnorm) {}
+      : graphValid_i(true), maxIterations_i(maxIterations),
+        maxNormThreshold_i(maxnorm), numThreads_i(1), pPool_i(0),
+        incremental_i(false), targetedNotices_i(false), schedule_i(FLOODING),
+        treeSolver_i(false), reorderGraph_i(false),
+        treesValid_i(false), noUpdates_i(0),
+        pObserver_i(0), workspaces_i(1), snapshots_i(false),
+        snapshotTotals_i(false), snapshot_i(), cancel_i(false),
+        pDeadline_i(0), utility_i(0), bestUtility_i(0) {}
 
       /**
        * Copy constructor.
+       * @post the new controller uses the same number of threads as
+       * <code>rhs</code>, but does not share its worker threads.
+       * @post the new controller has no MaxSumController::IterationObserver.
+       * @post the compiled factor graph refers to the functions owned by
+       * <code>rhs</code>, and so is recompiled before it is next used.
        */
       MaxSumController(const MaxSumController& rhs)
       : factors_i(rhs.factors_i), factorTotalValue_i(rhs.factorTotalValue_i),
-        values_i(rhs.values_i), fac2varMsgs_i(rhs.fac2varMsgs_i),
-        var2facMsgs_i(rhs.var2facMsgs_i), maxIterations_i(rhs.maxIterations_i),
-        maxNormThreshold_i(rhs.maxNormThreshold_i)
-      {}
+        implicit_i(rhs.implicit_i), values_i(rhs.values_i),
+        varDegrees_i(rhs.varDegrees_i),
+        graph_i(rhs.graph_i), graphValid_i(false),
+        maxIterations_i(rhs.maxIterations_i),
+        maxNormThreshold_i(rhs.maxNormThreshold_i), numThreads_i(1),
+        pPool_i(0), incremental_i(rhs.incremental_i),
+        targetedNotices_i(rhs.targetedNotices_i),
+        schedule_i(rhs.schedule_i), treeSolver_i(rhs.treeSolver_i),
+        reorderGraph_i(rhs.reorderGraph_i), treesValid_i(false),
+        noUpdates_i(rhs.noUpdates_i),
+        pObserver_i(0), workspaces_i(1), snapshots_i(rhs.snapshots_i),
+        snapshotTotals_i(rhs.snapshotTotals_i), snapshot_i(),
+        cancel_i(false), pDeadline_i(0), utility_i(0), bestUtility_i(0)
+      {
+         setNumThreads(rhs.numThreads_i);
+      }
+
+      /**
+       * Move constructor takes ownership of the factor graph, messages,
+       * settings and worker threads of another controller, without copying
+       * them.
+       * @post <code>rhs</code> is left as if newly constructed with its
+       * previous maximum number of iterations and maxnorm threshold: it has
+       * an empty factor graph, a single thread, and default values for all
+       * other settings.
+       * @throws std::bad_alloc if the empty graph left in <code>rhs</code>
+       * cannot be allocated, in which case <code>rhs</code> is unchanged.
+       * Since this constructor may throw, standard containers copy rather
+       * than move controllers when they reallocate, so a container of
+       * controllers should reserve its capacity in advance.
+       */
+      MaxSumController(MaxSumController&& rhs)
+      : MaxSumController(rhs.maxIterations_i,rhs.maxNormThreshold_i)
+      {
+         swap(rhs);
+      }
+
+      /**
+       * Destructor stops any worker threads.
+       */
+      ~MaxSumController()
+      {
+         delete pPool_i;
+      }
 
       /**
-       * Copy assignment.
+       * Copy assignment. This controller's
+       * MaxSumController::IterationObserver is unchanged.
        */
       MaxSumController& operator=(const MaxSumController& rhs)
       {
          factors_i = rhs.factors_i;
          factorTotalValue_i = rhs.factorTotalValue_i;
+         implicit_i = rhs.implicit_i;
          values_i = rhs.values_i;
-         fac2varMsgs_i = rhs.fac2varMsgs_i;
-         var2facMsgs_i = rhs.var2facMsgs_i;
+         varDegrees_i = rhs.varDegrees_i;
+         graph_i = rhs.graph_i;
+         graphValid_i = false;
          maxIterations_i = rhs.maxIterations_i;
          maxNormThreshold_i = rhs.maxNormThreshold_i;
+         incremental_i = rhs.incremental_i;
+         targetedNotices_i = rhs.targetedNotices_i;
+         schedule_i = rhs.schedule_i;
+         treeSolver_i = rhs.treeSolver_i;
+         reorderGraph_i = rhs.reorderGraph_i;
+         treesValid_i = false;
+         noUpdates_i = rhs.noUpdates_i;
+         snapshots_i = rhs.snapshots_i;
+         snapshotTotals_i = rhs.snapshotTotals_i;
+         setNumThreads(rhs.numThreads_i);
+         return *this;
+      }
+
+      /**
+       * Move assignment takes ownership of the factor graph, messages and
+       * worker threads of another controller, without copying them.
+       * @post <code>rhs</code> is left with the previous contents of
+       * this controller.
+       */
+      MaxSumController& operator=(MaxSumController&& rhs) noexcept
+      {
+         swap(rhs);
          return *this;
       }
 
+      /**
+       * Swaps the contents of this controller with another, including their
+       * settings and worker threads. No factors or messages are copied.
+       */
+      void swap(MaxSumController& rhs) noexcept;
+
+      /**
+       * Sets the number of threads used to update messages in
+       * MaxSumController::optimise. With more than one thread, the messages
+       * sent by all notified factors, and then all notified variables, are
+       * divided between a pool of worker threads. Since each message
+       * depends only on messages computed in the previous half-iteration,
+       * the results are identical to those computed by a single thread.
+       * @param[in] n the number of threads to use, including the calling
+       * thread. If <code>n</code> is 1 (the default), all messages are
+       * updated serially. If <code>n</code> is 0, one thread is used for
+       * each hardware thread.
+       */
+      void setNumThreads(int n);
+
+      /**
+       * Returns the number of threads used to update messages.
+       * @see MaxSumController::setNumThreads
+       */
+      int getNumThreads() const
+      {
+         return numThreads_i;
+      }
+
+      /**
+       * Turns incremental re-optimisation on or off. By default, any call
+       * to MaxSumController::setFactor or MaxSumController::removeFactor
+       * tells every node in the factor graph to recheck its mail, so the
+       * next call to MaxSumController::optimise recomputes every message.
+       * In incremental mode, only the changed factor, and any variables
+       * that have gained or lost an edge, are notified. All other messages
+       * are reused as a warm start, and changes spread outwards only as
+       * far as they are significant, so the cost of re-optimising depends
+       * on the size of the change rather than the size of the graph.
+       * @param[in] incremental true to enable incremental mode.
+       */
+      void setIncremental(bool incremental)
+      {
+         incremental_i = incremental;
+      }
+
+      /**
+       * Returns true if incremental re-optimisation is enabled.
+       * @see MaxSumController::setIncremental
+       */
+      bool isIncremental() const
+      {
+         return incremental_i;
+      }
+
+      /**
+       * Turns targeted notifications on or off. A factor's messages depend
+       * only on its inputs, but by default, if the value of any variable
+       * changes during an iteration of the MaxSumController::FLOODING
+       * schedule, every factor in the graph is told to recheck its mail.
+       * With targeted notifications, only the factors connected to the
+       * variables whose values have changed are notified, so that the
+       * work done by each iteration depends only on the part of the graph
+       * that is still changing. The other schedules always notify only
+       * the affected factors.
+       * @param[in] targeted true to enable targeted notifications.
+       */
+      void setTargetedNotices(bool targeted)
+      {
+         targetedNotices_i = targeted;
+      }
+
+      /**
+       * Returns true if targeted notifications are enabled.
+       * @see MaxSumController::setTargetedNotices
+       */
+      bool isTargetedNotices() const
+      {
+         return targetedNotices_i;
+      }
+
+      /**
+       * Enables or disables the exact solver for acyclic components. When
+       * enabled, MaxSumController::optimise first finds each connected
+       * component of the factor graph that is a tree, and solves any that
+       * have pending notices with one ordered pass from the leaves to a
+       * root and one pass back. Values are then decoded from the root, so
+       * that they are jointly optimal even when there are ties. Components
+       * with cycles are left for the selected schedule. Updates made by
+       * the exact solver are counted by MaxSumController::noUpdates, but
+       * do not count as iterations.
+       * @param[in] enabled true to enable the exact solver.
+       */
+      void setTreeSolver(bool enabled)
+      {
+         treeSolver_i = enabled;
+      }
+
+      /**
+       * Returns true if the exact solver for acyclic components is enabled.
+       * @see MaxSumController::setTreeSolver
+       */
+      bool isTreeSolver() const
+      {
+         return treeSolver_i;
+      }
+
+      /**
+       * Enables or disables reordering of the compiled factor graph. When
+       * enabled, factors and variables are renumbered internally in reverse
+       * Cuthill-McKee order each time the graph is compiled, so that the
+       * messages of neighbouring nodes are stored close together, and
+       * notices are processed in an order that follows the structure of the
+       * graph rather than the order of identifiers. Identifiers, values and
+       * messages are unaffected, but the result of each update may differ
+       * from the default order when there are ties, or when the schedule
+       * depends on the order of notices.
+       * @param[in] enabled true to reorder the graph when it is next
+       * compiled.
+       * @see util::FactorGraph::setReordering
+       */
+      void setReordering(bool enabled)
+      {
+         if(enabled!=reorderGraph_i)
+         {
+            reorderGraph_i = enabled;
+            graphValid_i = false;
+         }
+      }
+
+      /**
+       * Returns true if the compiled factor graph is reordered.
+       * @see MaxSumController::setReordering
+       */
+      bool isReordering() const
+      {
+         return reorderGraph_i;
+      }
+
+
+      /**
+       * Sets the order in which MaxSumController::optimise updates messages.
+       * Pending notices are kept when the schedule is changed, so the next
+       * call to MaxSumController::optimise continues from where the last
+       * one stopped. Only the MaxSumController::FLOODING schedule uses the
+       * threads set by MaxSumController::setNumThreads; the others update
+       * one node at a time on the calling thread.
+       * @param[in] schedule the schedule to use.
+       */
+      void setSchedule(Schedule schedule)
+      {
+         schedule_i = schedule;
+      }
+
+      /**
+       * Returns the order in which MaxSumController::optimise updates
+       * messages.
+       * @see MaxSumController::setSchedule
+       */
+      Schedule getSchedule() const
+      {
+         return schedule_i;
+      }
+
+      /**
+       * Sets the object that is notified after every iteration of
+       * MaxSumController::optimise, with statistics describing the messages
+       * updated and the time taken. When no observer is set (the default),
+       * the statistics are still counted, but no time is measured, so the
+       * cost of monitoring is negligible.
+       * @param[in] pObserver the observer to notify, or 0 for none. This
+       * controller does not take ownership of the observer.
+       */
+      void setObserver(IterationObserver* pObserver)
+      {
+         pObserver_i = pObserver;
+      }
+
+      /**
+       * Returns the object notified after each iteration, or 0 if none.
+       * @see MaxSumController::setObserver
+       */
+      IterationObserver* getObserver() const
+      {
+         return pObserver_i;
+      }
+
+      /**
+       * Returns the number of factor and variable updates performed by the
+       * most recent call to MaxSumController::optimise. Since each update
+       * recomputes all of a node's output messages, this is a measure of
+       * the work done that can be compared between schedules.
+       */
+      long noUpdates() const
+      {
+         return noUpdates_i;
+      }
+
+      /**
+       * Returns the number of bytes of heap storage used by this controller
+       * for its factors, messages and workspaces. Storage shared with other
+       * controllers, such as factor domains and the variable register, is
+       * not included.
+       */
+      MemoryUsage memoryUsage() const;
+
       /**
        * Returns the total value for a specified factor.
        * The total value is the factor plus the sum of all its received messages.
@@ -230,6 +1313,64 @@ namespace maxsum
        */
       void setFactor(FactorID id, const DiscreteFunction& factor);
 
+      /**
+       * Accessor method for factor function, which takes ownership of
+       * the specified function rather than copying it.
+       * @param[in] id the unique identifier of the desired factor.
+       * @param[in,out] factor the function representing this factor.
+       * @post <code>factor</code> is moved into this
+       * maxsum::MaxSumController and used to form part of a factor graph,
+       * and is left in a valid but unspecified state.
+       * @post Any previous value of the specified factor is overwritten.
+       */
+      void setFactor(FactorID id, DiscreteFunction&& factor);
+
+      /**
+       * Sets a factor that is defined by a maxsum::ImplicitFactor, rather
+       * than by a table of values. The factor is shared rather than copied,
+       * and must not change while it is part of this factor graph.
+       * @param[in] id the unique identifier of the factor.
+       * @param[in] pFactor the definition of the factor, which must not be
+       * empty.
+       * @post Any previous value of the specified factor, whether implicit
+       * or not, is overwritten.
+       */
+      void setImplicitFactor(FactorID id,
+            std::shared_ptr<const ImplicitFactor> pFactor);
+
+      /**
+       * Sets many factors at once. This is equivalent to calling
+       * MaxSumController::setFactor for each factor in turn, but is much
+       * faster when building or changing large graphs, because
+       * the factor graph is only told to recheck its mail once. As with
+       * setFactor, edges and message storage are not allocated until the
+       * graph is next compiled by MaxSumController::optimise, when they
+       * are laid out in a single pass.
+       * <p>
+       * The factors are specified by iterators over pairs of FactorID and
+       * DiscreteFunction, such as MaxSumController::FactorMap::iterator.
+       * Factors are copied, unless the iterators are wrapped in
+       * std::move_iterator, in which case they are moved into this
+       * controller instead.
+       * </p>
+       * @param[in] begin iterator to the first (id, factor) pair.
+       * @param[in] end iterator to the end of the list of factors.
+       * @post If the same id appears more than once, the last factor
+       * with that id is kept.
+       */
+      template<class FactorIt> void setFactors(FactorIt begin, FactorIt end)
+      {
+         for(FactorIt it=begin; it!=end; ++it)
+         {
+            updateStructure((*it).first,(*it).second,false) = (*it).second;
+         }
+
+         if(!incremental_i && (begin!=end))
+         {
+            graph_i.factorNotices().notifyAll();
+         }
+      }
+
       /**
        * Removes the specified factor from this controller's factor graph.
        * In addition, any variables that were previously only connected to this
@@ -263,7 +1404,17 @@ namespace maxsum
        */
       bool hasFactor(FactorID id) const
       {
-         return 0!=factors_i.count(id);;
+         return (0!=factors_i.count(id)) || (0!=implicit_i.count(id));
+      }
+
+      /**
+       * Returns true if and only if the specified factor is managed by this
+       * maxsum::MaxSumController, and is defined by a
+       * maxsum::ImplicitFactor.
+       */
+      bool hasImplicitFactor(FactorID id) const
+      {
+         return 0!=implicit_i.count(id);
       }
 
       /**
@@ -278,7 +1429,19 @@ namespace maxsum
        */
       bool hasEdge(FactorID id, VarID var) const
       {
-         return var2facMsgs_i.hasEdge(var,id);
+         FactorMap::const_iterator pos = factors_i.find(id);
+         if(factors_i.end()==pos)
+         {
+            ImplicitMap::const_iterator implicitPos = implicit_i.find(id);
+            if(implicit_i.end()==implicitPos)
+            {
+               return false;
+            }
+            const std::vector<VarID>& vars = implicitPos->second->vars();
+            return std::binary_search(vars.begin(),vars.end(),var);
+         }
+         return std::binary_search(pos->second.varBegin(),
+               pos->second.varEnd(),var);
       }
 
       /**
@@ -286,7 +1449,7 @@ namespace maxsum
        */
       int noFactors() const
       {
-         return factors_i.size();
+         return factors_i.size() + implicit_i.size();
       }
       
       /**
@@ -294,7 +1457,7 @@ namespace maxsum
        */
       int noVars() const
       {
-         return var2facMsgs_i.numOfSenders();;
+         return values_i.size();
       }
 
       /**
@@ -302,7 +1465,13 @@ namespace maxsum
        */
       int noEdges() const
       {
-         return var2facMsgs_i.numOfEdges();;
+         int count = 0;
+         for(DegreeMap::const_iterator it=varDegrees_i.begin();
+               it!=varDegrees_i.end(); ++it)
+         {
+            count += it->second;
+         }
+         return count;
       }
 
       /**
@@ -323,7 +1492,8 @@ namespace maxsum
       }
 
       /**
-       * Returns a read only iterator to the beginning of the factor map.
+       * Returns a read only iterator to the beginning of the factor map,
+       * which does not include implicit factors.
        */
       ConstFactorIterator factorBegin() const
       {
@@ -357,6 +1527,26 @@ namespace maxsum
          return pos->second;
       }
 
+      /**
+       * Accessor method for implicit factors.
+       * @param[in] id the unique identifier of the desired factor.
+       * @returns the definition of the implicit factor with unique
+       * identifier <code>id</code>.
+       * @throws maxsum::NoSuchElementException if the specified factor is not
+       * an implicit factor known to this maxsum::MaxSumController.
+       */
+      std::shared_ptr<const ImplicitFactor> getImplicitFactor(FactorID id) const
+      {
+         ImplicitMap::const_iterator pos = implicit_i.find(id);
+         if(implicit_i.end()==pos)
+         {
+            throw new NoSuchElementException
+               ("MaxSumController::getImplicitFactor()",
+                "No such implicit factor in factor graph.");
+         }
+         return pos->second;
+      }
+
       /**
        * Accessor method for (writable) reference to factor function.
        * This version returns a writable reference to a function to allow
@@ -406,7 +1596,11 @@ namespace maxsum
        */
       void notifyFactor(FactorID id)
       {
-         var2facMsgs_i.notify(id);
+         int f = graph_i.findFactor(id);
+         if(0<=f)
+         {
+            graph_i.factorNotices().notify(f);
+         }
       }
 
       /**
@@ -442,6 +1636,85 @@ namespace maxsum
          return pos->second;
       }
 
+      /**
+       * Compiles the current set of factors into the flat representation
+       * used to pass messages. This is called automatically by
+       * MaxSumController::optimise whenever factors have been added,
+       * removed or had their domains changed, but may be called explicitly
+       * once all such changes are finished, for example, to exclude the cost
+       * of compilation from timing measurements.
+       * @post messages for edges that remain in the factor graph are
+       * preserved.
+       */
+      void compile();
+
+      /**
+       * Saves this controller's factors to a binary file, together with the
+       * domain size of every variable they depend on. Values are written in
+       * the native byte order and precision, and can be read back with
+       * MaxSumController::load on any platform with the same
+       * maxsum::ValType and byte order.
+       * @param[in] path the name of the file to create or overwrite.
+       * @param[in] withMessages if true, and the factor graph has not changed
+       * since it was last compiled, then the current messages and variable
+       * values are also saved, so that optimisation can be warm started
+       * after the file is loaded.
+       * @throws FileFormatException if the file cannot be written, or this
+       * controller has any implicit factors.
+       */
+      void save(const std::string& path, bool withMessages=false) const;
+
+      /**
+       * Replaces the contents of this controller with the factors saved in
+       * a file by MaxSumController::save. The file is memory mapped, and
+       * each factor's values are copied directly from the mapped file.
+       * Every variable in the file is registered with its saved domain size.
+       * If the file contains messages, these are restored, so that the
+       * next call to MaxSumController::optimise resumes from them.
+       * @param[in] path the name of the file to load.
+       * @throws FileFormatException if the file cannot be read, or is not
+       * a valid factor graph file for this build of the library.
+       * @throws InconsistentDomainException if a variable in the file is
+       * already registered with a different domain size.
+       * @post If an exception is thrown, this controller is unchanged.
+       */
+      void load(const std::string& path);
+
+      /**
+       * Writes a checkpoint of the current message state to a binary stream.
+       * The checkpoint contains the value of every variable, and for every
+       * factor, its total value and the messages along each of its edges,
+       * but not the factors themselves. The factor graph is compiled first,
+       * if necessary.
+       * @param[out] out the stream to write, which should be opened in
+       * binary mode.
+       * @throws FileFormatException if the stream cannot be written.
+       * @see MaxSumController::restoreCheckpoint
+       */
+      void saveCheckpoint(std::ostream& out);
+
+      /**
+       * Restores message state from a checkpoint written by
+       * MaxSumController::saveCheckpoint, so that the next call to
+       * MaxSumController::optimise resumes from where the checkpoint was
+       * taken, rather than from zero messages.
+       * <p>
+       * The checkpoint need not have been taken from exactly the same
+       * factor graph. State is matched by factor and variable id: messages
+       * are restored along every edge that is still in the graph and whose
+       * variable has the same domain size, and totals are restored for
+       * every factor whose domain is unchanged. All other state is left as
+       * it is, so factors that have been added or changed since the
+       * checkpoint are optimised as usual.
+       * </p>
+       * @param[in] in the stream to read, which should be opened in
+       * binary mode.
+       * @throws FileFormatException if the stream is not a valid checkpoint
+       * for this build of the library.
+       * @post If an exception is thrown, no message state is changed.
+       */
+      void restoreCheckpoint(std::istream& in);
+
       /**
        * Runs the max-sum algorithm to optimise the values for each variable.
        * @post ::getValue(VarID id) will return the optimal value for the
@@ -450,13 +1723,118 @@ namespace maxsum
        */
       int optimise();
 
-   }; // MaxSumController class
+      /**
+       * Runs the max-sum algorithm until it converges, the maximum number
+       * of iterations is reached, or the specified deadline passes,
+       * whichever is first. The deadline is checked between node updates
+       * (or half-iterations for the MaxSumController::FLOODING schedule),
+       * so this returns soon after the deadline, even if the graph has not
+       * converged.
+       * <p>
+       * On loopy graphs, max-sum may oscillate, so the assignment found in
+       * the last iteration is not necessarily the best. While this runs,
+       * the utility of the current assignment is therefore tracked, by
+       * re-evaluating only the factors that depend on variables whose
+       * values have changed, and once it stops, each variable is set to
+       * its value in the best assignment seen.
+       * </p>
+       * <p>
+       * As with MaxSumController::optimise(), any nodes that have not been
+       * updated when this returns keep their notices, so a subsequent call
+       * continues from where this one stopped.
+       * </p>
+       * @param[in] deadline the time by which to stop.
+       * @returns the number of max-sum iterations performed, including any
+       * partial iteration cut short by the deadline.
+       * @see MaxSumController::getUtility
+       */
+      int optimise(Clock::time_point deadline);
 
-   /**
-    * Default maximum maxnorm allowed between the old and new values
-    * of a message, before it is assumed to have converged.
-    */
-   const ValType MaxSumController::DEFAULT_MAXNORM_THRESHOLD=0.0000001;
+      /**
+       * Runs MaxSumController::optimise in a new thread, and enables
+       * snapshots, so that the assignment can be read while it runs. Once
+       * the run finishes, snapshots are turned back on or off as they were
+       * before this was called, so later calls to optimise only publish
+       * snapshots if the caller enabled them explicitly.
+       * <p>
+       * Until the returned future is ready, the only member functions that
+       * may be called on this controller are MaxSumController::snapshot and
+       * MaxSumController::cancel. In particular, the factor graph must not
+       * be changed, and the future must be waited on before this
+       * controller is destroyed.
+       * </p>
+       * @returns a future for the number of iterations performed. Any
+       * exception thrown by MaxSumController::optimise is rethrown by
+       * std::future::get.
+       * @see MaxSumController::setSnapshots
+       */
+      std::future<int> optimiseAsync();
+
+      /**
+       * Runs MaxSumController::optimise(Clock::time_point) in a new thread,
+       * and enables snapshots until it finishes. The final snapshot is the
+       * best assignment seen.
+       * @param[in] deadline the time by which to stop.
+       * @see MaxSumController::optimiseAsync()
+       */
+      std::future<int> optimiseAsync(Clock::time_point deadline);
+
+      /**
+       * Asks the current call to MaxSumController::optimise, if any, to stop
+       * as soon as possible. This may be called from any thread. Any nodes
+       * that have not been updated keep their notices, as when a deadline
+       * passes. The request is cleared when MaxSumController::optimise
+       * returns, or by the next call to MaxSumController::optimiseAsync.
+       */
+      void cancel()
+      {
+         cancel_i.store(true);
+      }
+
+      /**
+       * Turns snapshots on or off. While enabled, MaxSumController::optimise
+       * publishes an immutable copy of the assignment after each iteration,
+       * and once more before it returns, so that other threads can read a
+       * consistent assignment through MaxSumController::snapshot while the
+       * solver runs. Each snapshot is a new allocation, so snapshots are
+       * disabled by default.
+       * @param[in] enabled true to publish snapshots.
+       * @param[in] totals true if snapshots should also include the total
+       * value of each factor table, which must be copied for each one.
+       */
+      void setSnapshots(bool enabled, bool totals=false)
+      {
+         snapshots_i = enabled;
+         snapshotTotals_i = enabled && totals;
+      }
+
+      /**
+       * Returns true if snapshots are enabled.
+       * @see MaxSumController::setSnapshots
+       */
+      bool isSnapshots() const
+      {
+         return snapshots_i;
+      }
+
+      /**
+       * Returns the most recently published snapshot of the assignment, or
+       * null if none has been published. This never blocks the solver,
+       * and may be called from any thread, even while
+       * MaxSumController::optimise runs in another.
+       */
+      SnapshotPtr snapshot() const
+      {
+         return std::atomic_load(&snapshot_i);
+      }
+
+      /**
+       * Returns the sum of every factor's value for the current assignment
+       * of values to variables.
+       */
+      ValType getUtility() const;
+
+   }; // MaxSumController class
 
    /**
     * Utility function used to dump the current state of this controller
@@ -0,0 +1,101 @@
+/**
+ * @file PartitionTransport.h
+ * Defines the maxsum::PartitionTransport interface, which is used by
+ * maxsum::PartitionedController to exchange boundary messages between the
+ * partitions of a factor graph.
+ */
+#ifndef MAXSUM_PARTITION_TRANSPORT_H
+#define MAXSUM_PARTITION_TRANSPORT_H
+
+#include <vector>
+#include "common.h"
+
+namespace maxsum
+{
+   /**
+    * Interface used by maxsum::PartitionedController to communicate with
+    * the controllers of the other partitions of a factor graph. Partitions
+    * are numbered from 0 to PartitionTransport::noPartitions-1, and may run
+    * in different threads, processes or machines. An implementation based
+    * on MPI would typically map partitions to ranks, and implement
+    * PartitionTransport::exchange with <code>MPI_Alltoallv</code> and
+    * PartitionTransport::allTrue with <code>MPI_Allreduce</code>.
+    * <p>
+    * Both operations are collective: every partition must call them the
+    * same number of times, in the same order.
+    * </p>
+    * @see maxsum::LocalTransport
+    */
+   class PartitionTransport
+   {
+   public:
+
+      /**
+       * Batch of messages sent from one partition to another. Each message
+       * is for one variable, and has one value for each value in the
+       * variable's domain, as given by maxsum::getDomainSize. The values of
+       * all messages are concatenated in the same order as the variables.
+       * A batch may also contain variables without values, in which case
+       * Batch::values is empty.
+       */
+      struct Batch
+      {
+         /**
+          * The variable of each message.
+          */
+         std::vector<VarID> vars;
+
+         /**
+          * The concatenated values of every message.
+          */
+         std::vector<ValType> values;
+
+         /**
+          * Removes every message from this batch, keeping its storage.
+          */
+         void clear()
+         {
+            vars.clear();
+            values.clear();
+         }
+      };
+
+      /**
+       * Virtual destructor.
+       */
+      virtual ~PartitionTransport() {}
+
+      /**
+       * Returns the number of the calling partition.
+       */
+      virtual int rank() const = 0;
+
+      /**
+       * Returns the total number of partitions.
+       */
+      virtual int noPartitions() const = 0;
+
+      /**
+       * Sends one batch to every partition, and receives one batch from
+       * every partition.
+       * @param[in] outgoing the batch to send to each partition, indexed by
+       * rank. The batch for the calling partition is ignored.
+       * @param[out] incoming resized to PartitionTransport::noPartitions,
+       * and set to the batch received from each partition, indexed by rank.
+       * The batch from the calling partition is empty.
+       * @pre <code>outgoing</code> has one batch for each partition.
+       */
+      virtual void exchange(const std::vector<Batch>& outgoing,
+            std::vector<Batch>& incoming) = 0;
+
+      /**
+       * Returns true if and only if every partition passes true.
+       * @param[in] value the calling partition's vote.
+       */
+      virtual bool allTrue(bool value) = 0;
+
+   }; // class PartitionTransport
+
+} // namespace maxsum
+
+#endif // MAXSUM_PARTITION_TRANSPORT_H
@@ -0,0 +1,282 @@
+/**
+ * @file PartitionedController.h
+ * Defines the maxsum::PartitionedController class, which runs max-sum on
+ * one partition of a factor graph that is divided between several
+ * controllers.
+ */
+#ifndef MAXSUM_PARTITIONED_CONTROLLER_H
+#define MAXSUM_PARTITIONED_CONTROLLER_H
+
+#include <map>
+#include <memory>
+#include <vector>
+#include "common.h"
+#include "DiscreteFunction.h"
+#include "ImplicitFactor.h"
+#include "MaxSumController.h"
+#include "PartitionTransport.h"
+
+namespace maxsum
+{
+   /**
+    * Runs max-sum on one partition of a factor graph that is too large for
+    * a single maxsum::MaxSumController. Each partition owns a disjoint
+    * subset of the factors, and any variable connected to factors in more
+    * than one partition is on the partition <em>boundary</em>.
+    * <p>
+    * Each partition keeps its own copy of every boundary variable, together
+    * with a <em>ghost</em> factor for it, whose message to the variable is
+    * the sum of the messages sent to that variable by factors in every
+    * other partition. The messages sent by each copy of a boundary variable
+    * are therefore the same as in the full factor graph. Once per
+    * iteration, each partition sends the sum of its own factors' messages
+    * to each boundary variable to the other partitions that share it, in
+    * one batch per partition. As with any other message, a sum is only
+    * sent if its maxnorm change since it was last sent exceeds the
+    * maxnorm threshold.
+    * </p>
+    * <p>
+    * The algorithm has converged when no partition has any pending
+    * notices, and no partition has sent any boundary messages. Since this
+    * is checked by every partition after each iteration, all partitions
+    * stop after the same number of iterations.
+    * </p>
+    * <p>
+    * Every partition must call PartitionedController::optimise together,
+    * since it uses the collective operations of its
+    * maxsum::PartitionTransport. Variables must be registered with the same
+    * domain sizes by every process.
+    * </p>
+    */
+   class PartitionedController
+   {
+   public:
+
+      /**
+       * Type of batch used to exchange boundary messages.
+       */
+      typedef PartitionTransport::Batch Batch;
+
+   private:
+
+      /**
+       * State of one boundary variable.
+       */
+      struct BoundaryVar
+      {
+         /**
+          * The id of the variable.
+          */
+         VarID var;
+
+         /**
+          * The id of the variable's ghost factor.
+          */
+         FactorID ghost;
+
+         /**
+          * The ranks of the other partitions that share this variable, in
+          * increasing order.
+          */
+         std::vector<int> sharers;
+
+         /**
+          * The sum of local factor messages to this variable, as it was last
+          * sent to the other partitions.
+          */
+         std::vector<ValType> sent;
+
+         /**
+          * The last sum received from each partition in
+          * BoundaryVar::sharers, concatenated in the same order.
+          */
+         std::vector<ValType> received;
+      };
+
+      /**
+       * Controller for the factors owned by this partition, and the ghost
+       * factors of its boundary variables. It performs a single iteration
+       * each time it is optimised.
+       */
+      MaxSumController controller_i;
+
+      /**
+       * Used to communicate with the other partitions.
+       */
+      PartitionTransport& transport_i;
+
+      /**
+       * Ghost factors are given consecutive ids starting from this one.
+       */
+      FactorID ghostBase_i;
+
+      /**
+       * The maximum number of iterations performed by
+       * PartitionedController::optimise.
+       */
+      int maxIterations_i;
+
+      /**
+       * False if the factors owned by this partition have changed since the
+       * boundary was last found.
+       */
+      bool boundaryValid_i;
+
+      /**
+       * State of each boundary variable, in increasing order of id.
+       */
+      std::vector<BoundaryVar> boundary_i;
+
+      /**
+       * Position of each boundary variable in boundary_i.
+       */
+      std::map<VarID,int> boundaryIndex_i;
+
+      /**
+       * Batch to be sent to each partition.
+       */
+      std::vector<Batch> outgoing_i;
+
+      /**
+       * Batch received from each partition.
+       */
+      std::vector<Batch> incoming_i;
+
+      /**
+       * Scratch space for the sum of local factor messages to a boundary
+       * variable.
+       */
+      std::vector<ValType> sum_i;
+
+      // The transport is shared by reference, so partitions are not copied.
+      PartitionedController(const PartitionedController&);
+      PartitionedController& operator=(const PartitionedController&);
+
+      /**
+       * Finds the boundary variables by exchanging the list of
+       * variables of each partition, and creates a ghost factor for each.
+       * @post all boundary messages are reset to zero.
+       */
+      void findBoundary();
+
+      /**
+       * Adds the sum of local factor messages to each boundary variable to
+       * the outgoing batches, if it has changed significantly since it
+       * was last sent.
+       * @returns the number of boundary variables whose sums were sent.
+       */
+      int sendBoundary();
+
+      /**
+       * Updates the ghost factors from the incoming batches.
+       */
+      void receiveBoundary();
+
+   public:
+
+      /**
+       * Constructs a controller for one partition of a factor graph.
+       * @param[in] transport used to communicate with the other partitions.
+       * It must outlive this controller.
+       * @param[in] ghostBase the first of a range of factor ids that is not
+       * used by any factor in this partition, which are used for ghost
+       * factors.
+       * @param[in] maxIterations the maximum number of iterations performed
+       * by PartitionedController::optimise.
+       * @param[in] maxnorm the maxnorm threshold used both for local
+       * messages and for boundary messages.
+       */
+      PartitionedController
+      (
+       PartitionTransport& transport,
+       FactorID ghostBase,
+       int maxIterations=MaxSumController::DEFAULT_MAX_ITERATIONS,
+       ValType maxnorm=MaxSumController::DEFAULT_MAXNORM_THRESHOLD
+      )
+      : controller_i(1,maxnorm), transport_i(transport),
+        ghostBase_i(ghostBase), maxIterations_i(maxIterations),
+        boundaryValid_i(false) {}
+
+      /**
+       * Sets a factor owned by this partition.
+       * @see MaxSumController::setFactor
+       */
+      void setFactor(FactorID id, const DiscreteFunction& factor)
+      {
+         controller_i.setFactor(id,factor);
+         boundaryValid_i = false;
+      }
+
+      /**
+       * Sets an implicit factor owned by this partition.
+       * @see MaxSumController::setImplicitFactor
+       */
+      void setImplicitFactor(FactorID id,
+            std::shared_ptr<const ImplicitFactor> pFactor)
+      {
+         controller_i.setImplicitFactor(id,pFactor);
+         boundaryValid_i = false;
+      }
+
+      /**
+       * Removes a factor owned by this partition.
+       * @see MaxSumController::removeFactor
+       */
+      void removeFactor(FactorID id)
+      {
+         controller_i.removeFactor(id);
+         boundaryValid_i = false;
+      }
+
+      /**
+       * Returns the controller for this partition, which also contains the
+       * ghost factors of its boundary variables. This can be used to
+       * change settings such as the number of worker threads, but factors
+       * should only be changed through this PartitionedController.
+       */
+      MaxSumController& local() { return controller_i; }
+
+      /**
+       * Returns the number of variables shared with other partitions.
+       */
+      int noBoundaryVars() const { return boundary_i.size(); }
+
+      /**
+       * Returns true if the specified variable is shared with at least one
+       * other partition.
+       */
+      bool isBoundary(VarID var) const
+      {
+         return 0!=boundaryIndex_i.count(var);
+      }
+
+      /**
+       * Returns the value assigned to a variable in this partition.
+       * @see MaxSumController::getValue
+       */
+      ValType getValue(VarID var) const
+      {
+         return controller_i.getValue(var);
+      }
+
+      /**
+       * Returns the sum of the values of the factors owned by this
+       * partition, for the current assignment. The utility of the full
+       * factor graph is the sum of the utilities of every partition.
+       */
+      ValType getUtility() const;
+
+      /**
+       * Runs max-sum on the full factor graph, in cooperation with every
+       * other partition, until it converges or the maximum number of
+       * iterations is reached.
+       * @returns the number of iterations performed, which is the same
+       * for every partition.
+       */
+      int optimise();
+
+   }; // class PartitionedController
+
+} // namespace maxsum
+
+#endif // MAXSUM_PARTITIONED_CONTROLLER_H
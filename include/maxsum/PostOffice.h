@@ -239,20 +239,59 @@ namespace util
          deepCopyMembers();
       }
       
+      /**
+       * Move constructor takes ownership of all messages managed by
+       * another post office, without copying them.
+       * @post <code>rhs</code> is left empty.
+       */
+      PostOffice(PostOffice&& rhs) noexcept
+         : curOutboxes_i(), prevOutboxes_i(),
+           curInboxes_i(), prevInboxes_i(),
+           senders_i(&curOutboxes_i), receivers_i(&curInboxes_i),
+           notices_i()
+      {
+         swap(rhs);
+      }
+
       /**
        * Deep copy assignment.
+       * Any messages previously managed by this post office are freed.
        */
       PostOffice& operator=(const PostOffice& rhs)
       {
-         curOutboxes_i = rhs.curOutboxes_i;
-         prevOutboxes_i = rhs.prevOutboxes_i;
-         curInboxes_i = rhs.curInboxes_i;
-         prevInboxes_i = rhs.prevInboxes_i;
+         PostOffice copy(rhs);
+         swap(copy);
+         return *this;
+      }
+
+      /**
+       * Move assignment takes ownership of all messages managed by
+       * another post office, without copying them.
+       * @post <code>rhs</code> is left with the previous contents of this
+       * post office, which are freed when it is destroyed.
+       */
+      PostOffice& operator=(PostOffice&& rhs) noexcept
+      {
+         swap(rhs);
+         return *this;
+      }
+
+      /**
+       * Swaps the contents of this post office with another. Since messages
+       * are stored by pointer, no messages are copied, and any external
+       * pointers to messages remain valid.
+       */
+      void swap(PostOffice& rhs) noexcept
+      {
+         curOutboxes_i.swap(rhs.curOutboxes_i);
+         prevOutboxes_i.swap(rhs.prevOutboxes_i);
+         curInboxes_i.swap(rhs.curInboxes_i);
+         prevInboxes_i.swap(rhs.prevInboxes_i);
+         std::swap(notices_i,rhs.notices_i);
          senders_i.setMap(&curOutboxes_i);
          receivers_i.setMap(&curInboxes_i);
-         notices_i = rhs.notices_i;
-         deepCopyMembers();
-         return *this;
+         rhs.senders_i.setMap(&rhs.curOutboxes_i);
+         rhs.receivers_i.setMap(&rhs.curInboxes_i);
       }
 
       /**
@@ -403,28 +442,34 @@ namespace util
          //*********************************************************************
          // Otherwise swap the list of outboxes for this sender in one go.
          //*********************************************************************
-         prevOutboxes_i[s].swap(curOutPos->second);
+         typename OutboxMap::iterator prevOutPos = prevOutboxes_i.find(s);
+         assert(prevOutboxes_i.end()!=prevOutPos); // should never happen.
+         prevOutPos->second.swap(curOutPos->second);
 
          //*********************************************************************
-         // Inbox pointers need the be swapped individually
+         // Inbox pointers need the be swapped individually, but only for
+         // the receivers that are connected to this sender. Notice that we
+         // never modify the structure of any map here, so that different
+         // senders can safely be swapped concurrently by different threads.
          //*********************************************************************
-         for(typename InboxMap::iterator curIt=curInboxes_i.begin();
-               curIt!=curInboxes_i.end(); ++curIt)
+         const PrivOutMsgMap& receivers = prevOutPos->second;
+         for(typename PrivOutMsgMap::const_iterator rIt=receivers.begin();
+               rIt!=receivers.end(); ++rIt)
          {
-            //******************************************************************
-            // If the current receiver is not related to this sender, continue
-            // to the next receiver.
-            //******************************************************************
+            typename InboxMap::iterator curIt = curInboxes_i.find(rIt->first);
+            typename InboxMap::iterator prevIt=prevInboxes_i.find(rIt->first);
+            assert(curInboxes_i.end()!=curIt);
+            assert(prevInboxes_i.end()!=prevIt);
+
             PrivInMsgIt curMsgPos = curIt->second.find(s);
-            if(curIt->second.end()==curMsgPos)
-            {
-               continue;
-            }
+            PrivInMsgIt prevMsgPos = prevIt->second.find(s);
+            assert(curIt->second.end()!=curMsgPos);
+            assert(prevIt->second.end()!=prevMsgPos);
 
             //******************************************************************
-            // Otherwise swap the current and previous in message pointers.
+            // Swap the current and previous in message pointers.
             //******************************************************************
-            Message*& prevPtr = prevInboxes_i[curIt->first][s];
+            Message*& prevPtr = prevMsgPos->second;
             Message*&  curPtr = curMsgPos->second;
             Message*   tmpPtr = prevPtr;
 
@@ -0,0 +1,83 @@
+/**
+ * @file PottsFactor.h
+ * Defines the maxsum::PottsFactor class, a pairwise factor that only
+ * depends on whether two variables take the same value.
+ */
+#ifndef MAXSUM_POTTS_FACTOR_H
+#define MAXSUM_POTTS_FACTOR_H
+
+#include "common.h"
+#include "ImplicitFactor.h"
+
+namespace maxsum
+{
+   /**
+    * Pairwise factor whose value is <code>same</code> if both its variables
+    * take the same value, and <code>different</code> otherwise. Variables
+    * with different domain sizes are allowed, in which case values outside
+    * the smaller domain are always different.
+    * <p>
+    * Max marginals are computed in time linear in the domain sizes, rather
+    * than their product, by keeping the best and second best value of each
+    * input message.
+    * </p>
+    */
+   class PottsFactor : public ImplicitFactor
+   {
+   private:
+
+      /**
+       * Value of this factor when both variables take the same value.
+       */
+      ValType same_i;
+
+      /**
+       * Value of this factor when the variables take different values.
+       */
+      ValType different_i;
+
+   public:
+
+      /**
+       * Constructs a Potts factor between two variables.
+       * @param[in] var1 the first variable.
+       * @param[in] var2 the second variable.
+       * @param[in] same value of the factor when both variables are equal.
+       * @param[in] different value of the factor when they are not.
+       * @throws UnknownVariableException if either variable is not
+       * registered.
+       * @throws BadDomainException if the two variables are the same.
+       */
+      PottsFactor(VarID var1, VarID var2, ValType same, ValType different);
+
+      /**
+       * Returns the value of this factor when both variables are equal.
+       */
+      ValType same() const { return same_i; }
+
+      /**
+       * Returns the value of this factor when the variables are not equal.
+       */
+      ValType different() const { return different_i; }
+
+      /**
+       * Returns the value of this factor for a joint assignment.
+       */
+      ValType value(const ValIndex* pSubs) const
+      {
+         return pSubs[0]==pSubs[1] ? same_i : different_i;
+      }
+
+      /**
+       * Max marginalises the sum of this factor and its input messages
+       * onto both variables.
+       * @see ImplicitFactor::maxMarginals
+       */
+      void maxMarginals(const ValType* const* ppMsgs,
+            ValType* const* ppOut) const;
+
+   }; // class PottsFactor
+
+} // namespace maxsum
+
+#endif // MAXSUM_POTTS_FACTOR_H
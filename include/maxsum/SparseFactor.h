@@ -0,0 +1,118 @@
+/**
+ * @file SparseFactor.h
+ * Defines the maxsum::SparseFactor class, a factor that takes a default
+ * value for all but a few joint assignments.
+ */
+#ifndef MAXSUM_SPARSE_FACTOR_H
+#define MAXSUM_SPARSE_FACTOR_H
+
+#include <map>
+#include <vector>
+#include "common.h"
+#include "ImplicitFactor.h"
+
+namespace maxsum
+{
+   /**
+    * Factor that takes the same default value for every joint assignment,
+    * except for a list of exceptions, each of which has its own value.
+    * Only the exceptions are stored, so the size of a sparse factor does
+    * not depend on the product of its variables' domain sizes.
+    * <p>
+    * Max marginals are computed in two parts. Every exception is visited
+    * once. For the default value, the best joint assignments of the other
+    * variables are enumerated in decreasing order of their total message
+    * value, until one is found that is not an exception. Since each
+    * exception can only be skipped once, the cost depends on the number of
+    * exceptions, rather than the number of joint assignments.
+    * </p>
+    * <p>
+    * Exceptions should all be set before the factor is passed to
+    * maxsum::MaxSumController::setImplicitFactor, since implicit factors
+    * must not change once they are in a factor graph.
+    * </p>
+    */
+   class SparseFactor : public ImplicitFactor
+   {
+   public:
+
+      /**
+       * Type of list used to specify a joint assignment, which has one
+       * value for each variable, in the same order as SparseFactor::vars.
+       */
+      typedef std::vector<ValIndex> Assignment;
+
+      /**
+       * Type of map used to store exceptions.
+       */
+      typedef std::map<Assignment,ValType> ExceptionMap;
+
+   private:
+
+      /**
+       * The value of every joint assignment that is not an exception.
+       */
+      ValType default_i;
+
+      /**
+       * The value of each exception.
+       */
+      ExceptionMap exceptions_i;
+
+   public:
+
+      /**
+       * Constructs a sparse factor with no exceptions.
+       * @param[in] begin iterator to the start of the variable list.
+       * @param[in] end iterator to the end of the variable list.
+       * @param[in] defaultValue the value of every joint assignment that is
+       * not an exception.
+       * @throws UnknownVariableException if any variable is not registered.
+       */
+      template<class VarIt> SparseFactor
+      (
+       VarIt begin,
+       VarIt end,
+       ValType defaultValue
+      )
+      : ImplicitFactor(begin,end), default_i(defaultValue), exceptions_i() {}
+
+      /**
+       * Sets the value of a joint assignment, making it an exception.
+       * @param[in] subs the value of each variable, in the same order as
+       * SparseFactor::vars.
+       * @param[in] val the value of this factor for this assignment.
+       * @throws OutOfRangeException if <code>subs</code> is not a valid
+       * joint assignment.
+       */
+      void set(const Assignment& subs, ValType val);
+
+      /**
+       * Returns the value of every joint assignment that is not an
+       * exception.
+       */
+      ValType defaultValue() const { return default_i; }
+
+      /**
+       * Returns the exceptions to the default value.
+       */
+      const ExceptionMap& exceptions() const { return exceptions_i; }
+
+      /**
+       * Returns the value of this factor for a joint assignment.
+       */
+      ValType value(const ValIndex* pSubs) const;
+
+      /**
+       * Max marginalises the sum of this factor and its input messages
+       * onto every variable.
+       * @see ImplicitFactor::maxMarginals
+       */
+      void maxMarginals(const ValType* const* ppMsgs,
+            ValType* const* ppOut) const;
+
+   }; // class SparseFactor
+
+} // namespace maxsum
+
+#endif // MAXSUM_SPARSE_FACTOR_H
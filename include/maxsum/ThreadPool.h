@@ -0,0 +1,206 @@
+/**
+ * @file ThreadPool.h
+ * Defines the maxsum::util::ThreadPool class, which is used by
+ * maxsum::MaxSumController to update messages in parallel.
+ * @attention The types defined in this header are not intended to form part
+ * of the public interface to the maxsum library.
+ */
+#ifndef MAXSUM_UTIL_THREAD_POOL_H
+#define MAXSUM_UTIL_THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace maxsum
+{
+namespace util
+{
+   /**
+    * Fixed size pool of worker threads, used to process a range of
+    * independent work items in parallel. Each call to ThreadPool::run
+    * divides the range [0,n) into one contiguous block per thread. Each
+    * thread processes small chunks of its own block, and once its own block
+    * is exhausted, steals chunks from the blocks of the other threads. This
+    * balances the load when the cost of each work item varies, for example,
+    * because factors have different numbers of neighbours.
+    *
+    * The calling thread always participates as worker 0, so a pool of size
+    * <code>n</code> creates <code>n-1</code> additional threads, and a pool
+    * of size 1 simply runs all work on the calling thread.
+    */
+   class ThreadPool
+   {
+   public:
+
+      /**
+       * Interface for work submitted to a maxsum::util::ThreadPool.
+       */
+      class Task
+      {
+      public:
+
+         /**
+          * Processes the work items in the range [begin,end).
+          * @param[in] begin index of first work item to process.
+          * @param[in] end index one past the last work item to process.
+          * @param[in] worker index of the calling worker in [0,size()).
+          * Work items processed by the same worker are never processed
+          * concurrently, so this can be used to index per-thread buffers.
+          */
+         virtual void run(int begin, int end, int worker)=0;
+
+         /**
+          * Virtual destructor.
+          */
+         virtual ~Task() {}
+
+      }; // class Task
+
+   private:
+
+      /**
+       * Block of work items assigned to one worker, which may be consumed
+       * concurrently by its owner, and by any worker trying to steal work.
+       * Each block is aligned to its own cache line to avoid false sharing.
+       */
+      struct alignas(64) Range
+      {
+         /**
+          * Index of the next unclaimed work item.
+          */
+         std::atomic<int> next;
+
+         /**
+          * Index one past the last work item in this block.
+          */
+         int end;
+      };
+
+      /**
+       * The number of workers in this pool, including the calling thread.
+       */
+      const int noThreads_i;
+
+      /**
+       * Work item blocks, one for each worker, constructed in
+       * ThreadPool::rangeStorage_i.
+       */
+      Range* ranges_i;
+
+      /**
+       * Storage for ThreadPool::ranges_i, with room to align the first block
+       * to a cache line. C++11 does not guarantee that new respects the
+       * alignment of over-aligned types, so this is aligned explicitly.
+       */
+      char* rangeStorage_i;
+
+      /**
+       * Number of work items claimed by a worker at a time.
+       */
+      int grain_i;
+
+      /**
+       * The task currently being processed.
+       */
+      Task* pTask_i;
+
+      /**
+       * Additional worker threads.
+       */
+      std::vector<std::thread> threads_i;
+
+      /**
+       * Mutex protecting the state shared with the worker threads.
+       */
+      std::mutex mutex_i;
+
+      /**
+       * Used to tell worker threads that a new task is available.
+       */
+      std::condition_variable start_i;
+
+      /**
+       * Used to tell the calling thread that all workers are finished.
+       */
+      std::condition_variable done_i;
+
+      /**
+       * Incremented each time a new task is started.
+       */
+      unsigned long generation_i;
+
+      /**
+       * Number of worker threads still processing the current task.
+       */
+      int noBusy_i;
+
+      /**
+       * True once this pool is being destroyed.
+       */
+      bool stopping_i;
+
+      /**
+       * First exception thrown by any worker during the current task.
+       */
+      std::exception_ptr error_i;
+
+      /**
+       * Main loop for each additional worker thread.
+       */
+      void workerLoop(int worker);
+
+      /**
+       * Claims and processes work items until none are left.
+       */
+      void process(int worker);
+
+      /**
+       * Copy construction is not supported.
+       */
+      ThreadPool(const ThreadPool&);
+
+      /**
+       * Copy assignment is not supported.
+       */
+      ThreadPool& operator=(const ThreadPool&);
+
+   public:
+
+      /**
+       * Constructs a pool with the specified number of workers.
+       * @param[in] noThreads the total number of workers, including
+       * the calling thread. Values less than 1 are treated as 1.
+       */
+      explicit ThreadPool(int noThreads);
+
+      /**
+       * Stops and joins all worker threads.
+       */
+      ~ThreadPool();
+
+      /**
+       * Returns the number of workers in this pool, including the
+       * calling thread.
+       */
+      int size() const { return noThreads_i; }
+
+      /**
+       * Processes the work items in the range [0,n) in parallel, and
+       * returns once all items have been processed.
+       * @param[in] n the number of work items.
+       * @param[in] task the task used to process each block of work items.
+       * @throws any exception thrown by <code>task</code> is rethrown in
+       * the calling thread, once all workers have finished.
+       */
+      void run(int n, Task& task);
+
+   }; // class ThreadPool
+
+} // namespace util
+} // namespace maxsum
+
+#endif // MAXSUM_UTIL_THREAD_POOL_H
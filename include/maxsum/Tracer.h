@@ -0,0 +1,249 @@
+/**
+ * @file Tracer.h
+ * Defines the maxsum::Tracer class, which profiles the main phases of
+ * maxsum::MaxSumController::optimise.
+ */
+#ifndef MAXSUM_TRACER_H
+#define MAXSUM_TRACER_H
+
+#include <chrono>
+#include <ostream>
+
+namespace maxsum
+{
+   /**
+    * Records the time spent in each phase of max-sum, for diagnosing
+    * performance. Tracing scopes are only compiled into the library if it
+    * is built with <code>MAXSUM_TRACE</code> defined (for example, with the
+    * CMake option of the same name), so that they cost nothing otherwise.
+    * When compiled in, scopes only record anything between calls to
+    * Tracer::start and Tracer::stop.
+    * <p>
+    * For each phase, the tracer aggregates the number of calls and total
+    * wall time across all threads. If requested and permitted by the
+    * operating system, it also reads Linux <code>perf_event</code> counters
+    * for the CPU cycles and cache misses of each calling thread. Phases are
+    * nested, and each total includes the time spent in any phases nested
+    * within it. Individual scopes may also be recorded as events, which can
+    * be written in the Chrome trace event format, and viewed with
+    * <code>chrome://tracing</code> or Perfetto.
+    * </p>
+    * <p>
+    * Each thread records into its own log, so scopes do not contend with
+    * each other. Tracer::start, Tracer::stop and the functions that read
+    * the results must not be called while any traced code is running.
+    * </p>
+    */
+   class Tracer
+   {
+   public:
+
+      /**
+       * The phases that are traced.
+       */
+      enum Phase
+      {
+         /**
+          * A whole call to MaxSumController::optimise.
+          */
+         OPTIMISE,
+
+         /**
+          * Adding a factor's input messages to its values, including any
+          * max marginals computed by the same fused kernel.
+          */
+         FACTOR_SUM,
+
+         /**
+          * Max marginalising a factor's total onto each of its variables,
+          * and updating its output messages.
+          */
+         MARGINALISE,
+
+         /**
+          * Summing a variable's input messages.
+          */
+         VARIABLE_SUM,
+
+         /**
+          * Normalising and updating a variable's output messages, and
+          * choosing its value.
+          */
+         NORMALISE,
+
+         /**
+          * The end of each iteration, which merges statistics, tracks the
+          * utility if needed, and decides whether to continue. Comparing
+          * each message with the maxnorm threshold is fused into the
+          * updates above.
+          */
+         CONVERGENCE,
+
+         /**
+          * Taking pending notices, and sending notices for changed messages
+          * and values.
+          */
+         NOTICES,
+
+         /**
+          * The number of phases.
+          */
+         NO_PHASES
+      };
+
+      /**
+       * Totals recorded for one phase.
+       */
+      struct PhaseTotals
+      {
+         /**
+          * The number of times the phase was entered.
+          */
+         long calls;
+
+         /**
+          * Total wall time spent in the phase, in seconds.
+          */
+         double seconds;
+
+         /**
+          * Total CPU cycles spent in the phase, or 0 if not counted.
+          */
+         long long cycles;
+
+         /**
+          * Total cache misses during the phase, or 0 if not counted.
+          */
+         long long cacheMisses;
+      };
+
+      /**
+       * Records one phase on the calling thread, from construction until
+       * destruction. Traced code should use MAXSUM_TRACE_SCOPE instead, so
+       * that scopes are only compiled in when requested.
+       */
+      class Scope
+      {
+      public:
+
+         /**
+          * Starts timing a phase, if the tracer is started.
+          */
+         explicit Scope(Phase phase);
+
+         /**
+          * Records the phase, if the tracer was started when it began.
+          */
+         ~Scope();
+
+      private:
+
+         // Scopes are tied to the calling thread, so are not copied.
+         Scope(const Scope&);
+         Scope& operator=(const Scope&);
+
+         /**
+          * The log of the calling thread, or 0 if nothing is recorded.
+          */
+         void* pLog_i;
+
+         /**
+          * The phase being recorded.
+          */
+         Phase phase_i;
+
+         /**
+          * The time at which the phase began.
+          */
+         std::chrono::steady_clock::time_point start_i;
+
+         /**
+          * Cycle count at which the phase began.
+          */
+         long long cycles_i;
+
+         /**
+          * Cache miss count at which the phase began.
+          */
+         long long cacheMisses_i;
+
+      }; // class Scope
+
+      /**
+       * Returns true if the library was built with tracing scopes.
+       */
+      static bool isCompiled();
+
+      /**
+       * Discards any previous results, and starts recording.
+       * @param[in] recordEvents true to record each scope as an event for
+       * Tracer::writeChromeTrace, as well as in the totals.
+       * @param[in] useCounters true to read hardware counters, if possible.
+       */
+      static void start(bool recordEvents=true, bool useCounters=false);
+
+      /**
+       * Stops recording, keeping the results so far.
+       */
+      static void stop();
+
+      /**
+       * Returns true if scopes are being recorded.
+       */
+      static bool isStarted();
+
+      /**
+       * Returns true if at least one thread has recorded a scope since
+       * Tracer::start, and hardware counters were successfully opened for
+       * every such thread.
+       */
+      static bool hasCounters();
+
+      /**
+       * Returns the totals recorded for one phase, across all threads.
+       */
+      static PhaseTotals totals(Phase phase);
+
+      /**
+       * Returns the name of a phase.
+       */
+      static const char* phaseName(Phase phase);
+
+      /**
+       * Returns the number of events recorded. Each thread stops recording
+       * events after Tracer::MAX_EVENTS, but continues to update totals.
+       */
+      static long noEvents();
+
+      /**
+       * Writes a table of the totals of every phase.
+       */
+      static void writeSummary(std::ostream& out);
+
+      /**
+       * Writes every recorded event as a JSON object in the Chrome trace
+       * event format, with one track for each thread.
+       */
+      static void writeChromeTrace(std::ostream& out);
+
+      /**
+       * The maximum number of events recorded by each thread.
+       */
+      static const long MAX_EVENTS = 1L<<20;
+
+   }; // class Tracer
+
+} // namespace maxsum
+
+/**
+ * Records the enclosing block as the specified maxsum::Tracer::Phase, if
+ * the library is built with <code>MAXSUM_TRACE</code> defined.
+ */
+#ifdef MAXSUM_TRACE
+#define MAXSUM_TRACE_SCOPE(phase) \
+   maxsum::Tracer::Scope maxsumTraceScope_(maxsum::Tracer::phase)
+#else
+#define MAXSUM_TRACE_SCOPE(phase) ((void)0)
+#endif
+
+#endif // MAXSUM_TRACER_H
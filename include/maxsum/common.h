@@ -24,19 +24,36 @@ namespace maxsum
     * Type of values stored by maxsum::DiscreteFunction objects.
     * This is, this type is used to represent the codomain of
     * mathematical functions represented by maxsum::DiscreteFunction objects.
+    * By default, this is double. If the library is built with the
+    * MAXSUM_SINGLE_PRECISION cmake option, then MAXSUM_SINGLE_PRECISION is
+    * defined and this is float, which halves the memory used for messages
+    * and factors. Programs that use the library must then also define
+    * MAXSUM_SINGLE_PRECISION before including any maxsum header.
     * @see maxsum::DiscreteFunction
     */
+#ifdef MAXSUM_SINGLE_PRECISION
+   typedef float ValType;
+#else
    typedef double ValType;
+#endif
+
+   /**
+    * Difference between 1 and the smallest value of type maxsum::ValType
+    * that is greater than 1.
+    */
+#ifdef MAXSUM_SINGLE_PRECISION
+   const ValType VALUE_EPSILON = FLT_EPSILON;
+#else
+   const ValType VALUE_EPSILON = DBL_EPSILON;
+#endif
 
    /**
     * Default tolerance used for comparing values of type maxsum::ValType.
     * This is the default value used by the maxsum::equalWithinTolerance
     * function, when comparing to maxsum::DiscreteFunction objects for equality.
-    * Note, if ValType is ever redefined, then this value should be changed
-    * appropriately also.
     * @see maxsum::equalWithinTolerance
     */
-   const ValType DEFAULT_VALUE_TOLERANCE = DBL_EPSILON * 1000.0;
+   const ValType DEFAULT_VALUE_TOLERANCE = VALUE_EPSILON * 1000;
 
    /**
     * Type used for uniquely identifying variables.
@@ -416,6 +416,64 @@ namespace maxsum
 
    }; // InconsistentDomainException
 
+   /**
+    * Exception thrown when a factor graph file or checkpoint cannot be read
+    * or written, or is not in the expected format.
+    * @see maxsum::MaxSumController::load
+    * @see maxsum::MaxSumController::save
+    * @see maxsum::MaxSumController::restoreCheckpoint
+    */
+   class FileFormatException : public std::exception
+   {
+   protected:
+
+      /**
+       * String identifying the source code locatioin where this exceptioin
+       * was generated.
+       */
+      const std::string where;
+
+      /**
+       * Message describing the cause of this exception.
+       */
+      const std::string mesg;
+
+      /**
+       * The message returned by FileFormatException::what, which is
+       * stored so that the returned pointer remains valid.
+       */
+      const std::string full;
+
+   public:
+
+      /**
+       * Constructs a new exception with specified location and message.
+       * @param[in] where_ the source code location where this exception was
+       * generated.
+       * @param[in] mesg_ Message describing the reason for this exception.
+       */
+      FileFormatException(const std::string where_, const std::string mesg_)
+         throw(): where(where_), mesg(mesg_),
+         full("FileFormatException: " + mesg_ + "\t[ in " + where_ + " ]") {}
+
+      /**
+       * Returns a message describing the cause of this exception, and
+       * the location it was thrown.
+       * @returns a message describing the cause of this exception, and
+       * the location it was thrown.
+       */
+      const char* what() const throw()
+      {
+         return full.c_str();
+      }
+
+      /**
+       * Destroys this exception and free's its allocated resources.
+       */
+      virtual ~FileFormatException() throw() {}
+
+   }; // FileFormatException
+
 } // namespace maxsum
 
 #endif // MAXSUM_EXCEPTIONS_H
@@ -10,6 +10,14 @@
  * Variables can be registered multiple times, but in each case the domain size
  * must not change. Variables must always be registered before they are
  * referenced by any function.
+ *
+ * All functions in this file are thread safe. Looking up a registered
+ * variable never takes a lock and, for dense variable ids starting at zero,
+ * is equivalent to indexing a contiguous array. Other ids are kept in a hash
+ * table, so memory grows with the number of variables, not the spread of
+ * their ids. New variables may be registered by any thread concurrently with
+ * such lookups, although registering ids outside the dense range briefly
+ * takes a lock.
  * 
  */
 #ifndef MAX_SUM_REGISTER_H
@@ -0,0 +1,502 @@
+/**
+ * @file BatchSolver.cpp
+ * Implementation of the maxsum::BatchSolver class.
+ * @see BatchSolver.h
+ * <p>
+ * Every array is indexed by element and then by problem, so each update
+ * below loops over the problems in a block innermost. Scratch space only
+ * holds one block, and is indexed in the same way, with the block size
+ * as its stride.
+ * </p>
+ */
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <maxsum/BatchSolver.h>
+#include <maxsum/MarginalPlan.h>
+#include <maxsum/exceptions.h>
+
+using namespace maxsum;
+
+/**
+ * Task used to solve blocks of problems in parallel.
+ */
+class BatchSolver::SolveTask : public util::ThreadPool::Task
+{
+public:
+
+   /**
+    * Constructs a task for solving every block of <code>solver</code>.
+    */
+   SolveTask(BatchSolver& solver) : solver_i(solver) {}
+
+   /**
+    * Solves the blocks in the range [begin,end).
+    */
+   void run(int begin, int end, int worker)
+   {
+      for(int block=begin; block<end; ++block)
+      {
+         solver_i.solveBlock(block,solver_i.workspaces_i[worker]);
+      }
+   }
+
+private:
+
+   /**
+    * The solver whose blocks are solved.
+    */
+   BatchSolver& solver_i;
+
+}; // class SolveTask
+
+/**
+ * Discards all problems, so that the structure can be changed.
+ */
+void BatchSolver::discardProblems()
+{
+   noProblems_i = 0;
+   tables_i.clear();
+   fac2var_i.clear();
+   var2fac_i.clear();
+   values_i.clear();
+   blockIterations_i.clear();
+}
+
+/**
+ * Reserves enough space in each workspace to update any node.
+ */
+void BatchSolver::reserveWorkspaces()
+{
+   ValIndex maxTable = 0;
+   for(int f=0; f<noFactors(); ++f)
+   {
+      maxTable = std::max(maxTable,tableSize(f));
+   }
+   ValIndex maxVar = 0;
+   for(int v=0; v<noVars(); ++v)
+   {
+      maxVar = std::max(maxVar,varSizes_i[v]);
+   }
+   for(std::vector<Workspace>::iterator it=workspaces_i.begin();
+         it!=workspaces_i.end(); ++it)
+   {
+      it->total.resize(maxTable*BLOCK_SIZE);
+      it->marginal.resize(maxVar*BLOCK_SIZE);
+      it->mean.resize(BLOCK_SIZE);
+   }
+}
+
+/**
+ * Adds a variable to the structure shared by every problem.
+ */
+int BatchSolver::addVariable(ValIndex size)
+{
+   if(1>size)
+   {
+      throw BadDomainException("BatchSolver::addVariable",
+            "Variables must have at least one value.");
+   }
+   discardProblems();
+   varSizes_i.push_back(size);
+   varEdgeStart_i.push_back(varEdgeStart_i.back());
+   return noVars()-1;
+
+} // function addVariable
+
+/**
+ * Adds a factor to the structure shared by every problem.
+ */
+int BatchSolver::addFactor(const std::vector<int>& vars)
+{
+   //***************************************************************************
+   // Check that the table is small enough to index.
+   //***************************************************************************
+   if(static_cast<int>(vars.size())>util::MAX_DOMAIN_DIMS)
+   {
+      throw BadDomainException("BatchSolver::addFactor",
+            "Factor depends on too many variables.");
+   }
+   ValIndex size = 1;
+   for(std::size_t j=0; j<vars.size(); ++j)
+   {
+      if( (0>vars[j]) || (noVars()<=vars[j]) )
+      {
+         throw OutOfRangeException("BatchSolver::addFactor",
+               "Factor depends on an unknown variable.");
+      }
+      if(std::count(vars.begin(),vars.begin()+j,vars[j]))
+      {
+         throw BadDomainException("BatchSolver::addFactor",
+               "Factor depends on the same variable twice.");
+      }
+      if(size > std::numeric_limits<ValIndex>::max()/varSizes_i[vars[j]])
+      {
+         throw BadDomainException("BatchSolver::addFactor",
+               "Factor table is too large.");
+      }
+      size *= varSizes_i[vars[j]];
+   }
+
+   //***************************************************************************
+   // Append the factor's edges, in order of significance.
+   //***************************************************************************
+   discardProblems();
+   ValIndex stride = 1;
+   for(std::size_t j=0; j<vars.size(); ++j)
+   {
+      edgeVar_i.push_back(vars[j]);
+      edgeStride_i.push_back(stride);
+      msgOffset_i.push_back(msgOffset_i.back()+varSizes_i[vars[j]]);
+      stride *= varSizes_i[vars[j]];
+   }
+   factorEdges_i.push_back(edgeVar_i.size());
+   tableOffset_i.push_back(tableOffset_i.back()+size);
+
+   //***************************************************************************
+   // Rebuild the edges of each variable, which are grouped by variable in
+   // the order in which their factors were added.
+   //***************************************************************************
+   varEdgeStart_i.assign(noVars()+1,0);
+   for(std::size_t e=0; e<edgeVar_i.size(); ++e)
+   {
+      ++varEdgeStart_i[edgeVar_i[e]+1];
+   }
+   for(int v=0; v<noVars(); ++v)
+   {
+      varEdgeStart_i[v+1] += varEdgeStart_i[v];
+   }
+   varEdges_i.resize(edgeVar_i.size());
+   std::vector<int> next(varEdgeStart_i.begin(),varEdgeStart_i.end()-1);
+   for(std::size_t e=0; e<edgeVar_i.size(); ++e)
+   {
+      varEdges_i[next[edgeVar_i[e]]++] = e;
+   }
+   return noFactors()-1;
+
+} // function addFactor
+
+/**
+ * Sets the number of problems in this batch.
+ */
+void BatchSolver::setNoProblems(int n)
+{
+   if(0>n)
+   {
+      throw OutOfRangeException("BatchSolver::setNoProblems",
+            "Number of problems cannot be negative.");
+   }
+   noProblems_i = n;
+   tables_i.assign(static_cast<std::size_t>(tableOffset_i.back())*n,0);
+   fac2var_i.assign(static_cast<std::size_t>(msgOffset_i.back())*n,0);
+   var2fac_i.assign(fac2var_i.size(),0);
+   values_i.assign(static_cast<std::size_t>(noVars())*n,0);
+   blockIterations_i.assign((n+BLOCK_SIZE-1)/BLOCK_SIZE,0);
+   reserveWorkspaces();
+
+} // function setNoProblems
+
+/**
+ * Sets the number of threads used by BatchSolver::solve.
+ */
+void BatchSolver::setNumThreads(int n)
+{
+   if(0>=n)
+   {
+      n = std::max(1u,std::thread::hardware_concurrency());
+   }
+   if( (n==numThreads_i) && ((1==n) == (0==pPool_i)) )
+   {
+      return;
+   }
+
+   delete pPool_i;
+   pPool_i = 0;
+   if(1<n)
+   {
+      pPool_i = new util::ThreadPool(n);
+   }
+   numThreads_i = n;
+   workspaces_i.resize(n);
+   reserveWorkspaces();
+
+} // function setNumThreads
+
+/**
+ * Sets the values of one factor for one problem.
+ */
+void BatchSolver::setFactor(int problem, int f, const ValType* values)
+{
+   if( (0>problem) || (noProblems_i<=problem) || (0>f) || (noFactors()<=f) )
+   {
+      throw OutOfRangeException("BatchSolver::setFactor",
+            "No such problem or factor.");
+   }
+   ValType* pTable = &tables_i[0] +
+      static_cast<std::size_t>(tableOffset_i[f])*noProblems_i + problem;
+   const ValIndex size = tableSize(f);
+   for(ValIndex k=0; k<size; ++k)
+   {
+      pTable[static_cast<std::size_t>(k)*noProblems_i] = values[k];
+   }
+
+} // function setFactor
+
+/**
+ * Resets every message to zero.
+ */
+void BatchSolver::clearMessages()
+{
+   std::fill(fac2var_i.begin(),fac2var_i.end(),0);
+   std::fill(var2fac_i.begin(),var2fac_i.end(),0);
+}
+
+/**
+ * Updates the messages sent by a factor for a block of problems.
+ */
+ValType BatchSolver::updateFactor(int f, int begin, int end, Workspace& ws)
+{
+   const std::size_t P = noProblems_i;
+   const int n = end-begin;
+   const int firstEdge = factorEdges_i[f];
+   const int lastEdge = factorEdges_i[f+1];
+   const ValIndex size = tableSize(f);
+
+   //***************************************************************************
+   // Add the input messages to the factor's values, for each problem.
+   //***************************************************************************
+   const ValType* pTable = &tables_i[0] + tableOffset_i[f]*P + begin;
+   ValType* pTotal = &ws.total[0];
+   for(ValIndex k=0; k<size; ++k)
+   {
+      ValType* pOut = pTotal + k*n;
+      const ValType* pIn = pTable + k*P;
+      for(int p=0; p<n; ++p)
+      {
+         pOut[p] = pIn[p];
+      }
+      for(int e=firstEdge; e<lastEdge; ++e)
+      {
+         const ValIndex x =
+            (k/edgeStride_i[e]) % varSizes_i[edgeVar_i[e]];
+         const ValType* pMsg = &var2fac_i[0] + (msgOffset_i[e]+x)*P + begin;
+         for(int p=0; p<n; ++p)
+         {
+            pOut[p] += pMsg[p];
+         }
+      }
+   }
+
+   //***************************************************************************
+   // The message to each variable is the max marginal of the total, minus
+   // the variable's own input.
+   //***************************************************************************
+   ValType residual = 0;
+   ValType* pMarginal = &ws.marginal[0];
+   for(int e=firstEdge; e<lastEdge; ++e)
+   {
+      const ValIndex stride = edgeStride_i[e];
+      const ValIndex varSize = varSizes_i[edgeVar_i[e]];
+      std::fill(pMarginal,pMarginal+varSize*n,
+            -std::numeric_limits<ValType>::max());
+      for(ValIndex k=0; k<size; ++k)
+      {
+         ValType* pOut = pMarginal + ((k/stride)%varSize)*n;
+         const ValType* pIn = pTotal + k*n;
+         for(int p=0; p<n; ++p)
+         {
+            pOut[p] = std::max(pOut[p],pIn[p]);
+         }
+      }
+
+      ValType* pMsg = &fac2var_i[0] + msgOffset_i[e]*P + begin;
+      const ValType* pVarMsg = &var2fac_i[0] + msgOffset_i[e]*P + begin;
+      for(ValIndex x=0; x<varSize; ++x)
+      {
+         for(int p=0; p<n; ++p)
+         {
+            const ValType newVal = pMarginal[x*n+p] - pVarMsg[x*P+p];
+            residual = std::max(residual,
+                  static_cast<ValType>(std::fabs(newVal-pMsg[x*P+p])));
+            pMsg[x*P+p] = newVal;
+         }
+      }
+   }
+   return residual;
+
+} // function updateFactor
+
+/**
+ * Updates the messages sent by a variable for a block of problems, and
+ * sets its value to maximise the sum of its inputs.
+ */
+ValType BatchSolver::updateVariable(int v, int begin, int end, Workspace& ws,
+      bool& changed)
+{
+   const std::size_t P = noProblems_i;
+   const int n = end-begin;
+   const ValIndex size = varSizes_i[v];
+   const int firstEdge = varEdgeStart_i[v];
+   const int lastEdge = varEdgeStart_i[v+1];
+
+   //***************************************************************************
+   // Sum the input messages from every factor, for each problem.
+   //***************************************************************************
+   ValType* pSum = &ws.marginal[0];
+   std::fill(pSum,pSum+size*n,0);
+   for(int j=firstEdge; j<lastEdge; ++j)
+   {
+      const ValType* pIn = &fac2var_i[0] + msgOffset_i[varEdges_i[j]]*P + begin;
+      for(ValIndex x=0; x<size; ++x)
+      {
+         for(int p=0; p<n; ++p)
+         {
+            pSum[x*n+p] += pIn[x*P+p];
+         }
+      }
+   }
+
+   //***************************************************************************
+   // The message to each factor is the sum of the other inputs, normalised
+   // to have zero mean.
+   //***************************************************************************
+   ValType residual = 0;
+   ValType* pMean = &ws.mean[0];
+   for(int j=firstEdge; j<lastEdge; ++j)
+   {
+      const int offset = msgOffset_i[varEdges_i[j]];
+      const ValType* pIn = &fac2var_i[0] + offset*P + begin;
+      ValType* pMsg = &var2fac_i[0] + offset*P + begin;
+      std::fill(pMean,pMean+n,0);
+      for(ValIndex x=0; x<size; ++x)
+      {
+         for(int p=0; p<n; ++p)
+         {
+            pMean[p] += (pSum[x*n+p] - pIn[x*P+p]) / size;
+         }
+      }
+      for(ValIndex x=0; x<size; ++x)
+      {
+         for(int p=0; p<n; ++p)
+         {
+            const ValType newVal = (pSum[x*n+p] - pIn[x*P+p]) - pMean[p];
+            residual = std::max(residual,
+                  static_cast<ValType>(std::fabs(newVal-pMsg[x*P+p])));
+            pMsg[x*P+p] = newVal;
+         }
+      }
+   }
+
+   //***************************************************************************
+   // Choose the first value that maximises the sum, for each problem.
+   //***************************************************************************
+   ValIndex* pValue = &values_i[0] + v*P + begin;
+   for(int p=0; p<n; ++p)
+   {
+      ValIndex best = 0;
+      for(ValIndex x=1; x<size; ++x)
+      {
+         if(pSum[best*n+p] < pSum[x*n+p])
+         {
+            best = x;
+         }
+      }
+      if(pValue[p]!=best)
+      {
+         pValue[p] = best;
+         changed = true;
+      }
+   }
+   return residual;
+
+} // function updateVariable
+
+/**
+ * Runs max-sum on one block of problems until they all converge, or the
+ * maximum number of iterations is reached.
+ */
+void BatchSolver::solveBlock(int block, Workspace& ws)
+{
+   const int begin = block*BLOCK_SIZE;
+   const int end = std::min(begin+BLOCK_SIZE,noProblems_i);
+   int iterationCount = 0;
+   while(iterationCount<maxIterations_i)
+   {
+      ++iterationCount;
+      ValType residual = 0;
+      for(int f=0; f<noFactors(); ++f)
+      {
+         residual = std::max(residual,updateFactor(f,begin,end,ws));
+      }
+      bool changed = false;
+      for(int v=0; v<noVars(); ++v)
+      {
+         residual = std::max(residual,updateVariable(v,begin,end,ws,changed));
+      }
+
+      //************************************************************************
+      // As with MaxSumController::optimise, stop once no message has
+      // changed significantly, and no value has changed.
+      //************************************************************************
+      if( (residual<=maxNormThreshold_i) && !changed )
+      {
+         break;
+      }
+   }
+   blockIterations_i[block] = iterationCount;
+
+} // function solveBlock
+
+/**
+ * Runs max-sum on every problem in this batch.
+ */
+int BatchSolver::solve()
+{
+   SolveTask task(*this);
+   const int noBlocks = blockIterations_i.size();
+   if(0!=pPool_i)
+   {
+      pPool_i->run(noBlocks,task);
+   }
+   else
+   {
+      task.run(0,noBlocks,0);
+   }
+   if(blockIterations_i.empty())
+   {
+      return 0;
+   }
+   return *std::max_element(blockIterations_i.begin(),
+         blockIterations_i.end());
+
+} // function solve
+
+/**
+ * Returns the value assigned to a variable in one problem.
+ */
+ValIndex BatchSolver::getValue(int problem, int var) const
+{
+   if( (0>problem) || (noProblems_i<=problem) || (0>var) || (noVars()<=var) )
+   {
+      throw OutOfRangeException("BatchSolver::getValue",
+            "No such problem or variable.");
+   }
+   return values_i[static_cast<std::size_t>(var)*noProblems_i+problem];
+}
+
+/**
+ * Copies the values assigned to every variable in one problem.
+ */
+void BatchSolver::getValues(int problem, std::vector<ValIndex>& values) const
+{
+   if( (0>problem) || (noProblems_i<=problem) )
+   {
+      throw OutOfRangeException("BatchSolver::getValues",
+            "No such problem.");
+   }
+   values.resize(noVars());
+   for(int v=0; v<noVars(); ++v)
+   {
+      values[v] = values_i[static_cast<std::size_t>(v)*noProblems_i+problem];
+   }
+}
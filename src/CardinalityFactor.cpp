@@ -0,0 +1,176 @@
+/**
+ * @file CardinalityFactor.cpp
+ * Implementation of the maxsum::CardinalityFactor class.
+ * @see CardinalityFactor.h
+ */
+#include <algorithm>
+#include <limits>
+#include <maxsum/CardinalityFactor.h>
+#include <maxsum/exceptions.h>
+
+using namespace maxsum;
+
+/**
+ * Private Module Namespace.
+ */
+namespace
+{
+   /**
+    * Orders variables by decreasing gain from being active, breaking ties
+    * by position so that the order is deterministic.
+    */
+   struct ByGain_m
+   {
+      const std::vector<ValType>& gain;
+
+      ByGain_m(const std::vector<ValType>& g) : gain(g) {}
+
+      bool operator()(int a, int b) const
+      {
+         return (gain[a] > gain[b]) || ( (gain[a]==gain[b]) && (a<b) );
+      }
+   };
+
+} // private namespace
+
+/**
+ * Checks that there is one value for each possible number of active
+ * variables.
+ * @throws BadDomainException if not.
+ */
+void CardinalityFactor::checkCounts() const
+{
+   if(counts_i.size() != static_cast<std::size_t>(noVars()+1))
+   {
+      throw BadDomainException("CardinalityFactor::CardinalityFactor",
+            "Expected one value for each number of active variables.");
+   }
+}
+
+/**
+ * Returns the value of this factor for a joint assignment.
+ */
+ValType CardinalityFactor::value(const ValIndex* pSubs) const
+{
+   int count = 0;
+   for(int k=0; k<noVars(); ++k)
+   {
+      if(0!=pSubs[k])
+      {
+         ++count;
+      }
+   }
+   return counts_i[count];
+}
+
+/**
+ * Max marginalises the sum of this factor and its input messages onto
+ * every variable.
+ */
+void CardinalityFactor::maxMarginals
+(
+ const ValType* const* ppMsgs,
+ ValType* const* ppOut
+) const
+{
+   const int n = noVars();
+   const ValIndex* pSizes = sizes().data();
+   const ValType NONE = -std::numeric_limits<ValType>::infinity();
+
+   //***************************************************************************
+   // For each variable, find the best message value when it is inactive,
+   // and the gain from making it active instead.
+   //***************************************************************************
+   std::vector<ValType> inactive(n);
+   std::vector<ValType> gain(n);
+   ValType inactiveSum = 0;
+   for(int j=0; j<n; ++j)
+   {
+      const ValType* pMsg = ppMsgs[j];
+      ValType active = NONE;
+      for(ValIndex x=1; x<pSizes[j]; ++x)
+      {
+         active = std::max(active,pMsg[x]);
+      }
+      inactive[j] = pMsg[0];
+      gain[j] = (NONE==active) ? NONE : active - pMsg[0];
+      inactiveSum += pMsg[0];
+   }
+
+   //***************************************************************************
+   // Sort the variables by decreasing gain. The best assignment with exactly
+   // c active variables activates the first c in this order, and so has
+   // value inactiveSum + prefix[c].
+   //***************************************************************************
+   std::vector<int> order(n);
+   for(int j=0; j<n; ++j)
+   {
+      order[j] = j;
+   }
+   std::sort(order.begin(),order.end(),ByGain_m(gain));
+   std::vector<int> rank(n);
+   std::vector<ValType> prefix(n+1);
+   prefix[0] = 0;
+   for(int r=0; r<n; ++r)
+   {
+      rank[order[r]] = r;
+      prefix[r+1] = prefix[r] + gain[order[r]];
+   }
+
+   //***************************************************************************
+   // Excluding the variable of rank r, the best gain from activating c of
+   // the others is prefix[c] if c<=r, and prefix[c+1]-gain otherwise. For
+   // s active variables among the excluded one, we therefore need
+   //    below[s][r] = max over c<=r of counts[c+s] + prefix[c], and
+   //    above[s][r] = max over r<c<n of counts[c+s] + prefix[c+1].
+   //***************************************************************************
+   std::vector<ValType> below[2];
+   std::vector<ValType> above[2];
+   for(int s=0; s<2; ++s)
+   {
+      below[s].resize(n);
+      above[s].resize(n);
+      ValType best = NONE;
+      for(int r=0; r<n; ++r)
+      {
+         best = std::max(best,counts_i[r+s]+prefix[r]);
+         below[s][r] = best;
+      }
+      best = NONE;
+      for(int r=n-1; r>=0; --r)
+      {
+         above[s][r] = best;
+         if(0<r)
+         {
+            best = std::max(best,counts_i[r+s]+prefix[r+1]);
+         }
+      }
+   }
+
+   //***************************************************************************
+   // Finally, combine these for each variable.
+   //***************************************************************************
+   for(int i=0; i<n; ++i)
+   {
+      const int r = rank[i];
+      const ValType others = inactiveSum - inactive[i];
+      ValType best[2];
+      for(int s=0; s<2; ++s)
+      {
+         best[s] = below[s][r];
+         if( (NONE!=gain[i]) && (NONE!=above[s][r]) )
+         {
+            best[s] = std::max(best[s],above[s][r]-gain[i]);
+         }
+      }
+
+      const ValType* pMsg = ppMsgs[i];
+      ValType* pOut = ppOut[i];
+      pOut[0] = pMsg[0] + (others + best[0]);
+      for(ValIndex x=1; x<pSizes[i]; ++x)
+      {
+         pOut[x] = pMsg[x] + (others + best[1]);
+      }
+   }
+
+} // function maxMarginals
@@ -0,0 +1,339 @@
+/**
+ * @file Checkpoint.cpp
+ * Implementation of MaxSumController::saveCheckpoint and
+ * MaxSumController::restoreCheckpoint.
+ * <p>
+ * A checkpoint consists of a fixed size header, followed by the id and
+ * value of each variable, and then one record per factor. Each factor
+ * record contains the factor's id, the id and domain size of each variable
+ * in its domain, the length of its total value followed by the total value
+ * itself (which is empty for implicit factors), and then the factor to
+ * variable and variable to factor messages for each of its edges, in
+ * domain order.
+ * The factors' own values are not included, so a checkpoint is only as
+ * large as the state that max-sum has computed.
+ * </p>
+ * <p>
+ * As with factor graph files, everything is stored in the native byte
+ * order and precision, and the header identifies both.
+ * </p>
+ */
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <vector>
+#include <maxsum/MaxSumController.h>
+
+using namespace maxsum;
+
+/**
+ * Private Module Namespace.
+ */
+namespace
+{
+   /**
+    * Identifies checkpoint streams.
+    */
+   const char MAGIC_M[8] = {'M','A','X','S','U','M','C','K'};
+
+   /**
+    * Current version of the checkpoint format.
+    */
+   const std::uint32_t VERSION_M = 2;
+
+   /**
+    * Written in native byte order, to detect streams with the wrong order.
+    */
+   const std::uint32_t BYTE_ORDER_M = 0x01020304;
+
+   /**
+    * Fixed size header at the start of every checkpoint.
+    */
+   struct CheckpointHeader_m
+   {
+      char magic[8];
+      std::uint32_t version;
+      std::uint32_t byteOrder;
+      std::uint32_t valueSize;
+      std::uint32_t reserved;
+      std::uint64_t noVars;
+      std::uint64_t noFactors;
+   };
+
+   /**
+    * Pair of a variable id and an index, used both for a variable's value
+    * and for its domain size.
+    */
+   struct VarRecord_m
+   {
+      std::uint32_t id;
+      std::int32_t index;
+   };
+
+   /**
+    * State of one factor, as read from a checkpoint.
+    */
+   struct FactorState_m
+   {
+      FactorID id;
+      std::vector<VarRecord_m> vars;
+      std::vector<ValType> total;
+      std::vector<ValType> msgs;
+   };
+
+   /**
+    * Writes an array of plain data to a stream.
+    */
+   template<class T> void write_m(std::ostream& out, const T* pData, int n)
+   {
+      out.write(reinterpret_cast<const char*>(pData),n*sizeof(T));
+   }
+
+   /**
+    * Reads an array of plain data from a stream.
+    * @throws FileFormatException if the stream ends early.
+    */
+   template<class T> void read_m(std::istream& in, T* pData, int n)
+   {
+      if(!in.read(reinterpret_cast<char*>(pData),n*sizeof(T)))
+      {
+         throw FileFormatException("MaxSumController::restoreCheckpoint",
+               "checkpoint is truncated");
+      }
+   }
+
+   /**
+    * Throws a FileFormatException for a corrupt or incompatible checkpoint.
+    */
+   void badCheckpoint_m(const std::string& reason)
+   {
+      throw FileFormatException("MaxSumController::restoreCheckpoint",reason);
+   }
+
+} // private namespace
+
+/**
+ * Writes a checkpoint of the current message state to a binary stream.
+ * @param[out] out the stream to write.
+ * @throws FileFormatException if the stream cannot be written.
+ */
+void MaxSumController::saveCheckpoint(std::ostream& out)
+{
+   if(!graphValid_i)
+   {
+      compile();
+   }
+
+   CheckpointHeader_m header;
+   std::memset(&header,0,sizeof(header));
+   std::memcpy(header.magic,MAGIC_M,sizeof(MAGIC_M));
+   header.version = VERSION_M;
+   header.byteOrder = BYTE_ORDER_M;
+   header.valueSize = sizeof(ValType);
+   header.noVars = graph_i.noVars();
+   header.noFactors = graph_i.noFactors();
+   write_m(out,&header,1);
+
+   //***************************************************************************
+   // Write the current value of every variable. Variables and factors are
+   // written in increasing order of id, whether or not the graph is
+   // reordered.
+   //***************************************************************************
+   for(int k=0; k<graph_i.noVars(); ++k)
+   {
+      const int v = graph_i.varById(k);
+      VarRecord_m rec = { graph_i.varId(v), graph_i.value(v) };
+      write_m(out,&rec,1);
+   }
+
+   //***************************************************************************
+   // Write each factor's domain, total value and edge messages.
+   //***************************************************************************
+   for(int k=0; k<graph_i.noFactors(); ++k)
+   {
+      const int f = graph_i.factorById(k);
+      const std::uint32_t id = graph_i.factorId(f);
+      const std::uint32_t arity = graph_i.factorEdgeEnd(f)
+         - graph_i.factorEdgeBegin(f);
+      write_m(out,&id,1);
+      write_m(out,&arity,1);
+      for(int e=graph_i.factorEdgeBegin(f); e<graph_i.factorEdgeEnd(f); ++e)
+      {
+         const int v = graph_i.edgeVar(e);
+         VarRecord_m rec = { graph_i.varId(v), graph_i.varSize(v) };
+         write_m(out,&rec,1);
+      }
+
+      //************************************************************************
+      // Implicit factors have no total value, so only its length is written.
+      //************************************************************************
+      if(0==graph_i.implicit(f))
+      {
+         const DiscreteFunction& total = graph_i.total(f);
+         const std::uint64_t totalSize = total.domainSize();
+         write_m(out,&totalSize,1);
+         write_m(out,&total(0),total.domainSize());
+      }
+      else
+      {
+         const std::uint64_t totalSize = 0;
+         write_m(out,&totalSize,1);
+      }
+      for(int e=graph_i.factorEdgeBegin(f); e<graph_i.factorEdgeEnd(f); ++e)
+      {
+         const int len = graph_i.varSize(graph_i.edgeVar(e));
+         write_m(out,graph_i.fac2var(e),len);
+         write_m(out,graph_i.var2fac(e),len);
+      }
+   }
+
+   if(!out)
+   {
+      throw FileFormatException("MaxSumController::saveCheckpoint",
+            "Failed to write checkpoint");
+   }
+
+} // function saveCheckpoint
+
+/**
+ * Restores message state from a checkpoint written by
+ * MaxSumController::saveCheckpoint.
+ * @param[in] in the stream to read.
+ * @throws FileFormatException if the stream is not a valid checkpoint.
+ */
+void MaxSumController::restoreCheckpoint(std::istream& in)
+{
+   //***************************************************************************
+   // Read and check the header.
+   //***************************************************************************
+   CheckpointHeader_m header;
+   read_m(in,&header,1);
+   if(0!=std::memcmp(header.magic,MAGIC_M,sizeof(MAGIC_M)))
+   {
+      badCheckpoint_m("not a checkpoint");
+   }
+   if( (VERSION_M!=header.version) || (BYTE_ORDER_M!=header.byteOrder) ||
+       (sizeof(ValType)!=header.valueSize) )
+   {
+      badCheckpoint_m("incompatible version, byte order or value type");
+   }
+   const std::uint64_t maxCount = std::numeric_limits<int>::max();
+   if( (header.noVars > maxCount) || (header.noFactors > maxCount) )
+   {
+      badCheckpoint_m("corrupt header");
+   }
+
+   //***************************************************************************
+   // Read the whole checkpoint before changing anything, so that a corrupt
+   // or truncated stream leaves this controller untouched.
+   //***************************************************************************
+   std::vector<VarRecord_m> values(header.noVars);
+   read_m(in,values.data(),values.size());
+
+   std::vector<FactorState_m> factors(header.noFactors);
+   for(std::vector<FactorState_m>::iterator it=factors.begin();
+         it!=factors.end(); ++it)
+   {
+      std::uint32_t arity = 0;
+      read_m(in,&it->id,1);
+      read_m(in,&arity,1);
+      if(arity > header.noVars)
+      {
+         badCheckpoint_m("corrupt factor record");
+      }
+      it->vars.resize(arity);
+      read_m(in,it->vars.data(),arity);
+
+      std::uint64_t totalSize = 1;
+      std::uint64_t msgSize = 0;
+      for(std::uint32_t k=0; k<arity; ++k)
+      {
+         const std::int32_t size = it->vars[k].index;
+         if( (0>=size) || (0<k && it->vars[k-1].id>=it->vars[k].id) )
+         {
+            badCheckpoint_m("corrupt factor record");
+         }
+         totalSize *= size;
+         msgSize += 2*size;
+         if(totalSize > maxCount)
+         {
+            badCheckpoint_m("corrupt factor record");
+         }
+      }
+      std::uint64_t storedSize = 0;
+      read_m(in,&storedSize,1);
+      if( (0!=storedSize) && (totalSize!=storedSize) )
+      {
+         badCheckpoint_m("corrupt factor record");
+      }
+      it->total.resize(storedSize);
+      read_m(in,it->total.data(),it->total.size());
+      it->msgs.resize(msgSize);
+      read_m(in,it->msgs.data(),it->msgs.size());
+   }
+
+   //***************************************************************************
+   // Restore the value of each variable that is still in the graph.
+   //***************************************************************************
+   if(!graphValid_i)
+   {
+      compile();
+   }
+   for(std::vector<VarRecord_m>::const_iterator it=values.begin();
+         it!=values.end(); ++it)
+   {
+      const int v = graph_i.findVar(it->id);
+      if( (0<=v) && (0<=it->index) && (it->index<graph_i.varSize(v)) )
+      {
+         graph_i.value(v) = it->index;
+      }
+   }
+
+   //***************************************************************************
+   // Restore messages along matching edges, and totals for factors whose
+   // domains are unchanged. Both edge lists are in increasing order of
+   // variable, so they can be matched in a single pass.
+   //***************************************************************************
+   for(std::vector<FactorState_m>::const_iterator it=factors.begin();
+         it!=factors.end(); ++it)
+   {
+      const int f = graph_i.findFactor(it->id);
+      if(0>f)
+      {
+         continue;
+      }
+
+      const ValType* pMsg = it->msgs.data();
+      int noMatched = 0;
+      int e = graph_i.factorEdgeBegin(f);
+      const int end = graph_i.factorEdgeEnd(f);
+      for(std::vector<VarRecord_m>::const_iterator var=it->vars.begin();
+            var!=it->vars.end(); ++var)
+      {
+         const int len = var->index;
+         while( (e<end) && (graph_i.varId(graph_i.edgeVar(e))<var->id) )
+         {
+            ++e;
+         }
+         if( (e<end) && (graph_i.varId(graph_i.edgeVar(e))==var->id) &&
+             (graph_i.varSize(graph_i.edgeVar(e))==len) )
+         {
+            std::copy(pMsg,pMsg+len,graph_i.fac2var(e));
+            std::copy(pMsg+len,pMsg+2*len,graph_i.var2fac(e));
+            ++noMatched;
+         }
+         pMsg += 2*len;
+      }
+
+      const int arity = end - graph_i.factorEdgeBegin(f);
+      if( (arity==noMatched) && (0==graph_i.implicit(f)) &&
+          (!it->total.empty()) &&
+          (static_cast<std::size_t>(arity)==it->vars.size()) )
+      {
+         std::copy(it->total.begin(),it->total.end(),&graph_i.total(f)(0));
+      }
+   }
+
+} // function restoreCheckpoint
@@ -16,11 +16,129 @@ using namespace maxsum;
 // module namespace for private module code.
 namespace
 {
+   /**
+    * Functors used to combine each value of a function with the
+    * corresponding value of another, using maxsum::util::BroadcastPlan.
+    */
+   struct AddTo_m
+   {
+      void operator()(ValType& x, const ValType y) const { x += y; }
+   };
+
+   struct SubtractFrom_m
+   {
+      void operator()(ValType& x, const ValType y) const { x -= y; }
+   };
+
+   struct MultiplyBy_m
+   {
+      void operator()(ValType& x, const ValType y) const { x *= y; }
+   };
+
+   struct DivideBy_m
+   {
+      void operator()(ValType& x, const ValType y) const { x /= y; }
+   };
+
    inline ValType add_m(ValType x, ValType y)
    {
       return x+y;
    }
 
+   /**
+    * Read only view of a function's value array as a column-major matrix.
+    */
+   typedef Eigen::Map<const Eigen::Array<ValType,Eigen::Dynamic,
+           Eigen::Dynamic> > ConstValMatrix_m;
+
+   /**
+    * Writable view of a function's value array.
+    */
+   typedef Eigen::Map<Eigen::Array<ValType,Eigen::Dynamic,1> > ValArray_m;
+
+   /**
+    * Constructs the plan for marginalising one function onto the domain of
+    * another.
+    * @throws maxsum::BadDomainException is the domain of outFun is not a
+    * subset of inFun.
+    */
+   util::MarginalPlan makePlan_m
+   (
+    const DiscreteFunction& inFun,
+    const DiscreteFunction& outFun
+   )
+   {
+      if(!std::includes(inFun.varBegin(),inFun.varEnd(),
+               outFun.varBegin(),outFun.varEnd()))
+      {
+         throw BadDomainException("marginal(DiscreteFunction,DiscreteFunction)",
+               "Out domain is not subset of in domain.");
+      }
+
+      return util::MarginalPlan(inFun.varBegin(),inFun.varEnd(),
+            inFun.sizeBegin(),outFun.varBegin(),outFun.varEnd());
+   }
+
+   /**
+    * Performs max (or min) marginalisation using Eigen's vectorised partial
+    * reductions, provided that the kept or eliminated variables are
+    * contiguous in memory. This covers the common case of factor to variable
+    * messages, where the kept variable is either first or last in a factor's
+    * domain. Eigen will use whichever SIMD instruction set (e.g. AVX2 or
+    * NEON) is enabled at compile time.
+    * @tparam MAX true for max marginalisation, false for min.
+    * @returns false if the plan layout is not supported, in which case
+    * no values are written.
+    */
+   template<bool MAX> bool vectorisedMarginal_m
+   (
+    const util::MarginalPlan& plan,
+    const DiscreteFunction& inFun,
+    DiscreteFunction& outFun
+   )
+   {
+      const ValIndex outSize = plan.outputSize();
+      const ValIndex freeSize = plan.freeSize();
+      ValArray_m out(&outFun(0),outSize);
+
+      //************************************************************************
+      // Kept variables are innermost, so reduce across each row.
+      //************************************************************************
+      if(plan.keptInner())
+      {
+         ConstValMatrix_m in(&inFun(0),outSize,freeSize);
+         if(MAX)
+         {
+            out = in.rowwise().maxCoeff();
+         }
+         else
+         {
+            out = in.rowwise().minCoeff();
+         }
+         return true;
+      }
+
+      //************************************************************************
+      // Eliminated variables are innermost, so reduce down each column.
+      //************************************************************************
+      if(plan.freeInner())
+      {
+         ConstValMatrix_m in(&inFun(0),freeSize,outSize);
+         if(MAX)
+         {
+            out = in.colwise().maxCoeff().transpose();
+         }
+         else
+         {
+            out = in.colwise().minCoeff().transpose();
+         }
+         return true;
+      }
+
+      return false;
+
+   } // vectorisedMarginal_m
+
 } // module namespace
 
 
@@ -53,7 +171,6 @@ ValType& DiscreteFunction::operator()(const DomainIterator& it)
  * If necessary, the domain of this function is expanded to include the
  * domain of the parameter fun.
  * @param[in] fun function whose domain we want to expand to.
- * @todo Make this more efficient by using fun.size_i cache.
  * @post domain of this is union of its previous domain, with that of fun.
  */
 void DiscreteFunction::expand(const DiscreteFunction& fun)
@@ -119,7 +236,7 @@ ValType& DiscreteFunction::operator()(ValIndex ind1, ValIndex ind2, ...)
    // Create a vector in which to hold all the indices
    //***************************************************************************
    std::vector<ValIndex> indices;
-   indices.reserve(vars_i.size());
+   indices.reserve(noVars());
 
    //***************************************************************************
    // Stick the named indices in the list
@@ -132,7 +249,7 @@ ValType& DiscreteFunction::operator()(ValIndex ind1, ValIndex ind2, ...)
    //***************************************************************************
    va_list args;
    va_start ( args, ind2 );
-   for(int k=0; k<vars_i.size()-2; ++k)
+   for(int k=0; k<noVars()-2; ++k)
    {
       indices.push_back(va_arg(args,ValIndex));
    }
@@ -155,7 +272,7 @@ const ValType& DiscreteFunction::operator()
    // Create a vector in which to hold all the indices
    //***************************************************************************
    std::vector<ValIndex> indices;
-   indices.reserve(vars_i.size());
+   indices.reserve(noVars());
 
    //***************************************************************************
    // Stick the named indices in the list
@@ -168,7 +285,7 @@ const ValType& DiscreteFunction::operator()
    //***************************************************************************
    va_list args;
    va_start ( args, ind2 );
-   for(int k=0; k<vars_i.size()-2; ++k)
+   for(int k=0; k<noVars()-2; ++k)
    {
       indices.push_back(va_arg(args,ValIndex));
    }
@@ -200,7 +317,7 @@ ValType& DiscreteFunction::at(ValIndex ind1, ValIndex ind2, ...)
    // Create a vector in which to hold all the indices
    //***************************************************************************
    std::vector<ValIndex> indices;
-   indices.reserve(vars_i.size());
+   indices.reserve(noVars());
 
    //***************************************************************************
    // Stick the named indices in the list
@@ -213,7 +330,7 @@ ValType& DiscreteFunction::at(ValIndex ind1, ValIndex ind2, ...)
    //***************************************************************************
    va_list args;
    va_start ( args, ind2 );
-   for(int k=0; k<vars_i.size()-2; ++k)
+   for(int k=0; k<noVars()-2; ++k)
    {
       indices.push_back(va_arg(args,ValIndex));
    }
@@ -245,7 +362,7 @@ const ValType& DiscreteFunction::at(ValIndex ind1, ValIndex ind2, ...) const
    // Create a vector in which to hold all the indices
    //***************************************************************************
    std::vector<ValIndex> indices;
-   indices.reserve(vars_i.size());
+   indices.reserve(noVars());
 
    //***************************************************************************
    // Stick the named indices in the list
@@ -258,7 +375,7 @@ const ValType& DiscreteFunction::at(ValIndex ind1, ValIndex ind2, ...) const
    //***************************************************************************
    va_list args;
    va_start ( args, ind2 );
-   for(int k=0; k<vars_i.size()-2; ++k)
+   for(int k=0; k<noVars()-2; ++k)
    {
       indices.push_back(va_arg(args,ValIndex));
    }
@@ -279,10 +396,9 @@ const ValType& DiscreteFunction::at(ValIndex ind1, ValIndex ind2, ...) const
  * @param fun Another DiscreteFunction whose value and domain is swapped
  * with that of this one.
 */
-void DiscreteFunction::swap(DiscreteFunction& fun)
+void DiscreteFunction::swap(DiscreteFunction& fun) noexcept
 {
-   vars_i.swap(fun.vars_i);
-   size_i.swap(fun.size_i);
+   std::swap(pDomain_i,fun.pDomain_i);
    values_i.swap(fun.values_i);
 }
 
@@ -292,8 +408,8 @@ void DiscreteFunction::swap(DiscreteFunction& fun)
  */
 DiscreteFunction& DiscreteFunction::operator=(ValType val)
 {
-   vars_i.clear();
-   size_i.clear();
+   util::Domain::release(pDomain_i);
+   pDomain_i = util::Domain::empty();
    values_i.resize(1);
    values_i(0) = val; 
    return *this;
@@ -305,8 +421,9 @@ DiscreteFunction& DiscreteFunction::operator=(ValType val)
  */
 DiscreteFunction& DiscreteFunction::operator=(const DiscreteFunction& val)
 {
-   vars_i = val.vars_i;
-   size_i = val.size_i;
+   const util::Domain* pOld = pDomain_i;
+   pDomain_i = util::Domain::addRef(val.pDomain_i);
+   util::Domain::release(pOld);
    values_i = val.values_i;
    return *this;
 }
@@ -334,10 +451,8 @@ DiscreteFunction& DiscreteFunction::operator+=(const DiscreteFunction& rhs)
    //***************************************************************************
    // Add corresponding elements of input function to this one.
    //***************************************************************************
-   for(DomainIterator it(*this); it.hasNext(); ++it)
-   {
-      this->at(it.getInd()) += rhs(it);
-   }
+   util::BroadcastPlan(domain(),rhs.domain())
+      .apply(values_i.data(),rhs.values_i.data(),AddTo_m());
    
    return *this;
 }
@@ -365,10 +480,8 @@ DiscreteFunction& DiscreteFunction::operator-=(const DiscreteFunction& rhs)
    //***************************************************************************
    // Subtract corresponding elements of input function to this one.
    //***************************************************************************
-   for(DomainIterator it(*this); it.hasNext(); ++it)
-   {
-      this->at(it.getInd()) -= rhs(it);
-   }
+   util::BroadcastPlan(domain(),rhs.domain())
+      .apply(values_i.data(),rhs.values_i.data(),SubtractFrom_m());
    
    return *this;
 }
@@ -396,10 +509,8 @@ DiscreteFunction& DiscreteFunction::operator*=(const DiscreteFunction& rhs)
    //***************************************************************************
    // Multiply corresponding elements of input function to this one.
    //***************************************************************************
-   for(DomainIterator it(*this); it.hasNext(); ++it)
-   {
-      this->at(it.getInd()) *= rhs(it);
-   }
+   util::BroadcastPlan(domain(),rhs.domain())
+      .apply(values_i.data(),rhs.values_i.data(),MultiplyBy_m());
    
    return *this;
 }
@@ -425,12 +536,10 @@ DiscreteFunction& DiscreteFunction::operator/=(const DiscreteFunction& rhs)
    expand(rhs); 
 
    //***************************************************************************
-   // Multiply corresponding elements of input function to this one.
+   // Divide corresponding elements of this function by the input function.
    //***************************************************************************
-   for(DomainIterator it(*this); it.hasNext(); ++it)
-   {
-      this->at(it.getInd()) /= rhs(it);
-   }
+   util::BroadcastPlan(domain(),rhs.domain())
+      .apply(values_i.data(),rhs.values_i.data(),DivideBy_m());
    
    return *this;
 }
@@ -595,12 +704,11 @@ std::ostream& maxsum::operator<<(std::ostream& out, const DiscreteFunction& fun)
  */
 bool maxsum::sameDomain(const DiscreteFunction& f1, const DiscreteFunction& f2)
 {
-   if(f1.noVars()!=f2.noVars())
-   {
-      return false;
-   }
-
-   return std::equal(f1.varBegin(),f1.varEnd(),f2.varBegin());
+   //***************************************************************************
+   // Domains are interned, so they are equal if and only if they are the
+   // same object.
+   //***************************************************************************
+   return &f1.domain()==&f2.domain();
 
 } // function sameDomain
 
@@ -710,6 +818,8 @@ bool maxsum::strictlyEqualWithinTolerance
  * This function reduces the domain of inFun to that of outFun by
  * maximisation, and stores the result in outFun. This behaviour is
  * equivalent to maxsum::marginal(inFun,std::max<ValType>,outFun).
+ * If the kept (or eliminated) variables are contiguous in memory,
+ * the reduction is performed by Eigen's vectorised kernels instead.
  * @pre variables in domain of outFun are a subset of variables in inFun.
  * @post previous content of outFun is overwritten.
  * @post The domains of outFun and inFun remain unchanged.
@@ -727,8 +837,14 @@ void maxsum::maxMarginal
  DiscreteFunction& outFun
 )
 {
+   util::MarginalPlan plan = makePlan_m(inFun,outFun);
+   if(vectorisedMarginal_m<true>(plan,inFun,outFun))
+   {
+      return;
+   }
+
    const ValType& (*pMax)(const ValType&, const ValType&) = std::max<ValType>;
-   marginal(inFun,pMax,outFun);
+   plan.reduce(&inFun(0),pMax,&outFun(0));
 }
 
 /**
@@ -736,6 +852,8 @@ void maxsum::maxMarginal
  * This function reduces the domain of inFun to that of outFun by
  * minimisation, and stores the result in outFun. This behaviour is
  * equivalent to maxsum::marginal(inFun,std::min<ValType>,outFun).
+ * If the kept (or eliminated) variables are contiguous in memory,
+ * the reduction is performed by Eigen's vectorised kernels instead.
  * @pre variables in domain of outFun are a subset of variables in inFun.
  * @post previous content of outFun is overwritten.
  * @post The domains of outFun and inFun remain unchanged.
@@ -753,8 +871,14 @@ void maxsum::minMarginal
  DiscreteFunction& outFun
 )
 {
+   util::MarginalPlan plan = makePlan_m(inFun,outFun);
+   if(vectorisedMarginal_m<false>(plan,inFun,outFun))
+   {
+      return;
+   }
+
    const ValType& (*pMin)(const ValType&, const ValType&) = std::min<ValType>;
-   marginal(inFun,pMin,outFun);
+   plan.reduce(&inFun(0),pMin,&outFun(0));
 }
 
 /**
@@ -0,0 +1,435 @@
+/**
+ * @file Domain.cpp
+ * Implementation of the maxsum::util::Domain intern table.
+ * <p>
+ * The table is split into a fixed number of shards, each of which is a
+ * hash table with one linked list of nodes per bucket. Readers search a
+ * shard without locking, while a mutex for each shard serialises inserting
+ * new domains, removing unused ones, and growing the bucket array. If a
+ * reader misses a domain because of a concurrent change, it searches again
+ * with the shard locked, so the lock-free search never needs to be exact.
+ * </p>
+ * <p>
+ * Removed nodes, domains and bucket arrays are reclaimed using epochs.
+ * Each thread that searches the table records the global epoch while it
+ * does so. Anything removed from the table is retired with the epoch at
+ * which it was removed, and freed once every thread that is still
+ * searching started after that epoch.
+ * </p>
+ * @see Domain.h
+ */
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <maxsum/Domain.h>
+#include <maxsum/register.h>
+
+using namespace maxsum;
+using maxsum::util::Domain;
+
+/**
+ * Private Module Namespace.
+ */
+namespace
+{
+   /**
+    * Number of shards in the intern table.
+    */
+   const std::size_t NO_SHARDS_M = 16;
+
+   /**
+    * Initial number of buckets in each shard.
+    */
+   const std::size_t START_BUCKETS_M = 16;
+
+   /**
+    * Entry in one bucket of the intern table.
+    */
+   struct Node_m
+   {
+      std::atomic<Node_m*> next;
+      const Domain* pDomain;
+      Node_m(const Domain* domain, Node_m* pNext)
+         : next(pNext), pDomain(domain) {}
+   };
+
+   /**
+    * Array of bucket lists for one shard.
+    */
+   struct Buckets_m
+   {
+      std::size_t mask;
+      std::vector<std::atomic<Node_m*> > heads;
+      explicit Buckets_m(std::size_t siz) : mask(siz-1), heads(siz)
+      {
+         for(std::size_t k=0; k<siz; ++k)
+         {
+            heads[k].store(0,std::memory_order_relaxed);
+         }
+      }
+   };
+
+   /**
+    * One shard of the intern table.
+    */
+   struct Shard_m
+   {
+      std::mutex mutex;
+      std::atomic<Buckets_m*> buckets;
+      std::size_t count;
+      Shard_m() : mutex(), buckets(new Buckets_m(START_BUCKETS_M)), count(0)
+         {}
+   };
+
+   /**
+    * Something removed from the table, which is freed once no thread can
+    * still be searching it. Each pointer may be NULL.
+    */
+   struct Retired_m
+   {
+      unsigned long epoch;
+      Node_m* pNode;
+      const Domain* pDomain;
+      Buckets_m* pBuckets;
+   };
+
+   /**
+    * The epoch recorded by one thread while it searches the table, or zero
+    * if it is not searching. Slots are reused by later threads, and are
+    * never freed.
+    */
+   struct ThreadSlot_m
+   {
+      std::atomic<unsigned long> epoch;
+      std::atomic<bool> inUse;
+      ThreadSlot_m* pNext;
+   };
+
+   /**
+    * Global state of the intern table. This is never destroyed, so domains
+    * may safely be interned and released by objects with static storage
+    * duration.
+    */
+   struct Table_m
+   {
+      Shard_m shards[NO_SHARDS_M];
+      std::atomic<unsigned long> epoch;
+      std::atomic<ThreadSlot_m*> slots;
+      std::mutex retiredMutex;
+      std::vector<Retired_m> retired;
+      std::atomic<std::size_t> noInterned;
+      Table_m() : epoch(1), slots(0), noInterned(0) {}
+   };
+
+   /**
+    * Returns the intern table.
+    */
+   Table_m& table_m()
+   {
+      static Table_m* pTable = new Table_m();
+      return *pTable;
+   }
+
+   /**
+    * The calling thread's slot, or NULL if it does not have one yet.
+    */
+   thread_local ThreadSlot_m* pThreadSlot_m = 0;
+
+   /**
+    * Returns the calling thread's slot to the table at thread exit.
+    */
+   struct SlotOwner_m
+   {
+      ~SlotOwner_m()
+      {
+         if(0!=pThreadSlot_m)
+         {
+            pThreadSlot_m->inUse.store(false,std::memory_order_release);
+            pThreadSlot_m = 0;
+         }
+      }
+   };
+
+   /**
+    * Returns the calling thread's slot, claiming an unused one, or adding
+    * a new one, the first time that it is called by each thread.
+    */
+   ThreadSlot_m& threadSlot_m()
+   {
+      if(0!=pThreadSlot_m)
+      {
+         return *pThreadSlot_m;
+      }
+
+      Table_m& table = table_m();
+      for(ThreadSlot_m* pSlot=table.slots.load(std::memory_order_acquire);
+            0!=pSlot; pSlot=pSlot->pNext)
+      {
+         bool inUse = false;
+         if(pSlot->inUse.compare_exchange_strong(inUse,true,
+                  std::memory_order_acq_rel))
+         {
+            pThreadSlot_m = pSlot;
+            break;
+         }
+      }
+      if(0==pThreadSlot_m)
+      {
+         ThreadSlot_m* pNew = new ThreadSlot_m();
+         pNew->epoch.store(0,std::memory_order_relaxed);
+         pNew->inUse.store(true,std::memory_order_relaxed);
+         pNew->pNext = table.slots.load(std::memory_order_relaxed);
+         while(!table.slots.compare_exchange_weak(pNew->pNext,pNew,
+                  std::memory_order_acq_rel,std::memory_order_relaxed)) {}
+         pThreadSlot_m = pNew;
+      }
+      static thread_local SlotOwner_m owner;
+      (void)owner;
+      return *pThreadSlot_m;
+   }
+
+   /**
+    * Returns the shard that holds domains with the specified hash.
+    */
+   Shard_m& shard_m(std::size_t key)
+   {
+      return table_m().shards[key % NO_SHARDS_M];
+   }
+
+   /**
+    * Returns the bucket that holds domains with the specified hash.
+    */
+   std::atomic<Node_m*>& bucket_m(Buckets_m& buckets, std::size_t key)
+   {
+      return buckets.heads[(key / NO_SHARDS_M) & buckets.mask];
+   }
+
+   /**
+    * Searches one bucket list for a domain that is still referenced, and
+    * adds a reference to it if found.
+    */
+   template<class Vars> const Domain* search_m(const Node_m* pNode,
+         const Vars& vars)
+   {
+      for(; 0!=pNode; pNode=pNode->next.load(std::memory_order_acquire))
+      {
+         const Domain* pDomain = pNode->pDomain;
+         if( (pDomain->hash()==vars.hash) && vars.equals(pDomain->vars()) &&
+             pDomain->tryAddRef() )
+         {
+            return pDomain;
+         }
+      }
+      return 0;
+   }
+
+   /**
+    * Frees every retired item that no thread can still be searching.
+    * The retired items must be locked by the caller.
+    */
+   void freeRetired_m(Table_m& table)
+   {
+      //************************************************************************
+      // Find the earliest epoch at which any thread started searching.
+      //************************************************************************
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      unsigned long oldest = table.epoch.load(std::memory_order_relaxed);
+      for(ThreadSlot_m* pSlot=table.slots.load(std::memory_order_acquire);
+            0!=pSlot; pSlot=pSlot->pNext)
+      {
+         const unsigned long epoch =
+            pSlot->epoch.load(std::memory_order_acquire);
+         if( (0!=epoch) && (epoch<oldest) )
+         {
+            oldest = epoch;
+         }
+      }
+
+      //************************************************************************
+      // Free everything retired before then.
+      //************************************************************************
+      std::vector<Retired_m>::iterator kept = table.retired.begin();
+      for(std::vector<Retired_m>::iterator it=table.retired.begin();
+            it!=table.retired.end(); ++it)
+      {
+         if(it->epoch < oldest)
+         {
+            delete it->pNode;
+            delete it->pDomain;
+            delete it->pBuckets;
+         }
+         else
+         {
+            *kept++ = *it;
+         }
+      }
+      table.retired.erase(kept,table.retired.end());
+   }
+
+   /**
+    * Retires items that have been removed from the table, and frees any
+    * that can no longer be searched.
+    */
+   void retire_m(const std::vector<Retired_m>& items)
+   {
+      Table_m& table = table_m();
+      std::lock_guard<std::mutex> lock(table.retiredMutex);
+      const unsigned long epoch =
+         table.epoch.fetch_add(1,std::memory_order_seq_cst);
+      for(std::vector<Retired_m>::const_iterator it=items.begin();
+            it!=items.end(); ++it)
+      {
+         table.retired.push_back(*it);
+         table.retired.back().epoch = epoch;
+      }
+      freeRetired_m(table);
+   }
+
+   /**
+    * Doubles the number of buckets in a locked shard. The existing nodes
+    * may still be searched, so each is copied into the new buckets, and
+    * the old nodes and buckets are retired.
+    */
+   void grow_m(Shard_m& shard)
+   {
+      Buckets_m* pOld = shard.buckets.load(std::memory_order_relaxed);
+      std::unique_ptr<Buckets_m> pNew(new Buckets_m(2*(pOld->mask+1)));
+      std::vector<Retired_m> retired;
+      retired.reserve(shard.count+1);
+      for(std::size_t k=0; k<=pOld->mask; ++k)
+      {
+         for(Node_m* pNode=pOld->heads[k].load(std::memory_order_relaxed);
+               0!=pNode; pNode=pNode->next.load(std::memory_order_relaxed))
+         {
+            std::atomic<Node_m*>& head =
+               bucket_m(*pNew,pNode->pDomain->hash());
+            head.store(new Node_m(pNode->pDomain,
+                     head.load(std::memory_order_relaxed)),
+                  std::memory_order_relaxed);
+            Retired_m item = {0,pNode,0,0};
+            retired.push_back(item);
+         }
+      }
+      Retired_m item = {0,0,0,pOld};
+      retired.push_back(item);
+      shard.buckets.store(pNew.release(),std::memory_order_release);
+      retire_m(retired);
+   }
+
+} // private namespace
+
+/**
+ * Constructs a domain over a sorted list of unique variables, with a
+ * single reference.
+ * @throws UnknownVariableException if any variable is not registered.
+ */
+Domain::Domain(const SortedVars& vars)
+   : vars_i(), size_i(vars.size), stride_i(vars.size), totalSize_i(1),
+     hash_i(vars.hash), refs_i(1)
+{
+   vars.copyTo(vars_i);
+   for(int k=0; k<noVars(); ++k)
+   {
+      size_i[k] = getDomainSize(vars_i[k]);
+      stride_i[k] = totalSize_i;
+      totalSize_i *= size_i[k];
+   }
+}
+
+/**
+ * Returns the number of domains currently interned, not counting the
+ * empty domain.
+ */
+std::size_t Domain::noInterned()
+{
+   return table_m().noInterned.load(std::memory_order_acquire);
+}
+
+/**
+ * Returns the shared domain for a sorted list of unique variables.
+ * If no such domain exists, then a new one is created. All variables are
+ * checked before anything is added to the table, so if an exception is
+ * thrown, the table is left unchanged.
+ * @throws UnknownVariableException if any variable is not registered.
+ */
+const Domain* Domain::internSorted(const SortedVars& vars)
+{
+   if(0==vars.size)
+   {
+      return empty();
+   }
+
+   //***************************************************************************
+   // Search for an existing domain with the same variables, without taking
+   // any locks. While searching, this thread records the epoch at which it
+   // started, so that nothing it may see is freed.
+   //***************************************************************************
+   Shard_m& shard = shard_m(vars.hash);
+   ThreadSlot_m& slot = threadSlot_m();
+   slot.epoch.store(table_m().epoch.load(std::memory_order_acquire),
+         std::memory_order_relaxed);
+   std::atomic_thread_fence(std::memory_order_seq_cst);
+   const Domain* pFound = search_m(bucket_m(*shard.buckets.load(
+               std::memory_order_acquire),vars.hash)
+         .load(std::memory_order_acquire),vars);
+   slot.epoch.store(0,std::memory_order_release);
+   if(0!=pFound)
+   {
+      return pFound;
+   }
+
+   //***************************************************************************
+   // Otherwise, search again with the shard locked, and create a new domain
+   // if there is still none.
+   //***************************************************************************
+   std::lock_guard<std::mutex> lock(shard.mutex);
+   Buckets_m* pBuckets = shard.buckets.load(std::memory_order_relaxed);
+   std::atomic<Node_m*>& head = bucket_m(*pBuckets,vars.hash);
+   pFound = search_m(head.load(std::memory_order_relaxed),vars);
+   if(0!=pFound)
+   {
+      return pFound;
+   }
+
+   std::unique_ptr<Domain> pNew(new Domain(vars));
+   head.store(new Node_m(pNew.get(),head.load(std::memory_order_relaxed)),
+         std::memory_order_release);
+   table_m().noInterned.fetch_add(1,std::memory_order_acq_rel);
+   if(pBuckets->mask < ++shard.count)
+   {
+      grow_m(shard);
+   }
+   return pNew.release();
+
+} // function internSorted
+
+/**
+ * Removes an unreferenced domain from the intern table, and frees it
+ * once no thread can still be searching it. A domain with no references
+ * can never gain any, so no new function can refer to it.
+ */
+void Domain::reclaim(const Domain* pDomain)
+{
+   Shard_m& shard = shard_m(pDomain->hash());
+   std::vector<Retired_m> retired;
+   {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      std::atomic<Node_m*>* pLink =
+         &bucket_m(*shard.buckets.load(std::memory_order_relaxed),
+               pDomain->hash());
+      Node_m* pNode = pLink->load(std::memory_order_relaxed);
+      while(pNode->pDomain!=pDomain)
+      {
+         pLink = &pNode->next;
+         pNode = pLink->load(std::memory_order_relaxed);
+      }
+      pLink->store(pNode->next.load(std::memory_order_relaxed),
+            std::memory_order_release);
+      --shard.count;
+      Retired_m item = {0,pNode,pDomain,0};
+      retired.push_back(item);
+   }
+   table_m().noInterned.fetch_sub(1,std::memory_order_acq_rel);
+   retire_m(retired);
+
+} // function reclaim
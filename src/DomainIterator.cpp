@@ -4,6 +4,7 @@
  * The maxsum::DomainIterator class provides methods for iterating over the
  * Cartesian product for a set of variable domains.
  */
+#include <cassert>
 #include <maxsum/register.h>
 #include <maxsum/DomainIterator.h>
 #include <maxsum/DiscreteFunction.h>
@@ -23,10 +24,27 @@ using namespace maxsum;
  */
 void DomainIterator::condition(const DomainIterator& it)
 {
-   VarList vars = it.getVars();
-   IndList inds = it.getSubInd();
-   condition(vars.begin(),vars.end(),inds.begin(), inds.end());
-}
+   //***************************************************************************
+   // Both variable lists are sorted, so they can be merged in one pass,
+   // without copying either.
+   //***************************************************************************
+   it.validateRange();
+   std::size_t pos = 0;
+   for(std::size_t k=0; (k<it.vars_i.size()) && (pos<vars_i.size()); ++k)
+   {
+      while( (pos<vars_i.size()) && (vars_i[pos]<it.vars_i[k]) )
+      {
+         ++pos;
+      }
+      if( (pos<vars_i.size()) && (vars_i[pos]==it.vars_i[k]) )
+      {
+         fix(static_cast<int>(pos));
+         subInd_i[pos] = it.subInd_i[k];
+      }
+   }
+   restart();
+
+} // function condition
 
 /**
  * Returns true if this function is conditioned on the specified
@@ -34,29 +52,68 @@ void DomainIterator::condition(const DomainIterator& it)
  */
 bool DomainIterator::isFixed(VarID var) const
 {
-   std::vector<VarID>::const_iterator pos = 
-   find(vars_i.begin(),vars_i.end(),var);
-   if(vars_i.end()==pos)
+   const int pos = position(var);
+   if(0>pos)
    {
       return false;
-   }  
-   return fixed_i[pos-vars_i.begin()];
+   }
+   return std::binary_search(fixed_i,fixed_i+fixedCount(),pos);
 }
 
 /**
- * Returns the number of conditioned variables for this function.
+ * Computes the stride of each variable from sizes_i, and marks every
+ * variable as free.
  */
-int DomainIterator::fixedCount() const
+void DomainIterator::initStrides()
 {
-   int count = 0;
-   for(int k=0; k<fixed_i.size(); ++k)
+   assert(util::MAX_DOMAIN_DIMS>=static_cast<int>(vars_i.size()));
+   ValIndex stride = 1;
+   noFree_i = vars_i.size();
+   for(int k=0; k<noFree_i; ++k)
    {
-      if(fixed_i[k])
-      {
-         ++count;
-      }
+      strides_i[k] = stride;
+      stride *= sizes_i[k];
+      free_i[k] = k;
+   }
+}
+
+/**
+ * Marks the variable at the specified position in vars_i as conditioned,
+ * if it is not already. Both position lists are kept in increasing order.
+ */
+void DomainIterator::fix(int position)
+{
+   int* pFree = std::lower_bound(free_i,free_i+noFree_i,position);
+   if( (free_i+noFree_i==pFree) || (position!=*pFree) )
+   {
+      return;
+   }
+   std::copy(pFree+1,free_i+noFree_i,pFree);
+   --noFree_i;
+
+   const int noFixed = fixedCount();
+   int* pFixed = std::lower_bound(fixed_i,fixed_i+noFixed-1,position);
+   std::copy_backward(pFixed,fixed_i+noFixed-1,fixed_i+noFixed);
+   *pFixed = position;
+}
+
+/**
+ * Sets every free sub index back to zero, and recomputes the linear
+ * index from the conditioned sub indices.
+ */
+void DomainIterator::restart()
+{
+   for(int k=0; k<noFree_i; ++k)
+   {
+      subInd_i[free_i[k]] = 0;
    }
-   return count;
+   ind_i = 0;
+   const int noFixed = fixedCount();
+   for(int k=0; k<noFixed; ++k)
+   {
+      ind_i += subInd_i[fixed_i[k]] * strides_i[fixed_i[k]];
+   }
+   finished_i = false;
 }
 
 /**
@@ -68,10 +125,12 @@ DomainIterator::DomainIterator(const DiscreteFunction& fun)
    : vars_i(fun.varBegin(),fun.varEnd()),    // copy variables
      subInd_i(fun.noVars(),0),               // set all subindices to zero
      ind_i(0),                               // set linear index to zero
-     fixed_i(fun.noVars(),false),            // all variables are initially free
      sizes_i(fun.sizeBegin(),fun.sizeEnd()), // copy variable sizes
+     noFree_i(0),                            // set by initStrides
      finished_i(false)                       // iterator is not done yet
-   {}                   // nothing left to do in constructor body
+{
+   initStrides();
+}
 
 /**
  * Copy constructor.
@@ -80,10 +139,15 @@ DomainIterator::DomainIterator(const DomainIterator& it)
    : vars_i(it.vars_i.begin(),it.vars_i.end()),       // copy everything
      subInd_i(it.subInd_i.begin(),it.subInd_i.end()),
      ind_i(it.ind_i),
-     fixed_i(it.fixed_i.begin(),it.fixed_i.end()),
      sizes_i(it.sizes_i.begin(),it.sizes_i.end()),
+     noFree_i(it.noFree_i),
      finished_i(it.finished_i)
-   {}                   // nothing left to do in constructor body
+{
+   const int noVars = vars_i.size();
+   std::copy(it.strides_i,it.strides_i+noVars,strides_i);
+   std::copy(it.free_i,it.free_i+noFree_i,free_i);
+   std::copy(it.fixed_i,it.fixed_i+(noVars-noFree_i),fixed_i);
+}
 
 /**
  * Copy assignment.
@@ -93,9 +157,13 @@ DomainIterator& DomainIterator::operator=(const DomainIterator& it)
    vars_i = it.vars_i;
    subInd_i = it.subInd_i;
    ind_i = it.ind_i;
-   fixed_i = it.fixed_i;
    sizes_i = it.sizes_i;
+   noFree_i = it.noFree_i;
    finished_i = it.finished_i;
+   const int noVars = vars_i.size();
+   std::copy(it.strides_i,it.strides_i+noVars,strides_i);
+   std::copy(it.free_i,it.free_i+noFree_i,free_i);
+   std::copy(it.fixed_i,it.fixed_i+(noVars-noFree_i),fixed_i);
    return *this;
 
 } // operator=
@@ -109,54 +177,37 @@ DomainIterator& DomainIterator::operator=(const DomainIterator& it)
 DomainIterator& DomainIterator::operator++()
 {
    //***************************************************************************
-   // Until proven otherwise, we assume that, by incrementing this iterator,
-   // we will run out of elements.
-   //***************************************************************************
-   finished_i = true;
-
-   //***************************************************************************
-   // Iterator through all subindices least significant first order.
+   // Iterator through the free subindices least significant first order.
    // As in Matlab, we consider the first index to be least significant,
-   // and the last to be most significant.
+   // and the last to be most significant. The linear index is updated by
+   // the stride of each subindex that changes.
    //***************************************************************************
-   for(int k=0; k<vars_i.size(); ++k)
+   for(int j=0; j<noFree_i; ++j)
    {
+      const int k = free_i[j];
+
       //************************************************************************
-      // Ignore conditioned variables
+      // If the current variable has another value, then we've completed
+      // this increment, and we've still got values yet to visit.
       //************************************************************************
-      if(fixed_i[k])
+      if(++subInd_i[k] < sizes_i[k])
       {
-         continue;
+         ind_i += strides_i[k];
+         return *this;
       }
 
       //************************************************************************
-      // Increment current variable to its next value.
-      //************************************************************************
-      subInd_i[k] = (subInd_i[k]+1) % sizes_i[k];
-
-      //************************************************************************
-      // If the new value is non-zero, then we've completed this incremenet,
-      // and we've still got values yet to visit.
+      // Otherwise, wrap it back to zero, and carry to the next variable.
       //************************************************************************
-      if(0 < subInd_i[k])
-      {
-         finished_i = false;
-         break;
-      }
+      ind_i -= (sizes_i[k]-1) * strides_i[k];
+      subInd_i[k] = 0;
 
    } // for loop
 
    //***************************************************************************
-   // Update linear index to be consistent with current subindices.
-   //***************************************************************************
-   ind_i = sub2ind( sizes_i.begin(),  sizes_i.end(),
-                   subInd_i.begin(), subInd_i.end() );
-
-   //***************************************************************************
-   // Return reference to this iterator
+   // If every free variable has wrapped around, we have run out of elements.
    //***************************************************************************
+   finished_i = true;
    return *this;
 
 } // prefix ++
-
-
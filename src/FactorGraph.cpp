@@ -0,0 +1,627 @@
+/**
+ * @file FactorGraph.cpp
+ * Implementation of the maxsum::util::FactorGraph class.
+ * @see FactorGraph.h
+ */
+#include <algorithm>
+#include <cassert>
+#include <maxsum/FactorGraph.h>
+
+using namespace maxsum;
+using namespace maxsum::util;
+
+namespace
+{
+   /**
+    * Returns the position of <code>id</code> in a sorted list of
+    * identifiers, or -1 if it is not in the list.
+    */
+   template<class ID> int findSorted_m(const std::vector<ID>& ids, ID id)
+   {
+      typename std::vector<ID>::const_iterator pos =
+         std::lower_bound(ids.begin(),ids.end(),id);
+      if( (ids.end()==pos) || (*pos!=id) )
+      {
+         return -1;
+      }
+      return pos - ids.begin();
+   }
+
+   /**
+    * Returns the number of bytes reserved for the elements of a vector.
+    */
+   template<class T> std::size_t capacityBytes_m(const std::vector<T>& vec)
+   {
+      return vec.capacity()*sizeof(T);
+   }
+
+   /**
+    * Returns the index of <code>id</code> in a list of identifiers, given
+    * the indices of the list in increasing order of identifier, or -1 if it
+    * is not in the list. If <code>byId</code> is empty, the list itself is
+    * assumed to be sorted.
+    */
+   template<class ID> int findRanked_m
+   (
+    const std::vector<ID>& ids,
+    const std::vector<int>& byId,
+    ID id
+   )
+   {
+      if(byId.empty())
+      {
+         return findSorted_m(ids,id);
+      }
+      int low = 0;
+      int high = byId.size();
+      while(low<high)
+      {
+         const int mid = low + (high-low)/2;
+         if(ids[byId[mid]]<id)
+         {
+            low = mid+1;
+         }
+         else
+         {
+            high = mid;
+         }
+      }
+      if( (static_cast<int>(byId.size())==low) || (ids[byId[low]]!=id) )
+      {
+         return -1;
+      }
+      return byId[low];
+   }
+
+   /**
+    * Rearranges a vector so that element <code>k</code> is the element
+    * previously at position <code>order[k]</code>.
+    */
+   template<class T> void permute_m(std::vector<T>& vec,
+         const std::vector<int>& order)
+   {
+      std::vector<T> result;
+      result.reserve(order.size());
+      for(std::vector<int>::const_iterator it=order.begin();
+            it!=order.end(); ++it)
+      {
+         result.push_back(vec[*it]);
+      }
+      vec.swap(result);
+   }
+
+} // module namespace
+
+/**
+ * Returns the index of the specified factor, or -1 if it is not in
+ * this graph.
+ */
+int FactorGraph::findFactor(FactorID id) const
+{
+   return findRanked_m(factorIds_i,factorsById_i,id);
+}
+
+/**
+ * Returns the index of the specified variable, or -1 if it is not in
+ * this graph.
+ */
+int FactorGraph::findVar(VarID id) const
+{
+   return findRanked_m(varIds_i,varsById_i,id);
+}
+
+/**
+ * Removes all nodes, edges, messages and notices from this graph.
+ */
+void FactorGraph::clear()
+{
+   FactorGraph empty;
+   empty.reorder_i = reorder_i;
+   swap(empty);
+}
+
+/**
+ * Removes all nodes, edges, messages and notices from this graph, but keeps
+ * its storage for reuse by FactorGraph::compile.
+ */
+void FactorGraph::recycle()
+{
+   factorIds_i.clear();
+   factors_i.clear();
+   implicit_i.clear();
+   totals_i.clear();
+   factorEdges_i.clear();
+   factorShape_i.clear();
+   varIds_i.clear();
+   values_i.clear();
+   varSizes_i.clear();
+   varEdgeStart_i.clear();
+   varEdges_i.clear();
+   edgeFactor_i.clear();
+   edgeVar_i.clear();
+   edgeStride_i.clear();
+   msgOffset_i.clear();
+   fac2var_i.clear();
+   var2fac_i.clear();
+   factorNotices_i.reset(0);
+   varNotices_i.reset(0);
+   maxVarSize_i = 0;
+   noShapes_i = 0;
+   maxImplicitArity_i = 0;
+   maxImplicitLength_i = 0;
+   factorsById_i.clear();
+   varsById_i.clear();
+
+} // function recycle
+
+/**
+ * Returns the number of bytes of heap storage reserved by this graph,
+ * including its messages, but excluding the factors it refers to.
+ */
+std::size_t FactorGraph::bytesUsed() const
+{
+   return capacityBytes_m(factorIds_i) + capacityBytes_m(factors_i)
+      + capacityBytes_m(implicit_i) + capacityBytes_m(totals_i)
+      + capacityBytes_m(factorEdges_i) + capacityBytes_m(factorShape_i)
+      + capacityBytes_m(varIds_i) + capacityBytes_m(values_i)
+      + capacityBytes_m(varSizes_i) + capacityBytes_m(varEdgeStart_i)
+      + capacityBytes_m(varEdges_i) + capacityBytes_m(edgeFactor_i)
+      + capacityBytes_m(edgeVar_i) + capacityBytes_m(edgeStride_i)
+      + capacityBytes_m(msgOffset_i) + capacityBytes_m(fac2var_i)
+      + capacityBytes_m(var2fac_i) + factorNotices_i.bytesUsed()
+      + varNotices_i.bytesUsed() + capacityBytes_m(factorsById_i)
+      + capacityBytes_m(varsById_i);
+
+} // function bytesUsed
+
+/**
+ * Swaps the contents of this graph with another.
+ */
+void FactorGraph::swap(FactorGraph& rhs) noexcept
+{
+   factorIds_i.swap(rhs.factorIds_i);
+   factors_i.swap(rhs.factors_i);
+   implicit_i.swap(rhs.implicit_i);
+   totals_i.swap(rhs.totals_i);
+   factorEdges_i.swap(rhs.factorEdges_i);
+   factorShape_i.swap(rhs.factorShape_i);
+   varIds_i.swap(rhs.varIds_i);
+   values_i.swap(rhs.values_i);
+   varSizes_i.swap(rhs.varSizes_i);
+   varEdgeStart_i.swap(rhs.varEdgeStart_i);
+   varEdges_i.swap(rhs.varEdges_i);
+   edgeFactor_i.swap(rhs.edgeFactor_i);
+   edgeVar_i.swap(rhs.edgeVar_i);
+   edgeStride_i.swap(rhs.edgeStride_i);
+   msgOffset_i.swap(rhs.msgOffset_i);
+   fac2var_i.swap(rhs.fac2var_i);
+   var2fac_i.swap(rhs.var2fac_i);
+   factorNotices_i.swap(rhs.factorNotices_i);
+   varNotices_i.swap(rhs.varNotices_i);
+   std::swap(maxVarSize_i,rhs.maxVarSize_i);
+   std::swap(noShapes_i,rhs.noShapes_i);
+   std::swap(maxImplicitArity_i,rhs.maxImplicitArity_i);
+   std::swap(maxImplicitLength_i,rhs.maxImplicitLength_i);
+   std::swap(reorder_i,rhs.reorder_i);
+   factorsById_i.swap(rhs.factorsById_i);
+   varsById_i.swap(rhs.varsById_i);
+
+} // swap
+
+/**
+ * Rebuilds this graph from the specified factors.
+ * Messages along edges that were already in this graph are preserved,
+ * while new edges start with zero messages. Likewise, any pending
+ * notices are preserved for nodes that remain in the graph. Factors
+ * that were not previously in this graph are notified, so that they
+ * send their initial messages.
+ * @param[in] factors the function for each factor stored as a table.
+ * @param[in] implicit each implicit factor, none of which has the same
+ * identifier as a factor in <code>factors</code>.
+ * @param[in,out] totals an entry is created for each factor table, if one
+ * does not already exist, to store its total value. Any entry whose
+ * domain differs from its factor is reset to the factor's value, so that
+ * totals can later be updated in place without allocating memory.
+ * @param[in,out] values the value of every variable in the domain of at
+ * least one factor.
+ * @param[in,out] spare graph whose storage is used to build the new graph,
+ * and which is left holding the storage of the old graph.
+ */
+void FactorGraph::compile
+(
+ const FactorMap& factors,
+ const ImplicitMap& implicit,
+ FactorMap& totals,
+ ValueMap& values,
+ FactorGraph& spare
+)
+{
+   assert(this!=&spare);
+   FactorGraph& next = spare;
+   next.recycle();
+   next.reorder_i = reorder_i;
+
+   //***************************************************************************
+   // Assign an index to each variable.
+   //***************************************************************************
+   const int noVars = values.size();
+   next.varIds_i.reserve(noVars);
+   next.values_i.reserve(noVars);
+   for(ValueMap::iterator it=values.begin(); it!=values.end(); ++it)
+   {
+      next.varIds_i.push_back(it->first);
+      next.values_i.push_back(&(it->second));
+   }
+   next.varSizes_i.assign(noVars,0);
+
+   //***************************************************************************
+   // Assign an index to each factor, and to each of its edges, in the same
+   // order as the factor's domain. Factor tables and implicit factors are
+   // merged, so that all factors are in increasing order of identifier.
+   //***************************************************************************
+   const std::size_t noFactors = factors.size() + implicit.size();
+   next.factorIds_i.reserve(noFactors);
+   next.factors_i.reserve(noFactors);
+   next.implicit_i.reserve(noFactors);
+   next.totals_i.reserve(noFactors);
+   next.factorEdges_i.reserve(noFactors+1);
+   next.factorShape_i.reserve(noFactors);
+   std::vector<int> varDegree(noVars,0);
+   std::map<std::vector<ValIndex>,int> shapes;
+   std::vector<ValIndex> shapeKey;
+   FactorMap::const_iterator denseIt = factors.begin();
+   ImplicitMap::const_iterator implicitIt = implicit.begin();
+   while( (factors.end()!=denseIt) || (implicit.end()!=implicitIt) )
+   {
+      const int f = next.factorIds_i.size();
+      const std::vector<VarID>* pVars = 0;
+      const std::vector<ValIndex>* pSizes = 0;
+      if( (implicit.end()==implicitIt) ||
+          ( (factors.end()!=denseIt) && (denseIt->first<implicitIt->first) ) )
+      {
+         const DiscreteFunction& fun = denseIt->second;
+         next.factorIds_i.push_back(denseIt->first);
+         next.factors_i.push_back(&fun);
+         next.implicit_i.push_back(0);
+         next.totals_i.push_back(&totals[denseIt->first]);
+         if(!sameDomain(*next.totals_i.back(),fun))
+         {
+            *next.totals_i.back() = fun;
+         }
+         pVars = &fun.domain().vars();
+         pSizes = &fun.domain().sizes();
+         shapeKey = *pSizes;
+         ++denseIt;
+      }
+      else
+      {
+         const ImplicitFactor& fun = *implicitIt->second;
+         assert(0==factors.count(implicitIt->first));
+         next.factorIds_i.push_back(implicitIt->first);
+         next.factors_i.push_back(0);
+         next.implicit_i.push_back(&fun);
+         next.totals_i.push_back(0);
+         pVars = &fun.vars();
+         pSizes = &fun.sizes();
+         shapeKey.assign(1,-1);
+         shapeKey.insert(shapeKey.end(),pSizes->begin(),pSizes->end());
+         ValIndex length = 0;
+         for(std::size_t k=0; k<pSizes->size(); ++k)
+         {
+            length += (*pSizes)[k];
+         }
+         next.maxImplicitArity_i =
+            std::max(next.maxImplicitArity_i,fun.noVars());
+         next.maxImplicitLength_i = std::max(next.maxImplicitLength_i,length);
+         ++implicitIt;
+      }
+      next.factorEdges_i.push_back(next.edgeVar_i.size());
+
+      //************************************************************************
+      // Factor tables with the same domain sizes share a shape, as do
+      // implicit factors, which are keyed separately by a leading -1.
+      //************************************************************************
+      const int noShapes = shapes.size();
+      next.factorShape_i.push_back(
+            shapes.insert(std::make_pair(shapeKey,noShapes)).first->second);
+
+      ValIndex stride = 1;
+      for(std::size_t k=0; k<pVars->size(); ++k)
+      {
+         const int v = next.findVar((*pVars)[k]);
+         assert(0<=v);
+         next.varSizes_i[v] = (*pSizes)[k];
+         next.edgeFactor_i.push_back(f);
+         next.edgeVar_i.push_back(v);
+         next.edgeStride_i.push_back(0==next.implicit_i[f] ? stride : 0);
+         ++varDegree[v];
+         stride *= (*pSizes)[k];
+      }
+   }
+   const int noEdges = next.edgeVar_i.size();
+   next.factorEdges_i.push_back(noEdges);
+   next.noShapes_i = shapes.size();
+   if(reorder_i)
+   {
+      next.reorder();
+      varDegree.assign(noVars,0);
+      for(int e=0; e<noEdges; ++e)
+      {
+         ++varDegree[next.edgeVar_i[e]];
+      }
+   }
+
+   //***************************************************************************
+   // Group edges by variable. Since edges are visited in increasing order,
+   // each variable's edges are listed in increasing order of factor index.
+   //***************************************************************************
+   next.varEdgeStart_i.resize(noVars+1);
+   next.varEdgeStart_i[0] = 0;
+   for(int v=0; v<noVars; ++v)
+   {
+      next.varEdgeStart_i[v+1] = next.varEdgeStart_i[v] + varDegree[v];
+      next.maxVarSize_i = std::max(next.maxVarSize_i,next.varSizes_i[v]);
+   }
+   next.varEdges_i.resize(noEdges);
+   std::vector<int> fill(next.varEdgeStart_i.begin(),
+         next.varEdgeStart_i.end()-1);
+   for(int e=0; e<noEdges; ++e)
+   {
+      next.varEdges_i[fill[next.edgeVar_i[e]]++] = e;
+   }
+
+   //***************************************************************************
+   // Lay out messages contiguously in edge order, initialised to zero.
+   //***************************************************************************
+   next.msgOffset_i.resize(noEdges+1);
+   next.msgOffset_i[0] = 0;
+   for(int e=0; e<noEdges; ++e)
+   {
+      next.msgOffset_i[e+1] = next.msgOffset_i[e]
+         + next.varSizes_i[next.edgeVar_i[e]];
+   }
+   next.fac2var_i.assign(next.msgOffset_i[noEdges],0);
+   next.var2fac_i.assign(next.msgOffset_i[noEdges],0);
+
+   //***************************************************************************
+   // Copy messages for edges that were already in this graph, and notify
+   // any factors that are new.
+   //***************************************************************************
+   next.factorNotices_i.reset(next.noFactors());
+   next.varNotices_i.reset(noVars);
+   for(int f=0; f<next.noFactors(); ++f)
+   {
+      const int oldF = findFactor(next.factorIds_i[f]);
+      if(0>oldF)
+      {
+         next.factorNotices_i.notify(f);
+         continue;
+      }
+
+      int oldE = factorEdgeBegin(oldF);
+      const int oldEnd = factorEdgeEnd(oldF);
+      for(int e=next.factorEdgeBegin(f); e<next.factorEdgeEnd(f); ++e)
+      {
+         //*********************************************************************
+         // Both edge lists are in increasing order of variable, so we only
+         // need to search forward from the last match.
+         //*********************************************************************
+         const VarID var = next.varIds_i[next.edgeVar_i[e]];
+         while( (oldE<oldEnd) && (varIds_i[edgeVar_i[oldE]]<var) )
+         {
+            ++oldE;
+         }
+         if( (oldE==oldEnd) || (varIds_i[edgeVar_i[oldE]]!=var) )
+         {
+            continue;
+         }
+
+         const int len = next.msgOffset_i[e+1] - next.msgOffset_i[e];
+         assert(len == msgOffset_i[oldE+1]-msgOffset_i[oldE]);
+         std::copy(fac2var(oldE),fac2var(oldE)+len,next.fac2var(e));
+         std::copy(var2fac(oldE),var2fac(oldE)+len,next.var2fac(e));
+      }
+
+      if(factorNotices_i.isPending(oldF))
+      {
+         next.factorNotices_i.notify(f);
+      }
+   }
+
+   //***************************************************************************
+   // Preserve pending notices for variables.
+   //***************************************************************************
+   for(int v=0; v<noVars; ++v)
+   {
+      const int oldV = findVar(next.varIds_i[v]);
+      if( (0<=oldV) && varNotices_i.isPending(oldV) )
+      {
+         next.varNotices_i.notify(v);
+      }
+   }
+
+   //***************************************************************************
+   // Finally, swap in the new graph, which leaves the old graph's storage in
+   // the spare graph for next time.
+   //***************************************************************************
+   swap(next);
+
+} // compile
+
+/**
+ * Renumbers the factors and variables of a graph that is being compiled,
+ * so that nodes which are close together in the graph are also close
+ * together in memory.
+ * <p>
+ * Factors and variables are the nodes of a bipartite graph, which is
+ * ordered by the reverse Cuthill-McKee algorithm: each connected component
+ * is searched breadth first from an unvisited node of least degree,
+ * visiting the unvisited neighbours of each node in increasing order of
+ * degree, and the resulting order is then reversed. Factors and variables
+ * are then each indexed in the order in which they appear.
+ * </p>
+ */
+void FactorGraph::reorder()
+{
+   const int noFactors = this->noFactors();
+   const int noVars = this->noVars();
+   const int noNodes = noFactors + noVars;
+   const int noEdges = edgeVar_i.size();
+
+   //***************************************************************************
+   // Nodes are numbered with factors first. Build a temporary list of the
+   // factors adjacent to each variable, since the graph's own list is only
+   // built after reordering.
+   //***************************************************************************
+   std::vector<int> adjStart(noVars+1,0);
+   for(int e=0; e<noEdges; ++e)
+   {
+      ++adjStart[edgeVar_i[e]+1];
+   }
+   for(int v=0; v<noVars; ++v)
+   {
+      adjStart[v+1] += adjStart[v];
+   }
+   std::vector<int> adjacent(noEdges);
+   std::vector<int> fill(adjStart.begin(),adjStart.end()-1);
+   for(int e=0; e<noEdges; ++e)
+   {
+      adjacent[fill[edgeVar_i[e]]++] = edgeFactor_i[e];
+   }
+
+   std::vector<int> degree(noNodes);
+   for(int f=0; f<noFactors; ++f)
+   {
+      degree[f] = factorEdges_i[f+1] - factorEdges_i[f];
+   }
+   for(int v=0; v<noVars; ++v)
+   {
+      degree[noFactors+v] = adjStart[v+1] - adjStart[v];
+   }
+
+   //***************************************************************************
+   // Search each component from its unvisited node of least degree, with
+   // ties broken by node number so that the order is deterministic.
+   //***************************************************************************
+   std::vector<int> roots(noNodes);
+   for(int node=0; node<noNodes; ++node)
+   {
+      roots[node] = node;
+   }
+   struct ByDegree
+   {
+      const std::vector<int>& degree;
+      bool operator()(int a, int b) const { return degree[a]<degree[b]; }
+   } byDegree = { degree };
+   std::stable_sort(roots.begin(),roots.end(),byDegree);
+
+   std::vector<int> order;
+   order.reserve(noNodes);
+   std::vector<char> seen(noNodes,0);
+   for(std::vector<int>::const_iterator root=roots.begin();
+         root!=roots.end(); ++root)
+   {
+      if(0!=seen[*root])
+      {
+         continue;
+      }
+      seen[*root] = 1;
+      order.push_back(*root);
+      for(std::size_t pos=order.size()-1; pos<order.size(); ++pos)
+      {
+         const int node = order[pos];
+         const std::size_t first = order.size();
+         if(node<noFactors)
+         {
+            for(int e=factorEdges_i[node]; e<factorEdges_i[node+1]; ++e)
+            {
+               const int next = noFactors + edgeVar_i[e];
+               if(0==seen[next])
+               {
+                  seen[next] = 1;
+                  order.push_back(next);
+               }
+            }
+         }
+         else
+         {
+            const int v = node - noFactors;
+            for(int k=adjStart[v]; k<adjStart[v+1]; ++k)
+            {
+               const int next = adjacent[k];
+               if(0==seen[next])
+               {
+                  seen[next] = 1;
+                  order.push_back(next);
+               }
+            }
+         }
+         std::stable_sort(order.begin()+first,order.end(),byDegree);
+      }
+   }
+   std::reverse(order.begin(),order.end());
+
+   //***************************************************************************
+   // Split the order into factors and variables. Since nodes were indexed
+   // in order of identifier, the new index of each old index is also the
+   // new index of each node in order of identifier.
+   //***************************************************************************
+   std::vector<int> factorOrder;
+   std::vector<int> varOrder;
+   factorOrder.reserve(noFactors);
+   varOrder.reserve(noVars);
+   factorsById_i.resize(noFactors);
+   varsById_i.resize(noVars);
+   for(std::vector<int>::const_iterator it=order.begin(); it!=order.end();
+         ++it)
+   {
+      if(*it<noFactors)
+      {
+         factorsById_i[*it] = factorOrder.size();
+         factorOrder.push_back(*it);
+      }
+      else
+      {
+         varsById_i[*it-noFactors] = varOrder.size();
+         varOrder.push_back(*it-noFactors);
+      }
+   }
+
+   //***************************************************************************
+   // Rearrange the nodes, and then the edges of each factor, which keep
+   // the order of the factor's domain.
+   //***************************************************************************
+   permute_m(factorIds_i,factorOrder);
+   permute_m(factors_i,factorOrder);
+   permute_m(implicit_i,factorOrder);
+   permute_m(totals_i,factorOrder);
+   permute_m(factorShape_i,factorOrder);
+   permute_m(varIds_i,varOrder);
+   permute_m(values_i,varOrder);
+   permute_m(varSizes_i,varOrder);
+
+   std::vector<int> factorEdges(1,0);
+   std::vector<int> edgeFactor;
+   std::vector<int> edgeVar;
+   std::vector<ValIndex> edgeStride;
+   factorEdges.reserve(noFactors+1);
+   edgeFactor.reserve(noEdges);
+   edgeVar.reserve(noEdges);
+   edgeStride.reserve(noEdges);
+   for(int f=0; f<noFactors; ++f)
+   {
+      const int oldF = factorOrder[f];
+      for(int e=factorEdges_i[oldF]; e<factorEdges_i[oldF+1]; ++e)
+      {
+         edgeFactor.push_back(f);
+         edgeVar.push_back(varsById_i[edgeVar_i[e]]);
+         edgeStride.push_back(edgeStride_i[e]);
+      }
+      factorEdges.push_back(edgeVar.size());
+   }
+   factorEdges_i.swap(factorEdges);
+   edgeFactor_i.swap(edgeFactor);
+   edgeVar_i.swap(edgeVar);
+   edgeStride_i.swap(edgeStride);
+
+} // function reorder
@@ -0,0 +1,567 @@
+/**
+ * @file GraphFile.cpp
+ * Implementation of MaxSumController::save and MaxSumController::load,
+ * which store factor graphs in a binary file format.
+ * <p>
+ * A factor graph file consists of a fixed size header, followed by a
+ * number of sections, each of which starts at a multiple of 8 bytes from
+ * the start of the file:
+ * </p>
+ * <ol>
+ * <li>the id and domain size of each variable, in increasing order of id;</li>
+ * <li>the id of each factor, in increasing order, together with the number
+ * of variables in its domain, and the offsets of its domain and values in
+ * the following sections;</li>
+ * <li>the domain variables of every factor, concatenated;</li>
+ * <li>the values of every factor, concatenated;</li>
+ * <li>optionally, the value assigned to each variable, followed by all
+ * factor to variable, and then all variable to factor messages. Messages
+ * are listed in increasing order of factor id, and then in the order of
+ * each factor's domain, whether or not the compiled graph is reordered.</li>
+ * </ol>
+ * All integers and values are stored in the native byte order and size.
+ * The header records the size of maxsum::ValType and a byte order mark,
+ * so that files written by an incompatible build are rejected.
+ */
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <maxsum/MaxSumController.h>
+
+using namespace maxsum;
+
+/**
+ * Private Module Namespace.
+ */
+namespace
+{
+   /**
+    * Identifies factor graph files.
+    */
+   const char MAGIC_M[8] = {'M','A','X','S','U','M','F','G'};
+
+   /**
+    * Current version of the file format.
+    */
+   const std::uint32_t VERSION_M = 1;
+
+   /**
+    * Written in native byte order, to detect files with the wrong order.
+    */
+   const std::uint32_t BYTE_ORDER_M = 0x01020304;
+
+   /**
+    * Set in FileHeader_m::flags if messages are included.
+    */
+   const std::uint32_t HAS_MESSAGES_M = 1;
+
+   /**
+    * Fixed size header at the start of every factor graph file.
+    */
+   struct FileHeader_m
+   {
+      char magic[8];
+      std::uint32_t version;
+      std::uint32_t byteOrder;
+      std::uint32_t valueSize;
+      std::uint32_t flags;
+      std::uint64_t noVars;
+      std::uint64_t noFactors;
+      std::uint64_t noDomainVars;
+      std::uint64_t noValues;
+      std::uint64_t noMsgValues;
+   };
+
+   /**
+    * Record of a variable's id and domain size.
+    */
+   struct VarRecord_m
+   {
+      std::uint32_t id;
+      std::int32_t size;
+   };
+
+   /**
+    * Record of a factor's id, and the position of its domain and values.
+    */
+   struct FactorRecord_m
+   {
+      std::uint32_t id;
+      std::uint32_t noVars;
+      std::uint64_t varOffset;
+      std::uint64_t valueOffset;
+   };
+
+   /**
+    * Rounds a file offset up to the next multiple of 8 bytes.
+    */
+   std::uint64_t align_m(std::uint64_t offset)
+   {
+      return (offset + 7) & ~static_cast<std::uint64_t>(7);
+   }
+
+   /**
+    * Byte offsets of each section in a file with the specified header.
+    */
+   struct Layout_m
+   {
+      std::uint64_t vars, factors, domains, values, assignments, fac2var,
+         var2fac, end;
+
+      Layout_m(const FileHeader_m& h)
+      {
+         vars = align_m(sizeof(FileHeader_m));
+         factors = align_m(vars + h.noVars*sizeof(VarRecord_m));
+         domains = align_m(factors + h.noFactors*sizeof(FactorRecord_m));
+         values = align_m(domains + h.noDomainVars*sizeof(std::uint32_t));
+         assignments = align_m(values + h.noValues*sizeof(ValType));
+         if(0==(h.flags & HAS_MESSAGES_M))
+         {
+            fac2var = var2fac = end = assignments;
+            return;
+         }
+         fac2var = align_m(assignments + h.noVars*sizeof(std::int32_t));
+         var2fac = align_m(fac2var + h.noMsgValues*sizeof(ValType));
+         end = var2fac + h.noMsgValues*sizeof(ValType);
+      }
+   };
+
+   /**
+    * Writes an array to a file at the specified offset, padding the file
+    * with zeros up to that offset if necessary.
+    */
+   void write_m
+   (
+    std::ofstream& out,
+    std::uint64_t offset,
+    const void* pData,
+    std::uint64_t size
+   )
+   {
+      static const char zeros[8] = {0};
+      std::uint64_t pos = out.tellp();
+      if(pos < offset)
+      {
+         out.write(zeros,offset-pos);
+      }
+      out.write(static_cast<const char*>(pData),size);
+   }
+
+   /**
+    * Read only memory mapping of a file, which is unmapped on destruction.
+    */
+   class MappedFile_m
+   {
+   private:
+
+      void* pData_i;
+      std::uint64_t size_i;
+
+      MappedFile_m(const MappedFile_m&);
+      MappedFile_m& operator=(const MappedFile_m&);
+
+   public:
+
+      /**
+       * Maps the specified file into memory.
+       * @throws FileFormatException if the file cannot be mapped.
+       */
+      MappedFile_m(const std::string& path) : pData_i(MAP_FAILED), size_i(0)
+      {
+         int fd = ::open(path.c_str(),O_RDONLY);
+         if(0>fd)
+         {
+            throw FileFormatException("MaxSumController::load",
+                  "Cannot open "+path);
+         }
+         struct stat info;
+         if(0==::fstat(fd,&info) && 0<info.st_size)
+         {
+            size_i = info.st_size;
+            pData_i = ::mmap(0,size_i,PROT_READ,MAP_PRIVATE,fd,0);
+         }
+         ::close(fd);
+         if(MAP_FAILED==pData_i)
+         {
+            throw FileFormatException("MaxSumController::load",
+                  "Cannot map "+path);
+         }
+      }
+
+      ~MappedFile_m()
+      {
+         ::munmap(pData_i,size_i);
+      }
+
+      /**
+       * Returns the number of bytes in the mapped file.
+       */
+      std::uint64_t size() const { return size_i; }
+
+      /**
+       * Returns a pointer to the data at the specified byte offset.
+       */
+      template<class T> const T* at(std::uint64_t offset) const
+      {
+         return reinterpret_cast<const T*>
+            (static_cast<const char*>(pData_i)+offset);
+      }
+   };
+
+   /**
+    * Orders variable records by id.
+    */
+   bool lessId_m(const VarRecord_m& lhs, const VarRecord_m& rhs)
+   {
+      return lhs.id < rhs.id;
+   }
+
+   /**
+    * Returns the total number of values in the messages along the edges of
+    * the specified factor, which are stored contiguously from its first edge.
+    */
+   int factorMsgLength_m(const util::FactorGraph& graph, int f)
+   {
+      int len = 0;
+      for(int e=graph.factorEdgeBegin(f); e<graph.factorEdgeEnd(f); ++e)
+      {
+         len += graph.varSize(graph.edgeVar(e));
+      }
+      return len;
+   }
+
+   /**
+    * Throws a FileFormatException for a corrupt or incompatible file.
+    */
+   void badFile_m(const std::string& path, const std::string& reason)
+   {
+      throw FileFormatException("MaxSumController::load",path+": "+reason);
+   }
+
+} // private namespace
+
+/**
+ * Saves this controller's factors to a binary file.
+ * @param[in] path the name of the file to create or overwrite.
+ * @param[in] withMessages if true, and the factor graph has not changed
+ * since it was last compiled, then the current messages and variable
+ * values are also saved.
+ * @throws FileFormatException if the file cannot be written, or this
+ * controller has any implicit factors.
+ */
+void MaxSumController::save(const std::string& path, bool withMessages) const
+{
+   //***************************************************************************
+   // Implicit factors are defined by code rather than data, so they cannot
+   // be written to a factor graph file.
+   //***************************************************************************
+   if(!implicit_i.empty())
+   {
+      throw FileFormatException("MaxSumController::save",
+            "Cannot save a factor graph with implicit factors: " + path);
+   }
+
+   //***************************************************************************
+   // Collect the variable and factor records, and count the total size of
+   // all domains and value arrays.
+   //***************************************************************************
+   FileHeader_m header;
+   std::memset(&header,0,sizeof(header));
+   std::memcpy(header.magic,MAGIC_M,sizeof(MAGIC_M));
+   header.version = VERSION_M;
+   header.byteOrder = BYTE_ORDER_M;
+   header.valueSize = sizeof(ValType);
+
+   std::vector<VarRecord_m> vars;
+   vars.reserve(values_i.size());
+   for(ValueMap::const_iterator it=values_i.begin(); it!=values_i.end(); ++it)
+   {
+      VarRecord_m rec = { it->first, getDomainSize(it->first) };
+      vars.push_back(rec);
+   }
+
+   std::vector<FactorRecord_m> factors;
+   std::vector<std::uint32_t> domains;
+   factors.reserve(factors_i.size());
+   for(FactorMap::const_iterator it=factors_i.begin(); it!=factors_i.end();
+         ++it)
+   {
+      FactorRecord_m rec = { it->first,
+         static_cast<std::uint32_t>(it->second.noVars()),
+         domains.size(), header.noValues };
+      factors.push_back(rec);
+      domains.insert(domains.end(),it->second.varBegin(),it->second.varEnd());
+      header.noValues += it->second.domainSize();
+   }
+
+   header.noVars = vars.size();
+   header.noFactors = factors.size();
+   header.noDomainVars = domains.size();
+
+   //***************************************************************************
+   // Messages are only meaningful if the compiled graph is up to date.
+   //***************************************************************************
+   if(withMessages && graphValid_i && (0<graph_i.noEdges()))
+   {
+      header.flags |= HAS_MESSAGES_M;
+      header.noMsgValues = graph_i.noMsgValues();
+   }
+   const Layout_m layout(header);
+
+   //***************************************************************************
+   // Write each section in turn.
+   //***************************************************************************
+   std::ofstream out(path.c_str(),std::ios::binary|std::ios::trunc);
+   write_m(out,0,&header,sizeof(header));
+   write_m(out,layout.vars,vars.data(),vars.size()*sizeof(VarRecord_m));
+   write_m(out,layout.factors,factors.data(),
+         factors.size()*sizeof(FactorRecord_m));
+   write_m(out,layout.domains,domains.data(),
+         domains.size()*sizeof(std::uint32_t));
+   write_m(out,layout.values,0,0);
+   for(FactorMap::const_iterator it=factors_i.begin(); it!=factors_i.end();
+         ++it)
+   {
+      const DiscreteFunction& fun = it->second;
+      out.write(reinterpret_cast<const char*>(&fun(0)),
+            fun.domainSize()*sizeof(ValType));
+   }
+
+   if(0!=(header.flags & HAS_MESSAGES_M))
+   {
+      std::vector<std::int32_t> assignments;
+      assignments.reserve(values_i.size());
+      for(ValueMap::const_iterator it=values_i.begin();
+            it!=values_i.end(); ++it)
+      {
+         assignments.push_back(it->second);
+      }
+      write_m(out,layout.assignments,assignments.data(),
+            assignments.size()*sizeof(std::int32_t));
+
+      //************************************************************************
+      // Write the messages for each factor in increasing order of id, so
+      // that the file does not depend on how the compiled graph is ordered.
+      //************************************************************************
+      write_m(out,layout.fac2var,0,0);
+      for(int k=0; k<graph_i.noFactors(); ++k)
+      {
+         const int f = graph_i.factorById(k);
+         const int len = factorMsgLength_m(graph_i,f);
+         if(0<len)
+         {
+            out.write(reinterpret_cast<const char*>(
+                     graph_i.fac2var(graph_i.factorEdgeBegin(f))),
+                  len*sizeof(ValType));
+         }
+      }
+      write_m(out,layout.var2fac,0,0);
+      for(int k=0; k<graph_i.noFactors(); ++k)
+      {
+         const int f = graph_i.factorById(k);
+         const int len = factorMsgLength_m(graph_i,f);
+         if(0<len)
+         {
+            out.write(reinterpret_cast<const char*>(
+                     graph_i.var2fac(graph_i.factorEdgeBegin(f))),
+                  len*sizeof(ValType));
+         }
+      }
+   }
+
+   out.close();
+   if(!out)
+   {
+      throw FileFormatException("MaxSumController::save",
+            "Failed to write "+path);
+   }
+
+} // function save
+
+/**
+ * Replaces the contents of this controller with the factors saved in
+ * a file by MaxSumController::save.
+ * @param[in] path the name of the file to load.
+ * @throws FileFormatException if the file cannot be read, or is not
+ * a valid factor graph file for this build of the library.
+ * @throws InconsistentDomainException if a variable in the file is
+ * already registered with a different domain size.
+ */
+void MaxSumController::load(const std::string& path)
+{
+   //***************************************************************************
+   // Map the file and check that its header is compatible with this build,
+   // and that every section lies within the file.
+   //***************************************************************************
+   MappedFile_m file(path);
+   if(file.size() < sizeof(FileHeader_m))
+   {
+      badFile_m(path,"file is too short");
+   }
+   const FileHeader_m& header = *file.at<FileHeader_m>(0);
+   if(0!=std::memcmp(header.magic,MAGIC_M,sizeof(MAGIC_M)))
+   {
+      badFile_m(path,"not a factor graph file");
+   }
+   if( (VERSION_M!=header.version) || (BYTE_ORDER_M!=header.byteOrder) ||
+       (sizeof(ValType)!=header.valueSize) )
+   {
+      badFile_m(path,"incompatible version, byte order or value type");
+   }
+   if( (header.noVars > file.size()) || (header.noFactors > file.size()) ||
+       (header.noDomainVars > file.size()) || (header.noValues > file.size()) ||
+       (header.noMsgValues > file.size()) )
+   {
+      badFile_m(path,"corrupt header");
+   }
+   const Layout_m layout(header);
+   if(layout.end > file.size())
+   {
+      badFile_m(path,"file is truncated");
+   }
+
+   //***************************************************************************
+   // Check that every variable record is valid, before registering each
+   // variable with its saved domain size.
+   //***************************************************************************
+   const VarRecord_m* pVars = file.at<VarRecord_m>(layout.vars);
+   const VarRecord_m* const pVarsEnd = pVars + header.noVars;
+   for(std::uint64_t k=0; k<header.noVars; ++k)
+   {
+      if( (2>pVars[k].size) || (0<k && pVars[k-1].id>=pVars[k].id) )
+      {
+         badFile_m(path,"corrupt variable record");
+      }
+   }
+   for(std::uint64_t k=0; k<header.noVars; ++k)
+   {
+      registerVariable(pVars[k].id,pVars[k].size);
+   }
+
+   //***************************************************************************
+   // Construct each factor, copying its values straight from the file, and
+   // set them all at once in a new controller.
+   //***************************************************************************
+   const FactorRecord_m* pFactors = file.at<FactorRecord_m>(layout.factors);
+   const std::uint32_t* pDomains = file.at<std::uint32_t>(layout.domains);
+   const ValType* pValues = file.at<ValType>(layout.values);
+   std::vector<std::pair<FactorID,DiscreteFunction> > factors;
+   factors.reserve(header.noFactors);
+   for(std::uint64_t k=0; k<header.noFactors; ++k)
+   {
+      const FactorRecord_m& rec = pFactors[k];
+      if( (rec.varOffset > header.noDomainVars) ||
+          (rec.noVars > header.noDomainVars - rec.varOffset) ||
+          (rec.valueOffset > header.noValues) )
+      {
+         badFile_m(path,"corrupt factor record");
+      }
+
+      //************************************************************************
+      // Every domain variable must be declared in the file, and the factor's
+      // values must lie within the values section.
+      //************************************************************************
+      const std::uint32_t* pDomain = pDomains + rec.varOffset;
+      const std::uint64_t maxSize = header.noValues - rec.valueOffset;
+      std::uint64_t domainSize = 1;
+      for(std::uint32_t j=0; j<rec.noVars; ++j)
+      {
+         VarRecord_m key = {pDomain[j],0};
+         const VarRecord_m* pVar =
+            std::lower_bound(pVars,pVarsEnd,key,lessId_m);
+         if( (pVarsEnd==pVar) || (pVar->id!=pDomain[j]) )
+         {
+            badFile_m(path,"factor depends on undeclared variable");
+         }
+         domainSize *= pVar->size;
+         if(domainSize > maxSize)
+         {
+            badFile_m(path,"corrupt factor record");
+         }
+      }
+
+      factors.push_back(std::make_pair(rec.id,
+               DiscreteFunction(pDomain,pDomain+rec.noVars)));
+      DiscreteFunction& fun = factors.back().second;
+      if(static_cast<std::uint64_t>(fun.domainSize()) > maxSize)
+      {
+         badFile_m(path,"corrupt factor record");
+      }
+      std::copy(pValues+rec.valueOffset,
+            pValues+rec.valueOffset+fun.domainSize(),&fun(0));
+   }
+
+   MaxSumController loaded(maxIterations_i,maxNormThreshold_i);
+   loaded.setReordering(reorderGraph_i);
+   loaded.setFactors(std::make_move_iterator(factors.begin()),
+         std::make_move_iterator(factors.end()));
+
+   //***************************************************************************
+   // Restore any saved messages and values. The loaded graph is compiled
+   // with this controller's reordering setting, so each factor's messages
+   // are found by id, in the same order in which they were saved.
+   //***************************************************************************
+   if(0!=(header.flags & HAS_MESSAGES_M))
+   {
+      loaded.compile();
+      if( (0==header.noMsgValues) ||
+          (static_cast<std::uint64_t>(loaded.graph_i.noMsgValues()) !=
+               header.noMsgValues) ||
+          (loaded.values_i.size()!=header.noVars) )
+      {
+         badFile_m(path,"messages do not match factor graph");
+      }
+
+      const std::int32_t* pAssign = file.at<std::int32_t>(layout.assignments);
+      for(ValueMap::iterator it=loaded.values_i.begin();
+            it!=loaded.values_i.end(); ++it, ++pAssign)
+      {
+         if( (0>*pAssign) || (*pAssign>=getDomainSize(it->first)) )
+         {
+            badFile_m(path,"corrupt variable assignment");
+         }
+         it->second = *pAssign;
+      }
+
+      const ValType* pFac2Var = file.at<ValType>(layout.fac2var);
+      const ValType* pVar2Fac = file.at<ValType>(layout.var2fac);
+      util::FactorGraph& graph = loaded.graph_i;
+      for(int k=0; k<graph.noFactors(); ++k)
+      {
+         const int f = graph.factorById(k);
+         const int len = factorMsgLength_m(graph,f);
+         if(0<len)
+         {
+            const int e = graph.factorEdgeBegin(f);
+            std::copy(pFac2Var,pFac2Var+len,graph.fac2var(e));
+            std::copy(pVar2Fac,pVar2Fac+len,graph.var2fac(e));
+            pFac2Var += len;
+            pVar2Fac += len;
+         }
+      }
+   }
+
+   //***************************************************************************
+   // Finally, swap the loaded graph into this controller, keeping its
+   // current settings and worker threads.
+   //***************************************************************************
+   factors_i.swap(loaded.factors_i);
+   factorTotalValue_i.swap(loaded.factorTotalValue_i);
+   implicit_i.swap(loaded.implicit_i);
+   values_i.swap(loaded.values_i);
+   varDegrees_i.swap(loaded.varDegrees_i);
+   graph_i.swap(loaded.graph_i);
+   std::swap(graphValid_i,loaded.graphValid_i);
+   if(graphValid_i)
+   {
+      reserveWorkspaces();
+   }
+
+} // function load
@@ -0,0 +1,84 @@
+/**
+ * @file LocalTransport.cpp
+ * Implementation of the maxsum::LocalTransport class.
+ * @see LocalTransport.h
+ */
+#include <cassert>
+#include <maxsum/LocalTransport.h>
+
+using namespace maxsum;
+
+/**
+ * Blocks until every partition has called this function.
+ * @param[in] lock a lock on mutex_i.
+ */
+void LocalTransport::Hub::barrier(std::unique_lock<std::mutex>& lock)
+{
+   const long generation = generation_i;
+   if(size_i == ++waiting_i)
+   {
+      waiting_i = 0;
+      ++generation_i;
+      ready_i.notify_all();
+      return;
+   }
+   while(generation==generation_i)
+   {
+      ready_i.wait(lock);
+   }
+}
+
+/**
+ * Sends one batch to every partition, and receives one batch from every
+ * partition. Each batch is copied directly by its receiver, so the
+ * sender must wait until every partition has finished reading.
+ */
+void LocalTransport::exchange
+(
+ const std::vector<Batch>& outgoing,
+ std::vector<Batch>& incoming
+)
+{
+   assert(static_cast<int>(outgoing.size())==hub_i.size());
+   std::unique_lock<std::mutex> lock(hub_i.mutex_i);
+   for(int dest=0; dest<hub_i.size(); ++dest)
+   {
+      hub_i.mail_i[dest][rank_i] = (dest==rank_i) ? 0 : &outgoing[dest];
+   }
+   hub_i.barrier(lock);
+
+   incoming.resize(hub_i.size());
+   for(int src=0; src<hub_i.size(); ++src)
+   {
+      const Batch* pBatch = hub_i.mail_i[rank_i][src];
+      if(0==pBatch)
+      {
+         incoming[src].clear();
+      }
+      else
+      {
+         incoming[src] = *pBatch;
+      }
+   }
+   hub_i.barrier(lock);
+
+} // function exchange
+
+/**
+ * Returns true if and only if every partition passes true.
+ */
+bool LocalTransport::allTrue(bool value)
+{
+   std::unique_lock<std::mutex> lock(hub_i.mutex_i);
+   hub_i.votes_i[rank_i] = value;
+   hub_i.barrier(lock);
+
+   bool result = true;
+   for(int src=0; src<hub_i.size(); ++src)
+   {
+      result = result && (0!=hub_i.votes_i[src]);
+   }
+   hub_i.barrier(lock);
+   return result;
+
+} // function allTrue
@@ -6,9 +6,28 @@
  */
 
 #include <maxsum/MaxSumController.h>
+#include <maxsum/Tracer.h>
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
 #include <iostream>
+#include <limits>
 
 using namespace maxsum;
+using maxsum::util::FactorGraph;
+
+/**
+ * Default maximum maxnorm allowed between the old and new values
+ * of a message, before it is assumed to have converged. In single
+ * precision, this is larger, since changes much smaller than
+ * maxsum::VALUE_EPSILON are lost to rounding error.
+ */
+#ifdef MAXSUM_SINGLE_PRECISION
+const ValType MaxSumController::DEFAULT_MAXNORM_THRESHOLD=0.000001f;
+#else
+const ValType MaxSumController::DEFAULT_MAXNORM_THRESHOLD=0.0000001;
+#endif
 
 namespace
 {
@@ -76,6 +95,17 @@ namespace
 
 #endif // IF MAXSUM_VERBOSE
 
+   /**
+    * Utility method to print the values of a message in compact form.
+    */
+   std::ostream& printMessage_m(std::ostream& out, VarID var,
+         const ValType* pValues)
+   {
+      DiscreteFunction msg(var,0);
+      std::copy(pValues,pValues+msg.domainSize(),&msg(0));
+      return printFunction_m(out,msg);
+   }
+
 } // module namespace
 
 /**
@@ -99,36 +129,34 @@ std::ostream& maxsum::operator<<(std::ostream& out,
       //out << std::endl;
    //}
 
+   //***************************************************************************
+   // Make sure the compiled factor graph is up to date.
+   //***************************************************************************
+   controller.compile();
+   FactorGraph& graph = controller.graph_i;
+
    //***************************************************************************
    // Print factor to variable messages
    //***************************************************************************
    out << "CURRENT FACTOR TO VARIABLE MESSAGES:\n";
-   for(F2VPostOffice::SenderIt it=controller.fac2varMsgs_i.senderBegin();
-         it!=controller.fac2varMsgs_i.senderEnd(); ++it)
+   for(int e=0; e<graph.noEdges(); ++e)
    {
-      F2VPostOffice::OutMsgMap msgs = controller.fac2varMsgs_i.curOutMsgs(*it);
-      for(F2VPostOffice::OutMsgIt k=msgs.begin(); k!=msgs.end(); ++k)
-      {
-         out << "F" << *it << "->V" << k->first << ": ";
-         printFunction_m(out,*(k->second));
-         out << std::endl;
-      }
+      out << "F" << graph.factorId(graph.edgeFactor(e));
+      out << "->V" << graph.varId(graph.edgeVar(e)) << ": ";
+      printMessage_m(out,graph.varId(graph.edgeVar(e)),graph.fac2var(e));
+      out << std::endl;
    }
 
    //***************************************************************************
    // Print variable to factor messages
    //***************************************************************************
    out << "VARIABLE TO FACTOR MESSAGES:\n";
-   for(V2FPostOffice::SenderIt it=controller.var2facMsgs_i.senderBegin();
-         it!=controller.var2facMsgs_i.senderEnd(); ++it)
+   for(int e=0; e<graph.noEdges(); ++e)
    {
-      V2FPostOffice::OutMsgMap msgs = controller.var2facMsgs_i.curOutMsgs(*it);
-      for(F2VPostOffice::OutMsgIt k=msgs.begin(); k!=msgs.end(); ++k)
-      {
-         out << "V" << *it << "->F" << k->first << ": ";
-         printFunction_m(out,*(k->second));
-         out << std::endl;
-      }
+      out << "V" << graph.varId(graph.edgeVar(e));
+      out << "->F" << graph.factorId(graph.edgeFactor(e)) << ": ";
+      printMessage_m(out,graph.varId(graph.edgeVar(e)),graph.var2fac(e));
+      out << std::endl;
    }
 
    //***************************************************************************
@@ -147,70 +175,108 @@ std::ostream& maxsum::operator<<(std::ostream& out,
 } // maxsum::operator<<
 
 /**
- * Accessor method for factor function.
- * @param[in] id the unique identifier of the desired factor.
- * @param[in] factor the function representing this factor.
- * @returns a reference to the function associated with the factor with
- * unique identifier <code>id</code>.
- * @post A copy of <code>factor</code> is stored internally by
- * this maxsum::MaxSumController and used to form part of a factor graph.
- * @post Any previous value of the specified factor is overwritten.
+ * Updates the edges and variables of the factor graph to reflect a
+ * new value for the specified factor, without changing the factor.
+ * @param[in] id the unique identifier of the factor.
+ * @param[in] factor the new value for this factor.
+ * @param[in] notifyAll if false, and this controller is not in incremental
+ * mode, the caller is responsible for telling every factor to recheck its
+ * mail.
+ * @returns a reference to the stored value of this factor, which
+ * should then be set to <code>factor</code>.
  */
-void MaxSumController::setFactor(FactorID id, const DiscreteFunction& factor)
+DiscreteFunction& MaxSumController::updateStructure
+(
+ FactorID id,
+ const DiscreteFunction& factor,
+ bool notifyAll
+)
 {
    //***************************************************************************
    // Set the specified factor. (Note: oldValue is created automatically if
-   // necessary).
+   // necessary). If the factor was previously implicit, its old variables
+   // are those of its implicit definition, which is discarded.
    //***************************************************************************
+   const bool isNew = (0==factors_i.count(id));
    DiscreteFunction& oldValue = factors_i[id];
+   ImplicitMap::iterator implicitPos = implicit_i.find(id);
+   if(implicit_i.end()!=implicitPos)
+   {
+      const std::shared_ptr<const ImplicitFactor> pOld = implicitPos->second;
+      implicit_i.erase(implicitPos);
+      updateEdges(id,pOld->vars(),factor.domain().vars(),true,notifyAll);
+   }
+   else
+   {
+      updateEdges(id,oldValue.domain().vars(),factor.domain().vars(),isNew,
+            notifyAll);
+   }
+   return oldValue;
+
+} // function updateStructure
 
+/**
+ * Updates the edges and variables of the factor graph when the variables
+ * of a factor change, and tells the appropriate factors and variables to
+ * recheck their mail.
+ * @param[in] id the unique identifier of the factor.
+ * @param[in] oldVars the sorted list of the factor's old variables.
+ * @param[in] newVars the sorted list of the factor's new variables.
+ * @param[in] changed true if the compiled graph must be rebuilt even if
+ * the factor's variables are the same.
+ * @param[in] notifyAll if false, and this controller is not in incremental
+ * mode, the caller is responsible for telling every factor to recheck its
+ * mail.
+ */
+void MaxSumController::updateEdges
+(
+ FactorID id,
+ const std::vector<VarID>& oldVars,
+ const std::vector<VarID>& newVars,
+ bool changed,
+ bool notifyAll
+)
+{
    //***************************************************************************
    // If this factor is currently related to any variables that it is no
-   // longer related to, delete the appropriate edges.
+   // longer related to, delete the appropriate edges. Likewise, add edges
+   // for any variables that are new to this factor.
    //***************************************************************************
-   std::vector<VarID> toRemove(oldValue.noVars());
-   std::set_difference(oldValue.varBegin(),oldValue.varEnd(),
-         factor.varBegin(),factor.varEnd(),toRemove.begin());
+   std::vector<VarID> toRemove(oldVars.size());
+   std::vector<VarID>::iterator removeEnd = std::set_difference(
+         oldVars.begin(),oldVars.end(),
+         newVars.begin(),newVars.end(),toRemove.begin());
+   toRemove.erase(removeEnd,toRemove.end());
+
+   std::vector<VarID> toAdd(newVars.size());
+   std::vector<VarID>::iterator addEnd = std::set_difference(
+         newVars.begin(),newVars.end(),
+         oldVars.begin(),oldVars.end(),toAdd.begin());
+   toAdd.erase(addEnd,toAdd.end());
 
    for(std::vector<VarID>::const_iterator it=toRemove.begin();
          it!=toRemove.end(); ++it)
    {
-      //************************************************************************
-      // Remove the redundant edges from the postoffice graphs
-      //************************************************************************
-      fac2varMsgs_i.removeEdge(id,*it);
-      var2facMsgs_i.removeEdge(*it,id);
-
       //************************************************************************
       // If the variable is no longer related to any factors, then we remove
       // it from the value list.
       //************************************************************************
-      if(!var2facMsgs_i.hasSender(*it))
+      DegreeMap::iterator degree = varDegrees_i.find(*it);
+      if(0 == --(degree->second))
       {
+         varDegrees_i.erase(degree);
          values_i.erase(*it);
       }
 
    } // for loop
 
-   //***************************************************************************
-   // For each variable in this factor's domain
-   //***************************************************************************
-   for(DiscreteFunction::VarIterator it=factor.varBegin();
-         it!=factor.varEnd(); ++it)
+   for(std::vector<VarID>::const_iterator it=toAdd.begin();
+         it!=toAdd.end(); ++it)
    {
-      //************************************************************************
-      // Initialise input and output messages between the factor and
-      // the current variable
-      //************************************************************************
-      DiscreteFunction msgTemplate(*it,0);
-      fac2varMsgs_i.addEdge(id,*it,msgTemplate);
-      var2facMsgs_i.addEdge(*it,id,msgTemplate);
-
       //************************************************************************
       // Touch the variable to ensure that it is in the value list.
       //************************************************************************
-      ValueMap::iterator pos = values_i.find(*it);
-      if(values_i.end()==pos)
+      if(1 == ++varDegrees_i[*it])
       {
          values_i[*it]=0;
       }
@@ -218,17 +284,111 @@ void MaxSumController::setFactor(FactorID id, const DiscreteFunction& factor)
    } // for loop
 
    //***************************************************************************
-   // Set the specified factor to its new value.
+   // The compiled graph is only invalidated if the structure of the
+   // factor graph has changed.
+   //***************************************************************************
+   if( changed || !toRemove.empty() || !toAdd.empty() )
+   {
+      graphValid_i = false;
+   }
+
+   //***************************************************************************
+   // In incremental mode, only tell this factor, and any variables that
+   // have gained or lost an edge, to recheck their mail. Notices are kept by
+   // identifier when the graph is recompiled, so it does not matter that
+   // graph_i may be out of date. Variables that are new to the graph send
+   // their first messages once they receive significant mail.
+   //***************************************************************************
+   if(incremental_i)
+   {
+      notifyFactor(id);
+      notifyVars(toRemove.begin(),toRemove.end());
+      notifyVars(toAdd.begin(),toAdd.end());
+      return;
+   }
+
+   //***************************************************************************
+   // Otherwise, tell everyone to recheck their mail. Telling everyone to
+   // recheck is the safest option, because the factor graph may have changed.
+   // (New factors are notified automatically when the graph is recompiled.)
    //***************************************************************************
-   factors_i[id] = factor;
+   if(notifyAll)
+   {
+      graph_i.factorNotices().notifyAll();
+   }
+
+} // function updateEdges
+
+/**
+ * Accessor method for factor function.
+ * @param[in] id the unique identifier of the desired factor.
+ * @param[in] factor the function representing this factor.
+ * @post A copy of <code>factor</code> is stored internally by
+ * this maxsum::MaxSumController and used to form part of a factor graph.
+ * @post Any previous value of the specified factor is overwritten.
+ */
+void MaxSumController::setFactor(FactorID id, const DiscreteFunction& factor)
+{
+   updateStructure(id,factor) = factor;
+}
+
+/**
+ * Accessor method for factor function, which takes ownership of
+ * the specified function rather than copying it.
+ * @param[in] id the unique identifier of the desired factor.
+ * @param[in,out] factor the function representing this factor.
+ * @post <code>factor</code> is moved into this maxsum::MaxSumController,
+ * and is left in a valid but unspecified state.
+ * @post Any previous value of the specified factor is overwritten.
+ */
+void MaxSumController::setFactor(FactorID id, DiscreteFunction&& factor)
+{
+   updateStructure(id,factor) = std::move(factor);
+}
+
+/**
+ * Sets a factor that is defined by a maxsum::ImplicitFactor, rather than
+ * by a table of values.
+ * @param[in] id the unique identifier of the factor.
+ * @param[in] pFactor the definition of the factor, which must not be
+ * empty.
+ * @post Any previous value of the specified factor, whether implicit or
+ * not, is overwritten.
+ */
+void MaxSumController::setImplicitFactor
+(
+ FactorID id,
+ std::shared_ptr<const ImplicitFactor> pFactor
+)
+{
+   assert(pFactor);
 
    //***************************************************************************
-   // Tell everyone to recheck their mail. Telling everyone to recheck is the
-   // safest option, because the factor graph may have changed.
+   // Find the variables of the previous value of this factor, if any. The
+   // compiled graph refers to implicit factors by pointer, so it must be
+   // rebuilt whenever the definition changes.
    //***************************************************************************
-   var2facMsgs_i.notifyAll();
+   std::vector<VarID> oldVars;
+   bool changed = true;
+   ImplicitMap::iterator pos = implicit_i.find(id);
+   FactorMap::iterator densePos = factors_i.find(id);
+   if(implicit_i.end()!=pos)
+   {
+      oldVars = pos->second->vars();
+      changed = (pos->second!=pFactor);
+   }
+   else if(factors_i.end()!=densePos)
+   {
+      oldVars = densePos->second.domain().vars();
+      factors_i.erase(densePos);
+      factorTotalValue_i.erase(id);
+   }
 
-} // function setFactor
+   const std::vector<VarID>& newVars = pFactor->vars();
+   implicit_i[id] = std::move(pFactor);
+   updateEdges(id,oldVars,newVars,changed,true);
+
+} // function setImplicitFactor
 
 /**
  * Removes the specified factor from this controller's factor graph.
@@ -251,45 +411,62 @@ void MaxSumController::removeFactor(FactorID id)
    // If the specified factor is not in the factor graph, then we are done.
    //***************************************************************************
    FactorMap::iterator facPos = factors_i.find(id);
-   if(factors_i.end()==facPos)
+   ImplicitMap::iterator implicitPos = implicit_i.find(id);
+   if( (factors_i.end()==facPos) && (implicit_i.end()==implicitPos) )
    {
       return;
    }
-   DiscreteFunction& factor = facPos->second;
+   const std::vector<VarID> vars = (factors_i.end()!=facPos) ?
+      facPos->second.domain().vars() : implicitPos->second->vars();
 
    //***************************************************************************
    // Otherwise, for each variable in this factor's domain
    //***************************************************************************
-   for(DiscreteFunction::VarIterator it=factor.varBegin();
-         it!=factor.varEnd(); ++it)
+   for(std::vector<VarID>::const_iterator it=vars.begin(); it!=vars.end();
+         ++it)
    {
-      //************************************************************************
-      // Delete the input and output messages.
-      //************************************************************************
-      fac2varMsgs_i.removeEdge(id,*it);
-      var2facMsgs_i.removeEdge(*it,id);
-
       //************************************************************************
       // If the variable is no longer related to any factors, then we remove
       // it from the value list.
       //************************************************************************
-      if(!var2facMsgs_i.hasSender(*it))
+      DegreeMap::iterator degree = varDegrees_i.find(*it);
+      if(0 == --(degree->second))
       {
+         varDegrees_i.erase(degree);
          values_i.erase(*it);
       }
 
    } // for loop
 
    //***************************************************************************
-   // Finally, we delete the factor from the factors_i map
+   // Tell all factors and variables to recheck their mail or, in incremental
+   // mode, only those variables that have lost an edge. (Any variables that
+   // have been removed altogether are dropped when the graph is recompiled.)
    //***************************************************************************
-   factors_i.erase(facPos);
+   if(incremental_i)
+   {
+      notifyVars(vars.begin(),vars.end());
+   }
+   else
+   {
+      graph_i.factorNotices().notifyAll();
+      graph_i.varNotices().notifyAll();
+   }
 
    //***************************************************************************
-   // Tell all factors and variables to recheck their mail.
+   // Finally, we delete the factor from the factors_i map, together with
+   // its total value, and mark the compiled graph as out of date.
    //***************************************************************************
-   var2facMsgs_i.notifyAll();
-   fac2varMsgs_i.notifyAll();
+   if(factors_i.end()!=facPos)
+   {
+      factors_i.erase(facPos);
+   }
+   else
+   {
+      implicit_i.erase(implicitPos);
+   }
+   factorTotalValue_i.erase(id);
+   graphValid_i = false;
 
 } // function removeFactor
 
@@ -305,292 +482,1348 @@ void MaxSumController::removeFactor(FactorID id)
    // Clear all data structures.
    //***************************************************************************
    factors_i.clear();
+   factorTotalValue_i.clear();
+   implicit_i.clear();
    values_i.clear();
-   fac2varMsgs_i.clear();
-   var2facMsgs_i.clear();
+   varDegrees_i.clear();
+   graph_i.clear();
+   spareGraph_i.clear();
+   graphValid_i = true;
 
 } // function clear
 
 /**
- * Infer the factor graph from the given factor domains.
- * This function populates all member variables of MaxSumController by
- * examining the domain of each factor in factors_i
+ * Returns the number of bytes of heap storage used by this controller for
+ * its factors, messages and workspaces.
  */
-void MaxSumController::inferGraph()
+MaxSumController::MemoryUsage MaxSumController::memoryUsage() const
 {
+   MemoryUsage usage;
+   usage.graphBytes = graph_i.bytesUsed();
+   usage.spareBytes = spareGraph_i.bytesUsed();
+   usage.factorBytes = 0;
+   for(FactorMap::const_iterator it=factors_i.begin(); it!=factors_i.end();
+         ++it)
+   {
+      usage.factorBytes += it->second.bytesUsed();
+   }
+   usage.totalBytes = 0;
+   for(FactorMap::const_iterator it=factorTotalValue_i.begin();
+         it!=factorTotalValue_i.end(); ++it)
+   {
+      usage.totalBytes += it->second.bytesUsed();
+   }
+
    //***************************************************************************
-   // For each factor
+   // Workspaces include the scratch space for every schedule.
    //***************************************************************************
-   for(FactorMap::const_iterator fIt = factors_i.begin();
-         fIt != factors_i.end(); ++fIt)
+   usage.workspaceBytes = heap_i.bytesUsed() + utilityNotices_i.bytesUsed()
+      + (jobs_i.capacity() + sweepVars_i.capacity() + treeNodes_i.capacity()
+            + treeParents_i.capacity() + treeStart_i.capacity()
+            + treeComponent_i.capacity())*sizeof(int)
+      + sweepFlags_i.capacity()*sizeof(char)
+      + factorUtility_i.capacity()*sizeof(ValType)
+      + (bestValues_i.capacity() + utilitySubs_i.capacity())*sizeof(ValIndex);
+   for(std::vector<Workspace>::const_iterator it=workspaces_i.begin();
+         it!=workspaces_i.end(); ++it)
    {
-      //************************************************************************
-      // Get the function that defines this factor
-      //************************************************************************
-      const DiscreteFunction& curFunc = fIt->second;
+      usage.workspaceBytes += it->bytesUsed();
+   }
+   return usage;
 
-      //************************************************************************
-      // For each variable in the current factor's domain.
-      //************************************************************************
-      for(DiscreteFunction::VarIterator vIt = curFunc.varBegin();
-            vIt != curFunc.varEnd(); ++vIt)
-      {
-         //*********************************************************************
-         // Ensure that that variable's value is present in the value list,
-         // and initialised to zero.
-         //*********************************************************************
-         values_i[*vIt] = 0;
+} // function memoryUsage
 
-         //*********************************************************************
-         // Add an edge between the current factor and variable to the 
-         // post office structures. This ensures that messages will flow
-         // between connected factors and variables when the optimise()
-         // function is next invoked.
-         //*********************************************************************
-         var2facMsgs_i.addEdge(*vIt,fIt->first);
-         fac2varMsgs_i.addEdge(fIt->first,*vIt);
+/**
+ * Swaps the contents of this controller with another, including their
+ * settings and worker threads. No factors or messages are copied.
+ * The compiled factor graphs refer to nodes in the factor and value maps,
+ * which are not moved by swapping, so both remain valid.
+ */
+void MaxSumController::swap(MaxSumController& rhs) noexcept
+{
+   factors_i.swap(rhs.factors_i);
+   factorTotalValue_i.swap(rhs.factorTotalValue_i);
+   implicit_i.swap(rhs.implicit_i);
+   values_i.swap(rhs.values_i);
+   varDegrees_i.swap(rhs.varDegrees_i);
+   graph_i.swap(rhs.graph_i);
+   spareGraph_i.swap(rhs.spareGraph_i);
+   std::swap(graphValid_i,rhs.graphValid_i);
+   std::swap(maxIterations_i,rhs.maxIterations_i);
+   std::swap(maxNormThreshold_i,rhs.maxNormThreshold_i);
+   std::swap(numThreads_i,rhs.numThreads_i);
+   std::swap(pPool_i,rhs.pPool_i);
+   std::swap(incremental_i,rhs.incremental_i);
+   std::swap(targetedNotices_i,rhs.targetedNotices_i);
+   std::swap(schedule_i,rhs.schedule_i);
+   std::swap(treeSolver_i,rhs.treeSolver_i);
+   std::swap(reorderGraph_i,rhs.reorderGraph_i);
+   std::swap(snapshots_i,rhs.snapshots_i);
+   std::swap(snapshotTotals_i,rhs.snapshotTotals_i);
+   std::swap(treesValid_i,rhs.treesValid_i);
+   treeNodes_i.swap(rhs.treeNodes_i);
+   treeParents_i.swap(rhs.treeParents_i);
+   treeStart_i.swap(rhs.treeStart_i);
+   treeComponent_i.swap(rhs.treeComponent_i);
+   std::swap(noUpdates_i,rhs.noUpdates_i);
+   std::swap(pObserver_i,rhs.pObserver_i);
+   workspaces_i.swap(rhs.workspaces_i);
+   jobs_i.swap(rhs.jobs_i);
+   heap_i.swap(rhs.heap_i);
+   sweepFlags_i.swap(rhs.sweepFlags_i);
+   sweepVars_i.swap(rhs.sweepVars_i);
+   factorUtility_i.swap(rhs.factorUtility_i);
+   utilityNotices_i.swap(rhs.utilityNotices_i);
+   bestValues_i.swap(rhs.bestValues_i);
+   utilitySubs_i.swap(rhs.utilitySubs_i);
+
+} // function swap
 
-      } // inner for loop
+/**
+ * Compiles the current set of factors into the flat representation
+ * used to pass messages.
+ * @post messages for edges that remain in the factor graph are
+ * preserved.
+ */
+void MaxSumController::compile()
+{
+   if(graphValid_i)
+   {
+      return;
+   }
 
-   } // outer for loop
+   graph_i.setReordering(reorderGraph_i);
+   graph_i.compile(factors_i,implicit_i,factorTotalValue_i,values_i,
+         spareGraph_i);
+   graphValid_i = true;
+   reserveWorkspaces();
 
-} // inferGraph
+} // function compile
 
 /**
- * Updates factor to variable messages.
- * This function only needs to update messages that have changed
- * significantly since the last iteration. A significant change
- * is one which exceeds the maxNormThreshold_i or results in a
- * change in variable assignment.
- * @returns the number of updated messages.
+ * Reserves enough space in each workspace, and in the schedule state, to
+ * optimise the current compiled graph without allocating memory.
  */
-int MaxSumController::updateFac2VarMsgs()
+void MaxSumController::reserveWorkspaces()
 {
-   using namespace util;
    //***************************************************************************
-   // For each factor with a non-empty inbox
+   // Make sure each workspace is large enough to hold one message for
+   // the largest variable, and to list every notice that could be sent in
+   // a single half-iteration, so that optimise never allocates memory.
    //***************************************************************************
-   while(var2facMsgs_i.newMail())
+   for(std::vector<Workspace>::iterator it=workspaces_i.begin();
+         it!=workspaces_i.end(); ++it)
    {
-      //************************************************************************
-      // Get the next factor that has new mail.
-      //************************************************************************
-      FactorID fac = var2facMsgs_i.popNotice();
-
-      //************************************************************************
-      // Swap the old messages with the new ones, so that the new ones become
-      // old, and the old ones become new. We can then overwrite the old ones.
-      // Swapping like this prevents us having to create lots of temporary
-      // objects, by reusing the old ones that we no longer need.
-      //************************************************************************
-      fac2varMsgs_i.swapOutBoxes(fac);
+      it->reserve(graph_i);
+   }
+   jobs_i.reserve(std::max(graph_i.noFactors(),graph_i.noVars()));
+   heap_i.reset(graph_i.noFactors()+graph_i.noVars());
+   sweepFlags_i.assign(graph_i.noFactors(),0);
+   sweepVars_i.reserve(graph_i.noEdges());
+   factorUtility_i.resize(graph_i.noFactors());
+   utilityNotices_i.reset(graph_i.noFactors());
+   bestValues_i.resize(graph_i.noVars());
+   utilitySubs_i.resize(graph_i.maxImplicitArity());
+   treesValid_i = false;
+
+} // function reserveWorkspaces
 
-      //************************************************************************
-      // Calculate the total sum of this factor and all its input messages
-      //************************************************************************
-      DiscreteFunction& msgSum = factorTotalValue_i[fac];
-      msgSum = factors_i[fac];
-      V2FPostOffice::InMsgMap curInMsgs = var2facMsgs_i.curInMsgs(fac);
-      typedef V2FPostOffice::InMsgIt InMsgIt;
-      for(InMsgIt it=curInMsgs.begin(); it!=curInMsgs.end(); ++it)
+namespace
+{
+   /**
+    * Max marginalises a factor's value array onto a single variable.
+    * Values are aggregated in increasing order of linear index, exactly as
+    * maxsum::maxMarginal does.
+    * @param[in] pTotal the factor's value array.
+    * @param[in] size the length of the factor's value array.
+    * @param[in] stride the stride of the output variable in the factor.
+    * @param[in] n the domain size of the output variable.
+    * @param[out] pOut the max marginal values.
+    */
+   void maxMarginal_m
+   (
+    const ValType* pTotal,
+    const ValIndex size,
+    const ValIndex stride,
+    const ValIndex n,
+    ValType* pOut
+   )
+   {
+      for(ValIndex j=0; j<n; ++j)
       {
-         msgSum += *(it->second);
+         pOut[j] = pTotal[j*stride];
       }
-
-      //************************************************************************
-      // Update the output messages for each connected neighbour
-      //************************************************************************
-      F2VPostOffice::OutMsgMap curOutMsgs = fac2varMsgs_i.curOutMsgs(fac);
-      F2VPostOffice::OutMsgMap prevOutMsgs = fac2varMsgs_i.prevOutMsgs(fac);
-      typedef F2VPostOffice::OutMsgIt OutMsgIt;
-      for(OutMsgIt it=curOutMsgs.begin(); it!=curOutMsgs.end(); ++it)
+      for(ValIndex outer=0; outer<size; outer+=stride*n)
       {
-         //*********************************************************************
-         // Calculate the updated message for the current neighbour by
-         // subtracting the neighbour's last message from the message sum, and
-         // max marginalising.
-         //*********************************************************************
-         DiscreteFunction sumOfOthers(msgSum);
-         DiscreteFunction& prevOutMsg = *prevOutMsgs[it->first];
-         DiscreteFunction& curOutMsg = *(it->second);
-         DiscreteFunction& curInMsg = *curInMsgs[it->first];
-         sumOfOthers -= curInMsg;
-         maxMarginal(sumOfOthers,curOutMsg);
-
-         //*********************************************************************
-         // If the max norm threshold has been passed, tell the current 
-         // neighbour that they have mail.
-         //*********************************************************************
-         DiscreteFunction msgDiff(curOutMsg);
-         msgDiff -= prevOutMsg;
-         if(msgDiff.maxnorm() > maxNormThreshold_i)
+         const ValType* pBlock = pTotal + outer;
+         for(ValIndex j=0; j<n; ++j)
          {
-            fac2varMsgs_i.notify(it->first);
+            ValType best = pOut[j];
+            for(ValIndex k=0; k<stride; ++k)
+            {
+               best = std::max(best,pBlock[k]);
+            }
+            pOut[j] = best;
+            pBlock += stride;
          }
+      }
+   }
 
-      } // for loop
+   /**
+    * Replaces a message with the values <code>(pA[j]-pB[j])-offset</code>,
+    * and returns the maxnorm of the difference between its old and new
+    * values. This fuses the final step of each message calculation with
+    * the convergence check, so that new messages need not be stored in
+    * a separate buffer.
+    */
+   ValType updateMessage_m
+   (
+    const ValType* pA,
+    const ValType* pB,
+    const ValType offset,
+    const ValIndex n,
+    ValType* pMsg
+   )
+   {
+      ValType result = 0;
+      for(ValIndex j=0; j<n; ++j)
+      {
+         const ValType newVal = (pA[j] - pB[j]) - offset;
+         const ValType absVal = std::fabs(newVal - pMsg[j]);
+         if(result<absVal)
+         {
+            result = absVal;
+         }
+         pMsg[j] = newVal;
+      }
+      return result;
+   }
 
-   } // while loop
+} // module namespace
 
-   //***************************************************************************
-   // Return the number of updated factor to variable messages
-   //***************************************************************************
-   return fac2varMsgs_i.noticeCount();
+/**
+ * Sets the message sent along an edge from its factor, given the max
+ * marginal of the factor's total value onto the edge's variable.
+ * @param[in] e the index of the edge in graph_i.
+ * @param[in] pMarginal the max marginal, including the variable's last
+ * message to the factor.
+ * @param[in,out] ws scratch space for the calling thread, to which the
+ * variable is appended if its message has changed significantly.
+ */
+void MaxSumController::sendFactorMessage
+(
+ int e,
+ const ValType* pMarginal,
+ Workspace& ws
+)
+{
+   const int v = graph_i.edgeVar(e);
+   const ValType residual = updateMessage_m(pMarginal,graph_i.var2fac(e),0,
+         graph_i.varSize(v),graph_i.fac2var(e));
+   ws.stats.maxFac2VarResidual =
+      std::max(ws.stats.maxFac2VarResidual,residual);
+   ws.stats.totalFac2VarResidual += residual;
+   if(residual > maxNormThreshold_i)
+   {
+      ws.notices.push_back(v);
+      ws.residuals.push_back(residual);
+      ++ws.stats.noFac2VarChanges;
+   }
 
-} // updateFac2VarMsgs
+} // function sendFactorMessage
 
 /**
- * Updates variable to factor messages.
- * This function only needs to update messages that have changed
- * significantly since the last iteration. A significant change
- * is one which exceeds the maxNormThreshold_i or results in a
- * change in variable assignment.
- * @post Each message is normalised so that the sum of its values is 0.
- * @returns the number of updated messages.
+ * Updates the messages sent by a single factor.
+ * @param[in] f the index of the factor in graph_i.
+ * @param[in,out] ws scratch space for the calling thread. The index
+ * of each variable whose message has changed significantly is
+ * appended to its notice list, together with the maxnorm change in
+ * its message.
  */
-int MaxSumController::updateVar2FacMsgs()
+void MaxSumController::updateFactor(int f, Workspace& ws)
 {
-   using namespace util;
+   const int begin = graph_i.factorEdgeBegin(f);
+   const int end = graph_i.factorEdgeEnd(f);
+   ++ws.stats.noFactorUpdates;
+
    //***************************************************************************
-   // For each variable with a non-empty inbox
+   // Implicit factors compute their own max marginals, which include each
+   // variable's input message, so this is subtracted as for factor tables.
    //***************************************************************************
-   while(fac2varMsgs_i.newMail())
+   const ImplicitFactor* pImplicit = graph_i.implicit(f);
+   if(0!=pImplicit)
    {
-      //************************************************************************
-      // Get the next variable that has new mail.
-      //************************************************************************
-      VarID var = fac2varMsgs_i.popNotice();
-
-      //************************************************************************
-      // Swap the old messages with the new ones, so that the new ones become
-      // old, and the old ones become new. We can then overwrite the old ones.
-      // Swapping like this prevents us having to create lots of temporary
-      // objects, by reusing the old ones that we no longer need.
-      //************************************************************************
-      var2facMsgs_i.swapOutBoxes(var);
-
-      //************************************************************************
-      // Calculate the total sum of all input messages
-      //************************************************************************
-      DiscreteFunction msgSum(&var,(&var)+1,0);
-      F2VPostOffice::InMsgMap curInMsgs = fac2varMsgs_i.curInMsgs(var);
-      typedef F2VPostOffice::InMsgIt InMsgIt;
-      for(InMsgIt it=curInMsgs.begin(); it!=curInMsgs.end(); ++it)
+      ValType* pNext = ws.buffer.data();
+      for(int e=begin; e<end; ++e)
       {
-         msgSum += *(it->second);
+         ws.inputs[e-begin] = graph_i.var2fac(e);
+         ws.outputs[e-begin] = pNext;
+         pNext += graph_i.varSize(graph_i.edgeVar(e));
       }
-
-      //************************************************************************
-      // Update the output messages for each connected neighbour
-      //************************************************************************
-      V2FPostOffice::OutMsgMap curOutMsgs = var2facMsgs_i.curOutMsgs(var);
-      V2FPostOffice::OutMsgMap prevOutMsgs = var2facMsgs_i.prevOutMsgs(var);
-      typedef V2FPostOffice::OutMsgIt OutMsgIt;
-      for(OutMsgIt it=curOutMsgs.begin(); it!=curOutMsgs.end(); ++it)
+      MAXSUM_TRACE_SCOPE(MARGINALISE);
+      pImplicit->maxMarginals(ws.inputs.data(),ws.outputs.data());
+      for(int e=begin; e<end; ++e)
       {
-         //*********************************************************************
-         // Calculate the updated message for the current neighbour subtracting
-         // the neighbour's last message from the message sum.
-         //*********************************************************************
-         DiscreteFunction& prevOutMsg = *prevOutMsgs[it->first];
-         DiscreteFunction& curOutMsg = *(it->second);
-         DiscreteFunction& curInMsg = *curInMsgs[it->first];
-         curOutMsg = msgSum;
-         curOutMsg -= curInMsg;
+         sendFactorMessage(e,ws.outputs[e-begin],ws);
+      }
+      return;
+   }
 
-         //*********************************************************************
-         // Normalise the current output message
-         //*********************************************************************
-         curOutMsg -= curOutMsg.mean();
+   const DiscreteFunction& factor = graph_i.factor(f);
+   DiscreteFunction& msgSum = graph_i.total(f);
+   assert(sameDomain(factor,msgSum));
+   const ValType* pFactor = &factor(0);
+   const ValIndex* pSizes = factor.domain().sizes().data();
+   ValType* pTotal = &msgSum(0);
+   const ValIndex size = msgSum.domainSize();
+   const int arity = end-begin;
+   const ValType* ppMsgs[util::MAX_DOMAIN_DIMS];
+   for(int e=begin; e<end; ++e)
+   {
+      ppMsgs[e-begin] = graph_i.var2fac(e);
+   }
 
-         //*********************************************************************
-         // If the max norm threshold has been passed, tell the current 
-         // neighbour that they have mail.
-         //*********************************************************************
-         DiscreteFunction msgDiff(curOutMsg);
-         msgDiff -= prevOutMsg;
-         if(msgDiff.maxnorm() > maxNormThreshold_i)
-         {
-            var2facMsgs_i.notify(it->first);
-         }
+   //***************************************************************************
+   // Small factors are max marginalised onto all their variables in one
+   // pass, using a kernel specialised for their arity. Otherwise, we
+   // calculate the total sum of this factor and all its input messages
+   // first, and then marginalise it onto each variable in turn.
+   //***************************************************************************
+   ValType* ppOut[util::MAX_FIXED_ARITY];
+   for(int k=0; k<util::MAX_FIXED_ARITY; ++k)
+   {
+      ppOut[k] = ws.buffer.data() + k*graph_i.maxVarSize();
+   }
 
-      } // for loop
+   const bool fixed = (0<arity) && (util::MAX_FIXED_ARITY>=arity);
+   {
+      MAXSUM_TRACE_SCOPE(FACTOR_SUM);
+      switch(fixed ? arity : 0)
+      {
+         case 1:
+            util::FixedArityKernel<1>::maxMarginals(pFactor,pSizes,ppMsgs,
+                  pTotal,ppOut);
+            break;
+         case 2:
+            util::FixedArityKernel<2>::maxMarginals(pFactor,pSizes,ppMsgs,
+                  pTotal,ppOut);
+            break;
+         case 3:
+            util::FixedArityKernel<3>::maxMarginals(pFactor,pSizes,ppMsgs,
+                  pTotal,ppOut);
+            break;
+         default:
+            util::addMessages(pFactor,arity,pSizes,ppMsgs,pTotal);
+      }
+   }
 
+   //***************************************************************************
+   // Update the output messages for each connected neighbour
+   //***************************************************************************
+   MAXSUM_TRACE_SCOPE(MARGINALISE);
+   for(int e=begin; e<end; ++e)
+   {
       //************************************************************************
-      // If the optimal value for this variable has changed, update its value,
-      // and tell all neighbours to check their mail.
+      // Calculate the updated message for the current neighbour by max
+      // marginalising the message sum, and subtracting the neighbour's last
+      // message. Since rounding is monotonic, this gives exactly the same
+      // result as subtracting the neighbour's message before marginalising.
+      // If the max norm threshold has been passed, tell the current
+      // neighbour that they have mail.
       //************************************************************************
-      ValIndex& curValue = values_i[var];
-      ValIndex bestValue = msgSum.argmax();
-      if(bestValue != curValue)
+      const ValIndex n = graph_i.varSize(graph_i.edgeVar(e));
+      ValType* pNew = ppOut[fixed ? e-begin : 0];
+      if(!fixed)
       {
-         curValue = bestValue;
-         var2facMsgs_i.notifyAll();
+         maxMarginal_m(pTotal,size,graph_i.edgeStride(e),n,pNew);
       }
+      sendFactorMessage(e,pNew,ws);
 
-   } // while loop
-
-   //***************************************************************************
-   // Return the number of updated variable to factor messages
-   //***************************************************************************
-   return var2facMsgs_i.noticeCount();
+   } // for loop
 
-} // updateVar2FacMsgs
+} // updateFactor
 
 /**
- * Runs the max-sum algorithm to optimise the values for each variable.
- * @post maxsum::MaxSumController::getValue will return the optimal value
- * for the the variable with unique identifier <code>id</code>.
+ * Updates the messages sent by a single variable.
+ * @param[in] v the index of the variable in graph_i.
+ * @param[in,out] ws scratch space for the calling thread. The index
+ * of each factor whose message has changed significantly is
+ * appended to its notice list, together with the maxnorm change in
+ * its message.
+ * @returns true if the value assigned to this variable has changed.
+ * @post Each message is normalised so that the sum of its values is 0.
  */
-int MaxSumController::optimise()
+bool MaxSumController::updateVariable(int v, Workspace& ws)
 {
    //***************************************************************************
-   // While the algorithm has not converged, or the maximum number of
-   // iterations has not been reached.
+   // Calculate the total sum of all input messages
    //***************************************************************************
-   //std::cout << "OPTIMISING...\n";
-   int iterationCount = 0;
-   while(iterationCount<maxIterations_i)
+   const ValIndex n = graph_i.varSize(v);
+   ValType* pSum = ws.buffer.data();
+   std::fill(pSum,pSum+n,0);
+   const int begin = graph_i.varEdgeBegin(v);
+   const int end = graph_i.varEdgeEnd(v);
+   ++ws.stats.noVarUpdates;
    {
-      //************************************************************************
-      // Update the number of iterations that we've performed
-      //************************************************************************
-      ++iterationCount;
-      //std::cout << "ITERATION: " << iterationCount << std::endl;
-
-      //************************************************************************
-      // Update the factor to variable messages
-      //************************************************************************
-      //std::cout << "UPDATING FAC2VAR MESSAGES...\n";
-      int numOfUpdates = updateFac2VarMsgs();
-      //std::cout << *this << std::endl;
-      //int tmp = numOfUpdates;
-      //std::cout << "NUMBER OF FAC2VAR UPDATES: " << numOfUpdates << "\n";
-
-      //************************************************************************
-      // Update the variable to factor messages
-      //************************************************************************
-      //std::cout << "UPDATING VAR2FAC MESSAGES...\n";
-      numOfUpdates += updateVar2FacMsgs();
-      //std::cout << *this << std::endl;
-      //std::cout << "NUMBER OF VAR2FAC UPDATES: " << numOfUpdates-tmp << "\n";
+      MAXSUM_TRACE_SCOPE(VARIABLE_SUM);
+      for(int k=begin; k<end; ++k)
+      {
+         const ValType* pIn = graph_i.fac2var(graph_i.varEdge(k));
+         for(ValIndex j=0; j<n; ++j)
+         {
+            pSum[j] += pIn[j];
+         }
+      }
+   }
 
+   //***************************************************************************
+   // Update the output messages for each connected neighbour
+   //***************************************************************************
+   MAXSUM_TRACE_SCOPE(NORMALISE);
+   const ValType N = n;
+   for(int k=begin; k<end; ++k)
+   {
       //************************************************************************
-      // If there have been no message updates since the last iteration, then
-      // we've converged, so we can stop.
+      // Calculate the updated message for the current neighbour subtracting
+      // the neighbour's last message from the message sum, and normalise
+      // it in the same way as DiscreteFunction::mean. If the max norm
+      // threshold has been passed, tell the current neighbour that they
+      // have mail.
       //************************************************************************
-      if(0==numOfUpdates)
+      const int e = graph_i.varEdge(k);
+      const ValType* pIn = graph_i.fac2var(e);
+      ValType mean = 0;
+      for(ValIndex j=0; j<n; ++j)
       {
-         break;
+         mean += (pSum[j] - pIn[j]) / N;
+      }
+      const ValType residual =
+         updateMessage_m(pSum,pIn,mean,n,graph_i.var2fac(e));
+      ws.stats.maxVar2FacResidual =
+         std::max(ws.stats.maxVar2FacResidual,residual);
+      ws.stats.totalVar2FacResidual += residual;
+      if(residual > maxNormThreshold_i)
+      {
+         ws.notices.push_back(graph_i.edgeFactor(e));
+         ws.residuals.push_back(residual);
+         ++ws.stats.noVar2FacChanges;
       }
 
-   } // while loop
-   //std::cout << "DONE\n\n";
+   } // for loop
 
    //***************************************************************************
-   // Return the number of iterations performed.
+   // If the optimal value for this variable has changed, update its value.
+   // (Ties are broken in favour of the first maximum, as in
+   // DiscreteFunction::argmax.)
    //***************************************************************************
-   return iterationCount;
-
-} // optimise function
+   ValIndex bestValue = 0;
+   for(ValIndex j=1; j<n; ++j)
+   {
+      if(pSum[bestValue] < pSum[j])
+      {
+         bestValue = j;
+      }
+   }
+   ValIndex& curValue = graph_i.value(v);
+   if(bestValue != curValue)
+   {
+      curValue = bestValue;
+      ++ws.stats.noValueChanges;
+      ws.changeVar(v);
+      return true;
+   }
+   return false;
+
+} // updateVariable
+
+/**
+ * Task used to update the messages sent by a set of factors or
+ * variables in parallel.
+ */
+class MaxSumController::UpdateTask : public util::ThreadPool::Task
+{
+public:
+
+   /**
+    * Constructs a task for updating the factors (if <code>factors</code>
+    * is true) or variables listed in <code>controller.jobs_i</code>.
+    */
+   UpdateTask(MaxSumController& controller, bool factors)
+      : controller_i(controller), factors_i(factors), changed_i(false) {}
+
+   /**
+    * Returns true if the value of any variable was changed by this task.
+    */
+   bool changed() const { return changed_i; }
+
+   /**
+    * Updates the messages for the work items in the range [begin,end).
+    */
+   void run(int begin, int end, int worker)
+   {
+      Workspace& ws = controller_i.workspaces_i[worker];
+      const std::vector<int>& jobs = controller_i.jobs_i;
+      if(factors_i)
+      {
+         for(int k=begin; k<end; ++k)
+         {
+            controller_i.updateFactor(jobs[k],ws);
+         }
+         return;
+      }
+
+      bool changed = false;
+      for(int k=begin; k<end; ++k)
+      {
+         changed = controller_i.updateVariable(jobs[k],ws) || changed;
+      }
+      if(changed)
+      {
+         changed_i = true;
+      }
+   }
+
+private:
+
+   /**
+    * The controller whose messages are updated.
+    */
+   MaxSumController& controller_i;
+
+   /**
+    * True if this task updates factors, false if it updates variables.
+    */
+   const bool factors_i;
+
+   /**
+    * True if the value of any variable has changed.
+    */
+   std::atomic<bool> changed_i;
+
+}; // class UpdateTask
+
+/**
+ * Sets the number of threads used to update messages in
+ * MaxSumController::optimise.
+ * @param[in] n the number of threads to use, including the calling
+ * thread. If <code>n</code> is 1 (the default), all messages are
+ * updated serially. If <code>n</code> is 0, one thread is used for
+ * each hardware thread.
+ */
+void MaxSumController::setNumThreads(int n)
+{
+   if(0>=n)
+   {
+      n = std::max(1u,std::thread::hardware_concurrency());
+   }
+   if( (n==numThreads_i) && ((1==n) == (0==pPool_i)) )
+   {
+      return;
+   }
+
+   delete pPool_i;
+   pPool_i = 0;
+   if(1<n)
+   {
+      pPool_i = new util::ThreadPool(n);
+   }
+   numThreads_i = n;
+   workspaces_i.resize(n);
+   for(std::vector<Workspace>::iterator it=workspaces_i.begin();
+         it!=workspaces_i.end(); ++it)
+   {
+      it->reserve(graph_i);
+   }
+
+} // function setNumThreads
+
+/**
+ * Updates factor to variable messages.
+ * This function only needs to update messages that have changed
+ * significantly since the last iteration. A significant change
+ * is one which exceeds the maxNormThreshold_i or results in a
+ * change in variable assignment.
+ * Each factor's messages depend only on the variable to factor messages
+ * computed in the previous half-iteration, so all notified factors may be
+ * updated in any order, or in parallel.
+ * @returns the number of updated messages.
+ */
+int MaxSumController::updateFac2VarMsgs()
+{
+   //***************************************************************************
+   // Update each factor with new mail, using all available threads.
+   //***************************************************************************
+   {
+      MAXSUM_TRACE_SCOPE(NOTICES);
+      graph_i.factorNotices().take(jobs_i);
+      noUpdates_i += jobs_i.size();
+   }
+   UpdateTask task(*this,true);
+   if(0!=pPool_i)
+   {
+      pPool_i->run(jobs_i.size(),task);
+   }
+   else
+   {
+      task.run(0,jobs_i.size(),0);
+   }
+
+   //***************************************************************************
+   // Tell each variable whose input has changed that they have mail.
+   //***************************************************************************
+   MAXSUM_TRACE_SCOPE(NOTICES);
+   util::NoticeList& varNotices = graph_i.varNotices();
+   for(std::vector<Workspace>::iterator ws=workspaces_i.begin();
+         ws!=workspaces_i.end(); ++ws)
+   {
+      for(std::vector<int>::const_iterator it=ws->notices.begin();
+            it!=ws->notices.end(); ++it)
+      {
+         varNotices.notify(*it);
+      }
+      ws->notices.clear();
+      ws->residuals.clear();
+   }
+
+   //***************************************************************************
+   // Return the number of variables with updated messages
+   //***************************************************************************
+   return varNotices.count();
+
+} // updateFac2VarMsgs
+
+/**
+ * Updates variable to factor messages.
+ * This function only needs to update messages that have changed
+ * significantly since the last iteration. A significant change
+ * is one which exceeds the maxNormThreshold_i or results in a
+ * change in variable assignment.
+ * @post Each message is normalised so that the sum of its values is 0.
+ * @returns the number of updated messages.
+ */
+int MaxSumController::updateVar2FacMsgs()
+{
+   //***************************************************************************
+   // Update each variable with new mail, using all available threads.
+   //***************************************************************************
+   {
+      MAXSUM_TRACE_SCOPE(NOTICES);
+      graph_i.varNotices().take(jobs_i);
+      noUpdates_i += jobs_i.size();
+   }
+   UpdateTask task(*this,false);
+   if(0!=pPool_i)
+   {
+      pPool_i->run(jobs_i.size(),task);
+   }
+   else
+   {
+      task.run(0,jobs_i.size(),0);
+   }
+
+   //***************************************************************************
+   // Tell each factor whose input has changed that they have mail. If the
+   // optimal value for any variable has changed, then all factors need to
+   // check their mail, or only its neighbours if notices are targeted.
+   // The changed variables are left for MaxSumController::trackUtility.
+   //***************************************************************************
+   MAXSUM_TRACE_SCOPE(NOTICES);
+   util::NoticeList& factorNotices = graph_i.factorNotices();
+   for(std::vector<Workspace>::iterator ws=workspaces_i.begin();
+         ws!=workspaces_i.end(); ++ws)
+   {
+      for(std::vector<int>::const_iterator it=ws->notices.begin();
+            it!=ws->notices.end(); ++it)
+      {
+         factorNotices.notify(*it);
+      }
+      ws->notices.clear();
+      ws->residuals.clear();
+   }
+   if(task.changed() && targetedNotices_i)
+   {
+      for(std::vector<Workspace>::const_iterator ws=workspaces_i.begin();
+            ws!=workspaces_i.end(); ++ws)
+      {
+         for(std::vector<int>::const_iterator v=ws->changedVars.begin();
+               v!=ws->changedVars.end(); ++v)
+         {
+            for(int k=graph_i.varEdgeBegin(*v); k<graph_i.varEdgeEnd(*v); ++k)
+            {
+               factorNotices.notify(graph_i.edgeFactor(graph_i.varEdge(k)));
+            }
+         }
+      }
+   }
+   else if(task.changed())
+   {
+      factorNotices.notifyAll();
+   }
+
+   //***************************************************************************
+   // Return the number of factors with updated messages
+   //***************************************************************************
+   return factorNotices.count();
+
+} // updateVar2FacMsgs
+
+namespace
+{
+   /**
+    * Clock used to time iterations and check deadlines.
+    */
+   typedef MaxSumController::Clock Clock_m;
+
+   /**
+    * Returns the time in seconds since <code>last</code>, and sets
+    * <code>last</code> to the current time. If <code>timed</code> is false,
+    * the clock is not read, and zero is returned.
+    */
+   double lap_m(bool timed, Clock_m::time_point& last)
+   {
+      if(!timed)
+      {
+         return 0;
+      }
+      const Clock_m::time_point now = Clock_m::now();
+      const double result = std::chrono::duration<double>(now-last).count();
+      last = now;
+      return result;
+   }
+
+} // module namespace
+
+/**
+ * Finishes an iteration, reporting its statistics to the observer, if any,
+ * and updating the utility of the current assignment, if a deadline is set.
+ */
+void MaxSumController::endIteration
+(
+ int iteration,
+ double fac2varSeconds,
+ double var2facSeconds
+)
+{
+   MAXSUM_TRACE_SCOPE(CONVERGENCE);
+   if(0!=pDeadline_i)
+   {
+      trackUtility();
+   }
+   if(snapshots_i)
+   {
+      publish(iteration);
+   }
+
+   IterationStats stats;
+   for(std::vector<Workspace>::iterator ws=workspaces_i.begin();
+         ws!=workspaces_i.end(); ++ws)
+   {
+      stats.merge(ws->stats);
+      ws->stats.clear();
+      ws->clearChangedVars();
+   }
+   if(0!=pObserver_i)
+   {
+      stats.iteration = iteration;
+      stats.fac2varSeconds = fac2varSeconds;
+      stats.var2facSeconds = var2facSeconds;
+      pObserver_i->iterationDone(stats);
+   }
+
+} // function endIteration
+
+/**
+ * Re-evaluates every factor that depends on a variable whose value has
+ * changed since the last call, and records the current assignment if it
+ * is the best seen so far.
+ */
+void MaxSumController::trackUtility()
+{
+   //***************************************************************************
+   // Find the factors affected by each changed variable.
+   //***************************************************************************
+   for(std::vector<Workspace>::iterator ws=workspaces_i.begin();
+         ws!=workspaces_i.end(); ++ws)
+   {
+      for(std::vector<int>::const_iterator v=ws->changedVars.begin();
+            v!=ws->changedVars.end(); ++v)
+      {
+         for(int k=graph_i.varEdgeBegin(*v); k<graph_i.varEdgeEnd(*v); ++k)
+         {
+            utilityNotices_i.notify(graph_i.edgeFactor(graph_i.varEdge(k)));
+         }
+      }
+      ws->clearChangedVars();
+   }
+   if(0==utilityNotices_i.count())
+   {
+      return;
+   }
+
+   //***************************************************************************
+   // Update the utility by the change in each affected factor's value.
+   //***************************************************************************
+   utilityNotices_i.take(jobs_i);
+   for(std::vector<int>::const_iterator f=jobs_i.begin(); f!=jobs_i.end(); ++f)
+   {
+      const ValType newUtility = evaluateFactor(*f);
+      utility_i += newUtility - factorUtility_i[*f];
+      factorUtility_i[*f] = newUtility;
+   }
+
+   if(bestUtility_i < utility_i)
+   {
+      bestUtility_i = utility_i;
+      for(int v=0; v<graph_i.noVars(); ++v)
+      {
+         bestValues_i[v] = graph_i.value(v);
+      }
+   }
+
+} // function trackUtility
+
+/**
+ * Returns the value of factor <code>f</code> in graph_i for the current
+ * assignment of values to variables.
+ */
+ValType MaxSumController::evaluateFactor(int f)
+{
+   const int begin = graph_i.factorEdgeBegin(f);
+   const int end = graph_i.factorEdgeEnd(f);
+   const ImplicitFactor* pImplicit = graph_i.implicit(f);
+   if(0!=pImplicit)
+   {
+      for(int e=begin; e<end; ++e)
+      {
+         utilitySubs_i[e-begin] = graph_i.value(graph_i.edgeVar(e));
+      }
+      return pImplicit->value(utilitySubs_i.data());
+   }
+
+   ValIndex index = 0;
+   for(int e=begin; e<end; ++e)
+   {
+      index += graph_i.value(graph_i.edgeVar(e)) * graph_i.edgeStride(e);
+   }
+   return graph_i.factor(f)(index);
+
+} // function evaluateFactor
+
+/**
+ * Runs max-sum using the MaxSumController::FLOODING schedule.
+ * @returns the number of iterations performed.
+ */
+int MaxSumController::optimiseFlooding()
+{
+   //***************************************************************************
+   // While the algorithm has not converged, or the maximum number of
+   // iterations has not been reached.
+   //***************************************************************************
+   int iterationCount = 0;
+   const bool timed = (0!=pObserver_i);
+   Clock_m::time_point lap = timed ? Clock_m::now() : Clock_m::time_point();
+   while(iterationCount<maxIterations_i)
+   {
+      //************************************************************************
+      // Update the number of iterations that we've performed
+      //************************************************************************
+      ++iterationCount;
+
+      //************************************************************************
+      // Update the factor to variable messages, and then the variable to
+      // factor messages, timing each half-iteration if we are observed.
+      //************************************************************************
+      int numOfUpdates = updateFac2VarMsgs();
+      const double fac2varSeconds = lap_m(timed,lap);
+      const bool late = pastDeadline();
+      if(!late)
+      {
+         numOfUpdates += updateVar2FacMsgs();
+      }
+      const double var2facSeconds = lap_m(timed,lap);
+      endIteration(iterationCount,fac2varSeconds,var2facSeconds);
+
+      //************************************************************************
+      // If we have run out of time, the remaining notices are kept for
+      // the next call.
+      //************************************************************************
+      if(late || pastDeadline())
+      {
+         break;
+      }
+
+      //************************************************************************
+      // If there have been no message updates since the last iteration, then
+      // we've converged, so we can stop.
+      //************************************************************************
+      if(0==numOfUpdates)
+      {
+         break;
+      }
+
+   } // while loop
+
+   //***************************************************************************
+   // Return the number of iterations performed.
+   //***************************************************************************
+   return iterationCount;
+
+} // optimiseFlooding
+
+/**
+ * Runs max-sum using the MaxSumController::RESIDUAL schedule.
+ * @returns the number of iterations performed, where one iteration is
+ * counted for every noFactors()+noVars() node updates.
+ */
+int MaxSumController::optimiseResidual()
+{
+   //***************************************************************************
+   // Nodes that were notified before this call have unknown residuals, so
+   // they are updated first.
+   //***************************************************************************
+   Workspace& ws = workspaces_i[0];
+   const int noFactors = graph_i.noFactors();
+   const int noNodes = noFactors + graph_i.noVars();
+   const ValType first = std::numeric_limits<ValType>::infinity();
+   graph_i.factorNotices().take(jobs_i);
+   for(std::vector<int>::const_iterator it=jobs_i.begin();
+         it!=jobs_i.end(); ++it)
+   {
+      heap_i.raise(*it,first);
+   }
+   graph_i.varNotices().take(jobs_i);
+   for(std::vector<int>::const_iterator it=jobs_i.begin();
+         it!=jobs_i.end(); ++it)
+   {
+      heap_i.raise(noFactors+*it,first);
+   }
+
+   //***************************************************************************
+   // Repeatedly update the node whose inputs have changed the most, until
+   // no input has changed significantly, or we run out of iterations.
+   //***************************************************************************
+   const long maxUpdates = static_cast<long>(maxIterations_i) * noNodes;
+   const long perIteration = std::max(1,noNodes);
+   const bool timed = (0!=pObserver_i);
+   Clock_m::time_point lap = timed ? Clock_m::now() : Clock_m::time_point();
+   long updates = 0;
+   while( (!heap_i.empty()) && (updates<maxUpdates) && !pastDeadline() )
+   {
+      ++updates;
+      const int k = heap_i.pop();
+      int offset = 0;
+      if(k<noFactors)
+      {
+         updateFactor(k,ws);
+         offset = noFactors;
+      }
+      else
+      {
+         updateVariable(k-noFactors,ws);
+      }
+
+      for(std::size_t j=0; j<ws.notices.size(); ++j)
+      {
+         heap_i.raise(offset+ws.notices[j],ws.residuals[j]);
+      }
+      ws.notices.clear();
+      ws.residuals.clear();
+
+      if(0==updates%perIteration)
+      {
+         endIteration(updates/perIteration,lap_m(timed,lap),0);
+      }
+   }
+   const int iterationCount = (updates+perIteration-1)/perIteration;
+   if( (0==updates) || (0!=updates%perIteration) )
+   {
+      endIteration(std::max(1,iterationCount),lap_m(timed,lap),0);
+   }
+
+   //***************************************************************************
+   // If we ran out of iterations or time, keep the remaining nodes' notices
+   // for the next call.
+   //***************************************************************************
+   while(!heap_i.empty())
+   {
+      const int k = heap_i.pop();
+      if(k<noFactors)
+      {
+         graph_i.factorNotices().notify(k);
+      }
+      else
+      {
+         graph_i.varNotices().notify(k-noFactors);
+      }
+   }
+
+   noUpdates_i += updates;
+   return std::max(1,iterationCount);
+
+} // optimiseResidual
+
+/**
+ * Runs max-sum using the MaxSumController::ROUND_ROBIN schedule.
+ * @returns the number of iterations (sweeps) performed.
+ */
+int MaxSumController::optimiseRoundRobin()
+{
+   //***************************************************************************
+   // Mark every notified factor for the first sweep, and update any
+   // variables that were notified before this call.
+   //***************************************************************************
+   Workspace& ws = workspaces_i[0];
+   const int noFactors = graph_i.noFactors();
+   graph_i.factorNotices().take(jobs_i);
+   for(std::vector<int>::const_iterator it=jobs_i.begin();
+         it!=jobs_i.end(); ++it)
+   {
+      sweepFlags_i[*it] = 1;
+   }
+   graph_i.varNotices().take(jobs_i);
+   noUpdates_i += jobs_i.size();
+   for(std::vector<int>::const_iterator it=jobs_i.begin();
+         it!=jobs_i.end(); ++it)
+   {
+      updateVariable(*it,ws);
+      for(std::vector<int>::const_iterator f=ws.notices.begin();
+            f!=ws.notices.end(); ++f)
+      {
+         sweepFlags_i[*f] = 1;
+      }
+      ws.notices.clear();
+      ws.residuals.clear();
+   }
+
+   //***************************************************************************
+   // Sweep through the factors until no factor needs updating, or we run
+   // out of iterations.
+   //***************************************************************************
+   int iterationCount = 0;
+   const bool timed = (0!=pObserver_i);
+   Clock_m::time_point lap = timed ? Clock_m::now() : Clock_m::time_point();
+   while(iterationCount<maxIterations_i)
+   {
+      ++iterationCount;
+      long updates = 0;
+      bool late = false;
+      for(int f=0; (f<noFactors) && !late; ++f)
+      {
+         if(0==sweepFlags_i[f])
+         {
+            continue;
+         }
+         sweepFlags_i[f] = 0;
+         ++updates;
+
+         //*********************************************************************
+         // Update the factor, and then immediately update each variable
+         // whose input has changed, marking the factors that they notify.
+         // Factors later in this sweep are updated in this sweep, while
+         // earlier factors wait for the next one.
+         //*********************************************************************
+         updateFactor(f,ws);
+         sweepVars_i.swap(ws.notices);
+         ws.residuals.clear();
+         for(std::vector<int>::const_iterator v=sweepVars_i.begin();
+               v!=sweepVars_i.end(); ++v)
+         {
+            ++updates;
+            updateVariable(*v,ws);
+            for(std::vector<int>::const_iterator g=ws.notices.begin();
+                  g!=ws.notices.end(); ++g)
+            {
+               sweepFlags_i[*g] = 1;
+            }
+            ws.notices.clear();
+            ws.residuals.clear();
+         }
+         sweepVars_i.clear();
+         late = pastDeadline();
+      }
+
+      noUpdates_i += updates;
+      endIteration(iterationCount,lap_m(timed,lap),0);
+      if( (0==updates) || late )
+      {
+         break;
+      }
+   }
+
+   //***************************************************************************
+   // If we ran out of iterations or time, keep the remaining factors' notices
+   // for the next call.
+   //***************************************************************************
+   for(int f=0; f<noFactors; ++f)
+   {
+      if(0!=sweepFlags_i[f])
+      {
+         sweepFlags_i[f] = 0;
+         graph_i.factorNotices().notify(f);
+      }
+   }
+
+   return iterationCount;
+
+} // optimiseRoundRobin
+
+/**
+ * Runs the max-sum algorithm to optimise the values for each variable.
+ * @post maxsum::MaxSumController::getValue will return the optimal value
+ * for the the variable with unique identifier <code>id</code>.
+ * @returns the number of iterations performed.
+ * @see MaxSumController::setSchedule
+ */
+int MaxSumController::optimise()
+{
+   //***************************************************************************
+   // Make sure that the compiled factor graph is up to date.
+   //***************************************************************************
+   MAXSUM_TRACE_SCOPE(OPTIMISE);
+   compile();
+   noUpdates_i = 0;
+
+   //***************************************************************************
+   // Solve the acyclic components exactly, if enabled, and then update the
+   // remaining messages using the selected schedule.
+   //***************************************************************************
+   if(treeSolver_i)
+   {
+      noUpdates_i += solveTrees();
+   }
+   int iterationCount = 0;
+   try
+   {
+      switch(schedule_i)
+      {
+         case RESIDUAL:
+            iterationCount = optimiseResidual();
+            break;
+
+         case ROUND_ROBIN:
+            iterationCount = optimiseRoundRobin();
+            break;
+
+         default:
+            iterationCount = optimiseFlooding();
+      }
+   }
+   catch(...)
+   {
+      cancel_i.store(false);
+      throw;
+   }
+
+   //***************************************************************************
+   // Clear any cancellation request, and publish the final assignment.
+   //***************************************************************************
+   cancel_i.store(false);
+   if(snapshots_i)
+   {
+      publish(iterationCount);
+   }
+   return iterationCount;
+
+} // optimise function
+
+/**
+ * Runs the max-sum algorithm until it converges, the maximum number of
+ * iterations is reached, or the specified deadline passes, and then sets
+ * each variable to its value in the best assignment seen.
+ * @param[in] deadline the time by which to stop.
+ * @returns the number of iterations performed.
+ */
+int MaxSumController::optimise(Clock::time_point deadline)
+{
+   MAXSUM_TRACE_SCOPE(OPTIMISE);
+   compile();
+   noUpdates_i = 0;
+
+   //***************************************************************************
+   // Evaluate every factor for the starting assignment, which is the best
+   // seen so far.
+   //***************************************************************************
+   utility_i = 0;
+   for(int f=0; f<graph_i.noFactors(); ++f)
+   {
+      factorUtility_i[f] = evaluateFactor(f);
+      utility_i += factorUtility_i[f];
+   }
+   bestUtility_i = utility_i;
+   for(int v=0; v<graph_i.noVars(); ++v)
+   {
+      bestValues_i[v] = graph_i.value(v);
+   }
+
+   //***************************************************************************
+   // Run the selected schedule, tracking the utility after each iteration.
+   //***************************************************************************
+   pDeadline_i = &deadline;
+   int iterationCount = 0;
+   try
+   {
+      if(treeSolver_i)
+      {
+         noUpdates_i += solveTrees();
+         trackUtility();
+      }
+      switch(schedule_i)
+      {
+         case RESIDUAL:
+            iterationCount = optimiseResidual();
+            break;
+
+         case ROUND_ROBIN:
+            iterationCount = optimiseRoundRobin();
+            break;
+
+         default:
+            iterationCount = optimiseFlooding();
+      }
+   }
+   catch(...)
+   {
+      pDeadline_i = 0;
+      cancel_i.store(false);
+      throw;
+   }
+   pDeadline_i = 0;
+   cancel_i.store(false);
+
+   //***************************************************************************
+   // If the final assignment is worse than the best, restore the best.
+   //***************************************************************************
+   if(utility_i < bestUtility_i)
+   {
+      for(int v=0; v<graph_i.noVars(); ++v)
+      {
+         graph_i.value(v) = bestValues_i[v];
+      }
+      utility_i = bestUtility_i;
+   }
+   if(snapshots_i)
+   {
+      publish(iterationCount);
+   }
+   return iterationCount;
+
+} // optimise function
+
+/**
+ * Runs MaxSumController::optimise for MaxSumController::optimiseAsync,
+ * and then restores the previous snapshot setting.
+ * @param[in] enabled true if snapshots were previously enabled.
+ * @param[in] totals true if snapshots previously included totals.
+ * @param[in] pDeadline the time by which to stop, or NULL for none.
+ * @returns the number of iterations performed.
+ */
+int MaxSumController::optimiseAndRestore
+(
+ bool enabled,
+ bool totals,
+ const Clock::time_point* pDeadline
+)
+{
+   int iterations = 0;
+   try
+   {
+      iterations = (0==pDeadline) ? optimise() : optimise(*pDeadline);
+   }
+   catch(...)
+   {
+      setSnapshots(enabled,totals);
+      throw;
+   }
+   setSnapshots(enabled,totals);
+   return iterations;
+
+} // function optimiseAndRestore
+
+/**
+ * Runs MaxSumController::optimise in a new thread, and enables snapshots
+ * until it finishes.
+ * @returns a future for the number of iterations performed.
+ */
+std::future<int> MaxSumController::optimiseAsync()
+{
+   cancel_i.store(false);
+   const bool enabled = snapshots_i;
+   const bool totals = snapshotTotals_i;
+   snapshots_i = true;
+   return std::async(std::launch::async,[this,enabled,totals]()
+         { return optimiseAndRestore(enabled,totals,0); });
+
+} // function optimiseAsync
+
+/**
+ * Runs MaxSumController::optimise(Clock::time_point) in a new thread, and
+ * enables snapshots until it finishes.
+ * @param[in] deadline the time by which to stop.
+ * @returns a future for the number of iterations performed.
+ */
+std::future<int> MaxSumController::optimiseAsync(Clock::time_point deadline)
+{
+   cancel_i.store(false);
+   const bool enabled = snapshots_i;
+   const bool totals = snapshotTotals_i;
+   snapshots_i = true;
+   return std::async(std::launch::async,[this,enabled,totals,deadline]()
+         { return optimiseAndRestore(enabled,totals,&deadline); });
+
+} // function optimiseAsync
+
+/**
+ * Publishes a snapshot of the current assignment, which replaces any
+ * previous snapshot. Readers that still hold the previous snapshot keep
+ * it until they release it.
+ * @param[in] iteration the number of iterations performed so far by the
+ * current call to MaxSumController::optimise.
+ */
+void MaxSumController::publish(int iteration)
+{
+   std::shared_ptr<Snapshot> pSnapshot(new Snapshot());
+   pSnapshot->iteration = iteration;
+   pSnapshot->vars.resize(graph_i.noVars());
+   pSnapshot->values.resize(graph_i.noVars());
+   for(int k=0; k<graph_i.noVars(); ++k)
+   {
+      const int v = graph_i.varById(k);
+      pSnapshot->vars[k] = graph_i.varId(v);
+      pSnapshot->values[k] = graph_i.value(v);
+   }
+   if(snapshotTotals_i)
+   {
+      pSnapshot->totals = factorTotalValue_i;
+   }
+   std::atomic_store(&snapshot_i,SnapshotPtr(pSnapshot));
+
+} // function publish
+
+/**
+ * Returns the sum of every factor's value for the current assignment of
+ * values to variables.
+ */
+ValType MaxSumController::getUtility() const
+{
+   ValType utility = 0;
+   for(FactorMap::const_iterator it=factors_i.begin(); it!=factors_i.end();
+         ++it)
+   {
+      utility += it->second(values_i);
+   }
+
+   std::vector<ValIndex> subs;
+   for(ImplicitMap::const_iterator it=implicit_i.begin();
+         it!=implicit_i.end(); ++it)
+   {
+      const std::vector<VarID>& vars = it->second->vars();
+      subs.resize(vars.size());
+      for(std::size_t k=0; k<vars.size(); ++k)
+      {
+         subs[k] = values_i.find(vars[k])->second;
+      }
+      utility += it->second->value(subs.data());
+   }
+   return utility;
 
+} // function getUtility
@@ -0,0 +1,279 @@
+/**
+ * @file PartitionedController.cpp
+ * Implementation of the maxsum::PartitionedController class.
+ * @see PartitionedController.h
+ */
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <maxsum/PartitionedController.h>
+#include <maxsum/register.h>
+
+using namespace maxsum;
+
+/**
+ * Finds the boundary variables by exchanging the list of variables of
+ * each partition, and creates a ghost factor for each.
+ * @post all boundary messages are reset to zero.
+ */
+void PartitionedController::findBoundary()
+{
+   //***************************************************************************
+   // Remove the old ghost factors, so that only variables connected to
+   // factors owned by this partition remain.
+   //***************************************************************************
+   for(std::vector<BoundaryVar>::const_iterator it=boundary_i.begin();
+         it!=boundary_i.end(); ++it)
+   {
+      controller_i.removeFactor(it->ghost);
+   }
+   boundary_i.clear();
+   boundaryIndex_i.clear();
+
+   //***************************************************************************
+   // Send the sorted list of this partition's variables to every other
+   // partition.
+   //***************************************************************************
+   const int noPartitions = transport_i.noPartitions();
+   const int rank = transport_i.rank();
+   outgoing_i.resize(noPartitions);
+   for(int dest=0; dest<noPartitions; ++dest)
+   {
+      outgoing_i[dest].clear();
+      if(dest==rank)
+      {
+         continue;
+      }
+      for(MaxSumController::ConstValueIterator it=controller_i.valBegin();
+            it!=controller_i.valEnd(); ++it)
+      {
+         outgoing_i[dest].vars.push_back(it->first);
+      }
+   }
+   transport_i.exchange(outgoing_i,incoming_i);
+
+   //***************************************************************************
+   // Any variable that is also in another partition's list is on the
+   // boundary.
+   //***************************************************************************
+   for(MaxSumController::ConstValueIterator it=controller_i.valBegin();
+         it!=controller_i.valEnd(); ++it)
+   {
+      BoundaryVar boundary;
+      boundary.var = it->first;
+      for(int src=0; src<noPartitions; ++src)
+      {
+         const std::vector<VarID>& vars = incoming_i[src].vars;
+         if( (src!=rank) &&
+             std::binary_search(vars.begin(),vars.end(),boundary.var) )
+         {
+            boundary.sharers.push_back(src);
+         }
+      }
+      if(!boundary.sharers.empty())
+      {
+         boundary.ghost = ghostBase_i + boundary_i.size();
+         boundaryIndex_i[boundary.var] = boundary_i.size();
+         boundary_i.push_back(boundary);
+      }
+   }
+
+   //***************************************************************************
+   // Finally, give each boundary variable a ghost factor, which is zero
+   // until messages are received from the other partitions.
+   //***************************************************************************
+   for(std::vector<BoundaryVar>::iterator it=boundary_i.begin();
+         it!=boundary_i.end(); ++it)
+   {
+      const ValIndex size = getDomainSize(it->var);
+      it->sent.assign(size,0);
+      it->received.assign(size*it->sharers.size(),0);
+      controller_i.setFactor(it->ghost,DiscreteFunction(it->var,0.0));
+   }
+
+} // function findBoundary
+
+/**
+ * Adds the sum of local factor messages to each boundary variable to the
+ * outgoing batches, if it has changed significantly since it was last
+ * sent.
+ * @returns the number of boundary variables whose sums were sent.
+ */
+int PartitionedController::sendBoundary()
+{
+   const util::FactorGraph& graph = controller_i.graph_i;
+   for(std::vector<Batch>::iterator it=outgoing_i.begin();
+         it!=outgoing_i.end(); ++it)
+   {
+      it->clear();
+   }
+
+   int count = 0;
+   for(std::vector<BoundaryVar>::iterator it=boundary_i.begin();
+         it!=boundary_i.end(); ++it)
+   {
+      //************************************************************************
+      // Sum the messages from every factor owned by this partition, which
+      // excludes the ghost factor.
+      //************************************************************************
+      const int v = graph.findVar(it->var);
+      assert(0<=v);
+      const ValIndex size = graph.varSize(v);
+      sum_i.assign(size,0);
+      for(int k=graph.varEdgeBegin(v); k<graph.varEdgeEnd(v); ++k)
+      {
+         const int e = graph.varEdge(k);
+         if(graph.factorId(graph.edgeFactor(e))==it->ghost)
+         {
+            continue;
+         }
+         const ValType* pMsg = graph.fac2var(e);
+         for(ValIndex x=0; x<size; ++x)
+         {
+            sum_i[x] += pMsg[x];
+         }
+      }
+
+      //************************************************************************
+      // Only send the sum if it has changed significantly.
+      //************************************************************************
+      ValType residual = 0;
+      for(ValIndex x=0; x<size; ++x)
+      {
+         residual = std::max(residual,
+               static_cast<ValType>(std::fabs(sum_i[x]-it->sent[x])));
+      }
+      if(residual <= controller_i.maxNormThreshold_i)
+      {
+         continue;
+      }
+
+      it->sent = sum_i;
+      for(std::vector<int>::const_iterator s=it->sharers.begin();
+            s!=it->sharers.end(); ++s)
+      {
+         outgoing_i[*s].vars.push_back(it->var);
+         outgoing_i[*s].values.insert(outgoing_i[*s].values.end(),
+               sum_i.begin(),sum_i.end());
+      }
+      ++count;
+   }
+   return count;
+
+} // function sendBoundary
+
+/**
+ * Updates the ghost factors from the incoming batches.
+ */
+void PartitionedController::receiveBoundary()
+{
+   //***************************************************************************
+   // Store each received sum.
+   //***************************************************************************
+   std::vector<int> changed;
+   for(int src=0; src<static_cast<int>(incoming_i.size()); ++src)
+   {
+      const Batch& batch = incoming_i[src];
+      const ValType* pValues = batch.values.data();
+      for(std::vector<VarID>::const_iterator var=batch.vars.begin();
+            var!=batch.vars.end(); ++var)
+      {
+         const ValIndex size = getDomainSize(*var);
+         std::map<VarID,int>::const_iterator pos = boundaryIndex_i.find(*var);
+         if(boundaryIndex_i.end()!=pos)
+         {
+            BoundaryVar& boundary = boundary_i[pos->second];
+            const int j = std::lower_bound(boundary.sharers.begin(),
+                  boundary.sharers.end(),src) - boundary.sharers.begin();
+            std::copy(pValues,pValues+size,boundary.received.begin()+j*size);
+            changed.push_back(pos->second);
+         }
+         pValues += size;
+      }
+   }
+
+   //***************************************************************************
+   // Set each changed ghost factor to the total of the sums received from
+   // every other partition, and tell it to recheck its mail.
+   //***************************************************************************
+   for(std::vector<int>::const_iterator it=changed.begin(); it!=changed.end();
+         ++it)
+   {
+      const BoundaryVar& boundary = boundary_i[*it];
+      DiscreteFunction& ghost =
+         controller_i.getUnSafeWritableFactorHandle(boundary.ghost);
+      const ValIndex size = ghost.domainSize();
+      for(ValIndex x=0; x<size; ++x)
+      {
+         ValType total = 0;
+         for(std::size_t j=0; j<boundary.sharers.size(); ++j)
+         {
+            total += boundary.received[j*size+x];
+         }
+         ghost(x) = total;
+      }
+      controller_i.notifyFactor(boundary.ghost);
+   }
+
+} // function receiveBoundary
+
+/**
+ * Returns the sum of the values of the factors owned by this partition,
+ * for the current assignment.
+ */
+ValType PartitionedController::getUtility() const
+{
+   ValType utility = controller_i.getUtility();
+   for(std::vector<BoundaryVar>::const_iterator it=boundary_i.begin();
+         it!=boundary_i.end(); ++it)
+   {
+      utility -= controller_i.getFactor(it->ghost)(controller_i.values_i);
+   }
+   return utility;
+
+} // function getUtility
+
+/**
+ * Runs max-sum on the full factor graph, in cooperation with every other
+ * partition, until it converges or the maximum number of iterations is
+ * reached.
+ * @returns the number of iterations performed.
+ */
+int PartitionedController::optimise()
+{
+   //***************************************************************************
+   // If any partition has changed its factors, every partition must find
+   // the boundary again.
+   //***************************************************************************
+   if(!transport_i.allTrue(boundaryValid_i))
+   {
+      findBoundary();
+      boundaryValid_i = true;
+   }
+
+   //***************************************************************************
+   // Each iteration updates the local messages once, and then exchanges
+   // the boundary messages that have changed.
+   //***************************************************************************
+   int iterationCount = 0;
+   while(iterationCount<maxIterations_i)
+   {
+      ++iterationCount;
+      controller_i.optimise();
+      const bool idle = (0==controller_i.noUpdates());
+      const int noSent = sendBoundary();
+      transport_i.exchange(outgoing_i,incoming_i);
+      receiveBoundary();
+
+      //************************************************************************
+      // We have converged once no partition has any mail to process or
+      // boundary messages to send.
+      //************************************************************************
+      if(transport_i.allTrue(idle && (0==noSent)))
+      {
+         break;
+      }
+   }
+   return iterationCount;
+
+} // function optimise
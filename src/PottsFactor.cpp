@@ -0,0 +1,109 @@
+/**
+ * @file PottsFactor.cpp
+ * Implementation of the maxsum::PottsFactor class.
+ * @see PottsFactor.h
+ */
+#include <limits>
+#include <maxsum/PottsFactor.h>
+#include <maxsum/exceptions.h>
+
+using namespace maxsum;
+
+/**
+ * Private Module Namespace.
+ */
+namespace
+{
+   /**
+    * Max marginalises a Potts factor onto one of its variables.
+    * @param[in] same value of the factor when both variables are equal.
+    * @param[in] different value of the factor when they are not.
+    * @param[in] pOwn the message for the output variable.
+    * @param[in] ownSize the domain size of the output variable.
+    * @param[in] pOther the message for the other variable.
+    * @param[in] otherSize the domain size of the other variable.
+    * @param[out] pOut the max marginal for the output variable.
+    */
+   void marginal_m
+   (
+    const ValType same,
+    const ValType different,
+    const ValType* pOwn,
+    const ValIndex ownSize,
+    const ValType* pOther,
+    const ValIndex otherSize,
+    ValType* pOut
+   )
+   {
+      //************************************************************************
+      // Find the best and second best values of the other message, so that
+      // the best value that differs from any x is found in constant time.
+      //************************************************************************
+      const ValType NONE = -std::numeric_limits<ValType>::infinity();
+      ValIndex bestIndex = 0;
+      ValType best = pOther[0];
+      ValType second = NONE;
+      for(ValIndex y=1; y<otherSize; ++y)
+      {
+         if(best < pOther[y])
+         {
+            second = best;
+            best = pOther[y];
+            bestIndex = y;
+         }
+         else if(second < pOther[y])
+         {
+            second = pOther[y];
+         }
+      }
+
+      for(ValIndex x=0; x<ownSize; ++x)
+      {
+         const ValType other = (x==bestIndex) ? second : best;
+         ValType result = (NONE==other) ? NONE : different + other;
+         if( (x<otherSize) && (result < same + pOther[x]) )
+         {
+            result = same + pOther[x];
+         }
+         pOut[x] = pOwn[x] + result;
+      }
+   }
+
+} // private namespace
+
+/**
+ * Constructs a Potts factor between two variables.
+ * @throws BadDomainException if the two variables are the same.
+ */
+PottsFactor::PottsFactor
+(
+ VarID var1,
+ VarID var2,
+ ValType same,
+ ValType different
+)
+: ImplicitFactor(VarVec{var1,var2}), same_i(same), different_i(different)
+{
+   if(var1==var2)
+   {
+      throw BadDomainException("PottsFactor::PottsFactor",
+            "A Potts factor must depend on two different variables.");
+   }
+}
+
+/**
+ * Max marginalises the sum of this factor and its input messages onto
+ * both variables.
+ */
+void PottsFactor::maxMarginals
+(
+ const ValType* const* ppMsgs,
+ ValType* const* ppOut
+) const
+{
+   const ValIndex* pSizes = sizes().data();
+   marginal_m(same_i,different_i,ppMsgs[0],pSizes[0],ppMsgs[1],pSizes[1],
+         ppOut[0]);
+   marginal_m(same_i,different_i,ppMsgs[1],pSizes[1],ppMsgs[0],pSizes[0],
+         ppOut[1]);
+}
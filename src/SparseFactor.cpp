@@ -0,0 +1,214 @@
+/**
+ * @file SparseFactor.cpp
+ * Implementation of the maxsum::SparseFactor class.
+ * @see SparseFactor.h
+ */
+#include <algorithm>
+#include <limits>
+#include <queue>
+#include <maxsum/SparseFactor.h>
+#include <maxsum/exceptions.h>
+
+using namespace maxsum;
+
+/**
+ * Private Module Namespace.
+ */
+namespace
+{
+   /**
+    * Partial joint assignment considered while enumerating assignments in
+    * decreasing order of total message value. Each variable's value is
+    * given by its rank in that variable's message, sorted in decreasing
+    * order.
+    */
+   struct Candidate_m
+   {
+      /**
+       * The total value of the messages for this assignment.
+       */
+      ValType score;
+
+      /**
+       * The rank of each variable's value.
+       */
+      std::vector<ValIndex> ranks;
+
+      /**
+       * Only variables from this position onwards may be advanced to
+       * generate successors, which ensures that each assignment is
+       * generated exactly once.
+       */
+      int pivot;
+
+      /**
+       * Orders candidates by score, for use in a max-heap.
+       */
+      bool operator<(const Candidate_m& rhs) const
+      {
+         return score < rhs.score;
+      }
+   };
+
+   /**
+    * Orders the values of a message in decreasing order, breaking ties
+    * by index.
+    */
+   struct ByMessage_m
+   {
+      const ValType* pMsg;
+
+      ByMessage_m(const ValType* p) : pMsg(p) {}
+
+      bool operator()(ValIndex a, ValIndex b) const
+      {
+         return (pMsg[a] > pMsg[b]) || ( (pMsg[a]==pMsg[b]) && (a<b) );
+      }
+   };
+
+} // private namespace
+
+/**
+ * Sets the value of a joint assignment, making it an exception.
+ * @throws OutOfRangeException if <code>subs</code> is not a valid
+ * joint assignment.
+ */
+void SparseFactor::set(const Assignment& subs, ValType val)
+{
+   bool valid = (subs.size() == static_cast<std::size_t>(noVars()));
+   for(int k=0; valid && k<noVars(); ++k)
+   {
+      valid = (0<=subs[k]) && (subs[k]<sizes()[k]);
+   }
+   if(!valid)
+   {
+      throw OutOfRangeException("SparseFactor::set",
+            "Invalid joint assignment for sparse factor.");
+   }
+   exceptions_i[subs] = val;
+}
+
+/**
+ * Returns the value of this factor for a joint assignment.
+ */
+ValType SparseFactor::value(const ValIndex* pSubs) const
+{
+   ExceptionMap::const_iterator pos =
+      exceptions_i.find(Assignment(pSubs,pSubs+noVars()));
+   if(exceptions_i.end()==pos)
+   {
+      return default_i;
+   }
+   return pos->second;
+}
+
+/**
+ * Max marginalises the sum of this factor and its input messages onto
+ * every variable.
+ */
+void SparseFactor::maxMarginals
+(
+ const ValType* const* ppMsgs,
+ ValType* const* ppOut
+) const
+{
+   const int n = noVars();
+   const ValIndex* pSizes = sizes().data();
+   const ValType NONE = -std::numeric_limits<ValType>::infinity();
+   for(int k=0; k<n; ++k)
+   {
+      std::fill(ppOut[k],ppOut[k]+pSizes[k],NONE);
+   }
+
+   //***************************************************************************
+   // Every exception contributes to one value of each variable's marginal.
+   // Sums are accumulated in domain order, as for a maxsum::DiscreteFunction.
+   //***************************************************************************
+   for(ExceptionMap::const_iterator it=exceptions_i.begin();
+         it!=exceptions_i.end(); ++it)
+   {
+      const Assignment& subs = it->first;
+      ValType score = it->second;
+      for(int j=0; j<n; ++j)
+      {
+         score += ppMsgs[j][subs[j]];
+      }
+      for(int k=0; k<n; ++k)
+      {
+         ppOut[k][subs[k]] = std::max(ppOut[k][subs[k]],score);
+      }
+   }
+
+   //***************************************************************************
+   // Sort the values of each message in decreasing order.
+   //***************************************************************************
+   std::vector<std::vector<ValIndex> > order(n);
+   for(int j=0; j<n; ++j)
+   {
+      order[j].resize(pSizes[j]);
+      for(ValIndex x=0; x<pSizes[j]; ++x)
+      {
+         order[j][x] = x;
+      }
+      std::sort(order[j].begin(),order[j].end(),ByMessage_m(ppMsgs[j]));
+   }
+
+   //***************************************************************************
+   // For each value of each variable, enumerate assignments to the other
+   // variables in decreasing order of message value, until we find one that
+   // takes the default value.
+   //***************************************************************************
+   Assignment subs(n);
+   for(int k=0; k<n; ++k)
+   {
+      for(ValIndex x=0; x<pSizes[k]; ++x)
+      {
+         std::priority_queue<Candidate_m> queue;
+         Candidate_m first;
+         first.ranks.assign(n,0);
+         first.pivot = 0;
+         first.score = 0;
+         for(int j=0; j<n; ++j)
+         {
+            first.score += ppMsgs[j][(j==k) ? x : order[j][0]];
+         }
+         queue.push(first);
+
+         while(!queue.empty())
+         {
+            const Candidate_m top = queue.top();
+            queue.pop();
+            for(int j=0; j<n; ++j)
+            {
+               subs[j] = (j==k) ? x : order[j][top.ranks[j]];
+            }
+
+            if(0==exceptions_i.count(subs))
+            {
+               ValType score = default_i;
+               for(int j=0; j<n; ++j)
+               {
+                  score += ppMsgs[j][subs[j]];
+               }
+               ppOut[k][x] = std::max(ppOut[k][x],score);
+               break;
+            }
+
+            for(int j=top.pivot; j<n; ++j)
+            {
+               const ValIndex r = top.ranks[j];
+               if( (j==k) || (r+1>=pSizes[j]) )
+               {
+                  continue;
+               }
+               Candidate_m next(top);
+               next.ranks[j] = r+1;
+               next.pivot = j;
+               next.score += ppMsgs[j][order[j][r+1]] - ppMsgs[j][order[j][r]];
+               queue.push(next);
+            }
+         }
+      }
+   }
+
+} // function maxMarginals
@@ -0,0 +1,232 @@
+/**
+ * @file ThreadPool.cpp
+ * Implementation of the maxsum::util::ThreadPool class.
+ * @see ThreadPool.h
+ */
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <maxsum/ThreadPool.h>
+
+using namespace maxsum::util;
+
+namespace
+{
+   /**
+    * Number of chunks into which each worker's block is divided. More
+    * chunks give finer grained load balancing, at the cost of more atomic
+    * operations.
+    */
+   const int CHUNKS_PER_THREAD_M = 16;
+
+} // module namespace
+
+/**
+ * Constructs a pool with the specified number of workers.
+ * @param[in] noThreads the total number of workers, including
+ * the calling thread. Values less than 1 are treated as 1.
+ */
+ThreadPool::ThreadPool(int noThreads)
+   : noThreads_i(std::max(1,noThreads)), ranges_i(0), rangeStorage_i(0),
+     grain_i(1), pTask_i(0), threads_i(), mutex_i(), start_i(), done_i(),
+     generation_i(0), noBusy_i(0), stopping_i(false), error_i()
+{
+   //***************************************************************************
+   // Align the first block to a cache line by hand, and construct every
+   // block in place.
+   //***************************************************************************
+   std::size_t space = (noThreads_i+1)*sizeof(Range);
+   rangeStorage_i = new char[space];
+   void* pAligned = rangeStorage_i;
+   std::align(alignof(Range),noThreads_i*sizeof(Range),pAligned,space);
+   ranges_i = static_cast<Range*>(pAligned);
+   for(int k=0; k<noThreads_i; ++k)
+   {
+      new(ranges_i+k) Range();
+      ranges_i[k].next = 0;
+      ranges_i[k].end = 0;
+   }
+
+   threads_i.reserve(noThreads_i-1);
+   for(int k=1; k<noThreads_i; ++k)
+   {
+      threads_i.push_back(std::thread(&ThreadPool::workerLoop,this,k));
+   }
+
+} // constructor
+
+/**
+ * Stops and joins all worker threads.
+ */
+ThreadPool::~ThreadPool()
+{
+   {
+      std::lock_guard<std::mutex> lock(mutex_i);
+      stopping_i = true;
+   }
+   start_i.notify_all();
+
+   for(std::vector<std::thread>::iterator it=threads_i.begin();
+         it!=threads_i.end(); ++it)
+   {
+      it->join();
+   }
+   for(int k=0; k<noThreads_i; ++k)
+   {
+      ranges_i[k].~Range();
+   }
+   delete[] rangeStorage_i;
+
+} // destructor
+
+/**
+ * Main loop for each additional worker thread.
+ */
+void ThreadPool::workerLoop(int worker)
+{
+   unsigned long seen = 0;
+   std::unique_lock<std::mutex> lock(mutex_i);
+   while(true)
+   {
+      //************************************************************************
+      // Wait until there is either a new task, or we are told to stop.
+      //************************************************************************
+      while( (!stopping_i) && (seen==generation_i) )
+      {
+         start_i.wait(lock);
+      }
+      if(stopping_i)
+      {
+         return;
+      }
+      seen = generation_i;
+
+      //************************************************************************
+      // Process work without holding the lock, and remember any exception
+      // so that it can be rethrown in the calling thread.
+      //************************************************************************
+      lock.unlock();
+      std::exception_ptr error;
+      try
+      {
+         process(worker);
+      }
+      catch(...)
+      {
+         error = std::current_exception();
+      }
+      lock.lock();
+
+      if( error && !error_i )
+      {
+         error_i = error;
+      }
+      if(0 == --noBusy_i)
+      {
+         done_i.notify_one();
+      }
+
+   } // while loop
+
+} // workerLoop
+
+/**
+ * Claims and processes work items until none are left. Each worker starts
+ * with its own block, and then visits the remaining blocks in turn, so
+ * that idle workers steal from those that still have work to do.
+ */
+void ThreadPool::process(int worker)
+{
+   for(int k=0; k<noThreads_i; ++k)
+   {
+      Range& range = ranges_i[(worker+k)%noThreads_i];
+      while(true)
+      {
+         int begin = range.next.fetch_add(grain_i,std::memory_order_relaxed);
+         if(begin >= range.end)
+         {
+            break;
+         }
+         pTask_i->run(begin,std::min(begin+grain_i,range.end),worker);
+      }
+   }
+
+} // process
+
+/**
+ * Processes the work items in the range [0,n) in parallel, and
+ * returns once all items have been processed.
+ * @param[in] n the number of work items.
+ * @param[in] task the task used to process each block of work items.
+ * @throws any exception thrown by <code>task</code> is rethrown in
+ * the calling thread, once all workers have finished.
+ */
+void ThreadPool::run(int n, Task& task)
+{
+   //***************************************************************************
+   // Deal with trivial cases, where there is nothing to be gained from
+   // waking up the other workers.
+   //***************************************************************************
+   if(0>=n)
+   {
+      return;
+   }
+   if( (1==noThreads_i) || (1==n) )
+   {
+      task.run(0,n,0);
+      return;
+   }
+
+   //***************************************************************************
+   // Divide the work items into one contiguous block per worker, and wake up
+   // the worker threads.
+   //***************************************************************************
+   {
+      std::lock_guard<std::mutex> lock(mutex_i);
+      const int blockSize = (n + noThreads_i - 1) / noThreads_i;
+      for(int k=0; k<noThreads_i; ++k)
+      {
+         ranges_i[k].next.store(std::min(n,k*blockSize),
+               std::memory_order_relaxed);
+         ranges_i[k].end = std::min(n,(k+1)*blockSize);
+      }
+      grain_i = std::max(1,blockSize/CHUNKS_PER_THREAD_M);
+      pTask_i = &task;
+      noBusy_i = noThreads_i-1;
+      error_i = std::exception_ptr();
+      ++generation_i;
+   }
+   start_i.notify_all();
+
+   //***************************************************************************
+   // The calling thread does its share of the work, and then waits for
+   // the others to finish.
+   //***************************************************************************
+   std::exception_ptr error;
+   try
+   {
+      process(0);
+   }
+   catch(...)
+   {
+      error = std::current_exception();
+   }
+
+   std::unique_lock<std::mutex> lock(mutex_i);
+   while(0 < noBusy_i)
+   {
+      done_i.wait(lock);
+   }
+   pTask_i = 0;
+   if(!error)
+   {
+      error = error_i;
+   }
+   lock.unlock();
+
+   if(error)
+   {
+      std::rethrow_exception(error);
+   }
+
+} // run
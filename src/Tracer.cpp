@@ -0,0 +1,486 @@
+/**
+ * @file Tracer.cpp
+ * Implementation of the maxsum::Tracer class.
+ * @see Tracer.h
+ */
+#include <atomic>
+#include <cstring>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <maxsum/Tracer.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace maxsum;
+
+const long Tracer::MAX_EVENTS;
+
+/**
+ * Private Module Namespace.
+ */
+namespace
+{
+   /**
+    * Clock used to time each scope.
+    */
+   typedef std::chrono::steady_clock Clock_m;
+
+   /**
+    * One recorded scope.
+    */
+   struct Event_m
+   {
+      Tracer::Phase phase;
+      Clock_m::time_point start;
+      Clock_m::duration length;
+      long long cycles;
+      long long cacheMisses;
+   };
+
+   /**
+    * Everything recorded by one thread.
+    */
+   struct ThreadLog_m
+   {
+      /**
+       * The number of this thread's track in the Chrome trace.
+       */
+      int track;
+
+      /**
+       * The value of generation_m when this log was last reset.
+       */
+      unsigned long generation;
+
+      /**
+       * Totals for each phase.
+       */
+      Tracer::PhaseTotals totals[Tracer::NO_PHASES];
+
+      /**
+       * Recorded scopes, in the order in which they ended.
+       */
+      std::vector<Event_m> events;
+
+      /**
+       * File descriptors of this thread's cycle and cache miss counters,
+       * or -1 if they are not open.
+       */
+      int cycleCounter;
+      int cacheCounter;
+
+      /**
+       * True if counters were requested, but could not be opened.
+       */
+      bool countersFailed;
+   };
+
+   /**
+    * Protects the list of logs and the settings below.
+    */
+   std::mutex mutex_m;
+
+   /**
+    * The log of every thread that has recorded a scope. Logs are never
+    * freed, since a thread may still refer to its own.
+    */
+   std::vector<std::unique_ptr<ThreadLog_m> > logs_m;
+
+   /**
+    * True between Tracer::start and Tracer::stop.
+    */
+   std::atomic<bool> started_m(false);
+
+   /**
+    * Incremented by Tracer::start, so that each log is reset before it is
+    * next used.
+    */
+   std::atomic<unsigned long> generation_m(0);
+
+   /**
+    * True if events are recorded, as well as totals.
+    */
+   bool recordEvents_m = true;
+
+   /**
+    * True if hardware counters are read.
+    */
+   bool useCounters_m = false;
+
+   /**
+    * The time at which the tracer was last started.
+    */
+   Clock_m::time_point epoch_m;
+
+   /**
+    * The log of the calling thread, or 0 if it has none yet.
+    */
+   thread_local ThreadLog_m* pThreadLog_m = 0;
+
+   /**
+    * Configuration of the cycle and cache miss counters.
+    */
+#ifdef __linux__
+   const unsigned long CYCLES_M = PERF_COUNT_HW_CPU_CYCLES;
+   const unsigned long CACHE_MISSES_M = PERF_COUNT_HW_CACHE_MISSES;
+#else
+   const unsigned long CYCLES_M = 0;
+   const unsigned long CACHE_MISSES_M = 1;
+#endif
+
+   /**
+    * Opens a counter for the calling thread, returning its file descriptor,
+    * or -1 if it cannot be opened.
+    */
+   int openCounter_m(unsigned long config)
+   {
+#ifdef __linux__
+      perf_event_attr attr;
+      std::memset(&attr,0,sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = config;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      return syscall(__NR_perf_event_open,&attr,0,-1,-1,0);
+#else
+      (void)config;
+      return -1;
+#endif
+   }
+
+   /**
+    * Returns the current value of a counter, or 0 if it is not open.
+    */
+   long long readCounter_m(int fd)
+   {
+#ifdef __linux__
+      long long value = 0;
+      if( (0<=fd) && (sizeof(value)==::read(fd,&value,sizeof(value))) )
+      {
+         return value;
+      }
+#else
+      (void)fd;
+#endif
+      return 0;
+   }
+
+   /**
+    * Closes both counters of a log.
+    */
+   void closeCounters_m(ThreadLog_m& log)
+   {
+#ifdef __linux__
+      if(0<=log.cycleCounter)
+      {
+         ::close(log.cycleCounter);
+      }
+      if(0<=log.cacheCounter)
+      {
+         ::close(log.cacheCounter);
+      }
+#endif
+      log.cycleCounter = -1;
+      log.cacheCounter = -1;
+   }
+
+   /**
+    * Returns the log of the calling thread, creating it if necessary, and
+    * resetting it if the tracer has been restarted since it was last used.
+    */
+   ThreadLog_m& threadLog_m()
+   {
+      if(0==pThreadLog_m)
+      {
+         std::unique_ptr<ThreadLog_m> pLog(new ThreadLog_m());
+         pLog->generation = generation_m.load()-1;
+         pLog->cycleCounter = -1;
+         pLog->cacheCounter = -1;
+         std::lock_guard<std::mutex> lock(mutex_m);
+         pLog->track = logs_m.size();
+         pThreadLog_m = pLog.get();
+         logs_m.push_back(std::move(pLog));
+      }
+
+      ThreadLog_m& log = *pThreadLog_m;
+      const unsigned long generation = generation_m.load();
+      if(log.generation!=generation)
+      {
+         log.generation = generation;
+         std::memset(log.totals,0,sizeof(log.totals));
+         log.events.clear();
+         closeCounters_m(log);
+         log.countersFailed = false;
+         if(useCounters_m)
+         {
+            log.cycleCounter = openCounter_m(CYCLES_M);
+            log.cacheCounter = openCounter_m(CACHE_MISSES_M);
+            log.countersFailed = (0>log.cycleCounter) || (0>log.cacheCounter);
+         }
+      }
+      return log;
+   }
+
+   /**
+    * Writes a JSON string, assuming it needs no escaping.
+    */
+   void writeName_m(std::ostream& out, const char* name)
+   {
+      out << '"' << name << '"';
+   }
+
+} // module namespace
+
+/**
+ * Starts timing a phase, if the tracer is started.
+ */
+Tracer::Scope::Scope(Phase phase) : pLog_i(0), phase_i(phase)
+{
+   if(!started_m.load(std::memory_order_relaxed))
+   {
+      return;
+   }
+   ThreadLog_m& log = threadLog_m();
+   pLog_i = &log;
+   cycles_i = readCounter_m(log.cycleCounter);
+   cacheMisses_i = readCounter_m(log.cacheCounter);
+   start_i = Clock_m::now();
+}
+
+/**
+ * Records the phase, if the tracer was started when it began.
+ */
+Tracer::Scope::~Scope()
+{
+   if(0==pLog_i)
+   {
+      return;
+   }
+   const Clock_m::time_point end = Clock_m::now();
+   ThreadLog_m& log = *static_cast<ThreadLog_m*>(pLog_i);
+   Event_m event;
+   event.phase = phase_i;
+   event.start = start_i;
+   event.length = end - start_i;
+   event.cycles = readCounter_m(log.cycleCounter) - cycles_i;
+   event.cacheMisses = readCounter_m(log.cacheCounter) - cacheMisses_i;
+
+   PhaseTotals& totals = log.totals[phase_i];
+   ++totals.calls;
+   totals.seconds += std::chrono::duration<double>(event.length).count();
+   totals.cycles += event.cycles;
+   totals.cacheMisses += event.cacheMisses;
+   if(recordEvents_m && (static_cast<long>(log.events.size())<MAX_EVENTS))
+   {
+      log.events.push_back(event);
+   }
+}
+
+/**
+ * Returns true if the library was built with tracing scopes.
+ */
+bool Tracer::isCompiled()
+{
+#ifdef MAXSUM_TRACE
+   return true;
+#else
+   return false;
+#endif
+}
+
+/**
+ * Discards any previous results, and starts recording.
+ */
+void Tracer::start(bool recordEvents, bool useCounters)
+{
+   std::lock_guard<std::mutex> lock(mutex_m);
+   recordEvents_m = recordEvents;
+   useCounters_m = useCounters;
+   for(std::vector<std::unique_ptr<ThreadLog_m> >::iterator it=logs_m.begin();
+         it!=logs_m.end(); ++it)
+   {
+      std::memset((*it)->totals,0,sizeof((*it)->totals));
+      (*it)->events.clear();
+      closeCounters_m(**it);
+      (*it)->countersFailed = false;
+   }
+   ++generation_m;
+   epoch_m = Clock_m::now();
+   started_m = true;
+}
+
+/**
+ * Stops recording, keeping the results so far.
+ */
+void Tracer::stop()
+{
+   started_m = false;
+}
+
+/**
+ * Returns true if scopes are being recorded.
+ */
+bool Tracer::isStarted()
+{
+   return started_m.load();
+}
+
+/**
+ * Returns true if hardware counters were opened for every thread that has
+ * recorded a scope since Tracer::start.
+ */
+bool Tracer::hasCounters()
+{
+   std::lock_guard<std::mutex> lock(mutex_m);
+   if(!useCounters_m)
+   {
+      return false;
+   }
+   bool opened = false;
+   for(std::vector<std::unique_ptr<ThreadLog_m> >::const_iterator
+         it=logs_m.begin(); it!=logs_m.end(); ++it)
+   {
+      if((*it)->generation!=generation_m.load())
+      {
+         continue;
+      }
+      if((*it)->countersFailed)
+      {
+         return false;
+      }
+      opened = true;
+   }
+   return opened;
+}
+
+/**
+ * Returns the totals recorded for one phase, across all threads.
+ */
+Tracer::PhaseTotals Tracer::totals(Phase phase)
+{
+   PhaseTotals result;
+   std::memset(&result,0,sizeof(result));
+   std::lock_guard<std::mutex> lock(mutex_m);
+   for(std::vector<std::unique_ptr<ThreadLog_m> >::const_iterator
+         it=logs_m.begin(); it!=logs_m.end(); ++it)
+   {
+      const ThreadLog_m& log = **it;
+      if(log.generation!=generation_m.load())
+      {
+         continue;
+      }
+      result.calls += log.totals[phase].calls;
+      result.seconds += log.totals[phase].seconds;
+      result.cycles += log.totals[phase].cycles;
+      result.cacheMisses += log.totals[phase].cacheMisses;
+   }
+   return result;
+}
+
+/**
+ * Returns the name of a phase.
+ */
+const char* Tracer::phaseName(Phase phase)
+{
+   static const char* const NAMES[NO_PHASES] =
+   {
+      "optimise", "factor sum", "marginalise", "variable sum", "normalise",
+      "convergence", "notices"
+   };
+   return (0<=phase && NO_PHASES>phase) ? NAMES[phase] : "unknown";
+}
+
+/**
+ * Returns the number of events recorded.
+ */
+long Tracer::noEvents()
+{
+   long result = 0;
+   std::lock_guard<std::mutex> lock(mutex_m);
+   for(std::vector<std::unique_ptr<ThreadLog_m> >::const_iterator
+         it=logs_m.begin(); it!=logs_m.end(); ++it)
+   {
+      if((*it)->generation==generation_m.load())
+      {
+         result += (*it)->events.size();
+      }
+   }
+   return result;
+}
+
+/**
+ * Writes a table of the totals of every phase.
+ */
+void Tracer::writeSummary(std::ostream& out)
+{
+   out << std::left << std::setw(14) << "phase" << std::right
+      << std::setw(12) << "calls" << std::setw(14) << "seconds"
+      << std::setw(16) << "cycles" << std::setw(14) << "cache misses"
+      << '\n';
+   for(int phase=0; phase<NO_PHASES; ++phase)
+   {
+      const PhaseTotals result = totals(static_cast<Phase>(phase));
+      out << std::left << std::setw(14) << phaseName(static_cast<Phase>(phase))
+         << std::right << std::setw(12) << result.calls
+         << std::setw(14) << result.seconds << std::setw(16) << result.cycles
+         << std::setw(14) << result.cacheMisses << '\n';
+   }
+}
+
+/**
+ * Writes every recorded event in the Chrome trace event format.
+ */
+void Tracer::writeChromeTrace(std::ostream& out)
+{
+   std::lock_guard<std::mutex> lock(mutex_m);
+   const std::ios_base::fmtflags flags = out.flags();
+   out << std::fixed << std::setprecision(3);
+   out << "{\"traceEvents\":[";
+   bool first = true;
+   for(std::vector<std::unique_ptr<ThreadLog_m> >::const_iterator
+         it=logs_m.begin(); it!=logs_m.end(); ++it)
+   {
+      const ThreadLog_m& log = **it;
+      if(log.generation!=generation_m.load())
+      {
+         continue;
+      }
+
+      //************************************************************************
+      // Name each thread's track, and then write its complete events, with
+      // times in microseconds since the tracer was started.
+      //************************************************************************
+      out << (first ? "\n" : ",\n");
+      first = false;
+      out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+         << log.track << ",\"args\":{\"name\":\"thread " << log.track
+         << "\"}}";
+      for(std::vector<Event_m>::const_iterator event=log.events.begin();
+            event!=log.events.end(); ++event)
+      {
+         out << ",\n{\"name\":";
+         writeName_m(out,phaseName(event->phase));
+         out << ",\"cat\":\"maxsum\",\"ph\":\"X\",\"ts\":"
+            << std::chrono::duration<double,std::micro>(
+                  event->start-epoch_m).count()
+            << ",\"dur\":"
+            << std::chrono::duration<double,std::micro>(event->length).count()
+            << ",\"pid\":1,\"tid\":" << log.track;
+         if(useCounters_m && !log.countersFailed)
+         {
+            out << ",\"args\":{\"cycles\":" << event->cycles
+               << ",\"cacheMisses\":" << event->cacheMisses << '}';
+         }
+         out << '}';
+      }
+   }
+   out << "\n],\"displayTimeUnit\":\"ns\"}\n";
+   out.flags(flags);
+}
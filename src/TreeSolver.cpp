@@ -0,0 +1,274 @@
+/**
+ * @file TreeSolver.cpp
+ * Implementation of the exact two-pass solver used by
+ * maxsum::MaxSumController for acyclic components of the factor graph.
+ * <p>
+ * On a tree, max-sum is exact once messages have been passed from the
+ * leaves to a root, and then back from the root to the leaves. Each
+ * acyclic component is therefore ordered by a breadth first search from
+ * one of its variables, and every node is updated once in reverse order
+ * and once in forward order. A node's messages to its children are
+ * wrong after the first pass, but are all recomputed in the second.
+ * </p>
+ * <p>
+ * Values are then decoded from the root downwards. Each factor chooses
+ * the best joint value of its children, given the value already chosen
+ * for its parent, so that the assignment is jointly optimal, even if
+ * several assignments are equally good.
+ * </p>
+ */
+#include <cassert>
+#include <maxsum/MaxSumController.h>
+
+using namespace maxsum;
+
+/**
+ * Finds the acyclic connected components of the compiled factor graph,
+ * and orders the nodes of each by a breadth first search.
+ */
+void MaxSumController::analyseTrees()
+{
+   const int noFactors = graph_i.noFactors();
+   const int noNodes = noFactors + graph_i.noVars();
+   treeNodes_i.clear();
+   treeParents_i.clear();
+   treeStart_i.assign(1,0);
+   treeComponent_i.assign(noNodes,-1);
+   std::vector<char> seen(noNodes,0);
+
+   //***************************************************************************
+   // Search from variables first, so that every component with a variable
+   // is rooted at one. Only factors that depend on no variables are left.
+   //***************************************************************************
+   for(int k=0; k<noNodes; ++k)
+   {
+      const int root = (k<graph_i.noVars()) ? noFactors+k : k-graph_i.noVars();
+      if(0!=seen[root])
+      {
+         continue;
+      }
+
+      const std::size_t begin = treeNodes_i.size();
+      long noEdges = 0;
+      seen[root] = 1;
+      treeNodes_i.push_back(root);
+      treeParents_i.push_back(-1);
+      for(std::size_t pos=begin; pos<treeNodes_i.size(); ++pos)
+      {
+         const int node = treeNodes_i[pos];
+         const int parent = treeParents_i[pos];
+         if(node<noFactors)
+         {
+            //******************************************************************
+            // Each edge is counted once, by its factor.
+            //******************************************************************
+            noEdges += graph_i.factorEdgeEnd(node)
+               - graph_i.factorEdgeBegin(node);
+            for(int e=graph_i.factorEdgeBegin(node);
+                  e<graph_i.factorEdgeEnd(node); ++e)
+            {
+               const int next = noFactors + graph_i.edgeVar(e);
+               if( (e!=parent) && (0==seen[next]) )
+               {
+                  seen[next] = 1;
+                  treeNodes_i.push_back(next);
+                  treeParents_i.push_back(e);
+               }
+            }
+         }
+         else
+         {
+            const int v = node - noFactors;
+            for(int j=graph_i.varEdgeBegin(v); j<graph_i.varEdgeEnd(v); ++j)
+            {
+               const int e = graph_i.varEdge(j);
+               const int next = graph_i.edgeFactor(e);
+               if( (e!=parent) && (0==seen[next]) )
+               {
+                  seen[next] = 1;
+                  treeNodes_i.push_back(next);
+                  treeParents_i.push_back(e);
+               }
+            }
+         }
+      }
+
+      //************************************************************************
+      // A connected component is acyclic if and only if it has one fewer
+      // edge than it has nodes. Otherwise, it is left for the iterative
+      // schedules.
+      //************************************************************************
+      const long size = treeNodes_i.size() - begin;
+      if(noEdges == size-1)
+      {
+         const int component = treeStart_i.size()-1;
+         for(std::size_t pos=begin; pos<treeNodes_i.size(); ++pos)
+         {
+            treeComponent_i[treeNodes_i[pos]] = component;
+         }
+         treeStart_i.push_back(treeNodes_i.size());
+      }
+      else
+      {
+         treeNodes_i.resize(begin);
+         treeParents_i.resize(begin);
+      }
+   }
+
+} // function analyseTrees
+
+/**
+ * Updates the messages sent by a node of a tree.
+ * @param[in] node the index of a factor, or the number of factors plus
+ * the index of a variable.
+ * @param[in,out] ws scratch space for the calling thread.
+ */
+void MaxSumController::updateTreeNode(int node, Workspace& ws)
+{
+   if(node<graph_i.noFactors())
+   {
+      updateFactor(node,ws);
+   }
+   else
+   {
+      updateVariable(node-graph_i.noFactors(),ws);
+   }
+}
+
+/**
+ * Solves every acyclic component that has pending notices exactly, using
+ * two ordered passes, and removes the notices of their nodes.
+ * @returns the number of factor and variable updates performed.
+ */
+long MaxSumController::solveTrees()
+{
+   if(!treesValid_i)
+   {
+      analyseTrees();
+      treesValid_i = true;
+   }
+
+   //***************************************************************************
+   // Solve each tree that has anything to do. Notices sent within a tree
+   // are discarded, since both passes visit every node anyway.
+   //***************************************************************************
+   const int noFactors = graph_i.noFactors();
+   util::NoticeList& factorNotices = graph_i.factorNotices();
+   util::NoticeList& varNotices = graph_i.varNotices();
+   Workspace& ws = workspaces_i[0];
+   long noUpdates = 0;
+   for(std::size_t c=0; c+1<treeStart_i.size(); ++c)
+   {
+      const int begin = treeStart_i[c];
+      const int end = treeStart_i[c+1];
+      bool pending = false;
+      for(int pos=begin; !pending && pos<end; ++pos)
+      {
+         const int node = treeNodes_i[pos];
+         pending = (node<noFactors) ? factorNotices.isPending(node) :
+            varNotices.isPending(node-noFactors);
+      }
+      if(!pending)
+      {
+         continue;
+      }
+
+      for(int pos=end-1; pos>=begin; --pos)
+      {
+         updateTreeNode(treeNodes_i[pos],ws);
+      }
+      for(int pos=begin; pos<end; ++pos)
+      {
+         updateTreeNode(treeNodes_i[pos],ws);
+      }
+      ws.notices.clear();
+      ws.residuals.clear();
+      decodeTree(begin,end,ws);
+      noUpdates += 2*(end-begin);
+   }
+   if(0==noUpdates)
+   {
+      return 0;
+   }
+
+   //***************************************************************************
+   // Keep only the notices for nodes on cycles, in their original order.
+   //***************************************************************************
+   factorNotices.take(jobs_i);
+   for(std::vector<int>::const_iterator it=jobs_i.begin(); it!=jobs_i.end();
+         ++it)
+   {
+      if(0>treeComponent_i[*it])
+      {
+         factorNotices.notify(*it);
+      }
+   }
+   varNotices.take(jobs_i);
+   for(std::vector<int>::const_iterator it=jobs_i.begin(); it!=jobs_i.end();
+         ++it)
+   {
+      if(0>treeComponent_i[noFactors+*it])
+      {
+         varNotices.notify(*it);
+      }
+   }
+   return noUpdates;
+
+} // function solveTrees
+
+/**
+ * Decodes the values of one tree from its root downwards, given exact
+ * messages.
+ * @param[in] begin position of the tree's root in treeNodes_i.
+ * @param[in] end position one past the tree's last node in treeNodes_i.
+ * @param[in,out] ws workspace to which every variable whose value
+ * changes is appended.
+ */
+void MaxSumController::decodeTree(int begin, int end, Workspace& ws)
+{
+   const int noFactors = graph_i.noFactors();
+   for(int pos=begin; pos<end; ++pos)
+   {
+      //************************************************************************
+      // The root variable's value has already been set to maximise its
+      // marginal. For each factor table below it, choose the best value of
+      // its total with the parent's value fixed. The children of implicit
+      // factors keep the values that maximise their marginals.
+      //************************************************************************
+      const int f = treeNodes_i[pos];
+      const int parent = treeParents_i[pos];
+      if( (f>=noFactors) || (0>parent) || (0!=graph_i.implicit(f)) )
+      {
+         continue;
+      }
+
+      const DiscreteFunction& total = graph_i.total(f);
+      const int p = graph_i.edgeVar(parent);
+      const ValIndex stride = graph_i.edgeStride(parent);
+      const ValIndex size = graph_i.varSize(p);
+      const ValIndex value = graph_i.value(p);
+      ValIndex best = -1;
+      for(ValIndex k=0; k<total.domainSize(); ++k)
+      {
+         if( ((k/stride)%size == value) &&
+             ( (0>best) || (total(best)<total(k)) ) )
+         {
+            best = k;
+         }
+      }
+      assert(0<=best);
+
+      for(int e=graph_i.factorEdgeBegin(f); e<graph_i.factorEdgeEnd(f); ++e)
+      {
+         const int v = graph_i.edgeVar(e);
+         const ValIndex newValue =
+            (best/graph_i.edgeStride(e)) % graph_i.varSize(v);
+         if( (e!=parent) && (graph_i.value(v)!=newValue) )
+         {
+            graph_i.value(v) = newValue;
+            ws.changeVar(v);
+         }
+      }
+   }
+
+} // function decodeTree
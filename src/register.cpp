@@ -5,7 +5,9 @@
  * @author Luke Teacy
  */
 
-#include <map>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
 #include <string>
 #include <sstream>
 #include <maxsum/register.h>
@@ -15,12 +17,269 @@
  */
 namespace
 {
+   using maxsum::VarID;
+   using maxsum::ValIndex;
 
    /**
-    * Hash map used to store registered variables are their domain size.
+    * Number of low bits of a maxsum::VarID used to index each leaf of the
+    * dense part of the variable register.
     */
-   std::map<maxsum::VarID,maxsum::ValIndex> varRegister_m;
+   const int LEAF_BITS_M = 10;
 
+   /**
+    * Number of variables in each leaf of the dense part of the register,
+    * chosen so that each leaf fills one page.
+    */
+   const unsigned LEAF_SIZE_M = 1u << LEAF_BITS_M;
+
+   /**
+    * Number of leaves in the dense part of the variable register.
+    */
+   const unsigned NO_LEAVES_M = 1u << 10;
+
+   /**
+    * Variables with ids below this limit are stored in the dense part of
+    * the register, and all others in the sparse part. Since leaves are
+    * only allocated for the dense part, it never uses more than
+    * NO_LEAVES_M leaves, however scattered its ids are.
+    */
+   const VarID DENSE_LIMIT_M = NO_LEAVES_M * LEAF_SIZE_M;
+
+   /**
+    * Initial number of entries in the sparse part of the register.
+    */
+   const std::size_t SPARSE_START_SIZE_M = 1024;
+
+   /**
+    * Block of domain sizes for LEAF_SIZE_M consecutive variables.
+    * A domain size of zero means that the variable is not registered.
+    */
+   struct Leaf_m
+   {
+      std::atomic<ValIndex> size[LEAF_SIZE_M];
+      Leaf_m() { for(unsigned k=0; k<LEAF_SIZE_M; ++k) size[k] = 0; }
+   };
+
+   /**
+    * The dense part of the variable register, which holds a pointer to each
+    * leaf that contains a registered variable. For dense ids starting at
+    * zero, this is effectively a contiguous array of domain sizes,
+    * allocated in blocks of LEAF_SIZE_M variables as they are registered.
+    *
+    * Leaves are only ever added, and are never freed, so readers can search
+    * the register without taking any locks, while other threads
+    * concurrently register new variables. Since this array has static
+    * storage duration, it is zero initialised before any dynamic
+    * initialisation takes place.
+    */
+   std::atomic<Leaf_m*> denseRegister_m[NO_LEAVES_M];
+
+   /**
+    * Entry in the sparse part of the variable register. The domain size
+    * is written before the id is published, and never changes afterwards.
+    * Since every sparse id is at least DENSE_LIMIT_M, an id of zero marks
+    * an empty entry.
+    */
+   struct SparseEntry_m
+   {
+      std::atomic<VarID> var;
+      ValIndex size;
+      SparseEntry_m() : var(0), size(0) {}
+   };
+
+   /**
+    * Open addressing hash table holding the sparse part of the register.
+    * When a table becomes half full, its entries are copied into a new
+    * table of twice the size. The old table is kept, and linked from the
+    * new one, because readers may still be searching it. Together, all
+    * tables therefore use at most twice the memory of the newest one.
+    */
+   struct SparseTable_m
+   {
+      std::size_t mask;
+      std::size_t count;
+      SparseEntry_m* entries;
+      const SparseTable_m* pOld;
+
+      SparseTable_m(std::size_t siz, const SparseTable_m* old)
+         : mask(siz-1), count(0), entries(new SparseEntry_m[siz]),
+           pOld(old) {}
+   };
+
+   /**
+    * The newest table in the sparse part of the register, or NULL if no
+    * sparse variable has been registered. This is zero initialised before
+    * any dynamic initialisation takes place.
+    */
+   std::atomic<SparseTable_m*> sparseRegister_m;
+
+   /**
+    * Mutex held while registering sparse variables. Readers never take it.
+    */
+   std::mutex sparseMutex_m;
+
+   /**
+    * The number of currently registered variables.
+    */
+   std::atomic<int> registerCount_m(0);
+
+   /**
+    * Returns the first entry to probe for a sparse variable.
+    */
+   std::size_t hash_m(VarID var, std::size_t mask)
+   {
+      return (static_cast<std::size_t>(var) * 2654435761u) & mask;
+   }
+
+   /**
+    * Returns the entry for a sparse variable in the specified table, or
+    * the empty entry at which it would be inserted.
+    */
+   SparseEntry_m& probe_m(const SparseTable_m& table, VarID var)
+   {
+      std::size_t k = hash_m(var,table.mask);
+      while(true)
+      {
+         SparseEntry_m& entry = table.entries[k];
+         VarID found = entry.var.load(std::memory_order_acquire);
+         if( (found==var) || (0==found) )
+         {
+            return entry;
+         }
+         k = (k+1) & table.mask;
+      }
+   }
+
+   /**
+    * Returns the domain size of the specified variable, or zero if it is
+    * not registered.
+    */
+   ValIndex findSize_m(VarID var)
+   {
+      if(DENSE_LIMIT_M > var)
+      {
+         Leaf_m* pLeaf = denseRegister_m[var >> LEAF_BITS_M]
+            .load(std::memory_order_acquire);
+         if(0==pLeaf)
+         {
+            return 0;
+         }
+         return pLeaf->size[var & (LEAF_SIZE_M-1)]
+            .load(std::memory_order_acquire);
+      }
+
+      const SparseTable_m* pTable =
+         sparseRegister_m.load(std::memory_order_acquire);
+      if(0==pTable)
+      {
+         return 0;
+      }
+      const SparseEntry_m& entry = probe_m(*pTable,var);
+      if(0==entry.var.load(std::memory_order_acquire))
+      {
+         return 0;
+      }
+      return entry.size;
+   }
+
+   /**
+    * Returns the leaf for the specified dense variable, creating it if
+    * necessary. If another thread creates the same leaf concurrently, then
+    * exactly one of the new leaves is kept, and the other is deleted.
+    */
+   Leaf_m* getOrCreateLeaf_m(VarID var)
+   {
+      std::atomic<Leaf_m*>& slot = denseRegister_m[var >> LEAF_BITS_M];
+      Leaf_m* pLeaf = slot.load(std::memory_order_acquire);
+      if(0!=pLeaf)
+      {
+         return pLeaf;
+      }
+
+      Leaf_m* pNew = new Leaf_m();
+      if(slot.compare_exchange_strong(pLeaf,pNew,std::memory_order_acq_rel,
+               std::memory_order_acquire))
+      {
+         return pNew;
+      }
+      delete pNew;
+      return pLeaf; // updated to the winning leaf by compare_exchange_strong
+   }
+
+   /**
+    * Registers a dense variable, unless it is already registered.
+    * @returns the previous domain size of the variable, or zero if it was
+    * not registered.
+    */
+   ValIndex registerDense_m(VarID var, ValIndex siz)
+   {
+      std::atomic<ValIndex>& entry =
+         getOrCreateLeaf_m(var)->size[var & (LEAF_SIZE_M-1)];
+      ValIndex oldSiz = 0;
+      entry.compare_exchange_strong(oldSiz,siz,std::memory_order_acq_rel,
+            std::memory_order_acquire);
+      return oldSiz;
+   }
+
+   /**
+    * Registers a sparse variable, unless it is already registered.
+    * @returns the previous domain size of the variable, or zero if it was
+    * not registered.
+    */
+   ValIndex registerSparse_m(VarID var, ValIndex siz)
+   {
+      std::lock_guard<std::mutex> lock(sparseMutex_m);
+
+      //************************************************************************
+      // Create the first table if necessary, and return the existing domain
+      // size if the variable is already registered.
+      //************************************************************************
+      SparseTable_m* pTable =
+         sparseRegister_m.load(std::memory_order_relaxed);
+      if(0==pTable)
+      {
+         pTable = new SparseTable_m(SPARSE_START_SIZE_M,0);
+         sparseRegister_m.store(pTable,std::memory_order_release);
+      }
+
+      SparseEntry_m* pEntry = &probe_m(*pTable,var);
+      if(0!=pEntry->var.load(std::memory_order_relaxed))
+      {
+         return pEntry->size;
+      }
+
+      //************************************************************************
+      // If the table would become more than half full, copy its entries into
+      // a new table of twice the size, and publish that instead.
+      //************************************************************************
+      if(pTable->mask+1 < 2*(pTable->count+1))
+      {
+         SparseTable_m* pNew = new SparseTable_m(2*(pTable->mask+1),pTable);
+         for(std::size_t k=0; k<=pTable->mask; ++k)
+         {
+            const SparseEntry_m& old = pTable->entries[k];
+            VarID oldVar = old.var.load(std::memory_order_relaxed);
+            if(0!=oldVar)
+            {
+               SparseEntry_m& copy = probe_m(*pNew,oldVar);
+               copy.size = old.size;
+               copy.var.store(oldVar,std::memory_order_relaxed);
+            }
+         }
+         pNew->count = pTable->count;
+         sparseRegister_m.store(pNew,std::memory_order_release);
+         pTable = pNew;
+         pEntry = &probe_m(*pTable,var);
+      }
+
+      //************************************************************************
+      // Write the domain size before publishing the variable's id.
+      //************************************************************************
+      pEntry->size = siz;
+      pEntry->var.store(var,std::memory_order_release);
+      ++(pTable->count);
+      return 0;
+   }
 
 } // private namespace
 
@@ -30,7 +289,7 @@ namespace
  */
 bool maxsum::isRegistered(VarID var)
 {
-   return varRegister_m.end() != varRegister_m.find(var);
+   return 0!=findSize_m(var);
 }
 
 /**
@@ -46,20 +305,19 @@ maxsum::ValIndex maxsum::getDomainSize(VarID var)
    //***************************************************************************
    // Lookup var in the variable register
    //***************************************************************************
-   typedef std::map<VarID,ValIndex>::const_iterator It;
-   It loc = varRegister_m.find(var);
+   ValIndex siz = findSize_m(var);
 
    //***************************************************************************
    // If found, return its size.
    //***************************************************************************
-   if(varRegister_m.end()!=loc)
+   if(0!=siz)
    {
-      return loc->second;
+      return siz;
    }
 
    //***************************************************************************
-   // Otherwise, if this variable is not found, return -1 to indicate that
-   // the variable is not yet registered.
+   // Otherwise, if this variable is not found, throw an exception to
+   // indicate that the variable is not yet registered.
    //***************************************************************************
    std::stringstream msg;
    msg << "Attempt to get domain size for unregistered variable: " <<  var;
@@ -73,7 +331,7 @@ maxsum::ValIndex maxsum::getDomainSize(VarID var)
  */
 int maxsum::getNumOfRegisteredVariables()
 {
-   return varRegister_m.size();
+   return registerCount_m.load(std::memory_order_acquire);
 }
 
 /**
@@ -108,34 +366,31 @@ void maxsum::registerVariable(VarID var, ValIndex siz)
    }
    
    //***************************************************************************
-   // Lookup var in the variable register
+   // Try to claim the register entry for var. This only succeeds if the
+   // variable is not already registered.
    //***************************************************************************
-   typedef std::map<VarID,ValIndex>::const_iterator It;
-   It loc = varRegister_m.find(var);
+   ValIndex oldSiz = DENSE_LIMIT_M > var ? registerDense_m(var,siz)
+      : registerSparse_m(var,siz);
+   if(0==oldSiz)
+   {
+      registerCount_m.fetch_add(1,std::memory_order_acq_rel);
+      return;
+   }
 
    //***************************************************************************
-   // If found, check that its size is consistent. Otherwise throw an
-   // exception.
+   // Otherwise, the variable is already registered, so check that its size
+   // is consistent. If not, throw an exception.
    //***************************************************************************
-   if(varRegister_m.end()!=loc)
+   if(oldSiz != siz)
    {
-      if(loc->second != siz)
-      {
-         std::stringstream msg;
+      std::stringstream msg;
 
-         msg << "Tried to register variable " << var << " again with "
-             << "inconsistent domain size.";
+      msg << "Tried to register variable " << var << " again with "
+          << "inconsistent domain size.";
 
-         throw InconsistentDomainException(functionName,msg.str());
-      }
+      throw InconsistentDomainException(functionName,msg.str());
    }
 
-   //***************************************************************************
-   // Otherwise, if this variable is not found, return -1 to indicate that
-   // the variable is not yet registered.
-   //***************************************************************************
-   varRegister_m[var] = siz;
-
 } // function registerVariable
 
 
@@ -10,6 +10,7 @@
 #include <vector>
 #include <iostream>
 #include <maxsum/DiscreteFunction.h>
+#include <maxsum/FixedArityKernel.h>
 
 using namespace maxsum;
 
@@ -30,6 +31,58 @@ inline bool nearlyEqual_m
    return relOK | absOK;
 }
 
+/**
+ * Reference implementation of maxsum::marginal() which conditions a new
+ * maxsum::DomainIterator for every output value. This is used to check that
+ * stride based marginalisation produces exactly the same results.
+ */
+template<typename F> void referenceMarginal_m
+(
+ const DiscreteFunction& inFun,
+ F aggregate,
+ DiscreteFunction& outFun
+)
+{
+   for(DomainIterator outIt(outFun); outIt.hasNext(); ++outIt)
+   {
+      DomainIterator inIt(inFun);
+      inIt.condition(outIt);
+      ValType result = inFun(inIt.getInd());
+      ++inIt;
+      while(inIt.hasNext())
+      {
+         result = aggregate(result,inFun(inIt.getInd()));
+         ++inIt;
+      }
+      outFun(outIt.getInd()) = result;
+   }
+}
+
+/**
+ * Utility function used as summation aggregate by referenceMarginal_m.
+ */
+inline ValType add_m(ValType x, ValType y)
+{
+   return x+y;
+}
+
+/**
+ * Returns the number of values that differ (bit for bit) between two
+ * functions with the same domain.
+ */
+int countDifferences_m(const DiscreteFunction& f1, const DiscreteFunction& f2)
+{
+   int count = 0;
+   for(int k=0; k<f1.domainSize(); ++k)
+   {
+      if(f1(k)!=f2(k))
+      {
+         ++count;
+      }
+   }
+   return count;
+}
+
 int testMarginals(const DiscreteFunction inFun, DiscreteFunction outFun)
 {
    int errorCount = 0;
@@ -268,6 +321,59 @@ int testMarginals(const DiscreteFunction inFun, DiscreteFunction outFun)
 
 } // testMarginals
 
+/**
+ * Checks that maxsum::maxMarginal(), maxsum::minMarginal() and
+ * maxsum::meanMarginal() produce exactly the same values as the reference
+ * implementation for non-integer function values, where the order of
+ * aggregation matters.
+ */
+int testExactMarginals(const DiscreteFunction& inFun, DiscreteFunction outFun)
+{
+   if(!std::includes(inFun.varBegin(),inFun.varEnd(),
+            outFun.varBegin(),outFun.varEnd()))
+   {
+      return 0;
+   }
+
+   int errorCount = 0;
+   const ValType& (*pMax)(const ValType&, const ValType&) = std::max<ValType>;
+   const ValType& (*pMin)(const ValType&, const ValType&) = std::min<ValType>;
+
+   DiscreteFunction result(outFun), expected(outFun);
+   maxMarginal(inFun,result);
+   referenceMarginal_m(inFun,pMax,expected);
+   if(0!=countDifferences_m(result,expected))
+   {
+      std::cout << "maxMarginal differs from reference implementation\n";
+      ++errorCount;
+   }
+
+   minMarginal(inFun,result);
+   referenceMarginal_m(inFun,pMin,expected);
+   if(0!=countDifferences_m(result,expected))
+   {
+      std::cout << "minMarginal differs from reference implementation\n";
+      ++errorCount;
+   }
+
+   meanMarginal(inFun,result);
+   referenceMarginal_m(inFun,add_m,expected);
+   ValType w = outFun.domainSize();
+   w = w / inFun.domainSize();
+   for(int k=0; k<expected.domainSize(); ++k)
+   {
+      expected(k) *= w;
+   }
+   if(0!=countDifferences_m(result,expected))
+   {
+      std::cout << "meanMarginal differs from reference implementation\n";
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // testExactMarginals
+
 int testMath()
 {
    //***************************************************************************
@@ -325,11 +431,85 @@ int testMath()
          errorCount += testMarginals(f1,f2);
       }
    }
+
+   //***************************************************************************
+   // Check that results are exactly the same as the reference implementation
+   // for fractional values, for which summation order matters.
+   //***************************************************************************
+   std::cout << "Checking exact agreement with reference implementation...";
+   int exactErrors = 0;
+   for(int k=0; k<funcs.size(); k++)
+   {
+      DiscreteFunction inFun(funcs[k]);
+      for(int i=0; i<inFun.domainSize(); ++i)
+      {
+         inFun(i) = static_cast<ValType>(rand()) / RAND_MAX - 0.5;
+      }
+      for(int j=0; j<funcs.size(); j++)
+      {
+         exactErrors += testExactMarginals(inFun,funcs[j]);
+      }
+   }
+   if(0==exactErrors)
+   {
+      std::cout << "OK\n";
+   }
+   errorCount += exactErrors;
    std::cout << "Number of failures: " << errorCount << std::endl;
    return errorCount;
 
 } // testMath
 
+/**
+ * Checks that util::FixedArityKernel gives exactly the same sums and max
+ * marginals as adding each message to a factor, and calling maxMarginal.
+ * @tparam Arity the number of variables in the test factor.
+ * @param[in] vars the variables in the test factor's domain.
+ * @returns the number of errors found.
+ */
+template<int Arity> int testFixedArity_m(const VarID* vars)
+{
+   DiscreteFunction factor(vars,vars+Arity);
+   for(int k=0; k<factor.domainSize(); ++k)
+   {
+      factor(k) = static_cast<ValType>(rand() % 1000 - 500) / 7;
+   }
+
+   std::vector<DiscreteFunction> msgs, out;
+   DiscreteFunction expected(factor);
+   const ValType* ppMsgs[Arity];
+   ValType* ppOut[Arity];
+   for(int m=0; m<Arity; ++m)
+   {
+      msgs.push_back(DiscreteFunction(vars[m],0.0));
+      out.push_back(msgs.back());
+      for(int j=0; j<msgs[m].domainSize(); ++j)
+      {
+         msgs[m](j) = static_cast<ValType>(rand() % 1000 - 500) / 3;
+      }
+      expected += msgs[m];
+   }
+   for(int m=0; m<Arity; ++m)
+   {
+      ppMsgs[m] = &msgs[m](0);
+      ppOut[m] = &out[m](0);
+   }
+
+   DiscreteFunction total(factor);
+   util::FixedArityKernel<Arity>::maxMarginals(&factor(0),
+         factor.domain().sizes().data(),ppMsgs,&total(0),ppOut);
+
+   int errorCount = countDifferences_m(total,expected);
+   for(int m=0; m<Arity; ++m)
+   {
+      DiscreteFunction marginal(vars[m],0.0);
+      maxMarginal(expected,marginal);
+      errorCount += countDifferences_m(out[m],marginal);
+   }
+   return errorCount;
+
+} // testFixedArity_m
+
 int main()
 {
    try
@@ -352,6 +532,17 @@ int main()
       {
          return EXIT_FAILURE;
       }
+
+      std::cout << "Testing fixed arity kernels...";
+      VarID fixedVars[] = {1,2,102};
+      int fixedErrors = testFixedArity_m<1>(fixedVars) +
+         testFixedArity_m<2>(fixedVars) + testFixedArity_m<3>(fixedVars);
+      if(0!=fixedErrors)
+      {
+         std::cout << fixedErrors << " differences FAILED\n";
+         return EXIT_FAILURE;
+      }
+      std::cout << "OK\n";
    }
    catch(std::exception& e)
    {
@@ -0,0 +1,296 @@
+/**
+ * @file allocHarness.cpp
+ * Test harness that checks that MaxSumController::optimise does not
+ * allocate heap memory once its factor graph has been compiled.
+ * All calls to the global operator new are counted by replacing it for
+ * this executable only, so the library itself is unaffected.
+ */
+#include "maxsum/common.h"
+#include "maxsum/MaxSumController.h"
+#include <atomic>
+#include <cstdlib>
+#include <future>
+#include <iostream>
+#include <new>
+#include <set>
+
+using namespace maxsum;
+
+namespace
+{
+   /**
+    * Number of calls to the global operator new made by this process.
+    */
+   std::atomic<long> allocCount_m(0);
+
+   /**
+    * Allocates memory and counts the allocation.
+    */
+   void* countedAlloc_m(std::size_t size)
+   {
+      ++allocCount_m;
+      void* result = std::malloc(0==size ? 1 : size);
+      if(0==result)
+      {
+         throw std::bad_alloc();
+      }
+      return result;
+   }
+
+} // module namespace
+
+void* operator new(std::size_t size) { return countedAlloc_m(size); }
+void* operator new[](std::size_t size) { return countedAlloc_m(size); }
+void operator delete(void* p) throw() { std::free(p); }
+void operator delete[](void* p) throw() { std::free(p); }
+
+void* operator new(std::size_t size, const std::nothrow_t&) throw()
+{
+   ++allocCount_m;
+   return std::malloc(0==size ? 1 : size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) throw()
+{
+   ++allocCount_m;
+   return std::malloc(0==size ? 1 : size);
+}
+
+void operator delete(void* p, const std::nothrow_t&) throw() { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) throw() { std::free(p); }
+
+namespace
+{
+   /**
+    * Number of colours used by the graph colouring problems in this harness.
+    */
+   const ValIndex NO_COLOURS_M = 3;
+
+   /**
+    * Number of variables in each test graph. Since the graph is fully
+    * connected, and there are more variables than colours, max-sum will
+    * not converge, and so runs for the maximum number of iterations.
+    */
+   const int NO_VARS_M = 5;
+
+   /**
+    * Maximum number of iterations performed by each call to optimise.
+    */
+   const int MAX_ITERATIONS_M = 50;
+
+   /**
+    * Sets up a non-colourable graph colouring problem with one factor for
+    * each pair of variables, each with a small random bias.
+    */
+   void genGraph_m(MaxSumController& controller)
+   {
+      FactorID id = 1;
+      for(VarID v1=1; v1<=NO_VARS_M; ++v1)
+      {
+         registerVariable(v1,NO_COLOURS_M);
+         for(VarID v2=1; v2<v1; ++v2)
+         {
+            VarID vars[] = {v2,v1};
+            DiscreteFunction factor(vars,vars+2);
+            for(DomainIterator it(factor); it.hasNext(); ++it)
+            {
+               std::set<ValIndex> unique(it.getSubInd().begin(),
+                     it.getSubInd().end());
+               ValType util = static_cast<ValType>(std::rand()) /
+                  (1000.0 * RAND_MAX);
+               factor(it) = util - (2 - static_cast<ValType>(unique.size()));
+            }
+            controller.setFactor(id++,factor);
+         }
+      }
+   }
+
+   /**
+    * Checks that optimise performs a full set of iterations without
+    * allocating any memory, once the controller has been warmed up.
+    * @param[in] noThreads the number of threads used to update messages.
+    * @param[in] schedule the order in which messages are updated.
+    * @returns the number of errors found.
+    */
+   int testSteadyState_m(int noThreads, MaxSumController::Schedule schedule)
+   {
+      MaxSumController controller(MAX_ITERATIONS_M,0);
+      controller.setNumThreads(noThreads);
+      controller.setSchedule(schedule);
+      genGraph_m(controller);
+
+      //************************************************************************
+      // Compiling the graph reserves the workspaces. The first call may
+      // still allocate memory, for example to publish snapshots during an
+      // asynchronous run, which should not leave them enabled.
+      //************************************************************************
+      controller.compile();
+      const std::size_t reserved = controller.memoryUsage().workspaceBytes;
+      controller.optimise();
+      controller.optimiseAsync().get();
+      if(controller.isSnapshots())
+      {
+         std::cout << "Snapshots left enabled by optimiseAsync.\n";
+         return 1;
+      }
+
+      //************************************************************************
+      // Subsequent calls should not allocate, whether or not the factors
+      // have been updated in place.
+      //************************************************************************
+      const long before = allocCount_m;
+      int iterations = controller.optimise();
+      controller.notifyFactor(1);
+      iterations += controller.optimise();
+      const long noAllocs = allocCount_m - before;
+
+      if(2*MAX_ITERATIONS_M != iterations)
+      {
+         std::cout << "Expected " << 2*MAX_ITERATIONS_M << " iterations but "
+            << "got " << iterations << ".\n";
+         return 1;
+      }
+
+      if(0!=noAllocs)
+      {
+         std::cout << noAllocs << " allocations in " << iterations
+            << " iterations.\n";
+         return 1;
+      }
+
+      //************************************************************************
+      // The warm up calls should not have needed more workspace than was
+      // reserved when the graph was compiled.
+      //************************************************************************
+      const std::size_t used = controller.memoryUsage().workspaceBytes;
+      if(used!=reserved)
+      {
+         std::cout << "Workspaces grew from " << reserved << " to " << used
+            << " bytes.\n";
+         return 1;
+      }
+      return 0;
+
+   } // testSteadyState_m
+
+   /**
+    * Checks that recompiling a factor graph whose size has not changed
+    * reuses the storage of the previous graph, and that clearing the
+    * controller releases it.
+    * @returns the number of errors found.
+    */
+   int testRecompile_m()
+   {
+      MaxSumController controller(MAX_ITERATIONS_M,0);
+      genGraph_m(controller);
+      controller.optimise();
+      const DiscreteFunction factor = controller.getFactor(1);
+
+      //************************************************************************
+      // Replacing a factor forces the graph to be recompiled. The first
+      // time, the spare graph is empty, so its arrays must be allocated.
+      //************************************************************************
+      long noAllocs[2];
+      for(int k=0; k<2; ++k)
+      {
+         controller.removeFactor(1);
+         controller.setFactor(1,factor);
+         const long before = allocCount_m;
+         controller.optimise();
+         noAllocs[k] = allocCount_m - before;
+      }
+      if(noAllocs[1] >= noAllocs[0])
+      {
+         std::cout << noAllocs[1] << " allocations recompiling with a spare "
+            << "graph, but " << noAllocs[0] << " without.\n";
+         return 1;
+      }
+
+      //************************************************************************
+      // The memory reported should cover at least the factor tables and
+      // both sets of messages, and should be released by clear.
+      //************************************************************************
+      MaxSumController::MemoryUsage usage = controller.memoryUsage();
+      const std::size_t noFactors = NO_VARS_M*(NO_VARS_M-1)/2;
+      const std::size_t tableBytes =
+         noFactors*NO_COLOURS_M*NO_COLOURS_M*sizeof(ValType);
+      if( (usage.factorBytes!=tableBytes) || (usage.totalBytes!=tableBytes) ||
+          (usage.graphBytes<4*noFactors*NO_COLOURS_M*sizeof(ValType)) ||
+          (0==usage.spareBytes) || (usage.total()<=2*tableBytes) )
+      {
+         std::cout << "Unexpected memory usage: " << usage.total() << ".\n";
+         return 1;
+      }
+      controller.clear();
+      usage = controller.memoryUsage();
+      if( (0!=usage.factorBytes) || (0!=usage.totalBytes) ||
+          (usage.graphBytes>64) || (usage.spareBytes>64) )
+      {
+         std::cout << "Memory not released by clear: " << usage.total()
+            << ".\n";
+         return 1;
+      }
+      return 0;
+
+   } // testRecompile_m
+
+} // module namespace
+
+/**
+ * Main function runs all tests in this harness.
+ */
+int main()
+{
+   int errorCount = 0;
+   try
+   {
+      const int threads[] = {1,2};
+      for(int k=0; k<2; ++k)
+      {
+         std::cout << "Testing steady state allocations with " << threads[k]
+            << " thread(s)...";
+         int errors = testSteadyState_m(threads[k],
+               MaxSumController::FLOODING);
+         std::cout << (0==errors ? "OK\n" : "FAILED\n");
+         errorCount += errors;
+      }
+
+      //************************************************************************
+      // Sequential schedules finish an iteration only after every node has
+      // been updated once on average, so each variable may change value
+      // several times in one iteration.
+      //************************************************************************
+      const MaxSumController::Schedule schedules[] =
+         {MaxSumController::RESIDUAL, MaxSumController::ROUND_ROBIN};
+      const char* const names[] = {"residual", "round robin"};
+      for(int k=0; k<2; ++k)
+      {
+         std::cout << "Testing steady state allocations with " << names[k]
+            << " schedule...";
+         int errors = testSteadyState_m(1,schedules[k]);
+         std::cout << (0==errors ? "OK\n" : "FAILED\n");
+         errorCount += errors;
+      }
+
+      std::cout << "Testing recompilation and memory usage...";
+      int errors = testRecompile_m();
+      std::cout << (0==errors ? "OK\n" : "FAILED\n");
+      errorCount += errors;
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what() << std::endl;
+      ++errorCount;
+   }
+
+   //***************************************************************************
+   // Return success if all tests in this harness have passed.
+   //***************************************************************************
+   std::cout << "NUMBER OF ERRORS: " << errorCount << std::endl;
+   if(0==errorCount)
+   {
+      return EXIT_SUCCESS;
+   }
+   return EXIT_FAILURE;
+
+} // function main
@@ -0,0 +1,286 @@
+/**
+ * @file batchHarness.cpp
+ * Test harness for the maxsum::BatchSolver class.
+ */
+#include "maxsum/BatchSolver.h"
+#include "maxsum/exceptions.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+using namespace maxsum;
+
+/**
+ * Private Module Namespace.
+ */
+namespace
+{
+   /**
+    * Number of variables in each test problem.
+    */
+   const int NO_VARS_M = 8;
+
+   /**
+    * Number of test problems, which does not fill the last block.
+    */
+   const int NO_PROBLEMS_M = 2*BatchSolver::BLOCK_SIZE + 22;
+
+   /**
+    * Returns a pseudo-random value in [-1,1).
+    */
+   ValType random_m()
+   {
+      return static_cast<ValType>(std::rand()%2000)/1000 - 1;
+   }
+
+   /**
+    * Gives a batch the structure of a random tree, with one unary factor
+    * for each variable, and one pairwise factor between each variable and
+    * its parent.
+    * @param[in,out] batch the batch to build.
+    * @param[out] parents the parent of each variable, or -1 for the root.
+    */
+   void buildTree_m(BatchSolver& batch, std::vector<int>& parents)
+   {
+      parents.assign(NO_VARS_M,-1);
+      for(int v=0; v<NO_VARS_M; ++v)
+      {
+         batch.addVariable(2+v%3);
+         batch.addFactor(std::vector<int>(1,v));
+         if(0<v)
+         {
+            parents[v] = std::rand()%v;
+            std::vector<int> vars;
+            vars.push_back(parents[v]);
+            vars.push_back(v);
+            batch.addFactor(vars);
+         }
+      }
+   }
+
+   /**
+    * Returns the total value of the factors of one problem, given the value
+    * of each variable.
+    */
+   ValType utility_m
+   (
+    const std::vector<int>& parents,
+    const std::vector<ValType>& tables,
+    const std::vector<ValIndex>& sizes,
+    const std::vector<ValIndex>& values
+   )
+   {
+      //************************************************************************
+      // Each unary factor is followed by the pairwise factor joining the same
+      // variable to its parent.
+      //************************************************************************
+      ValType total = 0;
+      int offset = 0;
+      for(int v=0; v<NO_VARS_M; ++v)
+      {
+         total += tables[offset+values[v]];
+         offset += sizes[v];
+         if(0<v)
+         {
+            const int parent = parents[v];
+            total += tables[offset+values[parent]+sizes[parent]*values[v]];
+            offset += sizes[parent]*sizes[v];
+         }
+      }
+      return total;
+   }
+
+   /**
+    * Returns the best utility of one problem, found by brute force.
+    */
+   ValType bruteForce_m
+   (
+    const std::vector<int>& parents,
+    const std::vector<ValType>& tables,
+    const std::vector<ValIndex>& sizes
+   )
+   {
+      std::vector<ValIndex> values(NO_VARS_M,0);
+      ValType best = utility_m(parents,tables,sizes,values);
+      while(true)
+      {
+         int v = 0;
+         while( (v<NO_VARS_M) && (++values[v]==sizes[v]) )
+         {
+            values[v++] = 0;
+         }
+         if(NO_VARS_M==v)
+         {
+            return best;
+         }
+         best = std::max(best,utility_m(parents,tables,sizes,values));
+      }
+   }
+
+   /**
+    * Checks that a batch solver finds the optimal assignment of every
+    * problem, when each is a tree.
+    * @param[in] noThreads the number of threads used by the solver.
+    * @returns the number of errors found.
+    */
+   int testTrees_m(int noThreads)
+   {
+      std::srand(23);
+      BatchSolver batch;
+      batch.setNumThreads(noThreads);
+      std::vector<int> parents;
+      buildTree_m(batch,parents);
+      batch.setNoProblems(NO_PROBLEMS_M);
+      std::vector<ValIndex> sizes;
+      for(int v=0; v<NO_VARS_M; ++v)
+      {
+         sizes.push_back(2+v%3);
+      }
+
+      //************************************************************************
+      // Give every problem different random values, keeping a copy of each
+      // problem's tables in order of factor.
+      //************************************************************************
+      std::vector<std::vector<ValType> > tables(NO_PROBLEMS_M);
+      for(int p=0; p<NO_PROBLEMS_M; ++p)
+      {
+         for(int f=0; f<batch.noFactors(); ++f)
+         {
+            std::vector<ValType> table(batch.tableSize(f));
+            for(std::size_t k=0; k<table.size(); ++k)
+            {
+               table[k] = random_m();
+            }
+            batch.setFactor(p,f,table.data());
+            tables[p].insert(tables[p].end(),table.begin(),table.end());
+         }
+      }
+
+      const int iterations = batch.solve();
+      int errors = 0;
+      if( (0>=iterations) || (MaxSumController::DEFAULT_MAX_ITERATIONS
+               <= iterations) )
+      {
+         std::cout << "Batch did not converge: " << iterations << '\n';
+         ++errors;
+      }
+
+      std::vector<ValIndex> values;
+      for(int p=0; p<NO_PROBLEMS_M; ++p)
+      {
+         batch.getValues(p,values);
+         const ValType utility = utility_m(parents,tables[p],sizes,values);
+         const ValType best = bruteForce_m(parents,tables[p],sizes);
+         if(0.0001 < std::fabs(utility-best))
+         {
+            std::cout << "Problem " << p << " has utility " << utility
+               << " instead of " << best << '\n';
+            ++errors;
+         }
+         if(batch.getValue(p,NO_VARS_M-1)!=values[NO_VARS_M-1])
+         {
+            std::cout << "Values of problem " << p << " disagree.\n";
+            ++errors;
+         }
+      }
+      return errors;
+   }
+
+   /**
+    * Checks that invalid structures and indices are rejected.
+    * @returns the number of errors found.
+    */
+   int testErrors_m()
+   {
+      int errors = 0;
+      BatchSolver batch;
+      const int v = batch.addVariable(3);
+      try
+      {
+         batch.addVariable(0);
+         std::cout << "Empty domain should be rejected.\n";
+         ++errors;
+      }
+      catch(BadDomainException&) {}
+      try
+      {
+         batch.addFactor(std::vector<int>(2,v));
+         std::cout << "Repeated variable should be rejected.\n";
+         ++errors;
+      }
+      catch(BadDomainException&) {}
+      try
+      {
+         batch.addFactor(std::vector<int>(1,v+1));
+         std::cout << "Unknown variable should be rejected.\n";
+         ++errors;
+      }
+      catch(OutOfRangeException&) {}
+
+      batch.addFactor(std::vector<int>(1,v));
+      batch.setNoProblems(1);
+      try
+      {
+         const ValType values[] = {0,1,2};
+         batch.setFactor(1,0,values);
+         std::cout << "Unknown problem should be rejected.\n";
+         ++errors;
+      }
+      catch(OutOfRangeException&) {}
+
+      //************************************************************************
+      // Changing the structure discards every problem.
+      //************************************************************************
+      batch.addVariable(2);
+      if(0!=batch.noProblems())
+      {
+         std::cout << "Problems should be discarded.\n";
+         ++errors;
+      }
+      return errors;
+   }
+
+} // module namespace
+
+/**
+ * Runs the batch solver tests.
+ */
+int main()
+{
+   int errorCount = 0;
+   try
+   {
+      std::cout << "Testing batch solver...";
+      int errors = testTrees_m(1);
+      std::cout << (0==errors ? "OK\n" : "FAILED\n");
+      errorCount += errors;
+
+      std::cout << "Testing threaded batch solver...";
+      errors = testTrees_m(3);
+      std::cout << (0==errors ? "OK\n" : "FAILED\n");
+      errorCount += errors;
+
+      std::cout << "Testing batch solver errors...";
+      errors = testErrors_m();
+      std::cout << (0==errors ? "OK\n" : "FAILED\n");
+      errorCount += errors;
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what() << std::endl;
+      ++errorCount;
+   }
+
+   //***************************************************************************
+   // Return success if all tests in this harness have passed.
+   //***************************************************************************
+   std::cout << "NUMBER OF ERRORS: " << errorCount << std::endl;
+   if(0==errorCount)
+   {
+      return EXIT_SUCCESS;
+   }
+   return EXIT_FAILURE;
+
+} // function main
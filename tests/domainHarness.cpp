@@ -260,6 +260,23 @@ int testDomain(std::vector<VarID> vars)
 
    exitStatus += testIterator(vars,condVars,condVals,it);
 
+   //***************************************************************************
+   // Repeat with an iterator conditioned on the same variables with
+   // different values, and then moved to the test values by rebinding.
+   //***************************************************************************
+   std::cout << "Trying rebind with " << condVars.size()
+      << " condition variables.\n";
+   std::vector<ValIndex> zeros(condVars.size(),0);
+   DomainIterator rebound(vars.begin(),vars.end());
+   rebound.condition(condVars.begin(),condVars.end(),
+                     zeros.begin(),zeros.end());
+   for(int k=0; rebound.hasNext() && (k<3); ++k)
+   {
+      ++rebound;
+   }
+   rebound.rebind(condVals.begin(),condVals.end());
+   exitStatus += testIterator(vars,condVars,condVals,rebound);
+
    //***************************************************************************
    // Repeat with iterator created from overlapping variable subsets
    //***************************************************************************
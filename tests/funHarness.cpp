@@ -1,6 +1,9 @@
 
+#include <atomic>
 #include <vector>
 #include <iostream>
+#include <thread>
+#include <utility>
 #include "maxsum/DiscreteFunction.h"
 
 int comparisionTestOne()
@@ -215,6 +218,259 @@ int comparisionTestTwo()
 
 } // comparision test 2
 
+/**
+ * Tests that moving functions transfers their storage rather than
+ * copying it, and that arithmetic on temporaries is computed in place.
+ */
+int moveTest()
+{
+   using namespace maxsum;
+
+   int exitValue = 0;
+   std::cout << "Testing move operations...";
+
+   VarID xDomain[] = {1,2};
+   DiscreteFunction x(xDomain,xDomain+2,3), y(xDomain,xDomain+2,2);
+   const DiscreteFunction expected = x + y;
+
+   //***************************************************************************
+   // Moving should keep the same value array, and leave the result equal
+   // to the original.
+   //***************************************************************************
+   const ValType* pValues = &x(0);
+   DiscreteFunction moved(std::move(x));
+   if( (&moved(0)!=pValues) || (moved.noVars()!=2) )
+   {
+      std::cout << "\nMove construction copied values.";
+      exitValue = 1;
+   }
+
+   DiscreteFunction assigned;
+   assigned = std::move(moved);
+   if(&assigned(0)!=pValues)
+   {
+      std::cout << "\nMove assignment copied values.";
+      exitValue = 1;
+   }
+
+   //***************************************************************************
+   // Arithmetic on a temporary should reuse its storage, while arithmetic
+   // on a named function should leave it unchanged.
+   //***************************************************************************
+   DiscreteFunction sum = std::move(assigned) + y;
+   if( (&sum(0)!=pValues) || (sum!=expected) )
+   {
+      std::cout << "\nAddition to temporary was not done in place.";
+      exitValue = 1;
+   }
+
+   DiscreteFunction diff = sum - y;
+   if( (&sum(0)==&diff(0)) || (sum!=expected) || (diff!=3) )
+   {
+      std::cout << "\nSubtraction from named function modified it.";
+      exitValue = 1;
+   }
+
+   if(0==exitValue)
+   {
+      std::cout << "OK" << std::endl;
+   }
+   std::cout << std::endl;
+   return exitValue;
+
+} // moveTest
+
+/**
+ * Tests that functions with the same domain share a single interned
+ * domain descriptor, regardless of how that domain was specified.
+ */
+int domainTest()
+{
+   using namespace maxsum;
+
+   int exitValue = 0;
+   std::cout << "Testing shared domains...";
+
+   VarID sorted[] = {1,2};
+   VarID unsorted[] = {2,1,2};
+   DiscreteFunction x(sorted,sorted+2,1), y(unsorted,unsorted+3,2);
+   if( (&x.domain()!=&y.domain()) || (2!=y.noVars()) || !sameDomain(x,y) )
+   {
+      std::cout << "\nEqual domains are not shared.";
+      exitValue = 1;
+   }
+
+   //***************************************************************************
+   // Expanding a single variable function should find the same domain,
+   // while different domains should never compare equal.
+   //***************************************************************************
+   DiscreteFunction z(1,0.0);
+   if(sameDomain(x,z) || sameDomain(z,DiscreteFunction(2,0.0)))
+   {
+      std::cout << "\nDifferent domains compare equal.";
+      exitValue = 1;
+   }
+   z.expand(2);
+   if(&z.domain()!=&x.domain())
+   {
+      std::cout << "\nExpanded domain is not shared.";
+      exitValue = 1;
+   }
+
+   //***************************************************************************
+   // The shared domain should cache each variable's size and stride.
+   //***************************************************************************
+   const util::Domain& domain = x.domain();
+   if( (domain.totalSize()!=x.domainSize()) ||
+       (1!=domain.strides()[0]) ||
+       (getDomainSize(1)!=domain.strides()[1]) ||
+       (getDomainSize(2)!=domain.sizes()[1]) )
+   {
+      std::cout << "\nDomain strides are wrong.";
+      exitValue = 1;
+   }
+
+   DiscreteFunction scalar(5);
+   scalar = x;
+   scalar = 3;
+   if(&scalar.domain()!=util::Domain::empty())
+   {
+      std::cout << "\nScalars do not share the empty domain.";
+      exitValue = 1;
+   }
+
+   if(0==exitValue)
+   {
+      std::cout << "OK" << std::endl;
+   }
+   std::cout << std::endl;
+   return exitValue;
+
+} // domainTest
+
+/**
+ * Repeatedly creates and destroys functions over pairs of variables,
+ * checking that each pair shares the domain of a function that stays alive.
+ * @param[in] anchors one live function for each pair of variables.
+ * @param[in] seed offset of the first pair used by this thread.
+ * @param[out] errors incremented for each function with the wrong domain.
+ */
+void internRepeatedly_m
+(
+ const std::vector<maxsum::DiscreteFunction>* anchors,
+ int seed,
+ std::atomic<int>* errors
+)
+{
+   using namespace maxsum;
+   for(int k=0; k<2000; ++k)
+   {
+      const int pair = (seed + 7*k) % static_cast<int>(anchors->size());
+      VarID vars[] = {static_cast<VarID>(501+pair), 500};
+      DiscreteFunction fun(vars,vars+2);
+      if(!sameDomain(fun,(*anchors)[pair]))
+      {
+         ++(*errors);
+      }
+
+      //************************************************************************
+      // Domains that are not held by any anchor are created and reclaimed
+      // concurrently by every thread.
+      //************************************************************************
+      VarID other[] = {500, static_cast<VarID>(600+(seed+k)%20)};
+      DiscreteFunction temp(other,other+2), copy(temp);
+      if(!sameDomain(temp,copy) || (2!=copy.noVars()))
+      {
+         ++(*errors);
+      }
+   }
+}
+
+/**
+ * Tests that domains are reclaimed once no function refers to them, and
+ * that interning is consistent when many threads intern the same domains.
+ */
+int reclaimTest()
+{
+   using namespace maxsum;
+
+   int exitValue = 0;
+   std::cout << "Testing domain reclamation...";
+   for(VarID var=500; var<700; ++var)
+   {
+      registerVariable(var,2);
+   }
+
+   //***************************************************************************
+   // Each new domain is interned until its last function is destroyed.
+   //***************************************************************************
+   const std::size_t start = util::Domain::noInterned();
+   {
+      std::vector<DiscreteFunction> funs;
+      for(VarID var=501; var<600; ++var)
+      {
+         VarID vars[] = {500, var};
+         funs.push_back(DiscreteFunction(vars,vars+2));
+      }
+      DiscreteFunction kept(funs[5]);
+      if(start+99!=util::Domain::noInterned())
+      {
+         std::cout << "\nNew domains were not interned.";
+         exitValue = 1;
+      }
+      funs.clear();
+      if(start+1!=util::Domain::noInterned())
+      {
+         std::cout << "\nUnused domains were not reclaimed.";
+         exitValue = 1;
+      }
+      kept = 1;
+   }
+   if(start!=util::Domain::noInterned())
+   {
+      std::cout << "\nLast domain was not reclaimed.";
+      exitValue = 1;
+   }
+
+   //***************************************************************************
+   // Intern, reclaim and reintern domains from several threads at once.
+   //***************************************************************************
+   std::vector<DiscreteFunction> anchors;
+   for(VarID var=501; var<550; ++var)
+   {
+      VarID vars[] = {var, 500};
+      anchors.push_back(DiscreteFunction(vars,vars+2));
+   }
+   std::atomic<int> errors(0);
+   std::vector<std::thread> threads;
+   for(int t=0; t<4; ++t)
+   {
+      threads.push_back(std::thread(internRepeatedly_m,&anchors,t,&errors));
+   }
+   for(std::size_t t=0; t<threads.size(); ++t)
+   {
+      threads[t].join();
+   }
+   if(0!=errors.load())
+   {
+      std::cout << "\nConcurrently interned domains are not shared.";
+      exitValue = 1;
+   }
+   if(start+anchors.size()!=util::Domain::noInterned())
+   {
+      std::cout << "\nConcurrently released domains were not reclaimed.";
+      exitValue = 1;
+   }
+
+   if(0==exitValue)
+   {
+      std::cout << "OK" << std::endl;
+   }
+   std::cout << std::endl;
+   return exitValue;
+
+} // reclaimTest
+
 int main()
 {
    std::cout << "******************************************\n";
@@ -235,4 +491,31 @@ int main()
       return exitStatus;
    }
 
+   std::cout << "******************************************\n";
+   std::cout << "Move Test\n";
+   std::cout << "******************************************\n";
+   exitStatus = moveTest();
+   if(0!=exitStatus)
+   {
+      return exitStatus;
+   }
+
+   std::cout << "******************************************\n";
+   std::cout << "Domain Test\n";
+   std::cout << "******************************************\n";
+   exitStatus = domainTest();
+   if(0!=exitStatus)
+   {
+      return exitStatus;
+   }
+
+   std::cout << "******************************************\n";
+   std::cout << "Reclaim Test\n";
+   std::cout << "******************************************\n";
+   exitStatus = reclaimTest();
+   if(0!=exitStatus)
+   {
+      return exitStatus;
+   }
+
 } // function main
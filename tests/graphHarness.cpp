@@ -0,0 +1,393 @@
+/**
+ * @file graphHarness.cpp
+ * Test harness for the maxsum::util::FactorGraph class.
+ */
+#include "maxsum/FactorGraph.h"
+#include "maxsum/IndexedHeap.h"
+#include "maxsum/register.h"
+#include <iostream>
+#include <vector>
+
+using namespace maxsum;
+using namespace maxsum::util;
+
+/**
+ * Creates a factor with the specified domain and arbitrary values.
+ */
+DiscreteFunction makeFactor_m(VarID v1, VarID v2)
+{
+   std::vector<VarID> vars;
+   vars.push_back(v1);
+   if(v1!=v2)
+   {
+      vars.push_back(v2);
+   }
+   DiscreteFunction result(vars.begin(),vars.end(),0);
+   for(ValIndex k=0; k<result.domainSize(); ++k)
+   {
+      result(k) = k;
+   }
+   return result;
+}
+
+/**
+ * Checks that a compiled graph is consistent with the factors it was
+ * compiled from.
+ * @returns the number of errors found.
+ */
+int checkStructure_m(FactorGraph& graph, const FactorGraph::FactorMap& factors,
+      const FactorGraph::ValueMap& values)
+{
+   int errorCount = 0;
+   int noEdges = 0;
+
+   if( (graph.noFactors() != static_cast<int>(factors.size())) ||
+       (graph.noVars() != static_cast<int>(values.size())) )
+   {
+      std::cout << "Wrong number of nodes.\n";
+      return 1;
+   }
+
+   //***************************************************************************
+   // Check that each factor's edges are in the same order as its domain,
+   // and have the correct strides.
+   //***************************************************************************
+   int f=0;
+   for(FactorGraph::FactorMap::const_iterator it=factors.begin();
+         it!=factors.end(); ++it, ++f)
+   {
+      if( (graph.factorId(f)!=it->first) || (&graph.factor(f)!=&it->second) )
+      {
+         std::cout << "Factor " << it->first << " has wrong index.\n";
+         ++errorCount;
+         continue;
+      }
+
+      if(graph.factorEdgeEnd(f)-graph.factorEdgeBegin(f)!=it->second.noVars())
+      {
+         std::cout << "Factor " << it->first << " has wrong edges.\n";
+         ++errorCount;
+         continue;
+      }
+
+      ValIndex stride = 1;
+      int e = graph.factorEdgeBegin(f);
+      for(int k=0; k<it->second.noVars(); ++k, ++e)
+      {
+         VarID var = *(it->second.varBegin()+k);
+         if( (graph.edgeFactor(e)!=f) ||
+             (graph.varId(graph.edgeVar(e))!=var) ||
+             (graph.edgeStride(e)!=stride) ||
+             (graph.varSize(graph.edgeVar(e))!=getDomainSize(var)) )
+         {
+            std::cout << "Edge " << e << " is inconsistent.\n";
+            ++errorCount;
+         }
+         stride *= getDomainSize(var);
+         ++noEdges;
+      }
+   }
+
+   if(noEdges!=graph.noEdges())
+   {
+      std::cout << "Wrong number of edges.\n";
+      ++errorCount;
+   }
+
+   //***************************************************************************
+   // Check that factors share a shape if and only if their domains have
+   // the same sizes.
+   //***************************************************************************
+   for(int f=0; f<graph.noFactors(); ++f)
+   {
+      for(int g=0; g<graph.noFactors(); ++g)
+      {
+         const bool sameShape = graph.factorShape(f)==graph.factorShape(g);
+         if( (0>graph.factorShape(f)) ||
+             (graph.noShapes()<=graph.factorShape(f)) ||
+             (sameShape != (graph.factor(f).domain().sizes() ==
+                            graph.factor(g).domain().sizes())) )
+         {
+            std::cout << "Factor " << graph.factorId(f)
+               << " has the wrong shape.\n";
+            ++errorCount;
+            break;
+         }
+      }
+   }
+
+   //***************************************************************************
+   // Check that each variable's edge list is the reverse of the factor
+   // edge lists, in increasing order of factor.
+   //***************************************************************************
+   int count = 0;
+   for(int v=0; v<graph.noVars(); ++v)
+   {
+      int prevFactor = -1;
+      for(int k=graph.varEdgeBegin(v); k<graph.varEdgeEnd(v); ++k, ++count)
+      {
+         int e = graph.varEdge(k);
+         if( (graph.edgeVar(e)!=v) || (graph.edgeFactor(e)<=prevFactor) )
+         {
+            std::cout << "Variable " << graph.varId(v)
+               << " has inconsistent edges.\n";
+            ++errorCount;
+         }
+         prevFactor = graph.edgeFactor(e);
+      }
+   }
+
+   if(count!=graph.noEdges())
+   {
+      std::cout << "Variable edge lists have wrong size.\n";
+      ++errorCount;
+   }
+
+   //***************************************************************************
+   // Check that messages are packed contiguously in edge order.
+   //***************************************************************************
+   for(int e=1; e<graph.noEdges(); ++e)
+   {
+      if( graph.fac2var(e-1)+graph.varSize(graph.edgeVar(e-1)) !=
+          graph.fac2var(e) )
+      {
+         std::cout << "Messages are not contiguous.\n";
+         ++errorCount;
+         break;
+      }
+   }
+
+   return errorCount;
+
+} // checkStructure_m
+
+/**
+ * Tests the maxsum::util::NoticeList class.
+ * @returns the number of errors found.
+ */
+int testNotices_m()
+{
+   int errorCount = 0;
+   NoticeList notices;
+   notices.reset(5);
+   notices.notify(3);
+   notices.notify(1);
+   notices.notify(3);
+
+   if( (2!=notices.count()) || !notices.isPending(1) || notices.isPending(0) )
+   {
+      std::cout << "Duplicate notices were not removed.\n";
+      ++errorCount;
+   }
+
+   std::vector<int> pending;
+   notices.take(pending);
+   if( (2!=pending.size()) || (3!=pending[0]) || (1!=pending[1]) ||
+       (0!=notices.count()) || notices.isPending(3) )
+   {
+      std::cout << "Failed to take pending notices.\n";
+      ++errorCount;
+   }
+
+   notices.notifyAll();
+   if(5!=notices.count())
+   {
+      std::cout << "Failed to notify all.\n";
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // testNotices_m
+
+/**
+ * Tests the maxsum::util::IndexedHeap class.
+ * @returns the number of errors found.
+ */
+int testHeap_m()
+{
+   int errorCount = 0;
+   IndexedHeap heap;
+   heap.reset(6);
+   heap.raise(0,1);
+   heap.raise(3,5);
+   heap.raise(4,2);
+   heap.raise(1,3);
+   heap.raise(3,4); // lower priority should be ignored
+   heap.raise(0,6); // higher priority should move to the top
+
+   if( (4!=heap.count()) || heap.contains(2) || (5!=heap.priority(3)) )
+   {
+      std::cout << "Heap contents are wrong.\n";
+      ++errorCount;
+   }
+
+   const int expected[] = {0,3,1,4};
+   for(int k=0; k<4; ++k)
+   {
+      if(heap.empty() || (expected[k]!=heap.pop()))
+      {
+         std::cout << "Nodes were not popped in priority order.\n";
+         ++errorCount;
+         break;
+      }
+   }
+
+   if(!heap.empty() || heap.contains(0))
+   {
+      std::cout << "Heap was not emptied.\n";
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // testHeap_m
+
+/**
+ * Main function runs all tests in this harness.
+ */
+int main()
+{
+   int errorCount = 0;
+   try
+   {
+      //************************************************************************
+      // Register some variables with different domain sizes
+      //************************************************************************
+      for(VarID var=1; var<=5; ++var)
+      {
+         registerVariable(var,var+1);
+      }
+
+      //************************************************************************
+      // Test notice lists
+      //************************************************************************
+      std::cout << "Testing notice lists...";
+      int noticeErrors = testNotices_m();
+      std::cout << (0==noticeErrors ? "OK\n" : "FAILED\n");
+      errorCount += noticeErrors;
+
+      std::cout << "Testing indexed heap...";
+      int heapErrors = testHeap_m();
+      std::cout << (0==heapErrors ? "OK\n" : "FAILED\n");
+      errorCount += heapErrors;
+
+      //************************************************************************
+      // Compile a small factor graph
+      //************************************************************************
+      std::cout << "Compiling graph...";
+      FactorGraph::FactorMap factors, totals;
+      FactorGraph::ValueMap values;
+      factors[10] = makeFactor_m(1,2);
+      factors[20] = makeFactor_m(2,3);
+      factors[30] = makeFactor_m(3,5);
+      factors[40] = makeFactor_m(1,1);
+      factors[50] = makeFactor_m(1,2);
+      values[1] = values[2] = values[3] = values[5] = 0;
+
+      FactorGraph graph;
+      graph.compile(factors,totals,values);
+      int structureErrors = checkStructure_m(graph,factors,values);
+      if(graph.factorNotices().count()!=graph.noFactors())
+      {
+         std::cout << "New factors were not notified.\n";
+         ++structureErrors;
+      }
+      if(totals.size()!=factors.size())
+      {
+         std::cout << "Total values were not created.\n";
+         ++structureErrors;
+      }
+      std::cout << (0==structureErrors ? "OK\n" : "FAILED\n");
+      errorCount += structureErrors;
+
+      //************************************************************************
+      // Fill messages with values that identify their edge, then recompile
+      // after changing the graph.
+      //************************************************************************
+      std::cout << "Recompiling graph...";
+      for(int e=0; e<graph.noEdges(); ++e)
+      {
+         VarID var = graph.varId(graph.edgeVar(e));
+         FactorID fac = graph.factorId(graph.edgeFactor(e));
+         for(ValIndex j=0; j<graph.varSize(graph.edgeVar(e)); ++j)
+         {
+            ValType id = static_cast<ValType>(fac*100 + var*10 + j);
+            graph.fac2var(e)[j] = id;
+            graph.var2fac(e)[j] = -id;
+         }
+      }
+      std::vector<int> pending;
+      graph.factorNotices().take(pending);
+      graph.factorNotices().notify(graph.findFactor(30));
+
+      factors.erase(20);
+      totals.erase(20);
+      factors[15] = makeFactor_m(2,4);
+      values[4] = 0;
+      graph.compile(factors,totals,values);
+      int recompileErrors = checkStructure_m(graph,factors,values);
+
+      for(int e=0; e<graph.noEdges(); ++e)
+      {
+         VarID var = graph.varId(graph.edgeVar(e));
+         FactorID fac = graph.factorId(graph.edgeFactor(e));
+         for(ValIndex j=0; j<graph.varSize(graph.edgeVar(e)); ++j)
+         {
+            ValType expected = (15==fac) ? 0 :
+               static_cast<ValType>(fac*100 + var*10 + j);
+            if( (graph.fac2var(e)[j]!=expected) ||
+                (graph.var2fac(e)[j]!=-expected) )
+            {
+               std::cout << "Message F" << fac << "<->V" << var
+                  << " was not preserved.\n";
+               ++recompileErrors;
+               break;
+            }
+         }
+      }
+
+      if( (2!=graph.factorNotices().count()) ||
+          !graph.factorNotices().isPending(graph.findFactor(15)) ||
+          !graph.factorNotices().isPending(graph.findFactor(30)) ||
+          (-1!=graph.findFactor(20)) )
+      {
+         std::cout << "Notices were not preserved.\n";
+         ++recompileErrors;
+      }
+      std::cout << (0==recompileErrors ? "OK\n" : "FAILED\n");
+      errorCount += recompileErrors;
+
+      //************************************************************************
+      // Check that clearing the graph removes everything
+      //************************************************************************
+      std::cout << "Clearing graph...";
+      graph.clear();
+      if( (0!=graph.noFactors()) || (0!=graph.noVars()) ||
+          (0!=graph.noEdges()) || (0!=graph.factorNotices().count()) )
+      {
+         std::cout << "FAILED\n";
+         ++errorCount;
+      }
+      else
+      {
+         std::cout << "OK\n";
+      }
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what() << std::endl;
+      ++errorCount;
+   }
+
+   //***************************************************************************
+   // Return success if all tests in this harness have passed.
+   //***************************************************************************
+   std::cout << "NUMBER OF ERRORS: " << errorCount << std::endl;
+   if(0==errorCount)
+   {
+      return EXIT_SUCCESS;
+   }
+   return EXIT_FAILURE;
+
+} // function main
@@ -0,0 +1,386 @@
+/**
+ * @file implicitHarness.cpp
+ * Test harness for maxsum::ImplicitFactor and its subclasses.
+ */
+#include "maxsum/CardinalityFactor.h"
+#include "maxsum/MaxSumController.h"
+#include "maxsum/PottsFactor.h"
+#include "maxsum/SparseFactor.h"
+#include "maxsum/register.h"
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+using namespace maxsum;
+
+/**
+ * Private Module Namespace.
+ */
+namespace
+{
+   /**
+    * Tolerance used when comparing values computed in a different order.
+    */
+   const ValType TOLERANCE_M = 0.0001;
+
+   /**
+    * Returns a pseudo-random value in [-1,1).
+    */
+   ValType random_m()
+   {
+      return static_cast<ValType>(std::rand()%2000)/1000 - 1;
+   }
+
+   /**
+    * Advances a joint assignment to the next in domain order.
+    * @returns false if <code>subs</code> was the last assignment.
+    */
+   bool next_m(std::vector<ValIndex>& subs, const std::vector<ValIndex>& sizes)
+   {
+      for(std::size_t k=0; k<subs.size(); ++k)
+      {
+         if(++subs[k] < sizes[k])
+         {
+            return true;
+         }
+         subs[k] = 0;
+      }
+      return false;
+   }
+
+   /**
+    * Expands an implicit factor into an equivalent factor table.
+    */
+   DiscreteFunction expand_m(const ImplicitFactor& factor)
+   {
+      DiscreteFunction result(factor.vars().begin(),factor.vars().end(),0.0);
+      std::vector<ValIndex> subs(factor.noVars(),0);
+      ValIndex k = 0;
+      do
+      {
+         result(k++) = factor.value(subs.data());
+      }
+      while(next_m(subs,factor.sizes()));
+      return result;
+   }
+
+   /**
+    * Checks the max marginals computed by an implicit factor against a
+    * brute force search over every joint assignment, for several sets of
+    * random input messages.
+    * @returns the number of errors found.
+    */
+   int checkMarginals_m(const ImplicitFactor& factor)
+   {
+      int errorCount = 0;
+      const int n = factor.noVars();
+      const std::vector<ValIndex>& sizes = factor.sizes();
+      for(int trial=0; trial<20; ++trial)
+      {
+         std::vector<std::vector<ValType> > msgs(n), out(n), expected(n);
+         std::vector<const ValType*> ppMsgs(n);
+         std::vector<ValType*> ppOut(n);
+         for(int k=0; k<n; ++k)
+         {
+            for(ValIndex x=0; x<sizes[k]; ++x)
+            {
+               msgs[k].push_back(random_m());
+            }
+            out[k].assign(sizes[k],0);
+            expected[k].assign(sizes[k],-1e30);
+            ppMsgs[k] = msgs[k].data();
+            ppOut[k] = out[k].data();
+         }
+
+         std::vector<ValIndex> subs(n,0);
+         do
+         {
+            ValType score = factor.value(subs.data());
+            for(int k=0; k<n; ++k)
+            {
+               score += msgs[k][subs[k]];
+            }
+            for(int k=0; k<n; ++k)
+            {
+               expected[k][subs[k]] = std::max(expected[k][subs[k]],score);
+            }
+         }
+         while(next_m(subs,sizes));
+
+         factor.maxMarginals(ppMsgs.data(),ppOut.data());
+         for(int k=0; k<n; ++k)
+         {
+            for(ValIndex x=0; x<sizes[k]; ++x)
+            {
+               if(TOLERANCE_M < std::fabs(out[k][x]-expected[k][x]))
+               {
+                  std::cout << "Wrong marginal for variable " << k
+                     << " value " << x << ": " << out[k][x] << " != "
+                     << expected[k][x] << std::endl;
+                  return errorCount+1;
+               }
+            }
+         }
+      }
+      return errorCount;
+
+   } // function checkMarginals_m
+
+   /**
+    * Tests each kind of implicit factor in isolation.
+    * @returns the number of errors found.
+    */
+   int testKernels_m()
+   {
+      int errorCount = 0;
+
+      PottsFactor potts(2,1,1.5,-0.5);
+      errorCount += checkMarginals_m(potts);
+      PottsFactor unequal(1,4,-1,0.25);
+      errorCount += checkMarginals_m(unequal);
+
+      std::vector<VarID> vars;
+      vars.push_back(4);
+      vars.push_back(1);
+      vars.push_back(3);
+      vars.push_back(2);
+      CardinalityFactor atMost(vars.begin(),vars.end(),2,-10);
+      errorCount += checkMarginals_m(atMost);
+      std::vector<ValType> counts;
+      for(int c=0; c<=4; ++c)
+      {
+         counts.push_back(random_m());
+      }
+      CardinalityFactor general(vars.begin(),vars.end(),counts);
+      errorCount += checkMarginals_m(general);
+
+      SparseFactor sparse(vars.begin()+1,vars.end(),-2);
+      SparseFactor::Assignment subs(3,0);
+      for(int k=0; k<10; ++k)
+      {
+         sparse.set(subs,random_m());
+         next_m(subs,sparse.sizes());
+         next_m(subs,sparse.sizes());
+      }
+      errorCount += checkMarginals_m(sparse);
+
+      //************************************************************************
+      // A sparse factor in which every assignment is an exception has no
+      // default assignments to find.
+      //************************************************************************
+      SparseFactor full(vars.begin(),vars.begin()+2,5);
+      subs.assign(2,0);
+      do
+      {
+         full.set(subs,random_m());
+      }
+      while(next_m(subs,full.sizes()));
+      errorCount += checkMarginals_m(full);
+
+      //************************************************************************
+      // Check invalid definitions are rejected.
+      //************************************************************************
+      try
+      {
+         PottsFactor bad(3,3,0,0);
+         std::cout << "Potts factor with one variable was accepted.\n";
+         ++errorCount;
+      }
+      catch(BadDomainException&) {}
+
+      try
+      {
+         CardinalityFactor bad(vars.begin(),vars.end(),
+               std::vector<ValType>(2,0.0));
+         std::cout << "Cardinality factor with wrong counts was accepted.\n";
+         ++errorCount;
+      }
+      catch(BadDomainException&) {}
+
+      try
+      {
+         sparse.set(SparseFactor::Assignment(2,0),1);
+         std::cout << "Sparse factor accepted a short assignment.\n";
+         ++errorCount;
+      }
+      catch(OutOfRangeException&) {}
+
+      return errorCount;
+
+   } // function testKernels_m
+
+   /**
+    * Tests that a factor graph with implicit factors gives the same results
+    * as the same graph with every factor expanded into a table.
+    * @returns the number of errors found.
+    */
+   int testController_m()
+   {
+      int errorCount = 0;
+      MaxSumController implicit;
+      MaxSumController expanded;
+
+      std::vector<std::shared_ptr<const ImplicitFactor> > factors;
+      factors.push_back(std::make_shared<PottsFactor>(1,2,0.5,-0.25));
+      factors.push_back(std::make_shared<PottsFactor>(2,6,0.3,0));
+      std::vector<VarID> vars;
+      for(VarID var=1; var<=5; ++var)
+      {
+         vars.push_back(var);
+      }
+      factors.push_back(
+            std::make_shared<CardinalityFactor>(vars.begin(),vars.end(),2,-5));
+      std::shared_ptr<SparseFactor> pSparse =
+         std::make_shared<SparseFactor>(vars.begin()+2,vars.end(),0);
+      SparseFactor::Assignment subs(3,0);
+      subs[0] = 1;
+      pSparse->set(subs,1.25);
+      subs[2] = 2;
+      pSparse->set(subs,-0.75);
+      factors.push_back(pSparse);
+
+      for(std::size_t k=0; k<factors.size(); ++k)
+      {
+         implicit.setImplicitFactor(k,factors[k]);
+         expanded.setFactor(k,expand_m(*factors[k]));
+      }
+      for(VarID var=1; var<=6; ++var)
+      {
+         DiscreteFunction unary(var,0.0);
+         for(ValIndex x=0; x<unary.domainSize(); ++x)
+         {
+            unary(x) = random_m();
+         }
+         implicit.setFactor(100+var,unary);
+         expanded.setFactor(100+var,unary);
+      }
+
+      if( (implicit.noFactors()!=expanded.noFactors()) ||
+          (implicit.noVars()!=expanded.noVars()) ||
+          (implicit.noEdges()!=expanded.noEdges()) ||
+          !implicit.hasImplicitFactor(2) || implicit.hasImplicitFactor(101) ||
+          !implicit.hasEdge(3,5) || implicit.hasEdge(3,1) )
+      {
+         std::cout << "Implicit factor graph has the wrong structure.\n";
+         ++errorCount;
+      }
+
+      const int implicitCount = implicit.optimise();
+      const int expandedCount = expanded.optimise();
+      if(implicitCount!=expandedCount)
+      {
+         std::cout << "Iteration counts differ: " << implicitCount << " != "
+            << expandedCount << std::endl;
+         ++errorCount;
+      }
+      for(MaxSumController::ConstValueIterator it=expanded.valBegin();
+            it!=expanded.valEnd(); ++it)
+      {
+         if(implicit.getValue(it->first)!=it->second)
+         {
+            std::cout << "Variable " << it->first << " has the wrong value.\n";
+            ++errorCount;
+         }
+      }
+      if(TOLERANCE_M < std::fabs(implicit.getUtility()-expanded.getUtility()))
+      {
+         std::cout << "Utilities differ.\n";
+         ++errorCount;
+      }
+
+      //************************************************************************
+      // Checkpoints include implicit factors, but factor graph files cannot.
+      //************************************************************************
+      std::stringstream checkpoint;
+      implicit.saveCheckpoint(checkpoint);
+      MaxSumController restored(implicit);
+      restored.restoreCheckpoint(checkpoint);
+      if(1!=restored.optimise())
+      {
+         std::cout << "Restored checkpoint did not warm start.\n";
+         ++errorCount;
+      }
+
+      try
+      {
+         implicit.save("implicitHarness.graph");
+         std::cout << "Saved a graph with implicit factors.\n";
+         ++errorCount;
+      }
+      catch(FileFormatException&) {}
+
+      //************************************************************************
+      // Replacing and removing implicit factors keeps the graph consistent.
+      //************************************************************************
+      implicit.setFactor(0,expand_m(*factors[0]));
+      implicit.setImplicitFactor(101,factors[1]);
+      implicit.removeFactor(2);
+      expanded.setFactor(101,expand_m(*factors[1]));
+      expanded.removeFactor(2);
+      if( implicit.hasImplicitFactor(0) || !implicit.hasImplicitFactor(101) ||
+          implicit.hasFactor(2) || (implicit.noEdges()!=expanded.noEdges()) )
+      {
+         std::cout << "Replaced factors have the wrong structure.\n";
+         ++errorCount;
+      }
+      implicit.optimise();
+      expanded.optimise();
+      if(TOLERANCE_M < std::fabs(implicit.getUtility()-expanded.getUtility()))
+      {
+         std::cout << "Utilities differ after replacing factors.\n";
+         ++errorCount;
+      }
+
+      return errorCount;
+
+   } // function testController_m
+
+} // module namespace
+
+/**
+ * Runs the implicit factor tests.
+ */
+int main()
+{
+   int errorCount = 0;
+   try
+   {
+      //************************************************************************
+      // Register some variables with different domain sizes
+      //************************************************************************
+      for(VarID var=1; var<=6; ++var)
+      {
+         registerVariable(var,2+var%3);
+      }
+      std::srand(7);
+
+      std::cout << "Testing implicit factor kernels...";
+      int kernelErrors = testKernels_m();
+      std::cout << (0==kernelErrors ? "OK\n" : "FAILED\n");
+      errorCount += kernelErrors;
+
+      std::cout << "Testing implicit factors in controller...";
+      int controllerErrors = testController_m();
+      std::cout << (0==controllerErrors ? "OK\n" : "FAILED\n");
+      errorCount += controllerErrors;
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what() << std::endl;
+      ++errorCount;
+   }
+
+   //***************************************************************************
+   // Return success if all tests in this harness have passed.
+   //***************************************************************************
+   std::cout << "NUMBER OF ERRORS: " << errorCount << std::endl;
+   if(0==errorCount)
+   {
+      return EXIT_SUCCESS;
+   }
+   return EXIT_FAILURE;
+
+} // function main
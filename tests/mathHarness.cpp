@@ -529,6 +529,76 @@ int testMath()
 
 } // testMath
 
+/**
+ * Tests broadcasting functions over larger domains, including domains in
+ * which the smaller function's variables are not contiguous, and checks
+ * that util::addMessages gives exactly the same result as adding each
+ * message to its factor in turn.
+ */
+int testBroadcast()
+{
+   int errorCount = 0;
+   VarID all[] = {1,2,3};
+   VarID outer[] = {1,3};
+   DiscreteFunction f(all,all+3), g(outer,outer+2);
+   for(ValIndex k=0; k<f.domainSize(); ++k)
+   {
+      f(k) = static_cast<ValType>(rand() % 1000) / 7;
+   }
+   for(ValIndex k=0; k<g.domainSize(); ++k)
+   {
+      g(k) = static_cast<ValType>(rand() % 1000) / 3;
+   }
+
+   DiscreteFunction sum = f+g, diff = g-f, expanded = g;
+   expanded.expand(2);
+   for(DomainIterator it(f); it.hasNext(); ++it)
+   {
+      if( (sum(it)!=f(it)+g(it)) || (diff(it)!=g(it)-f(it)) ||
+          (expanded(it)!=g(it)) )
+      {
+         std::cout << "Wrong broadcast value at " << it.getInd() << "\n";
+         ++errorCount;
+         break;
+      }
+   }
+
+   //***************************************************************************
+   // The fused kernel should match adding messages one at a time.
+   //***************************************************************************
+   std::vector<DiscreteFunction> msgs;
+   const ValType* ppMsgs[3];
+   DiscreteFunction expected(f);
+   for(int k=0; k<3; ++k)
+   {
+      msgs.push_back(DiscreteFunction(all[k],0.0));
+      for(ValIndex j=0; j<msgs[k].domainSize(); ++j)
+      {
+         msgs[k](j) = static_cast<ValType>(rand() % 1000) / 11;
+      }
+      expected += msgs[k];
+   }
+   for(int k=0; k<3; ++k)
+   {
+      ppMsgs[k] = &msgs[k](0);
+   }
+   DiscreteFunction fused(all,all+3);
+   util::addMessages(&f(0),3,f.domain().sizes().data(),ppMsgs,&fused(0));
+   for(ValIndex k=0; k<f.domainSize(); ++k)
+   {
+      if(fused(k)!=expected(k))
+      {
+         std::cout << "Fused message sum differs at " << k << "\n";
+         ++errorCount;
+         break;
+      }
+   }
+
+   std::cout << "Number of failures: " << errorCount << std::endl;
+   return errorCount;
+
+} // testBroadcast
+
 int main()
 {
    try
@@ -561,6 +631,15 @@ int main()
       {
          return EXIT_FAILURE;
       }
+
+      std::cout << "******************************************\n";
+      std::cout << " Test Broadcasting\n";
+      std::cout << "******************************************\n";
+      exitStatus = testBroadcast();
+      if(EXIT_SUCCESS!=exitStatus)
+      {
+         return EXIT_FAILURE;
+      }
    }
    catch(std::exception& e)
    {
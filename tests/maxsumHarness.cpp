@@ -7,10 +7,23 @@
 #include "maxsum/common.h"
 #include "maxsum/MaxSumController.h"
 #include<iostream>
+#include <algorithm>
+#include <chrono>
 #include <ctime>
 #include <iomanip>
 #include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <future>
 #include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <iterator>
+#include <utility>
 using namespace maxsum;
 
 /**
@@ -631,6 +644,1390 @@ int testMaxSum_m(MaxSumController& controller, const FactorMap_m& factors)
 } // function testMaxSum_m
 
 
+/**
+ * Tests that optimising a factor graph using several threads produces
+ * exactly the same result as optimising it using one thread.
+ * @returns the number of failures
+ */
+int testParallel_m(const FactorMap_m& factors, int noThreads)
+{
+   int errorCount = 0;
+   try
+   {
+      MaxSumController serial;
+      MaxSumController parallel;
+      parallel.setNumThreads(noThreads);
+      for(FactorMap_m::const_iterator it=factors.begin();
+            it!=factors.end(); ++it)
+      {
+         serial.setFactor(it->first,it->second);
+         parallel.setFactor(it->first,it->second);
+      }
+
+      std::cout << "Running with " << parallel.getNumThreads()
+         << " threads...";
+      int serialCount = serial.optimise();
+      int parallelCount = parallel.optimise();
+      std::cout << "DONE.\n";
+
+      //************************************************************************
+      // Check that both controllers stopped after the same number of
+      // iterations, with the same values.
+      //************************************************************************
+      if(serialCount != parallelCount)
+      {
+         std::cout << "Serial iterations " << serialCount
+            << " != parallel iterations " << parallelCount << std::endl;
+         ++errorCount;
+      }
+
+      for(MaxSumController::ConstValueIterator it=serial.valBegin();
+            it!=serial.valEnd(); ++it)
+      {
+         if(!parallel.hasValue(it->first))
+         {
+            std::cout << "Parallel controller is missing variable "
+               << it->first << std::endl;
+            ++errorCount;
+         }
+         else if(it->second != parallel.getValue(it->first))
+         {
+            std::cout << "Value mismatch for variable " << it->first
+               << ": serial=" << it->second << " parallel="
+               << parallel.getValue(it->first) << std::endl;
+            ++errorCount;
+         }
+      }
+
+      for(FactorMap_m::const_iterator it=factors.begin();
+            it!=factors.end(); ++it)
+      {
+         if(serial.getTotalValue(it->first) !=
+               parallel.getTotalValue(it->first))
+         {
+            std::cout << "Total value mismatch for factor " << it->first
+               << std::endl;
+            ++errorCount;
+         }
+      }
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what();
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // function testParallel_m
+
+/**
+ * Tests that factors and controllers can be moved without changing the
+ * result of optimisation.
+ * @returns the number of failures
+ */
+int testMove_m(const FactorMap_m& factors)
+{
+   int errorCount = 0;
+   try
+   {
+      MaxSumController reference;
+      MaxSumController source;
+      for(FactorMap_m::const_iterator it=factors.begin();
+            it!=factors.end(); ++it)
+      {
+         reference.setFactor(it->first,it->second);
+         DiscreteFunction copy(it->second);
+         source.setFactor(it->first,std::move(copy));
+      }
+
+      std::cout << "Moving controllers...";
+      int refCount = reference.optimise();
+      int count = source.optimise();
+      MaxSumController moved(std::move(source));
+      MaxSumController assigned;
+      assigned = std::move(moved);
+      std::cout << "DONE.\n";
+
+      if( (refCount!=count) || (0!=source.noFactors()) ||
+          (assigned.noFactors()!=reference.noFactors()) )
+      {
+         std::cout << "Moved controller has wrong contents.\n";
+         return 1;
+      }
+
+      //************************************************************************
+      // Move assignment only swaps, so cannot throw. Move construction
+      // allocates an empty graph for the moved-from controller, so may.
+      //************************************************************************
+      if(!std::is_nothrow_move_assignable<MaxSumController>::value)
+      {
+         std::cout << "Move assignment may throw.\n";
+         return 1;
+      }
+
+      //************************************************************************
+      // The moved controller has already converged, so should stop
+      // immediately with the same values.
+      //************************************************************************
+      if(1!=assigned.optimise())
+      {
+         std::cout << "Moved controller lost its messages.\n";
+         ++errorCount;
+      }
+
+      for(MaxSumController::ConstValueIterator it=reference.valBegin();
+            it!=reference.valEnd(); ++it)
+      {
+         if(it->second != assigned.getValue(it->first))
+         {
+            std::cout << "Value mismatch for variable " << it->first
+               << std::endl;
+            ++errorCount;
+         }
+      }
+
+      for(FactorMap_m::const_iterator it=factors.begin();
+            it!=factors.end(); ++it)
+      {
+         if(reference.getTotalValue(it->first) !=
+               assigned.getTotalValue(it->first))
+         {
+            std::cout << "Total value mismatch for factor " << it->first
+               << std::endl;
+            ++errorCount;
+         }
+      }
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what();
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // function testMove_m
+
+/**
+ * Checks that a controller has the same variable values as a new
+ * controller that optimises the specified factors from scratch.
+ * @returns the number of failures
+ */
+int compareWithFresh_m
+(
+ MaxSumController& controller,
+ const FactorMap_m& factors
+)
+{
+   MaxSumController fresh;
+   for(FactorMap_m::const_iterator it=factors.begin();
+         it!=factors.end(); ++it)
+   {
+      fresh.setFactor(it->first,it->second);
+   }
+   fresh.optimise();
+
+   int errorCount = isConsistent_m(controller,factors);
+   for(MaxSumController::ConstValueIterator it=fresh.valBegin();
+         it!=fresh.valEnd(); ++it)
+   {
+      if(!controller.hasValue(it->first) ||
+         (it->second != controller.getValue(it->first)) )
+      {
+         std::cout << "Value mismatch for variable " << it->first
+            << std::endl;
+         ++errorCount;
+      }
+   }
+   return errorCount;
+
+} // function compareWithFresh_m
+
+/**
+ * Tests that incremental re-optimisation of a tree graph after changing,
+ * removing and adding factors finds the same (optimal) solution as
+ * optimising from scratch.
+ * @returns the number of failures
+ */
+int testIncremental_m(FactorMap_m factors)
+{
+   int errorCount = 0;
+   try
+   {
+      MaxSumController controller;
+      controller.setIncremental(true);
+      for(FactorMap_m::const_iterator it=factors.begin();
+            it!=factors.end(); ++it)
+      {
+         controller.setFactor(it->first,it->second);
+      }
+      controller.optimise();
+      errorCount += compareWithFresh_m(controller,factors);
+
+      //************************************************************************
+      // Change the utilities of the last factor, without changing its domain.
+      //************************************************************************
+      std::cout << "Changing factor values...";
+      FactorID last = factors.rbegin()->first;
+      genColourUtil_m(factors[last]);
+      controller.setFactor(last,factors[last]);
+      std::cout << "iterations=" << controller.optimise() << std::endl;
+      errorCount += compareWithFresh_m(controller,factors);
+
+      //************************************************************************
+      // Remove a leaf factor, together with its variable.
+      //************************************************************************
+      std::cout << "Removing factor...";
+      factors.erase(last);
+      controller.removeFactor(last);
+      std::cout << "iterations=" << controller.optimise() << std::endl;
+      errorCount += compareWithFresh_m(controller,factors);
+
+      //************************************************************************
+      // Attach a new leaf factor to the root variable.
+      //************************************************************************
+      std::cout << "Adding factor...";
+      VarID vars[] = {1,last};
+      DiscreteFunction leaf(vars,vars+2);
+      genColourUtil_m(leaf);
+      factors[last] = leaf;
+      controller.setFactor(last,leaf);
+      std::cout << "iterations=" << controller.optimise() << std::endl;
+      errorCount += compareWithFresh_m(controller,factors);
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what();
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // function testIncremental_m
+
+/**
+ * Tests that setting many factors at once with
+ * MaxSumController::setFactors gives the same results as setting each
+ * factor in turn.
+ * @returns the number of failures
+ */
+int testBulk_m(FactorMap_m factors)
+{
+   int errorCount = 0;
+   try
+   {
+      std::cout << "Copying factors...";
+      MaxSumController copied;
+      copied.setFactors(factors.begin(),factors.end());
+      std::cout << "iterations=" << copied.optimise() << std::endl;
+      errorCount += compareWithFresh_m(copied,factors);
+
+      std::cout << "Moving factors...";
+      FactorMap_m source(factors);
+      MaxSumController moved;
+      moved.setFactors(std::make_move_iterator(source.begin()),
+            std::make_move_iterator(source.end()));
+      std::cout << "iterations=" << moved.optimise() << std::endl;
+      errorCount += compareWithFresh_m(moved,factors);
+
+      //************************************************************************
+      // Change every other factor in a graph that is already compiled.
+      //************************************************************************
+      std::cout << "Changing factors...";
+      FactorMap_m changes;
+      int k=0;
+      for(FactorMap_m::iterator it=factors.begin(); it!=factors.end(); ++it)
+      {
+         if(0==(k++)%2)
+         {
+            genColourUtil_m(it->second);
+            changes[it->first] = it->second;
+         }
+      }
+      copied.setFactors(changes.begin(),changes.end());
+      std::cout << "iterations=" << copied.optimise() << std::endl;
+      errorCount += compareWithFresh_m(copied,factors);
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what();
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // function testBulk_m
+
+/**
+ * Overwrites part of a saved factor graph file, and checks that loading it
+ * throws a FileFormatException, leaving the controller unchanged.
+ * @param[in,out] controller the controller that loads the corrupt file.
+ * @param[in] path the name of the file to write.
+ * @param[in] data the contents of a valid file.
+ * @param[in] offset the byte offset of the value to overwrite.
+ * @param[in] value the corrupt value.
+ * @param[in] description printed to describe the corruption.
+ * @returns the number of failures
+ */
+template<class T> int loadCorrupt_m
+(
+ MaxSumController& controller,
+ const char* path,
+ std::string data,
+ std::uint64_t offset,
+ const T& value,
+ const char* description
+)
+{
+   std::cout << "Loading file with " << description << "...";
+   std::memcpy(&data[offset],&value,sizeof(T));
+   {
+      std::ofstream out(path,std::ios::binary|std::ios::trunc);
+      out << data;
+   }
+   const int noFactors = controller.noFactors();
+   try
+   {
+      controller.load(path);
+      std::cout << " no exception FAILED" << std::endl;
+      return 1;
+   }
+   catch(FileFormatException& e)
+   {
+      if(controller.noFactors()!=noFactors)
+      {
+         std::cout << " controller changed FAILED" << std::endl;
+         return 1;
+      }
+   }
+   catch(std::exception& e)
+   {
+      std::cout << " wrong exception FAILED" << std::endl;
+      return 1;
+   }
+   std::cout << " OK" << std::endl;
+   return 0;
+
+} // function loadCorrupt_m
+
+/**
+ * Tests that a factor graph saved with MaxSumController::save is restored
+ * by MaxSumController::load, with and without its messages, and that
+ * corrupt files are rejected.
+ * @returns the number of failures
+ */
+int testSaveLoad_m(const FactorMap_m& factors)
+{
+   int errorCount = 0;
+   const char* const path = "maxsumHarness.graph";
+   try
+   {
+      MaxSumController original;
+      original.setFactors(factors.begin(),factors.end());
+      int origCount = original.optimise();
+
+      //************************************************************************
+      // Without messages, the loaded graph is optimised from scratch.
+      //************************************************************************
+      std::cout << "Saving and loading factors...";
+      original.save(path);
+      MaxSumController loaded;
+      loaded.setFactor(factors.rbegin()->first+1,DiscreteFunction(1.0));
+      loaded.load(path);
+      if(loaded.noFactors()!=original.noFactors())
+      {
+         std::cout << " wrong number of factors";
+         ++errorCount;
+      }
+      for(FactorMap_m::const_iterator it=factors.begin();
+            it!=factors.end(); ++it)
+      {
+         if(!loaded.hasFactor(it->first) ||
+            (loaded.getFactor(it->first)!=it->second))
+         {
+            std::cout << " factor " << it->first << " differs";
+            ++errorCount;
+         }
+      }
+      int count = loaded.optimise();
+      std::cout << " iterations=" << count << std::endl;
+      if(count!=origCount)
+      {
+         std::cout << "Expected " << origCount << " iterations" << std::endl;
+         ++errorCount;
+      }
+      errorCount += compareWithFresh_m(loaded,factors);
+
+      //************************************************************************
+      // With messages, the loaded graph has already converged.
+      //************************************************************************
+      std::cout << "Saving and loading messages...";
+      original.save(path,true);
+      MaxSumController warm;
+      warm.load(path);
+      for(MaxSumController::ConstValueIterator it=original.valBegin();
+            it!=original.valEnd(); ++it)
+      {
+         if(warm.getValue(it->first)!=it->second)
+         {
+            std::cout << " value of " << it->first << " differs";
+            ++errorCount;
+         }
+      }
+      count = warm.optimise();
+      std::cout << " iterations=" << count << std::endl;
+      if(1!=count)
+      {
+         std::cout << "Expected warm start to converge at once" << std::endl;
+         ++errorCount;
+      }
+      errorCount += compareWithFresh_m(warm,factors);
+
+      //************************************************************************
+      // Corrupt records must be rejected, leaving the controller unchanged.
+      // The header holds the number of variables, factors, domain variables
+      // and values from byte 24, and each section starts at a multiple of 8
+      // bytes after the 64 byte header.
+      //************************************************************************
+      std::string data;
+      {
+         std::ifstream in(path,std::ios::binary);
+         data.assign(std::istreambuf_iterator<char>(in),
+               std::istreambuf_iterator<char>());
+      }
+      std::uint64_t counts[4];
+      std::memcpy(counts,&data[24],sizeof(counts));
+      const std::uint64_t varsAt = 64;
+      const std::uint64_t factorsAt = varsAt + 8*counts[0];
+      const std::uint64_t domainsAt = factorsAt + 24*counts[1];
+      const std::uint64_t valuesAt = (domainsAt + 4*counts[2] + 7) & ~7ull;
+      const std::uint64_t assignAt =
+         (valuesAt + sizeof(ValType)*counts[3] + 7) & ~7ull;
+
+      errorCount += loadCorrupt_m(warm,path,data,varsAt+4,std::int32_t(1),
+            "singleton domain");
+      std::uint32_t arity = 0;
+      std::memcpy(&arity,&data[factorsAt+4],sizeof(arity));
+      errorCount += loadCorrupt_m(warm,path,data,factorsAt+8,
+            std::uint64_t(0)-arity,"wrapping domain offset");
+      errorCount += loadCorrupt_m(warm,path,data,domainsAt,
+            std::uint32_t(0xFFFFFFF0u),"undeclared domain variable");
+      errorCount += loadCorrupt_m(warm,path,data,assignAt,
+            std::int32_t(1000),"out of range assignment");
+
+      //************************************************************************
+      // A truncated file must be rejected, leaving the controller unchanged.
+      //************************************************************************
+      std::cout << "Loading truncated file...";
+      {
+         std::ofstream out(path,std::ios::binary|std::ios::trunc);
+         out << "MAXSUMFG";
+      }
+      try
+      {
+         warm.load(path);
+         std::cout << " no exception FAILED" << std::endl;
+         ++errorCount;
+      }
+      catch(FileFormatException& e)
+      {
+         if(warm.noFactors()!=original.noFactors())
+         {
+            std::cout << " controller changed FAILED" << std::endl;
+            ++errorCount;
+         }
+         else
+         {
+            std::cout << " OK" << std::endl;
+         }
+      }
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what();
+      ++errorCount;
+   }
+   std::remove(path);
+
+   return errorCount;
+
+} // function testSaveLoad_m
+
+/**
+ * Tests that restoring a checkpoint lets optimisation resume from the
+ * checkpointed messages, both for the same graph and after changing a
+ * factor, and that corrupt checkpoints are rejected.
+ * @returns the number of failures
+ */
+int testCheckpoint_m(FactorMap_m factors)
+{
+   int errorCount = 0;
+   try
+   {
+      MaxSumController original;
+      original.setFactors(factors.begin(),factors.end());
+      original.optimise();
+      std::stringstream checkpoint;
+      original.saveCheckpoint(checkpoint);
+
+      std::cout << "Restoring unchanged graph...";
+      MaxSumController restored;
+      restored.setFactors(factors.begin(),factors.end());
+      restored.restoreCheckpoint(checkpoint);
+      for(FactorMap_m::const_iterator it=factors.begin();
+            it!=factors.end(); ++it)
+      {
+         if(original.getTotalValue(it->first)!=
+               restored.getTotalValue(it->first))
+         {
+            std::cout << "Total value mismatch for factor " << it->first
+               << std::endl;
+            ++errorCount;
+         }
+      }
+      int count = restored.optimise();
+      std::cout << " iterations=" << count << std::endl;
+      if(1!=count)
+      {
+         std::cout << "Expected restored graph to converge at once\n";
+         ++errorCount;
+      }
+      errorCount += compareWithFresh_m(restored,factors);
+
+      //************************************************************************
+      // Change one factor, and check the restored graph still reaches the
+      // same solution as optimising from scratch.
+      //************************************************************************
+      std::cout << "Restoring changed graph...";
+      genColourUtil_m(factors.begin()->second);
+      MaxSumController changed;
+      changed.setFactors(factors.begin(),factors.end());
+      checkpoint.clear();
+      checkpoint.seekg(0);
+      changed.restoreCheckpoint(checkpoint);
+      std::cout << " iterations=" << changed.optimise() << std::endl;
+      errorCount += compareWithFresh_m(changed,factors);
+
+      std::cout << "Restoring truncated checkpoint...";
+      std::string data = checkpoint.str();
+      std::stringstream truncated(data.substr(0,data.size()/2));
+      try
+      {
+         changed.restoreCheckpoint(truncated);
+         std::cout << " no exception FAILED" << std::endl;
+         ++errorCount;
+      }
+      catch(FileFormatException& e)
+      {
+         std::cout << " OK" << std::endl;
+      }
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what();
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // function testCheckpoint_m
+
+/**
+ * Tests that each message schedule converges to the optimal solution on a
+ * tree graph, and converges on a loopy graph.
+ * @returns the number of failures
+ */
+int testSchedules_m(const FactorMap_m& tree, const FactorMap_m& loopy)
+{
+   int errorCount = 0;
+   const MaxSumController::Schedule schedules[] =
+      {MaxSumController::FLOODING, MaxSumController::RESIDUAL,
+       MaxSumController::ROUND_ROBIN};
+   const char* names[] = {"flooding", "residual", "round robin"};
+   try
+   {
+      for(int k=0; k<3; ++k)
+      {
+         std::cout << "Testing " << names[k] << " schedule...";
+         MaxSumController controller;
+         controller.setSchedule(schedules[k]);
+         for(FactorMap_m::const_iterator it=tree.begin();
+               it!=tree.end(); ++it)
+         {
+            controller.setFactor(it->first,it->second);
+         }
+         controller.optimise();
+         std::cout << " tree updates=" << controller.noUpdates();
+         int errors = compareWithFresh_m(controller,tree);
+
+         controller.clear();
+         for(FactorMap_m::const_iterator it=loopy.begin();
+               it!=loopy.end(); ++it)
+         {
+            controller.setFactor(it->first,it->second);
+         }
+         int count = controller.optimise();
+         std::cout << " loopy updates=" << controller.noUpdates();
+         if(count >= MaxSumController::DEFAULT_MAX_ITERATIONS)
+         {
+            std::cout << " did not converge";
+            ++errors;
+         }
+         errors += isConsistent_m(controller,loopy);
+         std::cout << (0==errors ? " OK\n" : " FAILED\n");
+         errorCount += errors;
+      }
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what();
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // function testSchedules_m
+
+/**
+ * Observer that records the statistics for every iteration.
+ */
+class StatsRecorder_m : public MaxSumController::IterationObserver
+{
+public:
+
+   std::vector<MaxSumController::IterationStats> history;
+
+   void iterationDone(const MaxSumController::IterationStats& stats)
+   {
+      history.push_back(stats);
+   }
+};
+
+/**
+ * Tests that an observer is told about every iteration of each schedule,
+ * and that the reported statistics agree with the controller's totals.
+ * @returns the number of failures
+ */
+int testObserver_m(const FactorMap_m& factors)
+{
+   int errorCount = 0;
+   const MaxSumController::Schedule schedules[] =
+      {MaxSumController::FLOODING, MaxSumController::RESIDUAL,
+       MaxSumController::ROUND_ROBIN};
+   const char* names[] = {"flooding", "residual", "round robin"};
+   try
+   {
+      for(int k=0; k<3; ++k)
+      {
+         std::cout << "Observing " << names[k] << " schedule...";
+         StatsRecorder_m recorder;
+         MaxSumController controller;
+         controller.setSchedule(schedules[k]);
+         controller.setObserver(&recorder);
+         controller.setFactors(factors.begin(),factors.end());
+         const int count = controller.optimise();
+
+         int errors = 0;
+         long noUpdates = 0;
+         for(std::size_t j=0; j<recorder.history.size(); ++j)
+         {
+            const MaxSumController::IterationStats& stats =
+               recorder.history[j];
+            noUpdates += stats.noFactorUpdates + stats.noVarUpdates;
+            if( (static_cast<int>(j+1)!=stats.iteration) ||
+                (stats.maxFac2VarResidual > stats.totalFac2VarResidual) ||
+                (stats.maxVar2FacResidual > stats.totalVar2FacResidual) ||
+                (0>stats.fac2varSeconds) || (0>stats.var2facSeconds) )
+            {
+               std::cout << " bad stats for iteration " << j+1;
+               ++errors;
+            }
+         }
+         std::cout << " iterations=" << recorder.history.size();
+         if(static_cast<int>(recorder.history.size())!=count)
+         {
+            std::cout << " expected " << count;
+            ++errors;
+         }
+         if(noUpdates!=controller.noUpdates())
+         {
+            std::cout << " updates=" << noUpdates << " expected "
+               << controller.noUpdates();
+            ++errors;
+         }
+         const MaxSumController::IterationStats& last =
+            recorder.history.back();
+         if( (MaxSumController::FLOODING==schedules[k]) &&
+             (0!=last.noVar2FacChanges+last.noValueChanges) )
+         {
+            std::cout << " last iteration not converged";
+            ++errors;
+         }
+
+         controller.setObserver(0);
+         controller.setFactors(factors.begin(),factors.end());
+         controller.optimise();
+         if(static_cast<int>(recorder.history.size())!=count)
+         {
+            std::cout << " observer called after removal";
+            ++errors;
+         }
+         std::cout << (0==errors ? " OK\n" : " FAILED\n");
+         errorCount += errors;
+      }
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what();
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // function testObserver_m
+
+/**
+ * Observer that records the utility of a controller's assignment after
+ * every iteration.
+ */
+class UtilityRecorder_m : public MaxSumController::IterationObserver
+{
+public:
+
+   UtilityRecorder_m(const MaxSumController& controller)
+      : controller_i(controller) {}
+
+   std::vector<ValType> history;
+
+   void iterationDone(const MaxSumController::IterationStats&)
+   {
+      history.push_back(controller_i.getUtility());
+   }
+
+private:
+
+   const MaxSumController& controller_i;
+};
+
+/**
+ * Tests that optimising with a deadline stops on time, and returns the
+ * best assignment seen during optimisation.
+ * @returns the number of failures
+ */
+int testDeadline_m(const FactorMap_m& factors)
+{
+   int errorCount = 0;
+   const MaxSumController::Schedule schedules[] =
+      {MaxSumController::FLOODING, MaxSumController::RESIDUAL,
+       MaxSumController::ROUND_ROBIN};
+   const char* names[] = {"flooding", "residual", "round robin"};
+   try
+   {
+      for(int k=0; k<3; ++k)
+      {
+         //*********************************************************************
+         // With a distant deadline, the result should be the best
+         // assignment found in any iteration.
+         //*********************************************************************
+         std::cout << "Testing " << names[k] << " with deadline...";
+         MaxSumController controller;
+         UtilityRecorder_m recorder(controller);
+         controller.setSchedule(schedules[k]);
+         controller.setObserver(&recorder);
+         controller.setFactors(factors.begin(),factors.end());
+         ValType best = controller.getUtility();
+         const int count = controller.optimise(MaxSumController::Clock::now()
+               + std::chrono::seconds(60));
+         for(std::size_t j=0; j<recorder.history.size(); ++j)
+         {
+            best = std::max(best,recorder.history[j]);
+         }
+         int errors = 0;
+         const ValType utility = controller.getUtility();
+         std::cout << " iterations=" << count << " utility=" << utility;
+         if(std::fabs(utility-best) > DEFAULT_VALUE_TOLERANCE*factors.size())
+         {
+            std::cout << " expected " << best;
+            ++errors;
+         }
+         errors += isConsistent_m(controller,factors);
+
+         //*********************************************************************
+         // With a deadline that has already passed, at most one step should
+         // be taken, and the rest should be left for the next call.
+         //*********************************************************************
+         MaxSumController late;
+         late.setSchedule(schedules[k]);
+         late.setFactors(factors.begin(),factors.end());
+         late.optimise(MaxSumController::Clock::now());
+         std::cout << " late updates=" << late.noUpdates();
+         if(late.noUpdates() > static_cast<long>(factors.size()))
+         {
+            std::cout << " too many";
+            ++errors;
+         }
+         late.optimise();
+         errors += isConsistent_m(late,factors);
+         std::cout << (0==errors ? " OK\n" : " FAILED\n");
+         errorCount += errors;
+      }
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what();
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // function testDeadline_m
+
+/**
+ * Generates a random tree of pairwise factors, with a unary factor for each
+ * variable, which is small enough to solve by brute force.
+ * @param[in] noVars the number of variables in the tree.
+ * @param[in] firstID the id of the first variable, which is also used as
+ * the first factor id.
+ * @param[out] factors map to which the generated factors are added.
+ * @returns the optimal utility, found by brute force.
+ */
+ValType genRandomTree_m(int noVars, int firstID, FactorMap_m& factors)
+{
+   DiscreteFunction total(0.0);
+   for(int k=0; k<noVars; ++k)
+   {
+      const VarID var = firstID+k;
+      registerVariable(var,2+k%2);
+      DiscreteFunction unary(var,0.0);
+      for(ValIndex j=0; j<unary.domainSize(); ++j)
+      {
+         unary(j) = static_cast<ValType>(std::rand()%1000)/1000;
+      }
+      factors[firstID+noVars+k] = unary;
+      total += unary;
+      if(0<k)
+      {
+         std::vector<VarID> vars;
+         vars.push_back(firstID+(k-1)/2);
+         vars.push_back(var);
+         DiscreteFunction pairwise(vars.begin(),vars.end(),0.0);
+         for(ValIndex j=0; j<pairwise.domainSize(); ++j)
+         {
+            pairwise(j) = static_cast<ValType>(std::rand()%1000)/1000;
+         }
+         factors[var] = pairwise;
+         total += pairwise;
+      }
+   }
+   return total.max();
+
+} // function genRandomTree_m
+
+/**
+ * Tests the exact solver for acyclic components.
+ * @param[in] tree a graph colouring problem on a tree.
+ * @param[in] loopy a graph colouring problem with cycles.
+ * @returns the number of errors encountered.
+ */
+int testTreeSolver_m(const FactorMap_m& tree, const FactorMap_m& loopy)
+{
+   int errorCount = 0;
+   try
+   {
+      //************************************************************************
+      // On a random tree, the exact solver should find the optimum found by
+      // brute force, without any iterations of the schedule.
+      //************************************************************************
+      std::cout << "Testing random tree...";
+      FactorMap_m random;
+      const ValType optimum = genRandomTree_m(10,1000,random);
+      MaxSumController exact;
+      exact.setTreeSolver(true);
+      exact.setFactors(random.begin(),random.end());
+      int count = exact.optimise();
+      int errors = isConsistent_m(exact,random);
+      std::cout << " iterations=" << count << " utility="
+         << exact.getUtility();
+      if( (1<count) ||
+          (std::fabs(exact.getUtility()-optimum) > DEFAULT_VALUE_TOLERANCE) )
+      {
+         std::cout << " expected " << optimum;
+         ++errors;
+      }
+      std::cout << (0==errors ? " OK\n" : " FAILED\n");
+      errorCount += errors;
+
+      //************************************************************************
+      // On a colouring tree, the result should be at least as good as the
+      // flooding schedule's, and the optimum should be kept once found.
+      //************************************************************************
+      std::cout << "Testing colouring tree...";
+      MaxSumController flooding;
+      flooding.setFactors(tree.begin(),tree.end());
+      flooding.optimise();
+      MaxSumController solver;
+      solver.setTreeSolver(true);
+      solver.setFactors(tree.begin(),tree.end());
+      count = solver.optimise();
+      errors = isConsistent_m(solver,tree);
+      std::cout << " iterations=" << count << " utility="
+         << solver.getUtility();
+      if( (1<count) || (solver.getUtility() <
+               flooding.getUtility()-DEFAULT_VALUE_TOLERANCE*tree.size()) )
+      {
+         std::cout << " expected at least " << flooding.getUtility();
+         ++errors;
+      }
+      const ValType utility = solver.getUtility();
+      solver.optimise();
+      if( (0!=solver.noUpdates()) || (utility!=solver.getUtility()) )
+      {
+         std::cout << " not stable";
+         ++errors;
+      }
+      std::cout << (0==errors ? " OK\n" : " FAILED\n");
+      errorCount += errors;
+
+      //************************************************************************
+      // If the graph also has a component with cycles, the tree should
+      // still be solved exactly, and the cycles left to the schedule.
+      //************************************************************************
+      std::cout << "Testing tree with loopy component...";
+      FactorMap_m mixed(loopy);
+      mixed.insert(random.begin(),random.end());
+      MaxSumController partial;
+      partial.setTreeSolver(true);
+      partial.setFactors(mixed.begin(),mixed.end());
+      count = partial.optimise();
+      errors = isConsistent_m(partial,mixed);
+      ValType treeUtility = 0;
+      for(FactorMap_m::const_iterator it=random.begin(); it!=random.end();
+            ++it)
+      {
+         std::map<VarID,ValIndex> values;
+         for(DiscreteFunction::VarIterator v=it->second.varBegin();
+               v!=it->second.varEnd(); ++v)
+         {
+            values[*v] = static_cast<ValIndex>(partial.getValue(*v));
+         }
+         treeUtility += it->second(values);
+      }
+      std::cout << " iterations=" << count << " tree utility=" << treeUtility;
+      if(std::fabs(treeUtility-optimum) > DEFAULT_VALUE_TOLERANCE)
+      {
+         std::cout << " expected " << optimum;
+         ++errors;
+      }
+      std::cout << (0==errors ? " OK\n" : " FAILED\n");
+      errorCount += errors;
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what();
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // function testTreeSolver_m
+
+/**
+ * Compares the number of updates made by the flooding schedule with and
+ * without targeted notifications.
+ * @param[in] tree a graph colouring problem on a tree.
+ * @param[in] loopy a graph colouring problem with cycles.
+ * @returns the number of errors encountered.
+ */
+int testTargetedNotices_m(const FactorMap_m& tree, const FactorMap_m& loopy)
+{
+   int errorCount = 0;
+   const FactorMap_m* graphs[] = {&tree, &loopy};
+   const char* names[] = {"tree", "ring"};
+   try
+   {
+      for(int k=0; k<2; ++k)
+      {
+         //*********************************************************************
+         // Targeted notifications should never need more updates, and on a
+         // tree should reach the same assignment.
+         //*********************************************************************
+         std::cout << "Testing targeted notices on " << names[k] << "...";
+         const FactorMap_m& factors = *graphs[k];
+         MaxSumController full;
+         full.setFactors(factors.begin(),factors.end());
+         std::clock_t fullTime = std::clock();
+         const int fullCount = full.optimise();
+         fullTime = std::clock() - fullTime;
+
+         MaxSumController targeted;
+         targeted.setTargetedNotices(true);
+         targeted.setFactors(factors.begin(),factors.end());
+         std::clock_t targetedTime = std::clock();
+         const int targetedCount = targeted.optimise();
+         targetedTime = std::clock() - targetedTime;
+
+         std::cout << " updates=" << full.noUpdates() << "->"
+            << targeted.noUpdates() << " iterations=" << fullCount << "->"
+            << targetedCount << " seconds="
+            << static_cast<float>(fullTime) / CLOCKS_PER_SEC << "->"
+            << static_cast<float>(targetedTime) / CLOCKS_PER_SEC;
+         int errors = isConsistent_m(targeted,factors);
+         if(targeted.noUpdates() > full.noUpdates())
+         {
+            std::cout << " too many updates";
+            ++errors;
+         }
+         if( (0==k) && (std::fabs(targeted.getUtility()-full.getUtility())
+                  > DEFAULT_VALUE_TOLERANCE*factors.size()) )
+         {
+            std::cout << " utility " << targeted.getUtility() << " expected "
+               << full.getUtility();
+            ++errors;
+         }
+         std::cout << (0==errors ? " OK\n" : " FAILED\n");
+         errorCount += errors;
+      }
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what();
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // function testTargetedNotices_m
+
+/**
+ * Tests optimising in another thread, while reading snapshots of the
+ * assignment.
+ * @param[in] loopy a graph colouring problem with cycles.
+ * @returns the number of errors encountered.
+ */
+int testAsync_m(const FactorMap_m& loopy)
+{
+   int errorCount = 0;
+   try
+   {
+      //************************************************************************
+      // Every snapshot read while the solver runs should be complete, and
+      // the last should match the final assignment.
+      //************************************************************************
+      std::cout << "Testing asynchronous optimise...";
+      MaxSumController controller;
+      controller.setFactors(loopy.begin(),loopy.end());
+      std::future<int> result = controller.optimiseAsync();
+      int errors = 0;
+      int lastIteration = 0;
+      int noReads = 0;
+      while(std::future_status::ready !=
+            result.wait_for(std::chrono::seconds(0)))
+      {
+         MaxSumController::SnapshotPtr pSnapshot = controller.snapshot();
+         if(0==pSnapshot)
+         {
+            continue;
+         }
+         ++noReads;
+         if( (pSnapshot->vars.size()!=pSnapshot->values.size()) ||
+             (pSnapshot->iteration<lastIteration) )
+         {
+            ++errors;
+         }
+         lastIteration = pSnapshot->iteration;
+      }
+      const int count = result.get();
+      MaxSumController::SnapshotPtr pFinal = controller.snapshot();
+      std::cout << " iterations=" << count << " reads=" << noReads;
+      if( (0==pFinal) || (count!=pFinal->iteration) ||
+          (static_cast<int>(pFinal->vars.size())!=controller.noVars()) )
+      {
+         std::cout << " bad final snapshot";
+         ++errors;
+      }
+      else
+      {
+         for(std::size_t k=0; k<pFinal->vars.size(); ++k)
+         {
+            if(controller.getValue(pFinal->vars[k])!=pFinal->values[k])
+            {
+               std::cout << " wrong value for " << pFinal->vars[k];
+               ++errors;
+            }
+         }
+      }
+      errors += isConsistent_m(controller,loopy);
+      std::cout << (0==errors ? " OK\n" : " FAILED\n");
+      errorCount += errors;
+
+      //************************************************************************
+      // A cancelled run should stop before its maximum number of
+      // iterations, and leave its remaining notices for the next call.
+      //************************************************************************
+      std::cout << "Testing cancellation...";
+      const int maxIterations = 100000000;
+      MaxSumController endless(maxIterations,0);
+      endless.setSnapshots(true,true);
+      endless.setFactors(loopy.begin(),loopy.end());
+      result = endless.optimiseAsync();
+      while(0==endless.snapshot())
+      {
+         std::this_thread::yield();
+      }
+      endless.cancel();
+      const int cancelled = result.get();
+      errors = 0;
+      std::cout << " iterations=" << cancelled;
+      if( (maxIterations<=cancelled) ||
+          (endless.snapshot()->totals.size()!=loopy.size()) )
+      {
+         ++errors;
+      }
+      errors += isConsistent_m(endless,loopy);
+      std::cout << (0==errors ? " OK\n" : " FAILED\n");
+      errorCount += errors;
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what();
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // function testAsync_m
+
+/**
+ * Returns the mean distance, in message values, between the first and last
+ * message of each variable in a compiled graph. This is a measure of how
+ * far apart in memory the messages read by each variable update are.
+ * @param[in] graph a compiled factor graph.
+ */
+float messageSpan_m(const util::FactorGraph& graph)
+{
+   double total = 0;
+   for(int v=0; v<graph.noVars(); ++v)
+   {
+      int low = graph.noMsgValues();
+      int high = 0;
+      for(int k=graph.varEdgeBegin(v); k<graph.varEdgeEnd(v); ++k)
+      {
+         const int offset = graph.fac2var(graph.varEdge(k)) - graph.fac2var(0);
+         low = std::min(low,offset);
+         high = std::max(high,offset);
+      }
+      total += std::max(0,high-low);
+   }
+   return 0==graph.noVars() ? 0 : total/graph.noVars();
+}
+
+/**
+ * Copies the structure of a factor graph, with variable and factor ids
+ * assigned in random order, so that ids carry no locality information.
+ * Every factor in the copy is zero.
+ * @param[in] factors the graph to copy.
+ * @param[in] base the smallest variable id used by the copy. Variables are
+ * registered with the same domain sizes as those they replace.
+ * @param[out] shuffled the copy.
+ */
+void shuffleIds_m(const FactorMap_m& factors, VarID base,
+      FactorMap_m& shuffled)
+{
+   std::map<VarID,VarID> newIds;
+   for(FactorMap_m::const_iterator it=factors.begin(); it!=factors.end(); ++it)
+   {
+      const std::vector<VarID>& vars = it->second.domain().vars();
+      for(std::size_t j=0; j<vars.size(); ++j)
+      {
+         newIds[vars[j]] = 0;
+      }
+   }
+   std::vector<VarID> varPerm;
+   for(std::size_t k=0; k<newIds.size(); ++k)
+   {
+      varPerm.push_back(base+k);
+   }
+   std::random_shuffle(varPerm.begin(),varPerm.end());
+   int pos = 0;
+   for(std::map<VarID,VarID>::iterator it=newIds.begin(); it!=newIds.end();
+         ++it)
+   {
+      it->second = varPerm[pos++];
+      registerVariable(it->second,getDomainSize(it->first));
+   }
+
+   std::vector<FactorID> factorPerm;
+   for(std::size_t k=0; k<factors.size(); ++k)
+   {
+      factorPerm.push_back(k);
+   }
+   std::random_shuffle(factorPerm.begin(),factorPerm.end());
+   shuffled.clear();
+   pos = 0;
+   for(FactorMap_m::const_iterator it=factors.begin(); it!=factors.end(); ++it)
+   {
+      const std::vector<VarID>& vars = it->second.domain().vars();
+      std::vector<VarID> copy;
+      for(std::size_t j=0; j<vars.size(); ++j)
+      {
+         copy.push_back(newIds[vars[j]]);
+      }
+      std::sort(copy.begin(),copy.end());
+      shuffled[factorPerm[pos++]] =
+         DiscreteFunction(copy.begin(),copy.end(),0.0);
+   }
+}
+
+/**
+ * Tests renumbering the compiled graph to follow its structure.
+ * @param[in] tree a graph colouring problem without cycles.
+ * @param[in] loopy a graph colouring problem with cycles.
+ * @returns the number of errors encountered.
+ */
+int testReordering_m(const FactorMap_m& tree, const FactorMap_m& loopy)
+{
+   int errorCount = 0;
+   const FactorMap_m* graphs[] = {&tree, &loopy};
+   const char* names[] = {"tree", "ring"};
+   try
+   {
+      for(int k=0; k<2; ++k)
+      {
+         //*********************************************************************
+         // Measure locality when ids are assigned at random. Every node
+         // should still be found by its id, and listed in order of id.
+         //*********************************************************************
+         std::cout << "Testing reordering on " << names[k] << "...";
+         const FactorMap_m& factors = *graphs[k];
+         int errors = 0;
+         FactorMap_m shuffled;
+         shuffleIds_m(factors,100000*(k+1),shuffled);
+         util::FactorGraph::ValueMap values;
+         for(FactorMap_m::const_iterator it=shuffled.begin();
+               it!=shuffled.end(); ++it)
+         {
+            const std::vector<VarID>& vars = it->second.domain().vars();
+            for(std::size_t j=0; j<vars.size(); ++j)
+            {
+               values[vars[j]] = 0;
+            }
+         }
+         FactorMap_m totals;
+         util::FactorGraph plain;
+         plain.compile(shuffled,totals,values);
+         util::FactorGraph reordered;
+         reordered.setReordering(true);
+         reordered.compile(shuffled,totals,values);
+         for(int j=0; j<reordered.noVars(); ++j)
+         {
+            const int v = reordered.varById(j);
+            if( (reordered.findVar(plain.varId(j))!=v) ||
+                (reordered.varId(v)!=plain.varId(j)) )
+            {
+               ++errors;
+            }
+         }
+         for(int j=0; j<reordered.noFactors(); ++j)
+         {
+            const int f = reordered.factorById(j);
+            if( (reordered.findFactor(plain.factorId(j))!=f) ||
+                (reordered.factorId(f)!=plain.factorId(j)) )
+            {
+               ++errors;
+            }
+         }
+         std::cout << " span=" << messageSpan_m(plain) << "->"
+            << messageSpan_m(reordered);
+         if(messageSpan_m(reordered) >= messageSpan_m(plain))
+         {
+            ++errors;
+         }
+
+         //*********************************************************************
+         // With the flooding schedule, every message depends only on the
+         // last iteration, so reordering should not change the result.
+         //*********************************************************************
+         MaxSumController full;
+         full.setFactors(factors.begin(),factors.end());
+         std::clock_t fullTime = std::clock();
+         const int fullCount = full.optimise();
+         fullTime = std::clock() - fullTime;
+
+         MaxSumController local;
+         local.setReordering(true);
+         local.setFactors(factors.begin(),factors.end());
+         std::clock_t localTime = std::clock();
+         const int localCount = local.optimise();
+         localTime = std::clock() - localTime;
+
+         std::cout << " seconds="
+            << static_cast<float>(fullTime) / CLOCKS_PER_SEC << "->"
+            << static_cast<float>(localTime) / CLOCKS_PER_SEC;
+         if( (fullCount!=localCount) || (full.noUpdates()!=local.noUpdates()) )
+         {
+            std::cout << " iterations=" << fullCount << "->" << localCount;
+            ++errors;
+         }
+         for(MaxSumController::ConstValueIterator it=full.valBegin();
+               it!=full.valEnd(); ++it)
+         {
+            if(local.getValue(it->first)!=it->second)
+            {
+               ++errors;
+            }
+         }
+         std::cout << (0==errors ? " OK\n" : " FAILED\n");
+         errorCount += errors;
+      }
+
+      //************************************************************************
+      // Messages saved from a reordered graph must be restored to the same
+      // edges, whether or not the loaded graph is also reordered.
+      //************************************************************************
+      FactorMap_m shuffled;
+      shuffleIds_m(loopy,300000,shuffled);
+      for(FactorMap_m::iterator it=shuffled.begin(); it!=shuffled.end(); ++it)
+      {
+         genColourUtil_m(it->second);
+      }
+      const char* const path = "maxsumHarness.graph";
+      MaxSumController original;
+      original.setReordering(true);
+      original.setFactors(shuffled.begin(),shuffled.end());
+      const int origCount = original.optimise();
+      original.save(path,true);
+      for(int k=0; k<2; ++k)
+      {
+         std::cout << "Loading reordered messages"
+            << (0==k ? " into plain graph..." : " into reordered graph...");
+         MaxSumController warm;
+         warm.setReordering(1==k);
+         warm.load(path);
+         const int count = warm.optimise();
+         std::cout << " iterations=" << origCount << "->" << count;
+         if( (1!=count) || (warm.isReordering()!=(1==k)) )
+         {
+            std::cout << " FAILED" << std::endl;
+            ++errorCount;
+         }
+         else
+         {
+            std::cout << " OK" << std::endl;
+         }
+      }
+      std::remove(path);
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what();
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // function testReordering_m
+
 /**
  * Main function tests a maxsum controller on several factor graphs.
  */
@@ -729,6 +2126,133 @@ int main()
       errorCount += testMaxSum_m(controller,factors);
       std::cout << std::endl;
 
+      //************************************************************************
+      // Test that parallel optimisation matches serial optimisation.
+      //************************************************************************
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing parallel optimisation                        *\n";
+      std::cout << "********************************************************\n";
+      genRingGraph_m(200,factors);
+      errorCount += testParallel_m(factors,4);
+      genTreeGraph_m(6,3,factors);
+      errorCount += testParallel_m(factors,3);
+      genFullGraph_m(NO_COLOURS+2,factors);
+      errorCount += testParallel_m(factors,0);
+      std::cout << std::endl;
+
+      //************************************************************************
+      // Test that moving controllers preserves their state.
+      //************************************************************************
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing move operations                              *\n";
+      std::cout << "********************************************************\n";
+      genTreeGraph_m(4,2,factors);
+      errorCount += testMove_m(factors);
+      std::cout << std::endl;
+
+      //************************************************************************
+      // Test incremental re-optimisation after changing the factor graph.
+      //************************************************************************
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing incremental re-optimisation                  *\n";
+      std::cout << "********************************************************\n";
+      genTreeGraph_m(5,3,factors);
+      errorCount += testIncremental_m(factors);
+      std::cout << std::endl;
+
+      //************************************************************************
+      // Test setting many factors at once.
+      //************************************************************************
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing bulk graph construction                      *\n";
+      std::cout << "********************************************************\n";
+      errorCount += testBulk_m(factors);
+      std::cout << std::endl;
+
+      //************************************************************************
+      // Test saving and loading factor graph files.
+      //************************************************************************
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing factor graph files                           *\n";
+      std::cout << "********************************************************\n";
+      errorCount += testSaveLoad_m(factors);
+      std::cout << std::endl;
+
+      //************************************************************************
+      // Test checkpointing and restoring message state.
+      //************************************************************************
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing checkpoints                                  *\n";
+      std::cout << "********************************************************\n";
+      errorCount += testCheckpoint_m(factors);
+      std::cout << std::endl;
+
+      //************************************************************************
+      // Test alternative message schedules.
+      //************************************************************************
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing message schedules                            *\n";
+      std::cout << "********************************************************\n";
+      FactorMap_m loopy;
+      genRingGraph_m(101,loopy);
+      genTreeGraph_m(5,3,factors);
+      errorCount += testSchedules_m(factors,loopy);
+      std::cout << std::endl;
+
+      //************************************************************************
+      // Test monitoring each iteration.
+      //************************************************************************
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing iteration observers                          *\n";
+      std::cout << "********************************************************\n";
+      errorCount += testObserver_m(loopy);
+      std::cout << std::endl;
+
+      //************************************************************************
+      // Test optimising with a deadline.
+      //************************************************************************
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing deadlines                                    *\n";
+      std::cout << "********************************************************\n";
+      errorCount += testDeadline_m(loopy);
+      std::cout << std::endl;
+
+      //************************************************************************
+      // Test the exact solver for acyclic components.
+      //************************************************************************
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing exact tree solver                            *\n";
+      std::cout << "********************************************************\n";
+      errorCount += testTreeSolver_m(factors,loopy);
+      std::cout << std::endl;
+
+      //************************************************************************
+      // Test notifying only the neighbours of changed variables.
+      //************************************************************************
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing targeted notices                             *\n";
+      std::cout << "********************************************************\n";
+      errorCount += testTargetedNotices_m(factors,loopy);
+      std::cout << std::endl;
+
+      //************************************************************************
+      // Test optimising in another thread.
+      //************************************************************************
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing asynchronous optimise                        *\n";
+      std::cout << "********************************************************\n";
+      errorCount += testAsync_m(loopy);
+      std::cout << std::endl;
+
+      //************************************************************************
+      // Test renumbering the compiled graph.
+      //************************************************************************
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing graph reordering                             *\n";
+      std::cout << "********************************************************\n";
+      errorCount += testReordering_m(factors,loopy);
+      std::cout << std::endl;
+
       //************************************************************************
       // Report the total runtime and number of failures.
       //************************************************************************
@@ -0,0 +1,225 @@
+/**
+ * @file partitionHarness.cpp
+ * Test harness for the maxsum::PartitionedController class.
+ */
+#include "maxsum/LocalTransport.h"
+#include "maxsum/MaxSumController.h"
+#include "maxsum/PartitionedController.h"
+#include "maxsum/register.h"
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using namespace maxsum;
+
+/**
+ * Private Module Namespace.
+ */
+namespace
+{
+   /**
+    * Number of variables in the test graph.
+    */
+   const int NO_VARS_M = 15;
+
+   /**
+    * Number of partitions the test graph is divided between.
+    */
+   const int NO_PARTITIONS_M = 3;
+
+   /**
+    * First factor id used for ghost factors.
+    */
+   const FactorID GHOST_BASE_M = 1000;
+
+   /**
+    * Returns a pseudo-random value in [-1,1).
+    */
+   ValType random_m()
+   {
+      return static_cast<ValType>(std::rand()%2000)/1000 - 1;
+   }
+
+   /**
+    * Results computed by one partition.
+    */
+   struct PartitionResult_m
+   {
+      std::vector<VarID> vars;
+      std::vector<ValType> values;
+      ValType utility;
+      int iterations;
+      int reruns;
+      int noBoundaryVars;
+      bool failed;
+   };
+
+   /**
+    * Optimises one partition of the test graph.
+    * @param[in] factors every factor in the graph.
+    * @param[in,out] hub shared by every partition.
+    * @param[in] rank the number of this partition.
+    * @param[out] result the values and utility found.
+    */
+   void runPartition_m
+   (
+    const MaxSumController::FactorMap& factors,
+    LocalTransport::Hub& hub,
+    int rank,
+    PartitionResult_m& result
+   )
+   {
+      result.failed = false;
+      try
+      {
+         LocalTransport transport(hub,rank);
+         PartitionedController partition(transport,GHOST_BASE_M);
+         for(MaxSumController::FactorMap::const_iterator it=factors.begin();
+               it!=factors.end(); ++it)
+         {
+            if(static_cast<int>(it->first%NO_PARTITIONS_M)==rank)
+            {
+               partition.setFactor(it->first,it->second);
+            }
+         }
+
+         result.iterations = partition.optimise();
+         result.noBoundaryVars = partition.noBoundaryVars();
+         for(MaxSumController::ConstValueIterator
+               it=partition.local().valBegin();
+               it!=partition.local().valEnd(); ++it)
+         {
+            result.vars.push_back(it->first);
+            result.values.push_back(it->second);
+         }
+         result.utility = partition.getUtility();
+         result.reruns = partition.optimise();
+      }
+      catch(...)
+      {
+         result.failed = true;
+      }
+   }
+
+} // module namespace
+
+/**
+ * Runs the partitioned max-sum tests.
+ */
+int main()
+{
+   int errorCount = 0;
+   try
+   {
+      //************************************************************************
+      // Build a random tree, on which max-sum finds the exact optimum.
+      //************************************************************************
+      std::srand(11);
+      MaxSumController::FactorMap factors;
+      for(VarID var=0; var<NO_VARS_M; ++var)
+      {
+         registerVariable(var,2+var%3);
+         DiscreteFunction unary(var,0.0);
+         for(ValIndex k=0; k<unary.domainSize(); ++k)
+         {
+            unary(k) = random_m();
+         }
+         factors[100+var] = unary;
+         if(0<var)
+         {
+            std::vector<VarID> vars;
+            vars.push_back((var-1)/2);
+            vars.push_back(var);
+            DiscreteFunction pairwise(vars.begin(),vars.end(),0.0);
+            for(ValIndex k=0; k<pairwise.domainSize(); ++k)
+            {
+               pairwise(k) = random_m();
+            }
+            factors[var] = pairwise;
+         }
+      }
+
+      MaxSumController full;
+      full.setFactors(factors.begin(),factors.end());
+      full.optimise();
+
+      //************************************************************************
+      // Optimise the same graph divided between several partitions, each
+      // running in its own thread.
+      //************************************************************************
+      std::cout << "Testing partitioned max-sum...";
+      LocalTransport::Hub hub(NO_PARTITIONS_M);
+      std::vector<PartitionResult_m> results(NO_PARTITIONS_M);
+      std::vector<std::thread> threads;
+      for(int rank=0; rank<NO_PARTITIONS_M; ++rank)
+      {
+         threads.push_back(std::thread(runPartition_m,std::cref(factors),
+                  std::ref(hub),rank,std::ref(results[rank])));
+      }
+      for(std::size_t k=0; k<threads.size(); ++k)
+      {
+         threads[k].join();
+      }
+
+      int partitionErrors = 0;
+      ValType utility = 0;
+      for(int rank=0; rank<NO_PARTITIONS_M; ++rank)
+      {
+         const PartitionResult_m& result = results[rank];
+         if(result.failed)
+         {
+            std::cout << "Partition " << rank << " failed.\n";
+            ++partitionErrors;
+            continue;
+         }
+         if( (result.iterations!=results[0].iterations) ||
+             (result.iterations>=MaxSumController::DEFAULT_MAX_ITERATIONS) )
+         {
+            std::cout << "Partition " << rank << " did not converge with "
+               "the others.\n";
+            ++partitionErrors;
+         }
+         if( (0==result.noBoundaryVars) || (2<result.reruns) )
+         {
+            std::cout << "Partition " << rank << " has the wrong boundary.\n";
+            ++partitionErrors;
+         }
+         for(std::size_t k=0; k<result.vars.size(); ++k)
+         {
+            if(result.values[k]!=full.getValue(result.vars[k]))
+            {
+               std::cout << "Variable " << result.vars[k] << " in partition "
+                  << rank << " has the wrong value.\n";
+               ++partitionErrors;
+            }
+         }
+         utility += result.utility;
+      }
+      if(0.0001 < std::fabs(utility-full.getUtility()))
+      {
+         std::cout << "Partition utilities do not add up: " << utility
+            << " != " << full.getUtility() << std::endl;
+         ++partitionErrors;
+      }
+      std::cout << (0==partitionErrors ? "OK\n" : "FAILED\n");
+      errorCount += partitionErrors;
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what() << std::endl;
+      ++errorCount;
+   }
+
+   //***************************************************************************
+   // Return success if all tests in this harness have passed.
+   //***************************************************************************
+   std::cout << "NUMBER OF ERRORS: " << errorCount << std::endl;
+   if(0==errorCount)
+   {
+      return EXIT_SUCCESS;
+   }
+   return EXIT_FAILURE;
+
+} // function main
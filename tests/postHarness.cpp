@@ -7,6 +7,7 @@
 #include <vector>
 #include <iostream>
 #include <set>
+#include <utility>
 
 using namespace maxsum;
 using namespace maxsum::util;
@@ -1059,6 +1060,31 @@ int main()
          std::cout << "FAILED\n";
          ++errorCount;
       }
+
+      //************************************************************************
+      // Test that moving a PostOffice transfers all of its edges, and that
+      // copy assignment replaces the previous contents.
+      //************************************************************************
+      std::cout << "Trying to move and copy PostOffice...";
+      PostOffice_m moved(std::move(postOffice));
+      PostOffice_m copied;
+      for(std::vector<Edge_m>::iterator it=edges.begin();
+            it!=edges.end(); ++it)
+      {
+         copied.addEdge(it->sender,it->receiver);
+      }
+      copied = moved;
+      if( isConsistent(remainingEdges,moved) &&
+          isConsistent(std::vector<Edge_m>(),postOffice) &&
+          isConsistent(remainingEdges,copied) )
+      {
+         std::cout << "OK\n";
+      }
+      else
+      {
+         std::cout << "FAILED\n";
+         ++errorCount;
+      }
    }
    //***************************************************************************
    // Catch any unexpected exceptions.
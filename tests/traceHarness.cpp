@@ -0,0 +1,219 @@
+/**
+ * @file traceHarness.cpp
+ * Test harness for the maxsum::Tracer class.
+ */
+#include "maxsum/MaxSumController.h"
+#include "maxsum/Tracer.h"
+#include "maxsum/register.h"
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace maxsum;
+
+/**
+ * Private Module Namespace.
+ */
+namespace
+{
+   /**
+    * Number of variables in the test graph.
+    */
+   const int NO_VARS_M = 20;
+
+   /**
+    * Returns a pseudo-random value in [-1,1).
+    */
+   ValType random_m()
+   {
+      return static_cast<ValType>(std::rand()%2000)/1000 - 1;
+   }
+
+   /**
+    * Counts the occurrences of <code>pattern</code> in <code>text</code>.
+    */
+   int count_m(const std::string& text, const std::string& pattern)
+   {
+      int result = 0;
+      for(std::string::size_type pos=text.find(pattern);
+            std::string::npos!=pos; pos=text.find(pattern,pos+1))
+      {
+         ++result;
+      }
+      return result;
+   }
+
+   /**
+    * Checks that scopes created directly are recorded, whether or not the
+    * library is built with tracing scopes.
+    * @returns the number of errors found.
+    */
+   int testScopes_m()
+   {
+      int errors = 0;
+      {
+         Tracer::Scope ignored(Tracer::NOTICES);
+      }
+      Tracer::start();
+      for(int k=0; k<3; ++k)
+      {
+         Tracer::Scope outer(Tracer::CONVERGENCE);
+         Tracer::Scope inner(Tracer::NORMALISE);
+      }
+      Tracer::stop();
+      {
+         Tracer::Scope ignored(Tracer::NOTICES);
+      }
+
+      if( (3!=Tracer::totals(Tracer::CONVERGENCE).calls) ||
+          (3!=Tracer::totals(Tracer::NORMALISE).calls) ||
+          (0!=Tracer::totals(Tracer::NOTICES).calls) ||
+          (6!=Tracer::noEvents()) )
+      {
+         std::cout << "Wrong number of scopes recorded.\n";
+         ++errors;
+      }
+      if( Tracer::totals(Tracer::CONVERGENCE).seconds <
+          Tracer::totals(Tracer::NORMALISE).seconds )
+      {
+         std::cout << "Outer scope should include inner scope.\n";
+         ++errors;
+      }
+
+      //************************************************************************
+      // Every event should be written, together with the name of its
+      // thread's track.
+      //************************************************************************
+      std::ostringstream out;
+      Tracer::writeChromeTrace(out);
+      const std::string json = out.str();
+      if( (0!=json.find("{\"traceEvents\":[")) ||
+          (6!=count_m(json,"\"ph\":\"X\"")) ||
+          (3!=count_m(json,"\"name\":\"normalise\"")) ||
+          (1!=count_m(json,"\"thread_name\"")) )
+      {
+         std::cout << "Bad trace:\n" << json;
+         ++errors;
+      }
+      return errors;
+   }
+
+   /**
+    * Checks that optimising records every phase, if the library is built
+    * with tracing scopes, and otherwise records nothing.
+    * @param[in] useCounters true to read hardware counters, if possible.
+    * @returns the number of errors found.
+    */
+   int testOptimise_m(bool useCounters)
+   {
+      std::srand(5);
+      MaxSumController controller;
+      for(VarID var=0; var<NO_VARS_M; ++var)
+      {
+         registerVariable(var,3);
+      }
+      for(VarID var=0; var<NO_VARS_M; ++var)
+      {
+         std::vector<VarID> vars;
+         vars.push_back(var);
+         vars.push_back((var+1)%NO_VARS_M);
+         DiscreteFunction factor(vars.begin(),vars.end(),0.0);
+         for(ValIndex k=0; k<factor.domainSize(); ++k)
+         {
+            factor(k) = random_m();
+         }
+         controller.setFactor(var,factor);
+      }
+
+      Tracer::start(true,useCounters);
+      const int iterations = controller.optimise();
+      Tracer::stop();
+
+      int errors = 0;
+      const long expected = Tracer::isCompiled() ? 1 : 0;
+      if(expected!=Tracer::totals(Tracer::OPTIMISE).calls)
+      {
+         std::cout << "Optimise recorded "
+            << Tracer::totals(Tracer::OPTIMISE).calls << " times.\n";
+         ++errors;
+      }
+      if(expected*iterations!=Tracer::totals(Tracer::CONVERGENCE).calls)
+      {
+         std::cout << "Iterations were not all recorded.\n";
+         ++errors;
+      }
+      for(int phase=0; phase<Tracer::NO_PHASES; ++phase)
+      {
+         const Tracer::PhaseTotals totals =
+            Tracer::totals(static_cast<Tracer::Phase>(phase));
+         if( (0<expected) != (0<totals.calls) )
+         {
+            std::cout << "Phase " << phase << " has the wrong count.\n";
+            ++errors;
+         }
+         if(!Tracer::hasCounters() && (0!=totals.cycles))
+         {
+            std::cout << "Cycles counted without counters.\n";
+            ++errors;
+         }
+      }
+      if(Tracer::totals(Tracer::OPTIMISE).seconds <
+            Tracer::totals(Tracer::FACTOR_SUM).seconds)
+      {
+         std::cout << "Optimise should include its phases.\n";
+         ++errors;
+      }
+      if(0<expected)
+      {
+         std::cout << "\n";
+         Tracer::writeSummary(std::cout);
+      }
+      return errors;
+   }
+
+} // module namespace
+
+/**
+ * Runs the tracer tests.
+ */
+int main()
+{
+   int errorCount = 0;
+   try
+   {
+      std::cout << "Testing trace scopes...";
+      int errors = testScopes_m();
+      std::cout << (0==errors ? "OK\n" : "FAILED\n");
+      errorCount += errors;
+
+      std::cout << "Testing traced optimise (compiled="
+         << Tracer::isCompiled() << ")...";
+      errors = testOptimise_m(false);
+      std::cout << (0==errors ? "OK\n" : "FAILED\n");
+      errorCount += errors;
+
+      std::cout << "Testing hardware counters...";
+      errors = testOptimise_m(true);
+      std::cout << (Tracer::hasCounters() ? "available " : "unavailable ")
+         << (0==errors ? "OK\n" : "FAILED\n");
+      errorCount += errors;
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what() << std::endl;
+      ++errorCount;
+   }
+
+   //***************************************************************************
+   // Return success if all tests in this harness have passed.
+   //***************************************************************************
+   std::cout << "NUMBER OF ERRORS: " << errorCount << std::endl;
+   if(0==errorCount)
+   {
+      return EXIT_SUCCESS;
+   }
+   return EXIT_FAILURE;
+
+} // function main
@@ -6,6 +6,10 @@
 #include <vector>
 #include <list>
 #include <queue>
+#include <thread>
+#ifdef __linux__
+#include <unistd.h>
+#endif
 #include "maxsum/register.h"
 #include "maxsum/common.h"
 #include "maxsum/DiscreteFunction.h"
@@ -574,6 +578,178 @@ int testRegister()
 
 } // function testRegister
 
+/**
+ * Registers a range of variables, checking that previously registered
+ * variables remain visible while doing so.
+ * @param[in] first the first variable to register.
+ * @param[in] count the number of variables to register.
+ * @param[in] stride difference between successive variable ids.
+ * @param[out] errorCount incremented for each error found.
+ */
+void registerRange_m(maxsum::VarID first, int count, maxsum::VarID stride,
+      int* errorCount)
+{
+   using namespace maxsum;
+   for(int k=0; k<count; ++k)
+   {
+      VarID var = first + k*stride;
+      registerVariable(var,2+k%7);
+
+      //************************************************************************
+      // Every thread registers the first variable in each range, so this
+      // should always succeed with a consistent domain size.
+      //************************************************************************
+      registerVariable(1000000,3);
+
+      VarID check = first + (k/2)*stride;
+      if( !isRegistered(check) ||
+          (getDomainSize(check) != static_cast<ValIndex>(2+(k/2)%7)) )
+      {
+         ++(*errorCount);
+      }
+   }
+}
+
+/**
+ * Function for testing concurrent variable registration.
+ */
+int testConcurrentRegister()
+{
+   using namespace maxsum;
+   const int NO_THREADS = 4;
+   const int NO_VARS = 5000;
+   const int NO_SPARSE_VARS = 500;
+
+   //***************************************************************************
+   // Register dense and sparse ranges of variables from several threads
+   // at once.
+   //***************************************************************************
+   std::cout << "Registering variables concurrently.\n";
+   int startCount = getNumOfRegisteredVariables();
+   int errors[2*NO_THREADS] = {0};
+   std::vector<std::thread> threads;
+   for(int t=0; t<NO_THREADS; ++t)
+   {
+      threads.push_back(std::thread(registerRange_m,
+               2000000+t*NO_VARS,NO_VARS,1,&errors[2*t]));
+      threads.push_back(std::thread(registerRange_m,
+               0xF0000000u+t,NO_SPARSE_VARS,0x1000u,&errors[2*t+1]));
+   }
+   for(int t=0; t<static_cast<int>(threads.size()); ++t)
+   {
+      threads[t].join();
+   }
+
+   for(int t=0; t<2*NO_THREADS; ++t)
+   {
+      if(0!=errors[t])
+      {
+         std::cout << "Registered variables were not visible." << std::endl;
+         return 16;
+      }
+   }
+
+   //***************************************************************************
+   // Check that every variable was registered exactly once.
+   //***************************************************************************
+   int expected = startCount + NO_THREADS*(NO_VARS+NO_SPARSE_VARS) + 1;
+   if(getNumOfRegisteredVariables()!=expected)
+   {
+      std::cout << "Count should be " << expected << ", but is actually " <<
+         getNumOfRegisteredVariables() << std::endl;
+      return 17;
+   }
+
+   if(isRegistered(2000000+NO_THREADS*NO_VARS) || isRegistered(0xFFFFFFFFu))
+   {
+      std::cout << "Registration of non-existant variable" << std::endl;
+      return 18;
+   }
+
+   std::cout << "Concurrent registration tests all passed.\n";
+   return 0;
+
+} // function testConcurrentRegister
+
+/**
+ * Returns the resident memory of this process in bytes, or zero if this
+ * cannot be measured on this platform.
+ */
+long residentBytes_m()
+{
+#ifdef __linux__
+   std::ifstream statm("/proc/self/statm");
+   long pages = 0;
+   long resident = 0;
+   if(statm >> pages >> resident)
+   {
+      return resident * sysconf(_SC_PAGESIZE);
+   }
+#endif
+   return 0;
+}
+
+/**
+ * Function for testing that registering scattered variable ids only uses
+ * memory in proportion to the number of variables.
+ */
+int testScatteredRegister()
+{
+   using namespace maxsum;
+   const int NO_VARS = 100000;
+   const long MAX_GROWTH = 64L << 20;
+
+   //***************************************************************************
+   // Register ids spread over the whole range of maxsum::VarID. Multiplying
+   // by an odd constant is a bijection, so no id is repeated.
+   //***************************************************************************
+   std::cout << "Registering scattered variables.\n";
+   const long startBytes = residentBytes_m();
+   const int startCount = getNumOfRegisteredVariables();
+   int newCount = 0;
+   for(int k=1; k<=NO_VARS; ++k)
+   {
+      VarID var = static_cast<VarID>(k) * 2654435761u;
+      if( (0xFFFFFFFFu!=var) && !isRegistered(var) )
+      {
+         registerVariable(var,2+k%5);
+         ++newCount;
+      }
+   }
+
+   for(int k=1; k<=NO_VARS; ++k)
+   {
+      VarID var = static_cast<VarID>(k) * 2654435761u;
+      if( (0xFFFFFFFFu!=var) && !isRegistered(var) )
+      {
+         std::cout << "Scattered variable " << var << " not registered.\n";
+         return 19;
+      }
+   }
+
+   if(getNumOfRegisteredVariables()!=startCount+newCount)
+   {
+      std::cout << "Count should be " << startCount+newCount
+         << ", but is actually " << getNumOfRegisteredVariables() << std::endl;
+      return 20;
+   }
+
+   //***************************************************************************
+   // Check that memory stays bounded, where this can be measured.
+   //***************************************************************************
+   const long growth = residentBytes_m() - startBytes;
+   if( (0!=startBytes) && (MAX_GROWTH < growth) )
+   {
+      std::cout << "Registering " << NO_VARS << " scattered variables used "
+         << growth << " bytes." << std::endl;
+      return 21;
+   }
+
+   std::cout << "Scattered registration tests all passed.\n";
+   return 0;
+
+} // function testScatteredRegister
+
 int main()
 {
    //***************************************************************************
@@ -600,5 +776,17 @@ int main()
       return exitValue;
    }
 
+   exitValue = testConcurrentRegister();
+   if(0!=exitValue)
+   {
+      return exitValue;
+   }
+
+   exitValue = testScatteredRegister();
+   if(0!=exitValue)
+   {
+      return exitValue;
+   }
+
 } // function main
 